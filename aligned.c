@@ -0,0 +1,194 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// aligned.c compresses and decompresses files as LZ4 frames with O_DIRECT
+// I/O, bypassing the page cache (see the "LZ4 Aligned Streams" section of
+// src/sflz4.h). It needs Linux.
+//
+// Usage:
+//
+// $ gcc -O2 aligned.c -o aligned
+// $ ./aligned -c big.bin big.bin.lz4
+// $ ./aligned -d big.bin.lz4 big2.bin
+//
+// Add -buffered (after -c or -d) to use ordinary, buffered I/O instead, for
+// comparison. Not every filesystem supports O_DIRECT (tmpfs does not).
+// Frames use 4 MiB blocks and all I/O is aligned to 4096 bytes.
+//
+// Each mode prints (to stderr) the output length, how long it took (including
+// an fsync) and how much the page cache (the "Cached" line of /proc/meminfo)
+// grew meanwhile.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "src/sflz4.h"
+
+#define BLOCK_MAX_LEN 0x400000
+#define ALIGNMENT 4096
+
+typedef struct files_struct {
+  int in;
+  int out;
+  off_t in_pos;
+  off_t out_pos;
+} files;
+
+double  //
+now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec * 1e-9);
+}
+
+// page_cache_kib returns the page cache's size in KiB, or zero if unknown.
+long  //
+page_cache_kib() {
+  FILE* f = fopen("/proc/meminfo", "r");
+  if (!f) {
+    return 0;
+  }
+  char line[256];
+  long kib = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (!strncmp(line, "Cached:", 7)) {
+      kib = atol(line + 7);
+      break;
+    }
+  }
+  fclose(f);
+  return kib;
+}
+
+sflz4_size_result   //
+read_func(          //
+    void* context,  //
+    uint8_t* ptr,   //
+    size_t len) {
+  files* f = (files*)context;
+  sflz4_size_result result = {NULL, 0};
+  while (result.value < len) {
+    ssize_t k = pread(f->in, ptr + result.value, len - result.value,
+                      f->in_pos + (off_t)result.value);
+    if (k < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      result.status_message = "could not read input";
+      return result;
+    } else if (k == 0) {
+      break;
+    }
+    result.value += (size_t)k;
+  }
+  f->in_pos += (off_t)result.value;
+  return result;
+}
+
+const char*              //
+write_func(              //
+    void* context,       //
+    const uint8_t* ptr,  //
+    size_t len) {
+  files* f = (files*)context;
+  while (len > 0) {
+    ssize_t k = pwrite(f->out, ptr, len, f->out_pos);
+    if (k < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return "could not write output";
+    }
+    ptr += k;
+    len -= (size_t)k;
+    f->out_pos += k;
+  }
+  return NULL;
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  const int c = (argc >= 4) && !strcmp(argv[1], "-c");
+  const int d = (argc >= 4) && !strcmp(argv[1], "-d");
+  const int buffered = (argc == 5) && !strcmp(argv[2], "-buffered");
+  if ((!c && !d) || ((argc == 5) && !buffered) || (argc > 5)) {
+    fprintf(stderr, "usage: %s -c|-d [-buffered] input output\n", argv[0]);
+    return 1;
+  }
+  const char* in_filename = argv[argc - 2];
+  const char* out_filename = argv[argc - 1];
+
+  sflz4_size_result r =
+      c ? sflz4_aligned_encode_workspace_len(BLOCK_MAX_LEN, ALIGNMENT)
+        : sflz4_aligned_decode_workspace_len(BLOCK_MAX_LEN, ALIGNMENT);
+  const size_t workspace_len =
+      (r.value + (ALIGNMENT - 1)) & ~((size_t)(ALIGNMENT - 1));
+  uint8_t* workspace =
+      r.status_message ? NULL
+                       : (uint8_t*)aligned_alloc(ALIGNMENT, workspace_len);
+  if (!workspace) {
+    fprintf(stderr, "aligned: out of memory\n");
+    return 1;
+  }
+
+  const long kib0 = page_cache_kib();
+  const double t0 = now();
+  const int o_direct = buffered ? 0 : O_DIRECT;
+  files f;
+  f.in = open(in_filename, O_RDONLY | o_direct);
+  f.out = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC | o_direct, 0644);
+  f.in_pos = 0;
+  f.out_pos = 0;
+  if ((f.in < 0) || (f.out < 0)) {
+    fprintf(stderr, "aligned: could not open %s: %s\n",
+            (f.in < 0) ? in_filename : out_filename, strerror(errno));
+    return 1;
+  }
+
+  r = c ? sflz4_aligned_encode(workspace, workspace_len, BLOCK_MAX_LEN,
+                               ALIGNMENT, &read_func, &write_func, &f)
+        : sflz4_aligned_decode(workspace, workspace_len, ALIGNMENT,
+                               &read_func, &write_func, &f);
+  // The final write was padded up to ALIGNMENT bytes.
+  if (!r.status_message &&
+      (ftruncate(f.out, (off_t)r.value) || fsync(f.out))) {
+    r.status_message = "could not truncate or sync output";
+  }
+  const double t1 = now();
+  const long kib1 = page_cache_kib();
+
+  if (r.status_message) {
+    fprintf(stderr, "aligned: %s\n", r.status_message);
+  } else {
+    fprintf(stderr, "aligned: wrote %zu bytes (%s) in %.3f s, ", r.value,
+            buffered ? "buffered" : "O_DIRECT", t1 - t0);
+    fprintf(stderr, "page cache grew %ld MiB\n", (kib1 - kib0) / 1024);
+  }
+  close(f.out);
+  close(f.in);
+  free(workspace);
+  return r.status_message ? 1 : 0;
+}
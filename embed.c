@@ -0,0 +1,190 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// embed.c compresses files into C source code for embedding in a program's
+// binary, as sflz4_asset values (see the "LZ4 Embedded Assets" section of
+// src/sflz4.h) that are decoded lazily, on first use.
+//
+// Usage:
+//
+// $ gcc -O2 embed.c -o embed
+// $ ./embed my_table=data/table.bin templates/page.html > assets.c
+//
+// Each argument is a filename, optionally preceded by "name=". Without a
+// name, the asset's name is derived from the filename ("templates_page_html"
+// in the example above). assets.c then defines, for each file:
+//
+//   sflz4_asset my_table = SFLZ4_ASSET_INITIALIZER(...);
+//
+// It #include's "sflz4.h" (without SFLZ4_IMPLEMENTATION), so compile it with
+// that header on the include path. Other code declares each asset as:
+//
+//   extern sflz4_asset my_table;
+//
+// and uses it as:
+//
+//   sflz4_size_result r = sflz4_asset_decode(&my_table);
+//   if (!r.status_message) {
+//     use(my_table.decoded_ptr, r.value);
+//   }
+//
+// Compression uses sflz4_block_encode_high_ratio, trading encode speed (paid
+// once, at build time) for a smaller binary.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "src/sflz4.h"
+
+uint8_t workspace[SFLZ4_BLOCK_ENCODE_HIGH_RATIO_WORKSPACE_LEN];
+
+// read_file returns the contents of the named file, setting *len, or NULL on
+// failure. The caller frees the returned buffer.
+uint8_t*                   //
+read_file(                 //
+    const char* filename,  //
+    size_t* len) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return NULL;
+  }
+  size_t cap = 65536;
+  size_t n = 0;
+  uint8_t* buf = (uint8_t*)malloc(cap);
+  while (buf) {
+    n += fread(buf + n, 1, cap - n, f);
+    if (n < cap) {
+      break;
+    }
+    uint8_t* const new_buf = (uint8_t*)realloc(buf, cap * 2);
+    if (!new_buf) {
+      free(buf);
+    }
+    buf = new_buf;
+    cap *= 2;
+  }
+  if (buf && ferror(f)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *len = n;
+  return buf;
+}
+
+// make_name writes to name (which has room for name_len bytes) a C
+// identifier derived from the arg, returning the filename part of the arg.
+const char*           //
+make_name(            //
+    char* name,       //
+    size_t name_len,  //
+    const char* arg) {
+  const char* eq = strchr(arg, '=');
+  const char* filename = eq ? (eq + 1) : arg;
+  const char* p = arg;
+  const char* p_end = eq ? eq : (arg + strlen(arg));
+  size_t n = 0;
+  if ((p < p_end) && (*p >= '0') && (*p <= '9') && (n + 1 < name_len)) {
+    name[n++] = '_';
+  }
+  for (; (p < p_end) && (n + 1 < name_len); p++) {
+    char c = *p;
+    if (!(((c >= '0') && (c <= '9')) || ((c >= 'A') && (c <= 'Z')) ||
+          ((c >= 'a') && (c <= 'z')))) {
+      c = '_';
+    }
+    name[n++] = c;
+  }
+  name[n] = '\x00';
+  return filename;
+}
+
+int     //
+embed(  //
+    const char* arg) {
+  char name[256];
+  const char* filename = make_name(name, sizeof(name), arg);
+  if (!name[0]) {
+    fprintf(stderr, "embed: %s: empty name\n", arg);
+    return 1;
+  }
+
+  size_t src_len = 0;
+  uint8_t* src_ptr = read_file(filename, &src_len);
+  if (!src_ptr) {
+    fprintf(stderr, "embed: %s: could not read file\n", filename);
+    return 1;
+  }
+
+  sflz4_size_result r = sflz4_block_encode_worst_case_dst_len(src_len);
+  uint8_t* dst_ptr = r.status_message ? NULL : (uint8_t*)malloc(r.value);
+  if (dst_ptr) {
+    r = sflz4_block_encode_high_ratio(dst_ptr, r.value, src_ptr, src_len,
+                                      workspace, sizeof(workspace));
+  }
+  if (!dst_ptr || r.status_message) {
+    fprintf(stderr, "embed: %s: %s\n", filename,
+            r.status_message ? r.status_message : "out of memory");
+    free(dst_ptr);
+    free(src_ptr);
+    return 1;
+  } else if (r.value > SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN) {
+    fprintf(stderr, "embed: %s: compressed form is too long to decode\n",
+            filename);
+    free(dst_ptr);
+    free(src_ptr);
+    return 1;
+  }
+
+  printf("\n// %s: %zu bytes compressed to %zu bytes.\n", filename, src_len,
+         r.value);
+  printf("static const uint8_t %s_encoded[%zu] = {", name, r.value);
+  for (size_t i = 0; i < r.value; i++) {
+    printf("%s0x%02X,", ((i & 7) ? " " : "\n    "), dst_ptr[i]);
+  }
+  printf("\n};\n");
+  // C doesn't allow zero-length arrays.
+  printf("static uint8_t %s_decoded[%zu];\n", name, src_len ? src_len : 1);
+  printf("sflz4_asset %s = SFLZ4_ASSET_INITIALIZER(\n", name);
+  printf("    %s_encoded, %zu, %s_decoded, %zu);\n", name, r.value, name,
+         src_len);
+
+  fprintf(stderr, "embed: %s: %zu bytes compressed to %zu bytes as %s\n",
+          filename, src_len, r.value, name);
+  free(dst_ptr);
+  free(src_ptr);
+  return 0;
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s [name=]filename...\n", argv[0]);
+    return 1;
+  }
+  printf("// Code generated by embed.c. DO NOT EDIT.\n\n");
+  printf("#include \"sflz4.h\"\n");
+  for (int i = 1; i < argc; i++) {
+    if (embed(argv[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
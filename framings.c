@@ -0,0 +1,256 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// framings.c measures how fast the "LZ4 Foreign Framings" section of
+// src/sflz4.h decodes, compared to bare sflz4_block_decode.
+//
+// Usage:
+//
+// $ gcc -O2 framings.c -o framings
+// $ ./framings text.txt a.out server.log
+//
+// Each file is split into 1 MiB Parquet pages, each encoded as a bare LZ4
+// block, which are decoded by sflz4_block_decode, sflz4_parquet_lz4_raw_decode
+// and sflz4_parquet_lz4_decode (which first tries, and rejects, Hadoop's
+// framing). The whole file is also encoded with Hadoop's framing (with the
+// default chunk length) and then decoded by sflz4_hadoop_decode and scanned
+// by sflz4_hadoop_decoded_len. For each file, it prints each decoder's rate
+// in decoded MB/s, the best of NUM_REPS runs.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "src/sflz4.h"
+
+#define PAGE_LEN 0x100000
+#define NUM_REPS 10
+
+#define KIND_BLOCK 0
+#define KIND_PARQUET_LZ4_RAW 1
+#define KIND_PARQUET_LZ4 2
+#define KIND_HADOOP 3
+#define KIND_HADOOP_DECODED_LEN 4
+#define NUM_KINDS 5
+
+static const char* const kind_names[NUM_KINDS] = {
+    "block", "lz4_raw", "parquet_lz4", "hadoop", "hadoop_len",
+};
+
+double  //
+now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec * 1e-9);
+}
+
+// read_file reads the named file into a newly allocated buffer, setting
+// *len. It returns NULL on failure.
+uint8_t*                   //
+read_file(                 //
+    const char* filename,  //
+    size_t* len) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return NULL;
+  }
+  size_t n = 0;
+  size_t cap = 0;
+  uint8_t* ptr = NULL;
+  while (1) {
+    if (n == cap) {
+      cap = cap ? (2 * cap) : PAGE_LEN;
+      uint8_t* p = (uint8_t*)realloc(ptr, cap);
+      if (!p) {
+        free(ptr);
+        fclose(f);
+        return NULL;
+      }
+      ptr = p;
+    }
+    size_t m = fread(ptr + n, 1, cap - n, f);
+    n += m;
+    if (m == 0) {
+      break;
+    }
+  }
+  fclose(f);
+  *len = n;
+  return ptr;
+}
+
+// decode_pages decodes every page, to its place in dst, with the kind's
+// decoder, returning NULL on success or a status message on failure.
+const char*                     //
+decode_pages(                   //
+    int kind,                   //
+    uint8_t* dst_ptr,           //
+    size_t src_len,             //
+    const uint8_t* pages,       //
+    const size_t* page_starts,  //
+    size_t num_pages) {
+  for (size_t i = 0; i < num_pages; i++) {
+    const size_t decoded_start = i * PAGE_LEN;
+    const size_t decoded_len = ((src_len - decoded_start) < PAGE_LEN)
+                                   ? (src_len - decoded_start)
+                                   : PAGE_LEN;
+    const uint8_t* p = pages + page_starts[i];
+    const size_t n = page_starts[i + 1] - page_starts[i];
+    sflz4_size_result r;
+    switch (kind) {
+      case KIND_BLOCK:
+        r = sflz4_block_decode(dst_ptr + decoded_start, decoded_len, p, n);
+        break;
+      case KIND_PARQUET_LZ4_RAW:
+        r = sflz4_parquet_lz4_raw_decode(dst_ptr + decoded_start, decoded_len,
+                                         p, n);
+        break;
+      default:
+        r = sflz4_parquet_lz4_decode(dst_ptr + decoded_start, decoded_len, p,
+                                     n);
+        break;
+    }
+    if (r.status_message) {
+      return r.status_message;
+    } else if (r.value != decoded_len) {
+      return "decoded page has the wrong length";
+    }
+  }
+  return NULL;
+}
+
+const char*  //
+run(         //
+    const char* filename) {
+  size_t src_len = 0;
+  uint8_t* src = read_file(filename, &src_len);
+  if (!src) {
+    return "could not read input";
+  } else if (src_len == 0) {
+    free(src);
+    return "empty input";
+  }
+
+  const size_t num_pages = (src_len + PAGE_LEN - 1) / PAGE_LEN;
+  sflz4_size_result wp = sflz4_block_encode_worst_case_dst_len(PAGE_LEN);
+  sflz4_size_result wh = sflz4_hadoop_encode_worst_case_dst_len(src_len, 0);
+  const char* status_message = wp.status_message ? wp.status_message
+                                                 : wh.status_message;
+  if (status_message) {
+    free(src);
+    return status_message;
+  }
+  uint8_t* pages = (uint8_t*)malloc(num_pages * wp.value);
+  size_t* page_starts = (size_t*)malloc((num_pages + 1) * sizeof(size_t));
+  uint8_t* hadoop = (uint8_t*)malloc(wh.value);
+  uint8_t* dst = (uint8_t*)malloc(src_len);
+  if (!pages || !page_starts || !hadoop || !dst) {
+    status_message = "out of memory";
+  }
+
+  // Encode the pages and the Hadoop stream.
+  size_t hadoop_len = 0;
+  if (!status_message) {
+    page_starts[0] = 0;
+    for (size_t i = 0; !status_message && (i < num_pages); i++) {
+      const size_t decoded_start = i * PAGE_LEN;
+      sflz4_size_result r = sflz4_block_encode(
+          pages + page_starts[i], wp.value, src + decoded_start,
+          ((src_len - decoded_start) < PAGE_LEN) ? (src_len - decoded_start)
+                                                 : PAGE_LEN);
+      status_message = r.status_message;
+      page_starts[i + 1] = page_starts[i] + r.value;
+    }
+  }
+  if (!status_message) {
+    sflz4_size_result r =
+        sflz4_hadoop_encode(hadoop, wh.value, src, src_len, 0);
+    status_message = r.status_message;
+    hadoop_len = r.value;
+  }
+
+  double best[NUM_KINDS];
+  for (int k = 0; k < NUM_KINDS; k++) {
+    best[k] = 1e300;
+  }
+  for (int rep = 0; !status_message && (rep < NUM_REPS); rep++) {
+    for (int k = 0; !status_message && (k < NUM_KINDS); k++) {
+      memset(dst, 0, src_len);
+      double t0 = now();
+      if (k < KIND_HADOOP) {
+        status_message =
+            decode_pages(k, dst, src_len, pages, page_starts, num_pages);
+      } else if (k == KIND_HADOOP) {
+        sflz4_size_result r =
+            sflz4_hadoop_decode(dst, src_len, hadoop, hadoop_len);
+        status_message = r.status_message;
+        if (!status_message && (r.value != src_len)) {
+          status_message = "decoded Hadoop stream has the wrong length";
+        }
+      } else {
+        sflz4_size_result r = sflz4_hadoop_decoded_len(hadoop, hadoop_len);
+        status_message = r.status_message;
+        if (!status_message && (r.value != src_len)) {
+          status_message = "Hadoop stream has the wrong decoded length";
+        }
+      }
+      double t = now() - t0;
+      if (best[k] > t) {
+        best[k] = t;
+      }
+      if (!status_message && (k != KIND_HADOOP_DECODED_LEN) &&
+          memcmp(dst, src, src_len)) {
+        status_message = "decoded output does not match input";
+      }
+    }
+  }
+
+  if (!status_message) {
+    printf("%-20s %10zu bytes", filename, src_len);
+    for (int k = 0; k < NUM_KINDS; k++) {
+      printf("  %s %8.1f MB/s", kind_names[k], src_len / (1e6 * best[k]));
+    }
+    printf("\n");
+  }
+  free(dst);
+  free(hadoop);
+  free(page_starts);
+  free(pages);
+  free(src);
+  return status_message;
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    return 1;
+  }
+  int ret = 0;
+  for (int i = 1; i < argc; i++) {
+    const char* status_message = run(argv[i]);
+    if (status_message) {
+      fprintf(stderr, "framings: %s: %s\n", argv[i], status_message);
+      ret = 1;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,171 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// page_pool.c measures how fast a sflz4_page_pool (see the "LZ4 Page Pool"
+// section of src/sflz4.h) stores and loads pages, and how much memory it
+// saves.
+//
+// Usage:
+//
+// $ gcc -O2 page_pool.c -o page_pool
+// $ ./page_pool text.txt a.out server.log random.bin
+//
+// Each file is split into 4 KiB pages (the last one zero padded) and one page
+// in seven is zeroed, to model a sparse cache. Every page is stored and then
+// loaded (and checked) back. For each file, it prints the store and load
+// rates and the memory used: the slabs in use divided by the raw page bytes.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "src/sflz4.h"
+
+#define PAGE_LEN SFLZ4_PAGE_POOL_PAGE_LEN
+
+double  //
+now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec * 1e-9);
+}
+
+// read_pages reads the named file into a newly allocated buffer of whole
+// pages, setting *num_pages. It returns NULL on failure.
+uint8_t*                   //
+read_pages(                //
+    const char* filename,  //
+    size_t* num_pages) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    return NULL;
+  }
+  size_t len = 0;
+  size_t cap = 0;
+  uint8_t* ptr = NULL;
+  while (1) {
+    if (len == cap) {
+      cap = cap ? (2 * cap) : (256 * PAGE_LEN);
+      uint8_t* p = (uint8_t*)realloc(ptr, cap);
+      if (!p) {
+        free(ptr);
+        fclose(f);
+        return NULL;
+      }
+      ptr = p;
+    }
+    size_t n = fread(ptr + len, 1, cap - len, f);
+    len += n;
+    if (n == 0) {
+      break;
+    }
+  }
+  fclose(f);
+  *num_pages = (len + (PAGE_LEN - 1)) / PAGE_LEN;
+  memset(ptr + len, 0, (*num_pages * PAGE_LEN) - len);
+  for (size_t i = 0; i < *num_pages; i += 7) {
+    memset(ptr + (i * PAGE_LEN), 0, PAGE_LEN);
+  }
+  return ptr;
+}
+
+const char*  //
+run(         //
+    const char* filename) {
+  size_t num_pages = 0;
+  uint8_t* pages = read_pages(filename, &num_pages);
+  if (!pages) {
+    return "could not read input";
+  } else if (num_pages == 0) {
+    free(pages);
+    return "empty input";
+  }
+
+  // Every page, even a raw one, fits in a quarter slab. Add a partially
+  // full slab per size class.
+  const size_t num_slabs = (num_pages / 4) + 1 + 64;
+  const size_t arena_len = (num_slabs * (SFLZ4_PAGE_POOL_SLAB_LEN + 16)) + 64;
+  uint8_t* arena = (uint8_t*)malloc(arena_len);
+  size_t* handles = (size_t*)malloc(num_pages * sizeof(size_t));
+  uint8_t loaded[PAGE_LEN];
+  sflz4_page_pool pool;
+  const char* status_message =
+      (!arena || !handles) ? "out of memory"
+                           : sflz4_page_pool_initialize(&pool, arena,
+                                                        arena_len);
+
+  double t0 = now();
+  for (size_t i = 0; !status_message && (i < num_pages); i++) {
+    sflz4_size_result r =
+        sflz4_page_pool_store(&pool, pages + (i * PAGE_LEN));
+    status_message = r.status_message;
+    handles[i] = r.value;
+  }
+  double t1 = now();
+  for (size_t i = 0; !status_message && (i < num_pages); i++) {
+    status_message = sflz4_page_pool_load(&pool, loaded, handles[i]);
+    if (!status_message &&
+        memcmp(loaded, pages + (i * PAGE_LEN), PAGE_LEN)) {
+      status_message = "loaded page does not match stored page";
+    }
+  }
+  double t2 = now();
+
+  if (!status_message) {
+    sflz4_page_pool_stats s = sflz4_page_pool_get_stats(&pool);
+    printf("%-20s %8zu pages  store %8.1fK pages/s  load %8.1fK pages/s  ",
+           filename, num_pages, num_pages / (1000 * (t1 - t0)),
+           num_pages / (1000 * (t2 - t1)));
+    printf("memory %.3f (%llu uniform, %llu raw)\n",
+           ((double)s.num_slabs * SFLZ4_PAGE_POOL_SLAB_LEN) /
+               ((double)num_pages * PAGE_LEN),
+           (unsigned long long)s.num_uniform_pages,
+           (unsigned long long)s.num_raw_pages);
+    for (size_t i = 0; i < num_pages; i++) {
+      sflz4_page_pool_free(&pool, handles[i]);
+    }
+    s = sflz4_page_pool_get_stats(&pool);
+    if (s.num_pages || s.num_slabs) {
+      status_message = "pages or slabs remain after freeing every page";
+    }
+  }
+  free(handles);
+  free(arena);
+  free(pages);
+  return status_message;
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    return 1;
+  }
+  int ret = 0;
+  for (int i = 1; i < argc; i++) {
+    const char* status_message = run(argv[i]);
+    if (status_message) {
+      fprintf(stderr, "page_pool: %s: %s\n", argv[i], status_message);
+      ret = 1;
+    }
+  }
+  return ret;
+}
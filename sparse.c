@@ -0,0 +1,267 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// sparse.c compresses and decompresses sparse files (e.g. VM disk images) as
+// sparse streams (see the "LZ4 Sparse Streams" section of src/sflz4.h). It
+// needs Linux (or another OS with lseek's SEEK_DATA and SEEK_HOLE).
+//
+// Usage:
+//
+// $ gcc -O2 sparse.c -o sparse
+// $ ./sparse -c disk.img disk.img.sz4
+// $ ./sparse -d disk.img.sz4 disk2.img
+//
+// Compressing reads only the input's data extents, not its holes, so its
+// cost is proportional to the data, not the file size. Pass -c32 instead of
+// -c to checksum records with CRC-32C instead of xxHash-32. Decompressing
+// writes only the data, seeking over the holes, so the output is sparse. The
+// output file must not already exist.
+//
+// Each mode prints (to stderr) how many bytes it read and wrote and how long
+// it took.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "src/sflz4.h"
+
+uint8_t data[SFLZ4_SPARSE_MAX_INCL_DATA_LEN];
+uint8_t* records;
+size_t records_len;
+
+double  //
+now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + (t.tv_nsec * 1e-9);
+}
+
+// read_fully reads exactly len bytes (or fewer, at end of file) from fd at
+// offset, returning how many it read or -1 on error.
+ssize_t            //
+read_fully(        //
+    int fd,        //
+    uint8_t* ptr,  //
+    size_t len,    //
+    off_t offset) {
+  size_t n = 0;
+  while (n < len) {
+    ssize_t k = pread(fd, ptr + n, len - n, offset + (off_t)n);
+    if (k < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    } else if (k == 0) {
+      break;
+    }
+    n += (size_t)k;
+  }
+  return (ssize_t)n;
+}
+
+// write_fully writes len bytes to fd at offset, returning zero on success.
+int                      //
+write_fully(             //
+    int fd,              //
+    const uint8_t* ptr,  //
+    size_t len,          //
+    off_t offset) {
+  while (len > 0) {
+    ssize_t k = pwrite(fd, ptr, len, offset);
+    if (k < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    ptr += k;
+    len -= (size_t)k;
+    offset += k;
+  }
+  return 0;
+}
+
+const char*   //
+compress(     //
+    int in,   //
+    int out,  //
+    uint32_t flags) {
+  const off_t size = lseek(in, 0, SEEK_END);
+  if (size < 0) {
+    return "could not seek input";
+  }
+  uint64_t num_data_bytes = 0;
+  off_t in_pos = 0;
+  off_t out_pos = 0;
+  while (in_pos < size) {
+    // Without SEEK_DATA and SEEK_HOLE support, the whole file is one data
+    // extent, but sflz4_sparse_encode_data still turns zeroes into holes.
+    off_t data_pos = lseek(in, in_pos, SEEK_DATA);
+    if (data_pos < 0) {
+      data_pos = (errno == ENXIO) ? size : in_pos;
+    }
+    off_t hole_pos = (data_pos < size) ? lseek(in, data_pos, SEEK_HOLE) : size;
+    if ((hole_pos < 0) || (hole_pos > size)) {
+      hole_pos = size;
+    }
+
+    sflz4_size_result r = sflz4_sparse_encode_hole(
+        records, records_len, (uint64_t)(data_pos - in_pos), flags);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (write_fully(out, records, r.value, out_pos)) {
+      return "could not write output";
+    }
+    out_pos += (off_t)r.value;
+
+    for (in_pos = data_pos; in_pos < hole_pos;) {
+      size_t n = SFLZ4_SPARSE_MAX_INCL_DATA_LEN;
+      if ((off_t)n > (hole_pos - in_pos)) {
+        n = (size_t)(hole_pos - in_pos);
+      }
+      ssize_t k = read_fully(in, data, n, in_pos);
+      if (k <= 0) {
+        return "could not read input";
+      }
+      r = sflz4_sparse_encode_data(records, records_len, data, (size_t)k,
+                                   flags);
+      if (r.status_message) {
+        return r.status_message;
+      } else if (write_fully(out, records, r.value, out_pos)) {
+        return "could not write output";
+      }
+      out_pos += (off_t)r.value;
+      in_pos += k;
+      num_data_bytes += (uint64_t)k;
+    }
+  }
+  fprintf(stderr, "sparse: read %llu of %llu bytes, wrote %llu bytes",
+          (unsigned long long)num_data_bytes, (unsigned long long)size,
+          (unsigned long long)out_pos);
+  return NULL;
+}
+
+const char*  //
+decompress(  //
+    int in,  //
+    int out) {
+  off_t in_pos = 0;
+  off_t out_pos = 0;
+  uint64_t num_data_bytes = 0;
+  while (1) {
+    ssize_t k =
+        read_fully(in, records, SFLZ4_SPARSE_RECORD_HEADER_LEN, in_pos);
+    if (k == 0) {
+      break;
+    } else if (k != SFLZ4_SPARSE_RECORD_HEADER_LEN) {
+      return "could not read input";
+    }
+    sflz4_size_result r = sflz4_sparse_record_len(records, (size_t)k);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (r.value > records_len) {
+      return sflz4_status_message__error_invalid_data;
+    }
+    const size_t record_len = r.value;
+    k = read_fully(in, records + SFLZ4_SPARSE_RECORD_HEADER_LEN,
+                   record_len - SFLZ4_SPARSE_RECORD_HEADER_LEN,
+                   in_pos + SFLZ4_SPARSE_RECORD_HEADER_LEN);
+    if (k != (ssize_t)(record_len - SFLZ4_SPARSE_RECORD_HEADER_LEN)) {
+      return "could not read input";
+    }
+    in_pos += (off_t)record_len;
+
+    uint64_t hole_len = 0;
+    r = sflz4_sparse_decode_record(data, sizeof(data), records, record_len,
+                                   &hole_len);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (hole_len > (uint64_t)(INT64_MAX - out_pos)) {
+      return sflz4_status_message__error_invalid_data;
+    } else if (write_fully(out, data, r.value, out_pos)) {
+      return "could not write output";
+    }
+    out_pos += (off_t)(r.value + hole_len);
+    num_data_bytes += r.value;
+  }
+  // The file may end with a hole, which nothing has been written to yet.
+  if (ftruncate(out, out_pos)) {
+    return "could not truncate output";
+  }
+  fprintf(stderr, "sparse: read %llu bytes, wrote %llu of %llu bytes",
+          (unsigned long long)in_pos, (unsigned long long)num_data_bytes,
+          (unsigned long long)out_pos);
+  return NULL;
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  const int c = (argc == 4) && (!strcmp(argv[1], "-c") ||
+                                !strcmp(argv[1], "-c32"));
+  const int d = (argc == 4) && !strcmp(argv[1], "-d");
+  if (!c && !d) {
+    fprintf(stderr, "usage: %s -c|-c32|-d input output\n", argv[0]);
+    return 1;
+  }
+
+  // This is also long enough for any one record that the encoder produces.
+  records_len =
+      sflz4_sparse_encode_worst_case_dst_len(SFLZ4_SPARSE_MAX_INCL_DATA_LEN)
+          .value;
+  records = (uint8_t*)malloc(records_len);
+  if (!records) {
+    fprintf(stderr, "sparse: out of memory\n");
+    return 1;
+  }
+  int in = open(argv[2], O_RDONLY);
+  if (in < 0) {
+    fprintf(stderr, "sparse: %s: could not open\n", argv[2]);
+    return 1;
+  }
+  int out = open(argv[3], O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (out < 0) {
+    fprintf(stderr, "sparse: %s: could not create\n", argv[3]);
+    return 1;
+  }
+
+  const double t0 = now();
+  const char* status_message =
+      c ? compress(in, out, argv[1][2] ? SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C : 0)
+        : decompress(in, out);
+  if (!status_message && fsync(out)) {
+    status_message = "could not sync output";
+  }
+  if (status_message) {
+    fprintf(stderr, "sparse: %s\n", status_message);
+  } else {
+    fprintf(stderr, " in %.3f s\n", now() - t0);
+  }
+  close(out);
+  close(in);
+  free(records);
+  return status_message ? 1 : 0;
+}
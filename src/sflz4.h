@@ -38,6 +38,7 @@ extern "C" {
 
 // The compile-time configuration macros are:
 //  - SFLZ4_CONFIG__STATIC_FUNCTIONS
+//  - SFLZ4_CONFIG__TELEMETRY
 
 // ----
 
@@ -54,6 +55,12 @@ extern "C" {
 #define SFLZ4_MAYBE_STATIC
 #endif  // defined(SFLZ4_CONFIG__STATIC_FUNCTIONS)
 
+// ----
+
+// Define SFLZ4_CONFIG__TELEMETRY (combined with SFLZ4_IMPLEMENTATION) to make
+// SFLZ4 count its calls, bytes, errors and (optionally) time. See the
+// "Telemetry" section below.
+
 // -------- Basics
 
 // Clang also #define's "__GNUC__".
@@ -70,9 +77,126 @@ typedef struct sflz4_size_result_struct {
 
 // -------- Status Messages
 
+extern const char sflz4_status_message__error_bad_argument[];
+extern const char sflz4_status_message__error_bad_checksum[];
 extern const char sflz4_status_message__error_dst_is_too_short[];
 extern const char sflz4_status_message__error_invalid_data[];
 extern const char sflz4_status_message__error_src_is_too_long[];
+extern const char sflz4_status_message__error_unsupported_feature[];
+extern const char sflz4_status_message__error_workspace_is_too_short[];
+
+// -------- Telemetry
+
+// Telemetry is a set of process-wide counters, maintained only if
+// SFLZ4_CONFIG__TELEMETRY is defined (otherwise, sflz4_telemetry_read
+// returns all zeroes), of:
+//  - SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, calls of sflz4_block_encode,
+//    sflz4_block_encode_high_ratio, sflz4_block_encode_parallel,
+//    sflz4_block_encode_segmented and sflz4_block_encode_with_dictionary.
+//  - SFLZ4_TELEMETRY_OP__BLOCK_DECODE, calls of sflz4_block_decode,
+//    sflz4_block_decode_growing, sflz4_block_decode_prefix,
+//    sflz4_block_decode_segment and sflz4_block_decode_with_dictionary.
+//  - SFLZ4_TELEMETRY_OP__FRAME_ENCODE, sflz4_frame_encode calls.
+//  - SFLZ4_TELEMETRY_OP__FRAME_DECODE, sflz4_frame_decode (and
+//    sflz4_frame_decode_with_dictionaries) calls.
+//
+// Every other function that encodes or decodes LZ4 blocks (page pools,
+// records, log writers and recovery, frame readers and checkpoints,
+// archives, messages, aligned streams, foreign framings, etc.) counts each
+// block as one block encode or block decode call, except that
+// sflz4_delta_encode and sflz4_delta_apply count as the one frame call that
+// each makes. A frame call's blocks aren't also counted as block calls and
+// sflz4_block_estimate_encoded_len's trial encodings aren't counted at all.
+//
+// Each thread, on its first counted call, claims one of
+// SFLZ4_TELEMETRY_NUM_SHARDS shards of counters, which only it updates (and
+// so needs no atomic read-modify-write instructions), keeping it for as long
+// as the process runs. Any further threads share one more shard, updated
+// with atomic additions. sflz4_telemetry_read sums all of the shards. The
+// counts are never reset, as a thread's counts outlive that thread. Take the
+// difference between two reads to measure an interval.
+//
+// Counting costs a few nanoseconds per call, plus two calls of the clock, if
+// one is set. Unlike most of SFLZ4, it assumes that the compiler supports
+// thread-local variables (if not, every thread shares the one atomic
+// shard).
+
+#define SFLZ4_TELEMETRY_OP__BLOCK_ENCODE 0
+#define SFLZ4_TELEMETRY_OP__BLOCK_DECODE 1
+#define SFLZ4_TELEMETRY_OP__FRAME_ENCODE 2
+#define SFLZ4_TELEMETRY_OP__FRAME_DECODE 3
+#define SFLZ4_TELEMETRY_NUM_OPS 4
+
+// Failed calls are counted by status message, indexed in the same
+// (alphabetical) order as the "Status Messages" section above, with
+// SFLZ4_TELEMETRY_ERROR__OTHER counting any other status message (e.g. one
+// returned by a caller-supplied function).
+#define SFLZ4_TELEMETRY_ERROR__BAD_ARGUMENT 0
+#define SFLZ4_TELEMETRY_ERROR__BAD_CHECKSUM 1
+#define SFLZ4_TELEMETRY_ERROR__DST_IS_TOO_SHORT 2
+#define SFLZ4_TELEMETRY_ERROR__INVALID_DATA 3
+#define SFLZ4_TELEMETRY_ERROR__SRC_IS_TOO_LONG 4
+#define SFLZ4_TELEMETRY_ERROR__UNSUPPORTED_FEATURE 5
+#define SFLZ4_TELEMETRY_ERROR__WORKSPACE_IS_TOO_SHORT 6
+#define SFLZ4_TELEMETRY_ERROR__OTHER 7
+#define SFLZ4_TELEMETRY_NUM_ERRORS 8
+
+// SFLZ4_TELEMETRY_NUM_SHARDS is the number of threads that get their own
+// shard of counters.
+#define SFLZ4_TELEMETRY_NUM_SHARDS 64
+
+// sflz4_telemetry_counters are one op's counters. src_len and dst_len total
+// the bytes in (for every call) and out (for successful calls). time totals
+// the clock's elapsed ticks.
+typedef struct sflz4_telemetry_counters_struct {
+  uint64_t calls;
+  uint64_t src_len;
+  uint64_t dst_len;
+  uint64_t time;
+  uint64_t errors[SFLZ4_TELEMETRY_NUM_ERRORS];
+} sflz4_telemetry_counters;
+
+typedef struct sflz4_telemetry_snapshot_struct {
+  sflz4_telemetry_counters ops[SFLZ4_TELEMETRY_NUM_OPS];
+} sflz4_telemetry_snapshot;
+
+// sflz4_telemetry_clock_func returns the current time, in ticks of any
+// caller-defined unit (e.g. nanoseconds or CPU cycles). It should be cheap:
+// it is called twice per counted call. The library does not read any clock
+// itself.
+typedef uint64_t (*sflz4_telemetry_clock_func)(void);
+
+// sflz4_telemetry_set_clock sets the clock used to time counted calls. A NULL
+// clock (the default) means to not time them. Set it before other threads
+// make counted calls.
+SFLZ4_MAYBE_STATIC void     //
+sflz4_telemetry_set_clock(  //
+    sflz4_telemetry_clock_func clock_func);
+
+// sflz4_telemetry_read sets *s to the sum of every shard's counters. It is
+// safe to call concurrently with counted calls, but the snapshot is not
+// atomic: it may see some of a concurrent call's counts but not others.
+SFLZ4_MAYBE_STATIC void  //
+sflz4_telemetry_read(    //
+    sflz4_telemetry_snapshot* s);
+
+// -------- CRC-32C
+
+// sflz4_crc32c_update returns the CRC-32C (Castagnoli) checksum of the
+// concatenation of (1) the bytes whose checksum is crc and (2) p[0 .. p_len).
+// Pass crc = 0 to start a new checksum. For example, the checksum of the 9
+// bytes "123456789" is 0xE3069283.
+//
+// It uses the CPU's CRC32C instructions (SSE4.2 on x86_64, the CRC extension
+// on ARMv8), if available, and falls back to a table-based implementation
+// otherwise. On x86_64, long inputs are split into three interleaved streams
+// (hiding the CRC32 instruction's latency) whose checksums are then combined
+// using the PCLMULQDQ (carry-less multiplication) instruction.
+SFLZ4_MAYBE_STATIC uint32_t  //
+sflz4_crc32c_update(         //
+    uint32_t crc,            //
+    const uint8_t* p,        //
+    size_t p_len);
 
 // -------- LZ4 Decode
 
@@ -101,6 +225,57 @@ sflz4_block_decode(                         //
     const uint8_t* SFLZ4_RESTRICT src_ptr,  //
     size_t src_len);
 
+// sflz4_block_decode_prefix is like sflz4_block_decode but only decodes the
+// first dst_len bytes of the decompressed form, stopping early (possibly
+// part-way through an LZ4 sequence) once dst is full. It returns the number
+// of bytes written, which is less than dst_len only if the whole
+// decompressed form is shorter than that.
+//
+// The cost is proportional to dst_len, not to the decompressed length. The
+// rest of src (after the point where it stops) is not checked for validity.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_prefix(                  //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_realloc_func resizes the buffer at ptr (which is NULL when old_len is
+// zero) from old_len to new_len bytes, preserving its first old_len bytes,
+// like realloc. It returns the (possibly moved) buffer, or NULL on failure
+// (leaving the buffer at ptr as it was).
+typedef void* (*sflz4_realloc_func)(void* context,
+                                    void* ptr,
+                                    size_t old_len,
+                                    size_t new_len);
+
+// sflz4_block_decode_growing is like sflz4_block_decode but for when the
+// decoded length isn't known in advance. It decodes into the *dst_len byte
+// buffer at *dst_ptr (which may be NULL and zero), growing that buffer via
+// realloc_func whenever the next literals or match wouldn't fit. Decoding
+// then carries on where it left off, as the buffer keeps the bytes (the
+// match history) decoded so far. Nothing is decoded twice.
+//
+// Each growth at least doubles the buffer's length, so the total cost of
+// growing is linear in the decoded length. An empty initial buffer starts at
+// (4 * src_len) bytes. The buffer never grows beyond dst_max_len, which
+// bounds how much memory untrusted src can make it allocate.
+//
+// It returns the decoded length. It updates *dst_ptr and *dst_len to the
+// (possibly moved) buffer and its length, even on failure, so that the
+// caller can always free it. It fails with
+// sflz4_status_message__error_dst_is_too_short if the decoded length would
+// exceed dst_max_len or if realloc_func fails.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_growing(                 //
+    uint8_t** dst_ptr,                      //
+    size_t* dst_len,                        //
+    size_t dst_max_len,                     //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_realloc_func realloc_func,        //
+    void* context);
+
 // -------- LZ4 Encode
 
 // SFLZ4_LZ4_BLOCK_ENCODE_MAX_INCL_SRC_LEN is the maximum (inclusive) supported
@@ -132,366 +307,10419 @@ sflz4_block_encode(                         //
     const uint8_t* SFLZ4_RESTRICT src_ptr,  //
     size_t src_len);
 
-// ================================ -Public Interface
+// sflz4_block_estimate_encoded_len returns an estimate of
+// sflz4_block_encode's output length for the given src, for callers deciding
+// whether src is worth compressing at all.
+//
+// It runs the encoder over at most SFLZ4_BLOCK_ESTIMATE_MAX_INCL_SAMPLE_LEN
+// bytes, sampled evenly across src, and scales the result to src_len. For
+// long inputs, this is much faster than encoding all of src, but the estimate
+// can be wrong when src is not homogeneous. Matches further apart than the
+// sample chunk length are also not counted, so it tends to slightly
+// overestimate.
+//
+// It fails (with sflz4_status_message__error_src_is_too_long) if and only if
+// sflz4_block_encode_worst_case_dst_len(src_len) fails.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_estimate_encoded_len(           //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
 
-#ifdef SFLZ4_IMPLEMENTATION
+// SFLZ4_BLOCK_ESTIMATE_MAX_INCL_SAMPLE_LEN is the maximum (inclusive) number
+// of src bytes that sflz4_block_estimate_encoded_len examines.
+#define SFLZ4_BLOCK_ESTIMATE_MAX_INCL_SAMPLE_LEN 65536
 
-// ================================ +Private Implementation
+// SFLZ4_BLOCK_ENCODE_HIGH_RATIO_WORKSPACE_LEN is the minimum (inclusive)
+// workspace_len argument to sflz4_block_encode_high_ratio.
+#define SFLZ4_BLOCK_ENCODE_HIGH_RATIO_WORKSPACE_LEN 0x40003
 
-// -------- Basics
+// sflz4_block_encode_high_ratio is like sflz4_block_encode but spends more
+// time looking for longer matches, for data that is compressed once (e.g. at
+// build time) and decoded many times. Its output is a regular LZ4 block.
+//
+// Where sflz4_block_encode takes the first match that one hash table probe
+// finds, this follows a chain of every earlier position (within the 64 KiB
+// window) with the same hash, keeping the longest match. It also defers each
+// match by one byte when the next position has a longer one (lazy matching).
+// It is roughly an order of magnitude slower to encode. Decoding is no
+// slower and is often faster, as there are fewer, longer sequences.
+//
+// The workspace holds the hash table and chain, and its length must be at
+// least SFLZ4_BLOCK_ENCODE_HIGH_RATIO_WORKSPACE_LEN. As with
+// sflz4_block_encode, dst_len must be at least
+// sflz4_block_encode_worst_case_dst_len(src_len).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_high_ratio(              //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len);
 
-// This implementation assumes that:
-//  - converting a uint32_t to a size_t will never overflow.
-//  - converting a size_t to a uint64_t will never overflow.
-#if defined(__WORDSIZE)
-#if (__WORDSIZE != 32) && (__WORDSIZE != 64)
-#error "sflz4.h requires a word size of either 32 or 64 bits"
-#endif
-#endif
+// -------- LZ4 Parallel Encode
 
-// Normally, the sflz4_private_peek_u32le implementation is both (1) correct
-// regardless of CPU endianness and (2) very fast (e.g. an inlined
-// sflz4_private_peek_u32le call, in an optimized clang or gcc build, is a
-// single MOV instruction on x86_64).
+// sflz4_parallel_for_func is a caller-supplied function that calls
+// func(func_context, i) exactly once for each i in the range [0, n), possibly
+// concurrently (e.g. on multiple threads), returning only after all n calls
+// have completed.
 //
-// However, the endian-agnostic implementations are slow on Microsoft's C
-// compiler (MSC). Alternative memcpy-based implementations restore speed, but
-// they are only correct on little-endian CPU architectures. Defining
-// SFLZ4_USE_MEMCPY_LE_PEEK_POKE opts in to these implementations.
+// SFLZ4 itself has no threading dependencies. The caller decides how (or
+// whether) to run work in parallel.
+typedef void (*sflz4_parallel_for_func)(         //
+    void* context,                               //
+    size_t n,                                    //
+    void (*func)(void* func_context, size_t i),  //
+    void* func_context);
+
+// SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS is the maximum (inclusive)
+// num_regions argument to sflz4_block_encode_parallel.
+#define SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS 256
+
+// sflz4_block_encode_parallel_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_block_encode_parallel.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_parallel_workspace_len(  //
+    size_t src_len,                         //
+    size_t num_regions);
+
+// sflz4_block_encode_parallel is like sflz4_block_encode, producing a single
+// LZ4 block, but src is split into num_regions equally sized regions whose
+// matches are found independently (and, via parallel_for, possibly
+// concurrently). Each region's matches may refer back into the 64 KiB of src
+// that precedes that region. The per-region results are then stitched into one
+// valid LZ4 block, readable by any LZ4 block decoder.
 //
-// https://godbolt.org/z/q4MfjzTPh
-#if defined(_MSC_VER) && !defined(__clang__) && \
-    (defined(_M_ARM64) || defined(_M_X64))
-#define SFLZ4_USE_MEMCPY_LE_PEEK_POKE
-#endif
+// The per-region results are written to the workspace, whose length must be
+// at least sflz4_block_encode_parallel_workspace_len(src_len, num_regions).
+// As with sflz4_block_encode, dst_len must be at least
+// sflz4_block_encode_worst_case_dst_len(src_len).
+//
+// A NULL parallel_for means to process each region sequentially, on the
+// calling thread.
+//
+// For a given src, the output bytes may differ from sflz4_block_encode's
+// output (and may be slightly longer), but they depend only on src and
+// num_regions, not on the order in which parallel_for runs the work.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_parallel(                //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len,                   //
+    size_t num_regions,                     //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context);
 
-static inline uint32_t     //
-sflz4_private_peek_u32le(  //
-    const uint8_t* p) {
-#if defined(SFLZ4_USE_MEMCPY_LE_PEEK_POKE)
-  uint32_t x;
-  memcpy(&x, p, 4);
-  return x;
-#else
-  return ((uint32_t)(p[0]) << 0) | ((uint32_t)(p[1]) << 8) |
-         ((uint32_t)(p[2]) << 16) | ((uint32_t)(p[3]) << 24);
-#endif
-}
+// -------- LZ4 Segments
 
-// -------- Status Messages
+// sflz4_segment is one entry of a side index for a segmented LZ4 block: one
+// that sflz4_block_encode_segmented produced. The segment's encoded (LZ4
+// compressed) bytes start at encoded_offset within the block and its decoded
+// (LZ4 decompressed) bytes start at decoded_offset. Each segment ends where
+// the next one starts (or, for the final segment, at the end of the block).
+typedef struct sflz4_segment_struct {
+  size_t encoded_offset;
+  size_t decoded_offset;
+} sflz4_segment;
 
-const char sflz4_status_message__error_dst_is_too_short[] =  //
-    "#sflz4: dst is too short";
-const char sflz4_status_message__error_invalid_data[] =  //
-    "#sflz4: invalid data";
-const char sflz4_status_message__error_src_is_too_long[] =  //
-    "#sflz4: src is too long";
+// sflz4_block_encode_segmented is like sflz4_block_encode, producing a single
+// LZ4 block (readable by any LZ4 block decoder), but restricts its matches so
+// that the block splits into segments_len segments that can each be decoded
+// independently (e.g. concurrently), via sflz4_block_decode_segment.
+//
+// It writes the side index to segments_ptr[0 .. segments_len). src is split
+// into segments_len roughly equal parts, but a segment's decoded_offset may
+// be a little earlier than its nominal starting point, since a literal run
+// that straddles the nominal boundary belongs to the later segment. Some
+// segments may also be empty (with the same offsets as the next segment).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_segmented(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_segment* segments_ptr,            //
+    size_t segments_len);
 
-// -------- LZ4 Decode
+// sflz4_block_decode_segment decodes one segment of a segmented LZ4 block.
+// src is that segment's encoded bytes and dst_len should be the length of
+// its decoded bytes (both derived from consecutive sflz4_segment entries).
+//
+// It is like sflz4_block_decode except that src may be empty and may end with
+// a match instead of a literal run (only the block's final segment ends the
+// way a whole LZ4 block does). It never refers to bytes before dst_ptr, so
+// separate segments can be decoded concurrently into the same (overall) dst
+// buffer.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_segment(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// -------- LZ4 Dictionaries
+
+// sflz4_dictionary is an LZ4 dictionary: up to 64 KiB of sample data that
+// matches may refer back to, as if it immediately preceded the data being
+// encoded or decoded. This improves the compression of short inputs (such as
+// individual messages) that resemble the sample data.
+//
+// It is pre-digested: sflz4_dictionary_initialize fills in a hash table, so
+// that encoding with it only costs a 16 KiB memcpy. Its fields are private
+// implementation details. The dictionary's bytes are not copied, so they must
+// outlive it.
+//
+// The id is what the LZ4 frame format calls the Dict-ID. The encoder records
+// it in the frame header and the decoder (given a sflz4_dictionary_registry)
+// uses it to select the matching dictionary.
+
+// SFLZ4_DICTIONARY_MAX_INCL_LEN is the maximum (inclusive) dictionary length:
+// the LZ4 block format's maximum match offset.
+#define SFLZ4_DICTIONARY_MAX_INCL_LEN 0x10000
+
+typedef struct sflz4_dictionary_struct {
+  uint32_t private_id;
+  const uint8_t* private_ptr;
+  size_t private_len;
+  uint32_t private_hash_table[4096];
+} sflz4_dictionary;
+
+// sflz4_dictionary_initialize prepares d to use the bytes at ptr[0 .. len),
+// returning NULL on success or a status message on failure. Only the final
+// 64 KiB are used if len is longer, so the most useful sample data should go
+// last. A dictionary shorter than 4 bytes (the minimum match length) is
+// treated as empty, both when encoding and when decoding.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_dictionary_initialize(    //
+    sflz4_dictionary* d,        //
+    uint32_t id,                //
+    const uint8_t* ptr,         //
+    size_t len);
 
+// sflz4_block_encode_with_dictionary is like sflz4_block_encode but its
+// output may refer back into the dictionary d. Decode it with
+// sflz4_block_decode_with_dictionary and the same dictionary.
 SFLZ4_MAYBE_STATIC sflz4_size_result        //
-sflz4_block_decode(                         //
+sflz4_block_encode_with_dictionary(         //
     uint8_t* SFLZ4_RESTRICT dst_ptr,        //
     size_t dst_len,                         //
     const uint8_t* SFLZ4_RESTRICT src_ptr,  //
-    size_t src_len) {
-  sflz4_size_result result = {0};
+    size_t src_len,                         //
+    const sflz4_dictionary* d);
 
-  if (src_len > SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN) {
-    result.status_message = sflz4_status_message__error_src_is_too_long;
-    return result;
-  }
+// sflz4_block_decode_with_dictionary is like sflz4_block_decode but src may
+// refer back into the dictionary d.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_with_dictionary(         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary* d);
 
-  uint8_t* const original_dst_ptr = dst_ptr;
+// sflz4_dictionary_registry maps Dict-IDs to dictionaries, so that a stream
+// of LZ4 frames that use different dictionaries (e.g. one per message type)
+// can be decoded without routing each frame to its dictionary out of band.
+// See sflz4_frame_decode_with_dictionaries.
+//
+// Looking up a dictionary is lock-free and may happen concurrently with
+// adding one (from any thread). Dictionaries cannot be removed, since
+// concurrent decoders may still be using them. Its fields are private
+// implementation details. Initialize it with
+// sflz4_dictionary_registry_initialize.
+typedef struct sflz4_dictionary_registry_struct {
+  volatile uint32_t private_lock;
+  volatile size_t private_count;
+  size_t private_capacity;
+  const sflz4_dictionary** private_entries;
+} sflz4_dictionary_registry;
 
-  // See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md for file
-  // format details, such as the LZ4 token's bit patterns.
-  while (src_len > 0) {
-    uint32_t token = *src_ptr++;
-    src_len--;
+// sflz4_dictionary_registry_initialize prepares r to hold up to
+// entries_len dictionaries, using the caller-supplied entries_ptr array. That
+// array, and the dictionaries added, must outlive r.
+SFLZ4_MAYBE_STATIC void                    //
+sflz4_dictionary_registry_initialize(      //
+    sflz4_dictionary_registry* r,          //
+    const sflz4_dictionary** entries_ptr,  //
+    size_t entries_len);
 
-    uint32_t literal_len = token >> 4;
-    if (literal_len > 0) {
-      if (literal_len == 15) {
-        while (1) {
-          if (src_len == 0) {
-            goto fail_invalid_data;
-          }
-          uint32_t s = *src_ptr++;
-          src_len--;
-          literal_len += s;
-          if (s != 255) {
-            break;
-          }
-        }
-      }
+// sflz4_dictionary_registry_add adds d to r, returning NULL on success or a
+// status message on failure. It fails with
+// sflz4_status_message__error_bad_argument if r already has a dictionary
+// with the same id and with
+// sflz4_status_message__error_workspace_is_too_short if r is full.
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_dictionary_registry_add(     //
+    sflz4_dictionary_registry* r,  //
+    const sflz4_dictionary* d);
 
-      if (literal_len > src_len) {
-        goto fail_invalid_data;
-      } else if (literal_len > dst_len) {
-        result.status_message = sflz4_status_message__error_dst_is_too_short;
-        return result;
-      }
-      memcpy(dst_ptr, src_ptr, literal_len);
-      dst_ptr += literal_len;
-      dst_len -= literal_len;
-      src_ptr += literal_len;
-      src_len -= literal_len;
-      if (src_len == 0) {
-        result.value = ((size_t)(dst_ptr - original_dst_ptr));
-        return result;
-      }
-    }
+// sflz4_dictionary_registry_find returns the dictionary in r with the given
+// id, or NULL if there is no such dictionary.
+SFLZ4_MAYBE_STATIC const sflz4_dictionary*  //
+sflz4_dictionary_registry_find(             //
+    const sflz4_dictionary_registry* r,     //
+    uint32_t id);
 
-    if (src_len < 2) {
-      goto fail_invalid_data;
-    }
-    uint32_t copy_off = ((uint32_t)src_ptr[0]) | (((uint32_t)src_ptr[1]) << 8);
-    src_ptr += 2;
-    src_len -= 2;
-    if ((copy_off == 0) ||  //
-        (copy_off > ((size_t)(dst_ptr - original_dst_ptr)))) {
-      goto fail_invalid_data;
-    }
+// -------- LZ4 Frame
 
-    uint32_t copy_len = (token & 15) + 4;
-    if (copy_len == 19) {
-      while (1) {
-        if (src_len == 0) {
-          goto fail_invalid_data;
-        }
-        uint32_t s = *src_ptr++;
-        src_len--;
-        copy_len += s;
-        if (s != 255) {
-          break;
-        }
-      }
-    }
+// The LZ4 frame format (https://github.com/lz4/lz4/blob/dev/doc/
+// lz4_Frame_format.md) wraps a sequence of LZ4 blocks with a header (whose
+// magic number identifies the format), block lengths, optional checksums and
+// an end marker.
 
-    if (dst_len < copy_len) {
-      result.status_message = sflz4_status_message__error_dst_is_too_short;
-      return result;
-    }
-    dst_len -= copy_len;
-    for (const uint8_t* from = dst_ptr - copy_off; copy_len > 0; copy_len--) {
-      *dst_ptr++ = *from++;
-    }
-  }
+// SFLZ4_FRAME_ENCODE_FLAGS__ETC are bits for the flags field of
+// sflz4_frame_encode_options.
+//
+// LINKED_BLOCKS means that each block's matches may refer back into earlier
+// blocks' data (compressing better), instead of each block being
+// independently decodable (allowing random access and parallel decoding).
+//
+// BLOCK_CHECKSUMS and CONTENT_CHECKSUM add xxHash-32 checksums of each
+// (encoded) block and of the entire (decoded) content.
+//
+// CONTENT_SIZE records the decoded length in the frame header.
+//
+// SEEK_TABLE appends a skippable frame holding every block's encoded and
+// decoded lengths, so that sflz4_frame_index_blocks can find any block
+// without scanning the frame. Other LZ4 decoders ignore skippable frames.
+#define SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS 0x01
+#define SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS 0x02
+#define SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_CHECKSUM 0x04
+#define SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_SIZE 0x08
+#define SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE 0x10
 
-fail_invalid_data:
-  result.status_message = sflz4_status_message__error_invalid_data;
-  return result;
-}
+typedef struct sflz4_frame_encode_options_struct {
+  // block_max_len is the maximum decoded length of each block. It must be
+  // one of 65536, 262144, 1048576 or 4194304 (64 KiB, 256 KiB, 1 MiB or
+  // 4 MiB), as per the LZ4 frame format, or zero, which means to choose
+  // automatically (see sflz4_frame_auto_block_max_len).
+  size_t block_max_len;
 
-// -------- LZ4 Encode
+  // flags is a bitmask of SFLZ4_FRAME_ENCODE_FLAGS__ETC values.
+  uint32_t flags;
 
-#define SFLZ4_HASH_TABLE_SHIFT 12
+  // num_threads is a hint for how many threads will process (encode or
+  // decode) this frame's blocks concurrently. Zero means the same as one.
+  // It only affects automatic block_max_len selection.
+  size_t num_threads;
 
-static inline uint32_t  //
-sflz4_private_hash(     //
-    uint32_t x) {
-  // 2654435761u is Knuth's magic constant.
-  return (x * 2654435761u) >> (32 - SFLZ4_HASH_TABLE_SHIFT);
-}
+  // dictionary, if non-NULL, is the dictionary that the frame's blocks may
+  // refer back into. Its id is recorded in the frame header.
+  const sflz4_dictionary* dictionary;
+} sflz4_frame_encode_options;
 
-static inline size_t                  //
-sflz4_private_longest_common_prefix(  //
-    const uint8_t* p,                 //
-    const uint8_t* q,                 //
-    const uint8_t* p_limit) {
-  const uint8_t* const original_p = p;
-  size_t n = p_limit - p;
-  while ((n >= 4) &&
-         (sflz4_private_peek_u32le(p) == sflz4_private_peek_u32le(q))) {
-    p += 4;
-    q += 4;
-    n -= 4;
-  }
-  while ((n > 0) && (*p == *q)) {
-    p += 1;
-    q += 1;
-    n -= 1;
-  }
-  return (size_t)(p - original_p);
-}
+// sflz4_frame_auto_block_max_len returns the block_max_len that
+// sflz4_frame_encode uses when options->block_max_len is zero.
+//
+// Larger blocks compress better when blocks are independent, as every block
+// starts with an empty history, but they are fewer, limiting concurrency.
+//
+// With one thread, or with linked blocks (which compress about as well at
+// every block length, as their history carries over), it picks the shortest
+// block length that holds all of src, capped at 256 KiB for linked blocks.
+//
+// With several threads and independent blocks, it then steps down (to no
+// less than 64 KiB) until every thread has at least N blocks to work on. N
+// depends on a quick estimate of src's compressibility (see
+// sflz4_block_estimate_encoded_len). N is 1 if src compresses to at most
+// half its length, as such data loses the most from shorter blocks. N is 4
+// if src compresses to no less than 90% of its length, as such data loses
+// almost nothing from shorter blocks, and more blocks balance the load
+// better. Otherwise, N is 2.
+SFLZ4_MAYBE_STATIC size_t                   //
+sflz4_frame_auto_block_max_len(             //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags,                         //
+    size_t num_threads);
 
+// sflz4_frame_encode_worst_case_dst_len returns the maximum (inclusive)
+// number of bytes required to LZ4 frame compress src_len input bytes, for
+// any sflz4_frame_encode_options.
 SFLZ4_MAYBE_STATIC sflz4_size_result    //
-sflz4_block_encode_worst_case_dst_len(  //
-    size_t src_len) {
-  sflz4_size_result result = {0};
+sflz4_frame_encode_worst_case_dst_len(  //
+    size_t src_len);
 
-  if (src_len > SFLZ4_LZ4_BLOCK_ENCODE_MAX_INCL_SRC_LEN) {
-    result.status_message = sflz4_status_message__error_src_is_too_long;
-    return result;
-  }
-  // For the curious, if (src_len <= 0x7E000000) then (value <= 0x7E7E7E8E).
-  result.value = src_len + (src_len / 255) + 16;
-  return result;
-}
+// sflz4_frame_encode writes to dst the LZ4 frame compressed form of src,
+// returning the number of bytes written. A NULL options is equivalent to a
+// zero-valued sflz4_frame_encode_options.
+//
+// Like sflz4_block_encode, it fails immediately with
+// sflz4_status_message__error_dst_is_too_short if dst_len is less than
+// sflz4_frame_encode_worst_case_dst_len(src_len).
+//
+// Blocks that do not shrink when compressed are stored uncompressed.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_encode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_frame_encode_options* options);
 
+// sflz4_frame_decode writes to dst the LZ4 frame decompressed form of src,
+// returning the number of bytes written. src may hold multiple concatenated
+// frames, including skippable frames (which are skipped).
+//
+// It fails with sflz4_status_message__error_bad_checksum if any checksum does
+// not match and with sflz4_status_message__error_unsupported_feature for
+// frames that need a dictionary.
 SFLZ4_MAYBE_STATIC sflz4_size_result        //
-sflz4_block_encode(                         //
+sflz4_frame_decode(                         //
     uint8_t* SFLZ4_RESTRICT dst_ptr,        //
     size_t dst_len,                         //
     const uint8_t* SFLZ4_RESTRICT src_ptr,  //
-    size_t src_len) {
-  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+    size_t src_len);
+
+// sflz4_frame_decode_with_dictionaries is like sflz4_frame_decode but frames
+// that need a dictionary are decoded with the one in registry (which may be
+// NULL) that has the frame header's Dict-ID. It fails with
+// sflz4_status_message__error_unsupported_feature if there is no such
+// dictionary.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_decode_with_dictionaries(       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary_registry* registry);
+
+// -------- LZ4 Frame Random Access
+
+// sflz4_frame_block locates one block of an LZ4 frame. encoded_offset is the
+// position (relative to the start of the frame) of the block's 4 byte length
+// prefix. decoded_offset is the position of the block's first byte in the
+// frame's decoded content.
+typedef struct sflz4_frame_block_struct {
+  uint64_t encoded_offset;
+  uint64_t decoded_offset;
+} sflz4_frame_block;
+
+// sflz4_frame_index_blocks writes to blocks_ptr one sflz4_frame_block per
+// block of the LZ4 frame at the start of src, plus a final sentinel entry
+// (whose encoded_offset is the position of the frame's end marker and whose
+// decoded_offset is the total decoded length). It returns the number of
+// entries (the number of blocks plus one). A NULL blocks_ptr means to only
+// count the entries.
+//
+// If src ends with a seek table (see SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE),
+// the index is read from that. Otherwise, it walks the frame's block headers
+// and scans (but does not decode) each compressed block to learn its decoded
+// length, which is much cheaper than decoding.
+//
+// It fails with sflz4_status_message__error_unsupported_feature if the frame
+// uses linked blocks or a dictionary, as those blocks can't be decoded in
+// isolation.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_index_blocks(                   //
+    sflz4_frame_block* blocks_ptr,          //
+    size_t blocks_len,                      //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_reader serves pread-style requests (read up to n bytes at some
+// decoded offset) from an LZ4 frame held in memory (e.g. a memory-mapped
+// file), decoding only the blocks needed. Recently decoded blocks are kept
+// in a size-bounded LRU (least recently used) cache.
+//
+// A sflz4_reader's methods may be called concurrently from multiple threads.
+// The cache is split into shards (each block belongs to one shard), each
+// with its own lock and its own LRU list, to reduce lock contention. Block
+// decoding happens outside of any lock. Uncompressed blocks bypass the cache
+// and are copied straight out of src.
+//
+// Its fields are private implementation details. Initialize it with
+// sflz4_reader_initialize.
+typedef struct sflz4_reader_struct {
+  const uint8_t* private_src_ptr;
+  size_t private_src_len;
+  const sflz4_frame_block* private_blocks_ptr;
+  size_t private_blocks_len;
+  size_t private_block_max_len;
+  uint32_t private_flg;
+  size_t private_num_shards;
+  size_t private_num_slots;
+  void* private_shards;
+  void* private_slots;
+  uint8_t* private_slot_data;
+} sflz4_reader;
+
+// sflz4_reader_workspace_len returns the minimum (inclusive) workspace_len
+// argument to sflz4_reader_initialize, for a cache of num_slots decoded
+// blocks (each of up to block_max_len bytes) in num_shards shards.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_reader_workspace_len(           //
+    size_t block_max_len,             //
+    size_t num_slots,                 //
+    size_t num_shards);
+
+// sflz4_reader_initialize prepares r to read from the LZ4 frame in src,
+// returning NULL on success or a status message on failure. The frame's
+// blocks (an sflz4_frame_index_blocks result, including the sentinel) are in
+// blocks_ptr[0 .. blocks_len). The src, blocks and workspace memory
+// must outlive r.
+//
+// num_slots must be at least num_shards, which must be positive.
+SFLZ4_MAYBE_STATIC const char*            //
+sflz4_reader_initialize(                  //
+    sflz4_reader* r,                      //
+    const uint8_t* src_ptr,               //
+    size_t src_len,                       //
+    const sflz4_frame_block* blocks_ptr,  //
+    size_t blocks_len,                    //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t num_slots,                     //
+    size_t num_shards);
+
+// sflz4_reader_read_at copies to dst up to dst_len bytes of the frame's
+// decoded content, starting at offset, returning the number of bytes copied.
+// Like pread, this is less than dst_len only at the end of the content.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_reader_read_at(                 //
+    sflz4_reader* r,                  //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    uint64_t offset);
+
+// -------- LZ4 Page Pool
+
+// sflz4_page_pool keeps fixed-length pages (e.g. an application's cold cache
+// pages) in memory in LZ4 block compressed form, similar to Linux's zswap.
+// Storing a page returns a handle, which is later used to load (decompress)
+// or free it.
+//
+// Compressed pages are packed into SFLZ4_PAGE_POOL_SLAB_LEN byte slabs, carved
+// out of a caller-supplied arena. Each slab holds objects of a single size
+// class (a multiple of 64 bytes), similar to Linux's zsmalloc, so that there
+// is little per-page overhead and freeing a page never moves another. Slabs
+// are returned to the arena (for reuse by any size class) when they become
+// empty. Pages whose bytes are all the same (such as all-zero pages) are
+// stored in the handle itself, using no arena memory. Pages that don't
+// compress well are stored verbatim.
+//
+// A sflz4_page_pool's methods may be called concurrently from multiple
+// threads, other than loading or freeing a handle that is concurrently being
+// freed. Compression and decompression happen outside of the pool's lock.
+//
+// Its fields are private implementation details. Initialize it with
+// sflz4_page_pool_initialize.
+
+#define SFLZ4_PAGE_POOL_PAGE_LEN 4096
+#define SFLZ4_PAGE_POOL_SLAB_LEN 16384
+
+typedef struct sflz4_page_pool_stats_struct {
+  uint64_t num_pages;          // All stored pages.
+  uint64_t num_uniform_pages;  // Pages stored in their handle.
+  uint64_t num_raw_pages;      // Pages stored verbatim.
+  uint64_t num_object_bytes;   // The sum of stored objects' size classes.
+  uint64_t num_slabs;          // Slabs in use.
+} sflz4_page_pool_stats;
+
+typedef struct sflz4_page_pool_struct {
+  volatile uint32_t private_lock;
+  uint32_t private_num_slabs;
+  uint32_t private_num_fresh_slabs;
+  uint32_t private_empty_slabs;
+  uint32_t private_partial_slabs[64];
+  uint8_t* private_slabs_ptr;
+  void* private_slab_metas;
+  sflz4_page_pool_stats private_stats;
+} sflz4_page_pool;
+
+// sflz4_page_pool_initialize prepares pool to use the arena memory, returning
+// NULL on success or a status message on failure. The arena memory must
+// outlive pool. Slab metadata takes 16 bytes per slab, about 0.1% of the
+// arena.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_page_pool_initialize(     //
+    sflz4_page_pool* pool,      //
+    uint8_t* arena_ptr,         //
+    size_t arena_len);
+
+// sflz4_page_pool_store stores a copy of the SFLZ4_PAGE_POOL_PAGE_LEN bytes at
+// page_ptr, returning a non-zero handle.
+//
+// It fails with sflz4_status_message__error_workspace_is_too_short if the
+// arena is full.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_page_pool_store(                //
+    sflz4_page_pool* pool,            //
+    const uint8_t* page_ptr);
+
+// sflz4_page_pool_load writes the SFLZ4_PAGE_POOL_PAGE_LEN bytes of the page
+// with the given handle to dst, returning NULL on success or a status message
+// on failure. The page stays in the pool.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_page_pool_load(           //
+    sflz4_page_pool* pool,      //
+    uint8_t* dst_ptr,           //
+    size_t handle);
+
+// sflz4_page_pool_free removes the page with the given handle from the pool.
+// Zero is a valid (no-op) handle. Handles that sflz4_page_pool_load would
+// reject as a bad argument, or that refer to a never allocated object or to
+// an empty slab, are ignored. Freeing a handle twice is otherwise undefined
+// behavior, as its object may have been reused by a later store.
+SFLZ4_MAYBE_STATIC void     //
+sflz4_page_pool_free(       //
+    sflz4_page_pool* pool,  //
+    size_t handle);
+
+// sflz4_page_pool_get_stats returns a snapshot of the pool's usage. The
+// memory saved is (num_pages * SFLZ4_PAGE_POOL_PAGE_LEN) minus (num_slabs *
+// SFLZ4_PAGE_POOL_SLAB_LEN).
+SFLZ4_MAYBE_STATIC sflz4_page_pool_stats  //
+sflz4_page_pool_get_stats(                //
+    sflz4_page_pool* pool);
+
+// -------- LZ4 Record Container
+
+// An LZ4 record container packs many small records (byte strings, identified
+// by their 0-based position, their record_id) into independently LZ4 block
+// compressed blocks of up to block_max_len decoded bytes. Each block starts
+// with a compact (varint) index of its records' lengths, stored
+// uncompressed. The container ends with a directory of every block's offset
+// and first record_id.
+//
+// Looking up one record decodes only (a prefix of) its containing block.
+// Scanning all records decodes each block once, in order.
+
+// sflz4_record_writer builds a record container in a caller-supplied dst
+// buffer. Its fields are private implementation details. Initialize it with
+// sflz4_record_writer_initialize.
+typedef struct sflz4_record_writer_struct {
+  uint8_t* private_dst_ptr;
+  size_t private_dst_len;
+  size_t private_dst_pos;
+  uint64_t private_num_blocks;
+  uint64_t private_num_records;
+  uint8_t* private_payload_ptr;
+  size_t private_payload_len;
+  uint8_t* private_index_ptr;
+  size_t private_index_len;
+  uint64_t private_block_num_records;
+  size_t private_block_max_len;
+} sflz4_record_writer;
+
+// sflz4_record_writer_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_record_writer_initialize.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_record_writer_workspace_len(    //
+    size_t block_max_len);
+
+// sflz4_record_writer_initialize prepares w to write a record container to
+// dst, returning NULL on success or a status message on failure. Larger
+// block_max_len values compress better but make lookups slower. It must be
+// positive and at most (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2).
+SFLZ4_MAYBE_STATIC const char*   //
+sflz4_record_writer_initialize(  //
+    sflz4_record_writer* w,      //
+    uint8_t* dst_ptr,            //
+    size_t dst_len,              //
+    uint8_t* workspace_ptr,      //
+    size_t workspace_len,        //
+    size_t block_max_len);
+
+// sflz4_record_writer_add appends a record, returning NULL on success or a
+// status message on failure. Its record_id is the number of records
+// previously added. A record may not be longer than block_max_len.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_record_writer_add(        //
+    sflz4_record_writer* w,     //
+    const uint8_t* record_ptr,  //
+    size_t record_len);
+
+// sflz4_record_writer_finish completes the container, returning its length.
+// No further records may be added.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_record_writer_finish(           //
+    sflz4_record_writer* w);
+
+// sflz4_records_num_records returns the number of records in the container.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_num_records(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_records_scratch_len returns the minimum (inclusive) scratch_len
+// argument to sflz4_records_get and sflz4_records_scan: the container's
+// block_max_len.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_scratch_len(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_records_get copies the record_id'th record to dst, returning its
+// length. It decodes only the containing block's prefix, up to the end of
+// that record, into scratch.
+//
+// It fails with sflz4_status_message__error_bad_argument if record_id is out
+// of range.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_get(                    //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    uint64_t record_id,               //
+    uint8_t* scratch_ptr,             //
+    size_t scratch_len);
+
+// sflz4_records_scan calls func once per record, in record_id order,
+// returning NULL on success or a status message on failure. The record_ptr
+// passed to func points into scratch and is only valid during that call.
+SFLZ4_MAYBE_STATIC const char*               //
+sflz4_records_scan(                          //
+    const uint8_t* src_ptr,                  //
+    size_t src_len,                          //
+    uint8_t* scratch_ptr,                    //
+    size_t scratch_len,                      //
+    void (*func)(void* context,              //
+                 uint64_t record_id,         //
+                 const uint8_t* record_ptr,  //
+                 size_t record_len),         //
+    void* context);
+
+// -------- LZ4 Log Writer
+
+// sflz4_log_writer appends records to a write-ahead log, as an LZ4 frame of
+// linked blocks (with block checksums). It never writes or syncs per record.
+// Instead, records are buffered and flushed as one compressed block (one
+// write_func call and one sync_func call) once enough bytes are buffered or
+// once the oldest buffered record is old enough: group commit.
+//
+// A block never splits a record, so a log recovered with sflz4_log_recover
+// (e.g. after a crash part-way through a write) holds only whole records.
+// Framing the records themselves (e.g. with a length prefix) is up to the
+// caller.
+//
+// Time is measured in caller-defined units (e.g. microseconds from a
+// monotonic clock), passed to sflz4_log_writer_append and
+// sflz4_log_writer_poll. The library does not read any clock itself.
+//
+// A sflz4_log_writer is not thread-safe. Callers that append from multiple
+// threads must serialize their calls, typically by holding a mutex that
+// also guards a condition variable signaled when sflz4_log_writer_synced_len
+// advances.
+//
+// Its fields are private implementation details. Initialize it with
+// sflz4_log_writer_initialize.
+
+// SFLZ4_LOG_WRITER_FLAGS__CLOSE_PREVIOUS_FRAME means to write an end marker
+// before the new frame's header, for appending to a log that
+// sflz4_log_recover reported as having an unterminated frame.
+#define SFLZ4_LOG_WRITER_FLAGS__CLOSE_PREVIOUS_FRAME 0x01
+
+typedef struct sflz4_log_writer_options_struct {
+  // block_max_len is the LZ4 frame's block maximum length: 64 KiB, 256 KiB,
+  // 1 MiB or 4 MiB. Zero means 64 KiB.
+  size_t block_max_len;
+
+  // flush_len is how many buffered bytes trigger a flush. Zero means
+  // block_max_len.
+  size_t flush_len;
+
+  // flush_delay is how old (in caller-defined time units) the oldest
+  // buffered record can be before a flush. Zero means no time limit.
+  uint64_t flush_delay;
+
+  uint32_t flags;
+} sflz4_log_writer_options;
+
+typedef struct sflz4_log_writer_struct {
+  const char* (*private_write_func)(void* context,
+                                    const uint8_t* ptr,
+                                    size_t len);
+  const char* (*private_sync_func)(void* context);
+  void* private_context;
+  sflz4_log_writer_options private_options;
+  uint32_t* private_hash_table;
+  uint8_t* private_window_ptr;
+  size_t private_history_len;
+  size_t private_pending_len;
+  uint8_t* private_encoded_ptr;
+  size_t private_encoded_len;
+  uint64_t private_pending_since;
+  uint64_t private_appended_len;
+  uint64_t private_synced_len;
+  uint64_t private_written_len;
+  const char* private_status_message;
+} sflz4_log_writer;
+
+// sflz4_log_writer_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_log_writer_initialize, for the given
+// block_max_len (zero means 64 KiB).
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_workspace_len(       //
+    size_t block_max_len);
+
+// sflz4_log_writer_initialize prepares w, returning NULL on success or a
+// status message on failure. The frame header is written on the first flush.
+//
+// write_func appends to the log and sync_func (which may be NULL) makes
+// everything written so far durable (e.g. with fsync or fdatasync). Each
+// returns NULL on success or a status message on failure. A failed write or
+// sync is reported by the sflz4_log_writer call that triggered it and
+// leaves w unusable: the log's tail is then in an unknown state, to be
+// resolved by sflz4_log_recover.
+SFLZ4_MAYBE_STATIC const char*                     //
+sflz4_log_writer_initialize(                       //
+    sflz4_log_writer* w,                           //
+    uint8_t* workspace_ptr,                        //
+    size_t workspace_len,                          //
+    const sflz4_log_writer_options* options,       //
+    const char* (*write_func)(void* context,       //
+                              const uint8_t* ptr,  //
+                              size_t len),         //
+    const char* (*sync_func)(void* context),       //
+    void* context);
+
+// sflz4_log_writer_append buffers a record, flushing first if it wouldn't
+// otherwise fit and flushing afterwards if the size or time thresholds are
+// met. It returns the record's end offset in the log's decoded content: the
+// record is durable once sflz4_log_writer_synced_len reaches that value.
+//
+// A record may not be longer than the block_max_len option.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_append(              //
+    sflz4_log_writer* w,              //
+    const uint8_t* record_ptr,        //
+    size_t record_len,                //
+    uint64_t now);
+
+// sflz4_log_writer_poll flushes if the oldest buffered record is at least
+// flush_delay old. Call it periodically (e.g. from a timer) so that records
+// don't wait indefinitely for another append.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_poll(          //
+    sflz4_log_writer* w,        //
+    uint64_t now);
+
+// sflz4_log_writer_flush writes and syncs any buffered records.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_flush(         //
+    sflz4_log_writer* w);
+
+// sflz4_log_writer_close flushes and then terminates the frame (writing its
+// end marker). No further records may be appended.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_close(         //
+    sflz4_log_writer* w);
+
+// sflz4_log_writer_synced_len returns how many bytes of the log's decoded
+// content are durable.
+SFLZ4_MAYBE_STATIC uint64_t   //
+sflz4_log_writer_synced_len(  //
+    const sflz4_log_writer* w);
+
+// SFLZ4_LOG_WRITER_CHECKPOINT_MAX_INCL_LEN is the maximum (inclusive) length
+// of a sflz4_log_writer_checkpoint: a 28 byte header, up to 64 KiB of history
+// and a 4 byte checksum.
+#define SFLZ4_LOG_WRITER_CHECKPOINT_MAX_INCL_LEN (32 + 0x10000)
+
+// sflz4_log_writer_checkpoint flushes and then serializes w's state to dst,
+// returning the number of bytes written. A later process can pass that to
+// sflz4_log_writer_restore to keep appending linked blocks to the same frame,
+// with the same compression ratio as an uninterrupted writer, without
+// re-reading the log.
+//
+// The state is the final 64 KiB of the log's decoded content (the history
+// that the next block's matches can refer to) and some counters. The hash
+// table is not saved. Restoring rebuilds it from the history, which is
+// cheaper than serializing its 16 KiB.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_checkpoint(          //
+    sflz4_log_writer* w,              //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len);
+
+// sflz4_log_writer_restore is like sflz4_log_writer_initialize but resumes
+// from a sflz4_log_writer_checkpoint. It returns how many bytes the
+// checkpointed writers (since the first, non-restored one) had written to
+// the log. The log must be truncated to that length (relative to where the
+// first writer started) before appending.
+//
+// The options' block_max_len must match the checkpoint's. Its flags are
+// ignored unless the checkpoint was taken before anything was written.
+SFLZ4_MAYBE_STATIC sflz4_size_result               //
+sflz4_log_writer_restore(                          //
+    sflz4_log_writer* w,                           //
+    uint8_t* workspace_ptr,                        //
+    size_t workspace_len,                          //
+    const sflz4_log_writer_options* options,       //
+    const char* (*write_func)(void* context,       //
+                              const uint8_t* ptr,  //
+                              size_t len),         //
+    const char* (*sync_func)(void* context),       //
+    void* context,                                 //
+    const uint8_t* checkpoint_ptr,                 //
+    size_t checkpoint_len);
+
+// sflz4_log_recover decodes the log in src, stopping (successfully) at the
+// first incomplete or corrupt block, such as one torn by a crash. It returns
+// the number of decoded bytes written to dst and sets *src_valid_len to the
+// length of src that holds whole blocks. Truncate the log to that length and
+// resume appending with SFLZ4_LOG_WRITER_FLAGS__CLOSE_PREVIOUS_FRAME if
+// *src_unterminated is set (meaning that the final frame has no end
+// marker).
+//
+// The log may hold several frames, one per sflz4_log_writer session.
+//
+// It fails with sflz4_status_message__error_dst_is_too_short if the valid
+// blocks' decoded content doesn't fit in dst.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_log_recover(                          //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    size_t* src_valid_len,                  //
+    int* src_unterminated);
+
+// -------- LZ4 Frame Checkpoints
+
+// An LZ4 frame of linked blocks can't normally be decoded from the middle,
+// as each block's matches can refer to the previous 64 KiB of decoded
+// content. A checkpoint index, built by sflz4_frame_build_checkpoints, holds
+// snapshots of that 64 KiB window (themselves LZ4 block compressed) at block
+// boundaries about every interval decoded bytes. sflz4_frame_read_at_checkpoint
+// starts decoding at the nearest checkpoint instead of at the frame's start.
+//
+// Smaller intervals mean faster reads but a larger index. The index is kept
+// separately from the frame, which is unchanged. It is only valid for the
+// frame that it was built from.
+//
+// Each checkpoint carries a checksum, which sflz4_frame_read_at_checkpoint
+// verifies (for the checkpoint that it starts from) before using it, so that
+// a corrupted or truncated index fails with an error instead of producing
+// wrong content. An index built from a different frame is not detected.
+//
+// Frames with independent blocks also work (with empty snapshots), but
+// sflz4_frame_index_blocks and sflz4_reader are better suited to them.
+
+// sflz4_frame_checkpoints_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_frame_build_checkpoints and
+// sflz4_frame_read_at_checkpoint, for the LZ4 frame at the start of src: 64
+// KiB plus the frame's block maximum length.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_checkpoints_workspace_len(      //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_frame_checkpoints_worst_case_dst_len returns the maximum (inclusive)
+// length of a checkpoint index for a frame whose decoded content is
+// decoded_len bytes long.
+SFLZ4_MAYBE_STATIC sflz4_size_result         //
+sflz4_frame_checkpoints_worst_case_dst_len(  //
+    uint64_t decoded_len,                    //
+    uint64_t interval);
+
+// sflz4_frame_build_checkpoints decodes the LZ4 frame at the start of src
+// and writes its checkpoint index to dst, returning the index's length.
+// interval must be positive.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_build_checkpoints(              //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint64_t interval,                      //
+    uint8_t* workspace_ptr,                 //
+    size_t workspace_len);
+
+// sflz4_frame_read_at_checkpoint copies to dst up to dst_len bytes of the
+// frame's decoded content, starting at offset, returning the number of bytes
+// copied. Like pread, this is less than dst_len only at the end of the
+// content. It decodes from the last checkpoint at or before offset.
+SFLZ4_MAYBE_STATIC sflz4_size_result          //
+sflz4_frame_read_at_checkpoint(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,          //
+    size_t dst_len,                           //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,    //
+    size_t src_len,                           //
+    const uint8_t* SFLZ4_RESTRICT index_ptr,  //
+    size_t index_len,                         //
+    uint64_t offset,                          //
+    uint8_t* workspace_ptr,                   //
+    size_t workspace_len);
+
+// -------- LZ4 Dictionary Builder
+
+// sflz4_dictionary_builder keeps a dictionary up to date as the data it is
+// used on drifts (e.g. as message schemas evolve). Encoding threads feed it
+// samples of their inputs. Every eighth sample is held out, for evaluation,
+// and the others are kept (up to samples_len bytes, most recent first) for
+// training. Periodically, a background thread calls
+// sflz4_dictionary_builder_refresh, which trains a candidate dictionary on
+// the training samples and publishes it if it compresses the held-out
+// samples better than the current dictionary does.
+//
+// Training picks, out of each of 64 equal spans of the training samples, the
+// 1 KiB segment whose 8-byte substrings are the most frequent overall (each
+// distinct substring counts once per segment and, once picked, never
+// counts again), similar to Zstandard's "cover" dictionary builder.
+//
+// Adding samples and getting the current dictionary may happen concurrently
+// (from any threads), including with a refresh. Only one thread at a time may
+// refresh. Its fields are private implementation details. Initialize it with
+// sflz4_dictionary_builder_initialize.
+typedef struct sflz4_dictionary_builder_struct {
+  volatile uint32_t private_lock;
+  const sflz4_dictionary* private_current;
+  uint8_t* private_workspace_ptr;
+  size_t private_samples_len;
+  uint64_t private_num_samples;
+  uint64_t private_train_written;
+  uint64_t private_holdout_written;
+  uint64_t private_holdout_count;
+} sflz4_dictionary_builder;
+
+// sflz4_dictionary_builder_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_dictionary_builder_initialize, for
+// samples_len bytes of training samples. That is a little under 3 times
+// samples_len, plus 256 KiB.
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_dictionary_builder_workspace_len(  //
+    size_t samples_len);
+
+// sflz4_dictionary_builder_initialize prepares b to use the workspace memory,
+// returning NULL on success or a status message on failure. samples_len must
+// be at least 4 times SFLZ4_DICTIONARY_MAX_INCL_LEN. The initial current
+// dictionary (which may be NULL) is the one that the first candidate has to
+// beat. The workspace memory and current dictionary must outlive b.
+SFLZ4_MAYBE_STATIC const char*        //
+sflz4_dictionary_builder_initialize(  //
+    sflz4_dictionary_builder* b,      //
+    uint8_t* workspace_ptr,           //
+    size_t workspace_len,             //
+    size_t samples_len,               //
+    const sflz4_dictionary* current);
+
+// sflz4_dictionary_builder_add_sample copies the sample at ptr[0 .. len) into
+// b. Samples longer than a sixteenth of samples_len are truncated.
+SFLZ4_MAYBE_STATIC void               //
+sflz4_dictionary_builder_add_sample(  //
+    sflz4_dictionary_builder* b,      //
+    const uint8_t* ptr,               //
+    size_t len);
+
+// sflz4_dictionary_builder_current returns the most recently published
+// dictionary (or the initial one, possibly NULL), for encoders to use.
+SFLZ4_MAYBE_STATIC const sflz4_dictionary*  //
+sflz4_dictionary_builder_current(           //
+    sflz4_dictionary_builder* b);
+
+// sflz4_dictionary_builder_refresh trains a candidate dictionary, with the
+// given id, into d (whose bytes go in the SFLZ4_DICTIONARY_MAX_INCL_LEN bytes
+// at d_buf). It compares the held-out samples' total sflz4_block_encode (or,
+// when there is a current dictionary, sflz4_block_encode_with_dictionary)
+// length with what the candidate achieves.
+//
+// If the candidate is better by at least 1/64th (so that noise doesn't cause
+// churn), it is added to registry (if non-NULL), so that decoders can find
+// it, and then made current, and the value returned is 1. Otherwise it is 0
+// and the d and d_buf memory can be reused. Published dictionaries' memory
+// must outlive b and the registry.
+//
+// It fails with sflz4_status_message__error_invalid_data if there are not
+// yet enough training or held-out samples.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_dictionary_builder_refresh(     //
+    sflz4_dictionary_builder* b,      //
+    sflz4_dictionary* d,              //
+    uint8_t* d_buf,                   //
+    uint32_t id,                      //
+    sflz4_dictionary_registry* registry);
+
+// -------- LZ4 Delta
+
+// An LZ4 delta (a patch) encodes a new version of some data (e.g. a large
+// file) relative to a previous version, the reference, which the patch's
+// recipient already has. It is a list of copies from the reference,
+// interleaved with literals (the new version's bytes that weren't copied).
+// The literals are themselves LZ4 frame compressed, with linked blocks.
+//
+// The copies are found by a long-range matcher that indexes every 16th
+// position of the reference, so they may come from anywhere in it, unlike
+// LZ4 matches, which only reach back 64 KiB. Applying a patch is mostly
+// memcpy and LZ4 decoding, and needs no memory other than dst.
+//
+// Patches hold xxHash-32 checksums of the reference and of the new version,
+// so that applying a patch to the wrong reference fails instead of producing
+// garbage.
+
+// sflz4_delta_encode_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_delta_encode: new_len plus 4 bytes per 16
+// reference bytes, for the matcher's hash table (capped at 64 MiB).
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_delta_encode_workspace_len(     //
+    size_t ref_len,                   //
+    size_t new_len);
+
+// sflz4_delta_encode_worst_case_dst_len returns the maximum (inclusive)
+// number of bytes required to delta encode new_len bytes.
+SFLZ4_MAYBE_STATIC sflz4_size_result    //
+sflz4_delta_encode_worst_case_dst_len(  //
+    size_t new_len);
+
+// sflz4_delta_encode writes to dst a patch that turns ref into new,
+// returning the patch's length.
+//
+// Like sflz4_block_encode, it fails immediately with
+// sflz4_status_message__error_dst_is_too_short if dst_len is less than
+// sflz4_delta_encode_worst_case_dst_len(new_len).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_delta_encode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT ref_ptr,  //
+    size_t ref_len,                         //
+    const uint8_t* SFLZ4_RESTRICT new_ptr,  //
+    size_t new_len,                         //
+    uint8_t* workspace_ptr,                 //
+    size_t workspace_len);
+
+// sflz4_delta_decoded_len returns the length of the new version that the
+// patch in src produces, the minimum (inclusive) dst_len argument to
+// sflz4_delta_apply.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_delta_decoded_len(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_delta_apply writes to dst the new version that the patch in src
+// produces from ref, returning its length.
+//
+// It fails with sflz4_status_message__error_bad_checksum if ref is not the
+// patch's reference or if the result does not match the new version's
+// checksum.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_delta_apply(                          //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT ref_ptr,  //
+    size_t ref_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// -------- LZ4 Memory Checkpoints
+
+// A memory checkpoint is a compressed snapshot of some of the pages of a
+// region of memory (e.g. a large in-memory data structure). A full checkpoint
+// holds every page. An incremental checkpoint holds only the pages that
+// changed (were dirtied) since the previous checkpoint. Restoring the full
+// checkpoint and then each incremental one, in order, recreates the memory.
+//
+// Consecutive dirty pages are grouped into runs of up to 64 KiB, each one an
+// independent LZ4 block (or stored verbatim, if incompressible). An index of
+// the runs, at the start of the checkpoint, lets runs be compressed and
+// decompressed in parallel, via a sflz4_parallel_for_func.
+//
+// Which pages are dirty is given as a bitmap (bit i, of byte i/8, with the
+// least significant bit first, is for page i). SFLZ4 itself has no OS
+// dependencies, so the caller builds it. On Linux, that could be from the
+// soft-dirty bits (bit 55) of /proc/self/pagemap, after writing "4" to
+// /proc/self/clear_refs at the previous checkpoint, or from a userfaultfd in
+// write-protect mode. Otherwise, sflz4_memory_find_dirty_pages detects
+// changed pages by comparing fingerprints (hashes) of their contents.
+
+// sflz4_memory_find_dirty_pages sets the bits of dirty_bitmap (which has
+// room for one bit per page) for the pages of mem whose 64-bit fingerprint
+// differs from the one in fingerprints_ptr (which holds one uint64_t per
+// page), and clears the other bits. It then updates fingerprints_ptr,
+// returning the number of dirty pages.
+//
+// Initialize fingerprints_ptr to all zeroes, so that (almost) every page is
+// dirty for the first (full) checkpoint. Unlike soft-dirty bits, this
+// examines every page (at memory bandwidth speed) and, in theory, a changed
+// page could have an unchanged fingerprint.
+//
+// page_len must be a power of two between 64 and 65536 inclusive and mem_len
+// must be a multiple of it.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_memory_find_dirty_pages(        //
+    uint8_t* dirty_bitmap_ptr,        //
+    uint64_t* fingerprints_ptr,       //
+    const uint8_t* mem_ptr,           //
+    size_t mem_len,                   //
+    size_t page_len);
+
+// sflz4_memory_checkpoint_worst_case_dst_len returns the maximum (inclusive)
+// length of a checkpoint of mem_len bytes of memory.
+SFLZ4_MAYBE_STATIC sflz4_size_result         //
+sflz4_memory_checkpoint_worst_case_dst_len(  //
+    size_t mem_len,                          //
+    size_t page_len);
+
+// sflz4_memory_checkpoint_encode writes to dst a checkpoint of the pages of
+// mem whose dirty_bitmap bits are set, returning its length. A NULL
+// dirty_bitmap means every page (a full checkpoint). A NULL parallel_for
+// means to compress each run sequentially, on the calling thread.
+//
+// Like sflz4_block_encode, it fails immediately with
+// sflz4_status_message__error_dst_is_too_short if dst_len is less than
+// sflz4_memory_checkpoint_worst_case_dst_len(mem_len, page_len).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_memory_checkpoint_encode(             //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT mem_ptr,  //
+    size_t mem_len,                         //
+    size_t page_len,                        //
+    const uint8_t* dirty_bitmap_ptr,        //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context);
+
+// sflz4_memory_checkpoint_restore writes the checkpoint's pages (in src) to
+// mem, returning the number of bytes written. mem_len must match the
+// checkpointed memory's length. A NULL parallel_for means to decompress each
+// run sequentially, on the calling thread.
+//
+// Each run's encoded data and its decoded pages are both checksummed (with
+// xxHash-32). The index and every run's encoded data are verified before any
+// page is written, so that a truncated or corrupted checkpoint leaves mem
+// untouched. Only a run whose encoded data verifies but that still fails to
+// decode (which sflz4_memory_checkpoint_encode never produces) leaves mem
+// partially restored.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_memory_checkpoint_restore(            //
+    uint8_t* SFLZ4_RESTRICT mem_ptr,        //
+    size_t mem_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context);
+
+// -------- LZ4 Archive
+
+// An LZ4 archive packs many (typically small) named files, like a tar file
+// piped through lz4, but it can extract any one file without decoding the
+// files before it.
+//
+// The files' contents are concatenated and cut into solid blocks of up to
+// block_max_len bytes. A file that fits within one block is never split
+// across two, so extracting it decodes exactly one block. Each block is
+// independently LZ4 compressed (or stored verbatim, if incompressible) and
+// checksummed (with xxHash-32), so that blocks are compressed and
+// decompressed in parallel, via a sflz4_parallel_for_func.
+//
+// An optional dictionary (see sflz4_dictionary_builder), trained on samples
+// of the files, helps when block_max_len is small. Its bytes are stored in
+// the archive, so that decoding does not need it.
+//
+// A central index, at the end, holds each block's location and each file's
+// name, length and position within the concatenated contents, with the file
+// names also sorted for lookup by binary search.
+
+// sflz4_archive_file is a named file: an element of the files_ptr array
+// argument to sflz4_archive_encode, or the output of sflz4_archive_file_at.
+typedef struct sflz4_archive_file_struct {
+  const uint8_t* name_ptr;
+  size_t name_len;
+  const uint8_t* data_ptr;
+  size_t data_len;
+} sflz4_archive_file;
+
+// sflz4_archive_encode_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_archive_encode: the total length of the
+// files' contents.
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_archive_encode_workspace_len(       //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len);
+
+// sflz4_archive_worst_case_dst_len returns the maximum (inclusive) length of
+// an archive of the given files. block_max_len must be positive and at most
+// (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2).
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_archive_worst_case_dst_len(         //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len,                     //
+    size_t block_max_len);
+
+// sflz4_archive_encode writes to dst an archive of the files_len files at
+// files_ptr, returning its length. Files keep their order (their file_index)
+// and files with equal names are allowed, but sflz4_archive_find returns
+// only one of them. A NULL dictionary means to not use one. A NULL
+// parallel_for means to compress each block sequentially, on the calling
+// thread.
+//
+// Like sflz4_block_encode, it fails immediately with
+// sflz4_status_message__error_dst_is_too_short if dst_len is less than
+// sflz4_archive_worst_case_dst_len(files_ptr, files_len, block_max_len).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_archive_encode(                       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const sflz4_archive_file* files_ptr,    //
+    size_t files_len,                       //
+    size_t block_max_len,                   //
+    const sflz4_dictionary* dictionary,     //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len,                   //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context);
+
+// sflz4_archive_num_files returns the number of files in the archive.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_num_files(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_archive_find returns the file_index of the file with the given name.
+//
+// It fails with sflz4_status_message__error_bad_argument if there is no such
+// file.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_find(                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    const uint8_t* name_ptr,          //
+    size_t name_len);
+
+// sflz4_archive_file_at sets *f to the file_index'th file's name (pointing
+// into src) and length, returning NULL on success or a status message on
+// failure. f->data_ptr points into contents_ptr (see
+// sflz4_archive_decode_all), or is NULL if contents_ptr is NULL.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_archive_file_at(          //
+    sflz4_archive_file* f,      //
+    const uint8_t* src_ptr,     //
+    size_t src_len,             //
+    uint64_t file_index,        //
+    const uint8_t* contents_ptr);
+
+// sflz4_archive_scratch_len returns the minimum (inclusive) scratch_len
+// argument to sflz4_archive_extract: the archive's block_max_len.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_scratch_len(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_archive_extract copies the file_index'th file's contents to dst,
+// returning its length. It decodes only the blocks that hold that file, using
+// scratch for those that also hold other files.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_extract(                //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    uint64_t file_index,              //
+    uint8_t* scratch_ptr,             //
+    size_t scratch_len);
+
+// sflz4_archive_contents_len returns the total length of the archive's
+// files' contents: the minimum (inclusive) dst_len argument to
+// sflz4_archive_decode_all.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_contents_len(           //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_archive_decode_all writes every file's contents to dst,
+// concatenated in file_index order, returning the number of bytes written.
+// Use sflz4_archive_file_at to find each file within dst. A NULL
+// parallel_for means to decompress each block sequentially, on the calling
+// thread.
+//
+// Unlike the other sflz4_archive_* functions, which check only the parts of
+// the index that they use, it also verifies the whole index's checksum.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_archive_decode_all(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context);
+
+// -------- LZ4 Sparse Streams
+
+// A sparse stream is a compressed form of a sparse file (e.g. a VM disk
+// image), whose holes (unallocated ranges, which read as zeroes) cost almost
+// nothing to encode or decode, however long they are. It is a sequence of
+// records, each either up to SFLZ4_SPARSE_MAX_INCL_DATA_LEN bytes of data (as
+// an LZ4 block, or stored verbatim if incompressible) or a hole of any
+// length. Every record is checksummed, with xxHash-32 or (for storage stacks
+// that already use it end to end) CRC-32C.
+//
+// SFLZ4 itself does no I/O. On Linux, a compressor finds the data and the
+// holes with lseek's SEEK_DATA and SEEK_HOLE, reads only the data, passing
+// it to sflz4_sparse_encode_data (in chunks), and passes each hole's length
+// to sflz4_sparse_encode_hole, so its cost is proportional to the data, not
+// the file size. A decompressor reads each record's header, then the rest of
+// the record (sflz4_sparse_record_len), and passes it to
+// sflz4_sparse_decode_record. For data, it writes the decoded bytes. For
+// holes, it skips over them with lseek (or punches them with fallocate's
+// FALLOC_FL_PUNCH_HOLE, if overwriting), ending with an ftruncate in case
+// the file ends with a hole.
+//
+// sflz4_sparse_encode_data also turns runs of zeroes (of whole
+// SFLZ4_SPARSE_ZERO_CHUNK_LEN chunks) into holes, so that a file without
+// holes (or a filesystem without SEEK_HOLE) still decompresses sparsely.
+
+// SFLZ4_SPARSE_RECORD_HEADER_LEN is the length of a record's header: the
+// minimum (inclusive) src_len argument to sflz4_sparse_record_len.
+#define SFLZ4_SPARSE_RECORD_HEADER_LEN 16
+
+// SFLZ4_SPARSE_MAX_INCL_DATA_LEN is the maximum (inclusive) src_len argument
+// to sflz4_sparse_encode_data, and so also the maximum number of bytes that
+// sflz4_sparse_decode_record writes.
+#define SFLZ4_SPARSE_MAX_INCL_DATA_LEN 0x400000
+
+// SFLZ4_SPARSE_ZERO_CHUNK_LEN is the granularity (relative to the start of
+// each src) at which sflz4_sparse_encode_data finds runs of zeroes.
+#define SFLZ4_SPARSE_ZERO_CHUNK_LEN 4096
+
+// SFLZ4_SPARSE_ENCODE_FLAGS__ETC are bits for the flags argument to
+// sflz4_sparse_encode_data and sflz4_sparse_encode_hole.
+//
+// CRC32C means to checksum records with CRC-32C (see sflz4_crc32c_update)
+// instead of xxHash-32. Each record says which checksum it uses, so the
+// decoder needs no flag and a stream may mix the two.
+#define SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C 0x01
+
+// sflz4_sparse_encode_worst_case_dst_len returns the maximum (inclusive)
+// length of sflz4_sparse_encode_data's output for src_len bytes of data.
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_sparse_encode_worst_case_dst_len(  //
+    size_t src_len);
+
+// sflz4_sparse_encode_data writes to dst the records for src (the next
+// src_len bytes of the file), returning their length. flags is a bitmask of
+// SFLZ4_SPARSE_ENCODE_FLAGS__ETC values.
+//
+// Like sflz4_block_encode, it fails immediately with
+// sflz4_status_message__error_dst_is_too_short if dst_len is less than
+// sflz4_sparse_encode_worst_case_dst_len(src_len).
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_sparse_encode_data(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags);
+
+// sflz4_sparse_encode_hole writes to dst the record for a hole (the next
+// hole_len bytes of the file, which read as zeroes), returning its length,
+// which is at most (SFLZ4_SPARSE_RECORD_HEADER_LEN + 4). It writes nothing
+// if hole_len is zero. flags is as for sflz4_sparse_encode_data.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_sparse_encode_hole(             //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    uint64_t hole_len,                //
+    uint32_t flags);
+
+// sflz4_sparse_record_len returns the length of the record that src starts
+// with. Only its header (the first SFLZ4_SPARSE_RECORD_HEADER_LEN bytes) is
+// read.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_sparse_record_len(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_sparse_decode_record decodes the record that src starts with,
+// returning the number of bytes written to dst. For a hole, that is zero and
+// *hole_len is set to the hole's length. Otherwise, *hole_len is set to
+// zero.
+//
+// Use sflz4_sparse_record_len to find where the next record starts.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_sparse_decode_record(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint64_t* hole_len);
+
+// -------- LZ4 Aligned Streams
+
+// sflz4_aligned_encode and sflz4_aligned_decode stream an LZ4 frame between
+// two files (or other byte streams) through caller-supplied read and write
+// functions, whose buffers, lengths and hence file offsets are all multiples
+// of an alignment (e.g. 4096), as Linux's O_DIRECT requires. O_DIRECT I/O
+// bypasses the page cache, so compressing or decompressing a huge file
+// doesn't evict other processes' working sets from it.
+//
+// The workspace (which must also be aligned) is the buffer pool. Data is
+// read straight into it and the encoder and decoder work on it in place. For
+// example, each block is compressed directly from the buffer it was read
+// into, and a decoded block is written directly from the buffer it was
+// decoded into (unless it is unaligned, when it is first copied).
+//
+// Only the final write is padded (with zeroes) up to the alignment. Truncate
+// the output file (e.g. with ftruncate) to the returned length afterwards.
+
+// sflz4_aligned_read_func reads up to len bytes, the next ones of the input,
+// to ptr, returning how many. Fewer than len means the end of the input.
+typedef sflz4_size_result (*sflz4_aligned_read_func)(  //
+    void* context,                                     //
+    uint8_t* ptr,                                      //
+    size_t len);
+
+// sflz4_aligned_write_func appends the len bytes at ptr to the output,
+// returning NULL on success or a status message on failure.
+typedef const char* (*sflz4_aligned_write_func)(  //
+    void* context,                                //
+    const uint8_t* ptr,                           //
+    size_t len);
+
+// sflz4_aligned_encode_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_aligned_encode. block_max_len is the LZ4
+// frame's block maximum length: 64 KiB, 256 KiB, 1 MiB or 4 MiB. alignment
+// must be a power of two between 512 and 65536 inclusive.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_aligned_encode_workspace_len(   //
+    size_t block_max_len,             //
+    size_t alignment);
+
+// sflz4_aligned_encode reads all of the input and writes its LZ4 frame
+// compressed form (with independent blocks and block checksums), returning
+// the frame's length (excluding the final write's padding).
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_aligned_encode(                     //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t block_max_len,                 //
+    size_t alignment,                     //
+    sflz4_aligned_read_func read_func,    //
+    sflz4_aligned_write_func write_func,  //
+    void* context);
+
+// sflz4_aligned_decode_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_aligned_decode, for frames whose block
+// maximum length is at most block_max_len (4 MiB allows any frame).
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_aligned_decode_workspace_len(   //
+    size_t block_max_len,             //
+    size_t alignment);
+
+// sflz4_aligned_decode reads an LZ4 frame from the input and writes its
+// decoded content, returning that content's length (excluding the final
+// write's padding). It stops after the frame's end marker (and content
+// checksum, which is not verified, although block checksums are).
+//
+// It fails with sflz4_status_message__error_unsupported_feature if the frame
+// uses a dictionary.
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_aligned_decode(                     //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t alignment,                     //
+    sflz4_aligned_read_func read_func,    //
+    sflz4_aligned_write_func write_func,  //
+    void* context);
+
+// -------- LZ4 Message Channels
+
+// A message channel carries a stream of compressed messages (e.g. RPC
+// requests or replies) over one direction of a connection, such as a Unix
+// domain socket, a pipe or a loopback TCP socket. Each message is flushed on
+// its own: it is encoded as a single LZ4 block and is decodable as soon as
+// it arrives, without waiting for later messages. By default, each block can
+// refer back to the previous messages' final 64 KiB, so that a small message
+// that resembles earlier ones compresses well.
+//
+// Each message has a small header (2 to 8 bytes) that gives its encoded and
+// decoded lengths, so that the receiver knows how many more bytes to read
+// and how big a buffer to decode into. A whole LZ4 frame per message costs
+// at least 15 bytes (a frame header, a block length and an end marker) and
+// each frame starts without any history.
+//
+// A channel starts with a hello message, which the encoder writes (as part
+// of its first output) and the decoder consumes. It holds the channel's
+// flags and its dictionary's id (zero for no dictionary). The decoder looks
+// that id up in its sflz4_dictionary_registry, so both ends of a connection
+// agree on the shared dictionary without any out of band configuration.
+//
+// SFLZ4 itself does no I/O. A sender passes each message to
+// sflz4_message_encode and writes the output. A receiver reads (at least)
+// SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN bytes or until
+// sflz4_message_parse_header reports a complete header, reads the rest of
+// the message and passes it to sflz4_message_decode.
+//
+// Messages are not checksummed, as stream sockets and pipes already deliver
+// bytes intact and in order.
+//
+// An encoder or decoder is one direction's per-connection state. It is not
+// thread-safe. Its fields are private implementation details.
+
+// SFLZ4_MESSAGE_FLAGS__INDEPENDENT means that each message's LZ4 block
+// refers only to the dictionary (if any), not to earlier messages. This
+// costs compression ratio but each block, as passed to sflz4_message_decode,
+// can also be decoded on its own with sflz4_block_decode (or
+// sflz4_block_decode_with_dictionary) and the encoder needs no workspace.
+#define SFLZ4_MESSAGE_FLAGS__INDEPENDENT 0x01
+
+// SFLZ4_MESSAGE_MAX_INCL_LEN is the maximum (inclusive) decoded length of a
+// message.
+#define SFLZ4_MESSAGE_MAX_INCL_LEN 0x7FFFFF
+
+// SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN is the maximum (inclusive) length of a
+// message's header.
+#define SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN 8
+
+// SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN is the minimum (inclusive)
+// workspace_len argument to sflz4_message_decoder_initialize.
+#define SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN 0x20000
+
+// A message's kind is one of:
+//  - SFLZ4_MESSAGE_KIND__LZ4, an LZ4 block compressed message.
+//  - SFLZ4_MESSAGE_KIND__STORED, a message stored verbatim (when
+//    compression wouldn't make it shorter).
+//  - SFLZ4_MESSAGE_KIND__HELLO, a hello message, which decodes to zero
+//    bytes.
+#define SFLZ4_MESSAGE_KIND__LZ4 0
+#define SFLZ4_MESSAGE_KIND__STORED 1
+#define SFLZ4_MESSAGE_KIND__HELLO 2
+
+// sflz4_message_header describes a message. The message is header_len plus
+// encoded_len bytes long.
+typedef struct sflz4_message_header_struct {
+  size_t header_len;
+  size_t encoded_len;
+  size_t decoded_len;
+  uint32_t kind;
+} sflz4_message_header;
+
+// sflz4_message_encoder is a sender's per-connection state. Initialize it
+// with sflz4_message_encoder_initialize.
+typedef struct sflz4_message_encoder_struct {
+  uint32_t* private_hash_table;
+  uint8_t* private_window_ptr;
+  size_t private_window_len;
+  size_t private_history_len;
+  size_t private_message_max_len;
+  const sflz4_dictionary* private_dictionary;
+  uint32_t private_flags;
+  uint32_t private_hello_pending;
+} sflz4_message_encoder;
+
+// sflz4_message_decoder is a receiver's per-connection state. Initialize it
+// with sflz4_message_decoder_initialize.
+typedef struct sflz4_message_decoder_struct {
+  const sflz4_dictionary_registry* private_registry;
+  const sflz4_dictionary* private_dictionary;
+  uint8_t* private_history_ptr;
+  size_t private_history_len;
+  uint32_t private_flags;
+  uint32_t private_hello_received;
+} sflz4_message_decoder;
+
+// sflz4_message_encoder_workspace_len returns the minimum (inclusive)
+// workspace_len argument to sflz4_message_encoder_initialize. It is zero for
+// SFLZ4_MESSAGE_FLAGS__INDEPENDENT.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_encoder_workspace_len(  //
+    size_t message_max_len,           //
+    uint32_t flags);
+
+// sflz4_message_encoder_initialize prepares e, returning NULL on success or a
+// status message on failure. message_max_len (at most
+// SFLZ4_MESSAGE_MAX_INCL_LEN) bounds every message's length. The dictionary
+// d may be NULL. If not, it must outlive e and the receiver's registry must
+// hold a dictionary with the same id and bytes.
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_message_encoder_initialize(  //
+    sflz4_message_encoder* e,      //
+    uint8_t* workspace_ptr,        //
+    size_t workspace_len,          //
+    size_t message_max_len,        //
+    uint32_t flags,                //
+    const sflz4_dictionary* d);
+
+// sflz4_message_encode_worst_case_dst_len returns the maximum (inclusive)
+// length of sflz4_message_encode's output for a src_len byte message.
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_message_encode_worst_case_dst_len(  //
+    size_t src_len);
+
+// sflz4_message_encode writes the message src to dst, preceded by the hello
+// message if this is e's first output, returning the number of bytes
+// written. Send them all, in order: later messages may refer back to this
+// one.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_message_encode(                       //
+    sflz4_message_encoder* e,               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_message_encode_hello writes the hello message to dst (unless e has
+// already written it), returning the number of bytes written. Calling it is
+// optional, for senders that want to complete the handshake (e.g. have the
+// receiver check the dictionary id) before the first real message.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_encode_hello(           //
+    sflz4_message_encoder* e,         //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len);
+
+// sflz4_message_decoder_initialize prepares d, returning NULL on success or a
+// status message on failure. The registry r (which may be NULL, for no
+// dictionaries) must outlive d.
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_message_decoder_initialize(  //
+    sflz4_message_decoder* d,      //
+    uint8_t* workspace_ptr,        //
+    size_t workspace_len,          //
+    const sflz4_dictionary_registry* r);
+
+// sflz4_message_parse_header parses the header of the message at the start
+// of src into *h, returning the message's total length (header_len plus
+// encoded_len). It returns zero (and no status message) if src is too short
+// to hold the whole header: read more bytes and try again.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_parse_header(           //
+    sflz4_message_header* h,          //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_message_decode decodes the message in src (which must be exactly
+// one whole message, header included) to dst, returning its decoded length.
+// A hello message decodes to zero bytes.
+//
+// It fails with sflz4_status_message__error_unsupported_feature if a hello
+// message names a dictionary that isn't in d's registry. Any failure leaves
+// d unable to decode further messages until the next hello message.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_message_decode(                       //
+    sflz4_message_decoder* d,               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// -------- LZ4 Shared Memory Rings
+
+// A shared memory ring is a single-producer single-consumer queue of
+// compressed messages, for passing messages (e.g. telemetry) between two
+// processes that map the same shared memory (e.g. with mmap's MAP_SHARED).
+// The producer compresses each message straight into the ring and the
+// consumer decodes it straight out of the ring, so each message crosses the
+// process boundary once, compressed, with no intermediate copies.
+//
+// The ring is lock-free. The producer's and consumer's positions live on
+// separate cache lines, and each side caches the other's position, only
+// re-reading it (one cache miss) when the ring looks full (or empty).
+//
+// The shared memory holds only offsets, no pointers, as the two processes
+// may map it at different addresses. Each process instead has its own
+// sflz4_ring_producer or sflz4_ring_consumer, attached to its mapping. Their
+// fields are private implementation details.
+
+// SFLZ4_RING_HEADER_LEN is the length of the shared memory's header, before
+// the ring's data. It is three cache line pairs: the ring's configuration,
+// the producer's position and the consumer's position. Padding to pairs of
+// (64 byte) cache lines stops adjacent line prefetching from making the
+// positions share a line.
+#define SFLZ4_RING_HEADER_LEN 384
+
+typedef struct sflz4_ring_producer_struct {
+  uint8_t* private_shared_ptr;
+  size_t private_data_len;
+  size_t private_message_max_len;
+  size_t private_write_pos;
+  size_t private_cached_read_pos;
+} sflz4_ring_producer;
+
+typedef struct sflz4_ring_consumer_struct {
+  uint8_t* private_shared_ptr;
+  size_t private_data_len;
+  size_t private_read_pos;
+  size_t private_cached_write_pos;
+} sflz4_ring_consumer;
+
+// sflz4_ring_shared_len returns the length of the shared memory for a ring
+// with data_len bytes of data, which must be a power of two between 4 KiB
+// and 1 GiB inclusive.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_ring_shared_len(                //
+    size_t data_len);
+
+// sflz4_ring_initialize formats the shared memory (which must be 8 byte
+// aligned) as an empty ring, returning NULL on success or a status message
+// on failure. Call it once, before either side attaches. message_max_len
+// (at most (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2)) bounds every
+// message's decoded length. A message's slot takes up to
+// (sflz4_block_encode_worst_case_dst_len(message_max_len) + 16) bytes,
+// which must fit in data_len.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_initialize(          //
+    uint8_t* shared_ptr,        //
+    size_t shared_len,          //
+    size_t message_max_len);
+
+// sflz4_ring_producer_attach prepares p to send messages into the ring in
+// the shared memory, returning NULL on success or a status message on
+// failure.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_producer_attach(     //
+    sflz4_ring_producer* p,     //
+    uint8_t* shared_ptr,        //
+    size_t shared_len);
+
+// sflz4_ring_consumer_attach prepares c to receive messages from the ring in
+// the shared memory, returning NULL on success or a status message on
+// failure.
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_consumer_attach(     //
+    sflz4_ring_consumer* c,     //
+    uint8_t* shared_ptr,        //
+    size_t shared_len);
+
+// sflz4_ring_send compresses the message src into the ring, returning the
+// number of ring bytes that it occupies. It returns zero (and no status
+// message) if the ring is currently too full: retry (or drop the message)
+// later.
+//
+// The producer reserves a slot for the worst case encoding but only
+// occupies the (8 byte aligned) actual encoding, stored uncompressed if
+// compression wouldn't make it shorter.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_ring_send(                            //
+    sflz4_ring_producer* p,                 //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_ring_receive decodes the oldest message in the ring to dst,
+// returning its decoded length and setting *received. If the ring is empty,
+// it returns zero and clears *received. A dst_len of message_max_len always
+// suffices.
+//
+// It fails with sflz4_status_message__error_dst_is_too_short (leaving the
+// message in the ring) if dst_len is too short and with
+// sflz4_status_message__error_invalid_data if the ring is corrupt (e.g.
+// written to by something other than a sflz4_ring_producer).
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_ring_receive(                   //
+    sflz4_ring_consumer* c,           //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,  //
+    size_t dst_len,                   //
+    int* received);
+
+// -------- LZ4 Foreign Framings
+
+// Other systems wrap LZ4 blocks in their own, simpler framings than the LZ4
+// frame format. These functions read and write some of them in place: they
+// decode straight from the caller's (e.g. memory mapped) src to dst and
+// encode straight from src to dst, with no intermediate buffers.
+//
+// Hadoop's Lz4Codec (BlockCompressorStream) splits its input into chunks of
+// up to a buffer size (io.compression.codec.lz4.buffersize, 256 KiB by
+// default). Each chunk is its decoded length (u32be) and then one or more
+// sub-blocks, each an encoded length (u32be) and an independent LZ4 block.
+//
+// Parquet's LZ4_RAW codec is a bare LZ4 block per page, whose decoded length
+// is the page header's uncompressed_page_size. Encode it with
+// sflz4_block_encode. Parquet's older (deprecated) LZ4 codec is ambiguous:
+// some writers used Hadoop's framing and others a bare LZ4 block.
+//
+// A size-prefixed block is its decoded length (u32le) and then an LZ4 block,
+// as written by e.g. python-lz4's lz4.block.compress (with store_size).
+
+// SFLZ4_HADOOP_DEFAULT_CHUNK_LEN is Hadoop's default buffer size.
+#define SFLZ4_HADOOP_DEFAULT_CHUNK_LEN 0x40000
+
+// sflz4_hadoop_encode_worst_case_dst_len returns the maximum (inclusive)
+// length of sflz4_hadoop_encode's output. Zero chunk_max_len means
+// SFLZ4_HADOOP_DEFAULT_CHUNK_LEN.
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_hadoop_encode_worst_case_dst_len(  //
+    size_t src_len,                      //
+    size_t chunk_max_len);
+
+// sflz4_hadoop_encode writes to dst src's Hadoop Lz4Codec framing, one
+// sub-block per chunk of up to chunk_max_len bytes, returning the number of
+// bytes written. Zero chunk_max_len means SFLZ4_HADOOP_DEFAULT_CHUNK_LEN.
+// Hadoop's decompressor needs chunk_max_len to be at most its own buffer
+// size.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_hadoop_encode(                        //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    size_t chunk_max_len);
+
+// sflz4_hadoop_decoded_len returns the total decoded length of the Hadoop
+// Lz4Codec framed src (the sum of its chunks' decoded lengths), reading only
+// the framing, not the LZ4 blocks.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_hadoop_decoded_len(             //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_hadoop_decode writes to dst the decoded form of the Hadoop Lz4Codec
+// framed src, returning the number of bytes written.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_hadoop_decode(                        //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_parquet_lz4_raw_decode decodes a Parquet LZ4_RAW page to dst, whose
+// dst_len must be exactly the page's uncompressed_page_size. It fails with
+// sflz4_status_message__error_invalid_data if the page decodes to any other
+// length.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_parquet_lz4_raw_decode(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_parquet_lz4_decode is like sflz4_parquet_lz4_raw_decode but for
+// Parquet's older LZ4 codec. Like Apache Arrow, it tries Hadoop's framing
+// first and then falls back to a bare LZ4 block.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_parquet_lz4_decode(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_size_prefixed_encode_worst_case_dst_len returns the maximum
+// (inclusive) length of sflz4_size_prefixed_encode's output.
+SFLZ4_MAYBE_STATIC sflz4_size_result            //
+sflz4_size_prefixed_encode_worst_case_dst_len(  //
+    size_t src_len);
+
+// sflz4_size_prefixed_encode writes src's size-prefixed block to dst,
+// returning the number of bytes written.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_size_prefixed_encode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// sflz4_size_prefixed_decoded_len returns the decoded length recorded in the
+// size-prefixed block src.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_size_prefixed_decoded_len(      //
+    const uint8_t* src_ptr,           //
+    size_t src_len);
+
+// sflz4_size_prefixed_decode writes to dst the decoded form of the
+// size-prefixed block src, returning the number of bytes written.
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_size_prefixed_decode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len);
+
+// -------- LZ4 Embedded Assets
+
+// An asset is an LZ4 block compressed blob (e.g. a large static table or
+// template) embedded in a program's binary, typically as a const array
+// generated by the embed.c tool. It is decoded, on first use, into its
+// decoded buffer. That buffer is typically a zero-initialized static array
+// (in the .bss section), which takes no space in the binary and isn't paged
+// in until it is decoded into. Assets that are never used cost only their
+// compressed bytes.
+//
+// sflz4_asset_decode decodes the asset, if no earlier call has already done
+// so, and returns its decoded length. It is safe to call concurrently, from
+// multiple threads, on the same asset: exactly one call decodes and the
+// others wait for it. After that, a call is a single atomic load.
+//
+// On success, the decoded bytes are at decoded_ptr. Failure (invalid_data,
+// if the encoded bytes don't decode to exactly decoded_len bytes) is also
+// remembered, so every later call fails the same way.
+
+// sflz4_asset holds an asset's bytes and its decoding state. Initialize it
+// statically with SFLZ4_ASSET_INITIALIZER and don't modify the fields.
+typedef struct sflz4_asset_struct {
+  const uint8_t* encoded_ptr;
+  size_t encoded_len;
+  uint8_t* decoded_ptr;
+  size_t decoded_len;
+  const char* private_status_message;
+  volatile size_t private_state;
+  volatile uint32_t private_lock;
+} sflz4_asset;
+
+// SFLZ4_ASSET_INITIALIZER is the static initializer for an sflz4_asset whose
+// encoded_len byte LZ4 block at encoded_ptr decodes into the decoded_len byte
+// buffer at decoded_ptr.
+#define SFLZ4_ASSET_INITIALIZER(encoded_ptr, encoded_len, decoded_ptr, \
+                                decoded_len)                           \
+  {(encoded_ptr), (encoded_len), (decoded_ptr), (decoded_len), NULL, 0, 0}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_asset_decode(                   //
+    sflz4_asset* a);
+
+// ================================ -Public Interface
+
+#ifdef SFLZ4_IMPLEMENTATION
+
+// ================================ +Private Implementation
+
+// -------- Basics
+
+// This implementation assumes that:
+//  - converting a uint32_t to a size_t will never overflow.
+//  - converting a size_t to a uint64_t will never overflow.
+#if defined(__WORDSIZE)
+#if (__WORDSIZE != 32) && (__WORDSIZE != 64)
+#error "sflz4.h requires a word size of either 32 or 64 bits"
+#endif
+#endif
+
+// SFLZ4_ALWAYS_INLINE is for generic functions whose callers should each get
+// their own copy, specialized for (optimized for) their constant arguments.
+#if defined(__GNUC__)
+#define SFLZ4_ALWAYS_INLINE __attribute__((always_inline)) inline
+#elif defined(_MSC_VER)
+#define SFLZ4_ALWAYS_INLINE __forceinline
+#else
+#define SFLZ4_ALWAYS_INLINE inline
+#endif
+
+// Normally, the sflz4_private_peek_u32le implementation is both (1) correct
+// regardless of CPU endianness and (2) very fast (e.g. an inlined
+// sflz4_private_peek_u32le call, in an optimized clang or gcc build, is a
+// single MOV instruction on x86_64).
+//
+// However, the endian-agnostic implementations are slow on Microsoft's C
+// compiler (MSC). Alternative memcpy-based implementations restore speed, but
+// they are only correct on little-endian CPU architectures. Defining
+// SFLZ4_USE_MEMCPY_LE_PEEK_POKE opts in to these implementations.
+//
+// https://godbolt.org/z/q4MfjzTPh
+#if defined(_MSC_VER) && !defined(__clang__) && \
+    (defined(_M_ARM64) || defined(_M_X64))
+#define SFLZ4_USE_MEMCPY_LE_PEEK_POKE
+#endif
+
+static inline uint32_t     //
+sflz4_private_peek_u32le(  //
+    const uint8_t* p) {
+#if defined(SFLZ4_USE_MEMCPY_LE_PEEK_POKE)
+  uint32_t x;
+  memcpy(&x, p, 4);
+  return x;
+#else
+  return ((uint32_t)(p[0]) << 0) | ((uint32_t)(p[1]) << 8) |
+         ((uint32_t)(p[2]) << 16) | ((uint32_t)(p[3]) << 24);
+#endif
+}
+
+static inline uint64_t     //
+sflz4_private_peek_u64le(  //
+    const uint8_t* p) {
+#if defined(SFLZ4_USE_MEMCPY_LE_PEEK_POKE)
+  uint64_t x;
+  memcpy(&x, p, 8);
+  return x;
+#else
+  return ((uint64_t)(sflz4_private_peek_u32le(p + 0)) << 0) |
+         ((uint64_t)(sflz4_private_peek_u32le(p + 4)) << 32);
+#endif
+}
+
+static inline void         //
+sflz4_private_poke_u32le(  //
+    uint8_t* p,            //
+    uint32_t x) {
+#if defined(SFLZ4_USE_MEMCPY_LE_PEEK_POKE)
+  memcpy(p, &x, 4);
+#else
+  p[0] = (uint8_t)(x >> 0);
+  p[1] = (uint8_t)(x >> 8);
+  p[2] = (uint8_t)(x >> 16);
+  p[3] = (uint8_t)(x >> 24);
+#endif
+}
+
+static inline void         //
+sflz4_private_poke_u64le(  //
+    uint8_t* p,            //
+    uint64_t x) {
+#if defined(SFLZ4_USE_MEMCPY_LE_PEEK_POKE)
+  memcpy(p, &x, 8);
+#else
+  sflz4_private_poke_u32le(p + 0, (uint32_t)(x >> 0));
+  sflz4_private_poke_u32le(p + 4, (uint32_t)(x >> 32));
+#endif
+}
+
+// -------- Atomics
+
+// SFLZ4's thread-safe types use these spin locks, built on the compiler's
+// atomic intrinsics. Other compilers get plain (not thread-safe) loads and
+// stores.
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+static inline void    //
+sflz4_private_pause(  //
+    void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  _mm_pause();
+#endif
+}
+
+static inline void   //
+sflz4_private_lock(  //
+    volatile uint32_t* p) {
+#if defined(__GNUC__)
+  while (__atomic_exchange_n(p, 1, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(p, __ATOMIC_RELAXED)) {
+      sflz4_private_pause();
+    }
+  }
+#elif defined(_MSC_VER)
+  while (_InterlockedExchange((volatile long*)p, 1)) {
+    while (*p) {
+      sflz4_private_pause();
+    }
+  }
+#else
+  *p = 1;
+#endif
+}
+
+static inline void     //
+sflz4_private_unlock(  //
+    volatile uint32_t* p) {
+#if defined(__GNUC__)
+  __atomic_store_n(p, 0, __ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+  _InterlockedExchange((volatile long*)p, 0);
+#else
+  *p = 0;
+#endif
+}
+
+// sflz4_private_load_acquire_size_t and sflz4_private_store_release_size_t
+// publish a count (e.g. of initialized array elements) from one thread to
+// lock-free readers in other threads.
+static inline size_t                //
+sflz4_private_load_acquire_size_t(  //
+    const volatile size_t* p) {
+#if defined(__GNUC__)
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+  const size_t x = *p;
+  _ReadWriteBarrier();
+  return x;
+#else
+  return *p;
+#endif
+}
+
+static inline void                   //
+sflz4_private_store_release_size_t(  //
+    volatile size_t* p,              //
+    size_t x) {
+#if defined(__GNUC__)
+  __atomic_store_n(p, x, __ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+  _ReadWriteBarrier();
+  *p = x;
+#else
+  *p = x;
+#endif
+}
+
+// -------- Status Messages
+
+const char sflz4_status_message__error_bad_argument[] =  //
+    "#sflz4: bad argument";
+const char sflz4_status_message__error_bad_checksum[] =  //
+    "#sflz4: bad checksum";
+const char sflz4_status_message__error_dst_is_too_short[] =  //
+    "#sflz4: dst is too short";
+const char sflz4_status_message__error_invalid_data[] =  //
+    "#sflz4: invalid data";
+const char sflz4_status_message__error_src_is_too_long[] =  //
+    "#sflz4: src is too long";
+const char sflz4_status_message__error_unsupported_feature[] =  //
+    "#sflz4: unsupported feature";
+const char sflz4_status_message__error_workspace_is_too_short[] =  //
+    "#sflz4: workspace is too short";
+
+// -------- Telemetry
+
+// sflz4_private_telemetry_now and sflz4_private_telemetry_record wrap each
+// counted call. Without SFLZ4_CONFIG__TELEMETRY, they are empty, so that the
+// compiler removes them.
+#if defined(SFLZ4_CONFIG__TELEMETRY)
+
+#if defined(__GNUC__)
+#define SFLZ4_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define SFLZ4_THREAD_LOCAL __declspec(thread)
+#elif defined(__cplusplus) && (__cplusplus >= 201103L)
+#define SFLZ4_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define SFLZ4_THREAD_LOCAL _Thread_local
+#endif
+
+// sflz4_private_telemetry_shard's length, 384 bytes, is a multiple of 64
+// bytes, a common cache line length, so that different shards' counters
+// mostly don't share a cache line. Shard number SFLZ4_TELEMETRY_NUM_SHARDS
+// is the one that is shared by any further threads.
+typedef struct sflz4_private_telemetry_shard_struct {
+  sflz4_telemetry_counters ops[SFLZ4_TELEMETRY_NUM_OPS];
+} sflz4_private_telemetry_shard;
+
+static sflz4_private_telemetry_shard  //
+    sflz4_private_telemetry_shards[SFLZ4_TELEMETRY_NUM_SHARDS + 1];
+
+static sflz4_telemetry_clock_func sflz4_private_telemetry_clock;
+
+#if defined(SFLZ4_THREAD_LOCAL)
+// sflz4_private_telemetry_thread_shard is this thread's shard number plus
+// one, or zero if it hasn't claimed a shard yet.
+static SFLZ4_THREAD_LOCAL size_t sflz4_private_telemetry_thread_shard;
+
+static volatile uint32_t sflz4_private_telemetry_num_claimed;
+#endif
+
+// sflz4_private_telemetry_add adds x to *p. Only the shared shard needs an
+// atomic read-modify-write. An exclusive shard needs only atomic (untorn)
+// stores, as other threads (in sflz4_telemetry_read) only load.
+static inline void            //
+sflz4_private_telemetry_add(  //
+    uint64_t* p,              //
+    uint64_t x,               //
+    int shared) {
+#if defined(__GNUC__)
+  if (shared) {
+    __atomic_fetch_add(p, x, __ATOMIC_RELAXED);
+  } else {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + x,
+                     __ATOMIC_RELAXED);
+  }
+#elif defined(_MSC_VER)
+  if (shared) {
+    _InterlockedExchangeAdd64((volatile __int64*)p, (__int64)x);
+  } else {
+    *(volatile uint64_t*)p += x;
+  }
+#else
+  (void)shared;
+  *p += x;
+#endif
+}
+
+static inline uint64_t         //
+sflz4_private_telemetry_load(  //
+    const uint64_t* p) {
+#if defined(__GNUC__)
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+#else
+  return *(const volatile uint64_t*)p;
+#endif
+}
+
+static inline size_t                  //
+sflz4_private_telemetry_shard_index(  //
+    void) {
+#if defined(SFLZ4_THREAD_LOCAL)
+  size_t i = sflz4_private_telemetry_thread_shard;
+  if (i == 0) {
+#if defined(__GNUC__)
+    i = 1 + __atomic_fetch_add(&sflz4_private_telemetry_num_claimed, 1,
+                               __ATOMIC_RELAXED);
+#elif defined(_MSC_VER)
+    i = (size_t)(uint32_t)_InterlockedIncrement(
+        (volatile long*)&sflz4_private_telemetry_num_claimed);
+#else
+    i = ++sflz4_private_telemetry_num_claimed;
+#endif
+    if (i > SFLZ4_TELEMETRY_NUM_SHARDS) {
+      i = SFLZ4_TELEMETRY_NUM_SHARDS + 1;
+    }
+    sflz4_private_telemetry_thread_shard = i;
+  }
+  return i - 1;
+#else
+  return SFLZ4_TELEMETRY_NUM_SHARDS;
+#endif
+}
+
+static inline size_t                  //
+sflz4_private_telemetry_error_index(  //
+    const char* status_message) {
+  static const char* const status_messages[SFLZ4_TELEMETRY_ERROR__OTHER] = {
+      sflz4_status_message__error_bad_argument,
+      sflz4_status_message__error_bad_checksum,
+      sflz4_status_message__error_dst_is_too_short,
+      sflz4_status_message__error_invalid_data,
+      sflz4_status_message__error_src_is_too_long,
+      sflz4_status_message__error_unsupported_feature,
+      sflz4_status_message__error_workspace_is_too_short,
+  };
+  size_t i = 0;
+  while ((i < SFLZ4_TELEMETRY_ERROR__OTHER) &&
+         (status_messages[i] != status_message)) {
+    i++;
+  }
+  return i;
+}
+
+#endif  // defined(SFLZ4_CONFIG__TELEMETRY)
+
+static inline uint64_t        //
+sflz4_private_telemetry_now(  //
+    void) {
+#if defined(SFLZ4_CONFIG__TELEMETRY)
+  const sflz4_telemetry_clock_func clock_func = sflz4_private_telemetry_clock;
+  return clock_func ? (*clock_func)() : 0;
+#else
+  return 0;
+#endif
+}
+
+static inline void               //
+sflz4_private_telemetry_record(  //
+    uint32_t op,                 //
+    uint64_t start_time,         //
+    size_t src_len,              //
+    sflz4_size_result result) {
+#if defined(SFLZ4_CONFIG__TELEMETRY)
+  const size_t shard_index = sflz4_private_telemetry_shard_index();
+  const int shared = shard_index >= SFLZ4_TELEMETRY_NUM_SHARDS;
+  sflz4_telemetry_counters* c =
+      &sflz4_private_telemetry_shards[shard_index].ops[op];
+  sflz4_private_telemetry_add(&c->calls, 1, shared);
+  sflz4_private_telemetry_add(&c->src_len, src_len, shared);
+  if (result.status_message) {
+    sflz4_private_telemetry_add(
+        &c->errors[sflz4_private_telemetry_error_index(result.status_message)],
+        1, shared);
+  } else {
+    sflz4_private_telemetry_add(&c->dst_len, result.value, shared);
+  }
+  const sflz4_telemetry_clock_func clock_func = sflz4_private_telemetry_clock;
+  if (clock_func) {
+    sflz4_private_telemetry_add(&c->time, (*clock_func)() - start_time, shared);
+  }
+#else
+  (void)op;
+  (void)start_time;
+  (void)src_len;
+  (void)result;
+#endif
+}
+
+SFLZ4_MAYBE_STATIC void     //
+sflz4_telemetry_set_clock(  //
+    sflz4_telemetry_clock_func clock_func) {
+#if defined(SFLZ4_CONFIG__TELEMETRY)
+  sflz4_private_telemetry_clock = clock_func;
+#else
+  (void)clock_func;
+#endif
+}
+
+SFLZ4_MAYBE_STATIC void  //
+sflz4_telemetry_read(    //
+    sflz4_telemetry_snapshot* s) {
+  memset(s, 0, sizeof(*s));
+#if defined(SFLZ4_CONFIG__TELEMETRY)
+  // Every field of sflz4_telemetry_counters is a uint64_t.
+  const size_t n = sizeof(sflz4_telemetry_counters) / sizeof(uint64_t);
+  for (size_t i = 0; i <= SFLZ4_TELEMETRY_NUM_SHARDS; i++) {
+    for (size_t op = 0; op < SFLZ4_TELEMETRY_NUM_OPS; op++) {
+      const uint64_t* src =
+          (const uint64_t*)(const void*)&sflz4_private_telemetry_shards[i]
+              .ops[op];
+      uint64_t* dst = (uint64_t*)(void*)&s->ops[op];
+      for (size_t j = 0; j < n; j++) {
+        dst[j] += sflz4_private_telemetry_load(src + j);
+      }
+    }
+  }
+#endif
+}
+
+// -------- CRC-32C
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define SFLZ4_USE_X86_64_CRC32C
+#define SFLZ4_ATTRIBUTE_TARGET_X86_64_CRC32C \
+  __attribute__((target("sse4.2,pclmul")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#define SFLZ4_USE_X86_64_CRC32C
+#define SFLZ4_ATTRIBUTE_TARGET_X86_64_CRC32C
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define SFLZ4_USE_ARM_CRC32C
+#endif
+
+// sflz4_private_crc32c_table is the table for the byte-at-a-time, reflected
+// (least significant bit first) CRC-32C algorithm, whose polynomial is
+// 0x82F63B78 (or 0x1EDC6F41 in unreflected form).
+static const uint32_t sflz4_private_crc32c_table[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C,
+    0x26A1E7E8, 0xD4CA64EB, 0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B,
+    0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24, 0x105EC76F, 0xE235446C,
+    0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC,
+    0xBC267848, 0x4E4DFB4B, 0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A,
+    0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35, 0xAA64D611, 0x580F5512,
+    0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD,
+    0x1642AE59, 0xE4292D5A, 0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A,
+    0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595, 0x417B1DBC, 0xB3109EBF,
+    0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F,
+    0xED03A29B, 0x1F682198, 0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927,
+    0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38, 0xDBFC821C, 0x2997011F,
+    0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E,
+    0x4767748A, 0xB50CF789, 0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859,
+    0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46, 0x7198540D, 0x83F3D70E,
+    0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE,
+    0xDDE0EB2A, 0x2F8B6829, 0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C,
+    0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93, 0x082F63B7, 0xFA44E0B4,
+    0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B,
+    0xB4091BFF, 0x466298FC, 0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C,
+    0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033, 0xA24BB5A6, 0x502036A5,
+    0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975,
+    0x0E330A81, 0xFC588982, 0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D,
+    0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622, 0x38CC2A06, 0xCAA7A905,
+    0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8,
+    0xE52CC12C, 0x1747422F, 0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF,
+    0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0, 0xD3D3E1AB, 0x21B862A8,
+    0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78,
+    0x7FAB5E8C, 0x8DC0DD8F, 0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE,
+    0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1, 0x69E9F0D5, 0x9B8273D6,
+    0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69,
+    0xD5CF889D, 0x27A40B9E, 0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E,
+    0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
+};
+
+static inline uint32_t              //
+sflz4_private_crc32c_update_table(  //
+    uint32_t c,                     //
+    const uint8_t* p,               //
+    size_t p_len) {
+  for (; p_len > 0; p_len--) {
+    c = sflz4_private_crc32c_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+  }
+  return c;
+}
+
+#if defined(SFLZ4_USE_X86_64_CRC32C)
+
+// SFLZ4_CRC32C_LANE_LEN is the length of each of the three interleaved
+// streams. The two magic constants, for shifting a CRC-32C state past 1 or 2
+// lanes' worth of zeroes, are (x ** ((8 * n) - 33)) modulo the CRC-32C
+// polynomial, in reflected form, for n being 1 or 2 times the lane length.
+#define SFLZ4_CRC32C_LANE_LEN 4096
+#define SFLZ4_CRC32C_SHIFT_1_LANE 0x82F89C77
+#define SFLZ4_CRC32C_SHIFT_2_LANES 0x54A86326
+
+static inline int                     //
+sflz4_private_cpu_has_x86_64_crc32c(  //
+    void) {
+#if defined(__GNUC__)
+  return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+#else
+  int info[4];
+  __cpuid(info, 1);
+  return ((info[2] & (1 << 20)) != 0) && ((info[2] & (1 << 1)) != 0);
+#endif
+}
+
+SFLZ4_ATTRIBUTE_TARGET_X86_64_CRC32C static inline uint32_t  //
+sflz4_private_crc32c_shift_x86_64(                           //
+    uint32_t c,                                              //
+    uint32_t k) {
+  __m128i v = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)c),
+                                   _mm_cvtsi32_si128((int)k), 0x00);
+  return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(v));
+}
+
+SFLZ4_ATTRIBUTE_TARGET_X86_64_CRC32C static uint32_t  //
+sflz4_private_crc32c_update_x86_64(                   //
+    uint32_t c,                                       //
+    const uint8_t* p,                                 //
+    size_t p_len) {
+  for (; (p_len > 0) && ((((uintptr_t)p) & 7) != 0); p_len--) {
+    c = _mm_crc32_u8(c, *p++);
+  }
+
+  for (; p_len >= (3 * SFLZ4_CRC32C_LANE_LEN);
+       p_len -= (3 * SFLZ4_CRC32C_LANE_LEN)) {
+    uint64_t c0 = c;
+    uint64_t c1 = 0;
+    uint64_t c2 = 0;
+    for (size_t i = 0; i < SFLZ4_CRC32C_LANE_LEN; i += 8) {
+      uint64_t x0;
+      uint64_t x1;
+      uint64_t x2;
+      memcpy(&x0, p + i + (0 * SFLZ4_CRC32C_LANE_LEN), 8);
+      memcpy(&x1, p + i + (1 * SFLZ4_CRC32C_LANE_LEN), 8);
+      memcpy(&x2, p + i + (2 * SFLZ4_CRC32C_LANE_LEN), 8);
+      c0 = _mm_crc32_u64(c0, x0);
+      c1 = _mm_crc32_u64(c1, x1);
+      c2 = _mm_crc32_u64(c2, x2);
+    }
+    c = sflz4_private_crc32c_shift_x86_64((uint32_t)c0,
+                                          SFLZ4_CRC32C_SHIFT_2_LANES) ^
+        sflz4_private_crc32c_shift_x86_64((uint32_t)c1,
+                                          SFLZ4_CRC32C_SHIFT_1_LANE) ^
+        ((uint32_t)c2);
+    p += 3 * SFLZ4_CRC32C_LANE_LEN;
+  }
+
+  uint64_t c64 = c;
+  for (; p_len >= 8; p_len -= 8) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    c64 = _mm_crc32_u64(c64, x);
+    p += 8;
+  }
+  c = (uint32_t)c64;
+  for (; p_len > 0; p_len--) {
+    c = _mm_crc32_u8(c, *p++);
+  }
+  return c;
+}
+
+#elif defined(SFLZ4_USE_ARM_CRC32C)
+
+static inline uint32_t            //
+sflz4_private_crc32c_update_arm(  //
+    uint32_t c,                   //
+    const uint8_t* p,             //
+    size_t p_len) {
+  for (; p_len >= 8; p_len -= 8) {
+    uint64_t x;
+    memcpy(&x, p, 8);
+    c = __crc32cd(c, x);
+    p += 8;
+  }
+  for (; p_len > 0; p_len--) {
+    c = __crc32cb(c, *p++);
+  }
+  return c;
+}
+
+#endif
+
+SFLZ4_MAYBE_STATIC uint32_t  //
+sflz4_crc32c_update(         //
+    uint32_t crc,            //
+    const uint8_t* p,        //
+    size_t p_len) {
+  uint32_t c = ~crc;
+#if defined(SFLZ4_USE_X86_64_CRC32C)
+  if (sflz4_private_cpu_has_x86_64_crc32c()) {
+    return ~sflz4_private_crc32c_update_x86_64(c, p, p_len);
+  }
+#elif defined(SFLZ4_USE_ARM_CRC32C)
+  return ~sflz4_private_crc32c_update_arm(c, p, p_len);
+#endif
+  return ~sflz4_private_crc32c_update_table(c, p, p_len);
+}
+
+// -------- LZ4 Decode
+
+// SFLZ4_BLOCK_DECODE_FLAGS__ALLOW_TRAILING_MATCH means that src may be empty
+// or end with a sequence's match instead of its literals.
+//
+// SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END means to stop, successfully, once
+// dst is full, even if that's part-way through a sequence.
+#define SFLZ4_BLOCK_DECODE_FLAGS__ALLOW_TRAILING_MATCH 0x01
+#define SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END 0x02
+
+// sflz4_private_growth is a growable dst buffer, for
+// sflz4_block_decode_growing.
+typedef struct sflz4_private_growth_struct {
+  sflz4_realloc_func realloc_func;
+  void* context;
+  uint8_t* ptr;
+  size_t len;
+  size_t max_len;
+} sflz4_private_growth;
+
+// sflz4_private_grow grows g's buffer so that at least more_len bytes follow
+// its first used_len bytes, returning whether it succeeded.
+static int                    //
+sflz4_private_grow(           //
+    sflz4_private_growth* g,  //
+    size_t used_len,          //
+    size_t more_len) {
+  if (more_len > (g->max_len - used_len)) {
+    return 0;
+  }
+  size_t new_len = used_len + more_len;
+  const size_t doubled_len =
+      (g->len > (g->max_len / 2)) ? g->max_len : (g->len * 2);
+  if (new_len < doubled_len) {
+    new_len = doubled_len;
+  }
+  void* p = (*g->realloc_func)(g->context, g->ptr, g->len, new_len);
+  if (!p) {
+    return 0;
+  }
+  g->ptr = (uint8_t*)p;
+  g->len = new_len;
+  return 1;
+}
+
+// sflz4_private_block_decode_with_growth implements sflz4_block_decode,
+// sflz4_block_decode_prefix, sflz4_block_decode_segment,
+// sflz4_block_decode_with_dictionary and sflz4_block_decode_growing.
+//
+// Matches may refer back to the dst_prefix_len bytes immediately before
+// dst_ptr, which hold previously decoded history (e.g. from earlier linked
+// blocks of an LZ4 frame), and then further back to the dict_len bytes at
+// dict_ptr, which are treated as if they immediately preceded that history.
+//
+// If growth is non-NULL then dst_ptr and dst_len must be its buffer, with no
+// prefix, and running out of dst grows that buffer instead of failing. That
+// check is only on the (cold) out-of-space paths, and callers without growth
+// pass a constant NULL, which optimizes it away.
+static inline sflz4_size_result             //
+sflz4_private_block_decode_with_growth(     //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    size_t dst_prefix_len,                  //
+    const uint8_t* dict_ptr,                //
+    size_t dict_len,                        //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags,                         //
+    sflz4_private_growth* growth) {
+  sflz4_size_result result = {NULL, 0};
+
+  if (src_len > SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+
+  uint8_t* original_dst_ptr = dst_ptr;
+
+  // See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md for file
+  // format details, such as the LZ4 token's bit patterns.
+  while (src_len > 0) {
+    if ((flags & SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END) && (dst_len == 0)) {
+      goto done;
+    }
+    uint32_t token = *src_ptr++;
+    src_len--;
+
+    uint32_t literal_len = token >> 4;
+    if (literal_len > 0) {
+      if (literal_len == 15) {
+        while (1) {
+          if (src_len == 0) {
+            goto fail_invalid_data;
+          }
+          uint32_t s = *src_ptr++;
+          src_len--;
+          literal_len += s;
+          if (s != 255) {
+            break;
+          }
+        }
+      }
+
+      if (literal_len > src_len) {
+        goto fail_invalid_data;
+      } else if (literal_len > dst_len) {
+        if (flags & SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END) {
+          memcpy(dst_ptr, src_ptr, dst_len);
+          dst_ptr += dst_len;
+          goto done;
+        }
+        const size_t used_len = (size_t)(dst_ptr - original_dst_ptr);
+        if (!growth || !sflz4_private_grow(growth, used_len, literal_len)) {
+          result.status_message =
+              sflz4_status_message__error_dst_is_too_short;
+          return result;
+        }
+        original_dst_ptr = growth->ptr;
+        dst_ptr = original_dst_ptr + used_len;
+        dst_len = growth->len - used_len;
+      }
+      memcpy(dst_ptr, src_ptr, literal_len);
+      dst_ptr += literal_len;
+      dst_len -= literal_len;
+      src_ptr += literal_len;
+      src_len -= literal_len;
+      if (src_len == 0) {
+        result.value = ((size_t)(dst_ptr - original_dst_ptr));
+        return result;
+      }
+    }
+
+    if (src_len < 2) {
+      goto fail_invalid_data;
+    }
+    uint32_t copy_off = ((uint32_t)src_ptr[0]) | (((uint32_t)src_ptr[1]) << 8);
+    src_ptr += 2;
+    src_len -= 2;
+    const size_t history_len =
+        dst_prefix_len + ((size_t)(dst_ptr - original_dst_ptr));
+    if ((copy_off == 0) || (copy_off > (history_len + dict_len))) {
+      goto fail_invalid_data;
+    }
+
+    uint32_t copy_len = (token & 15) + 4;
+    if (copy_len == 19) {
+      while (1) {
+        if (src_len == 0) {
+          goto fail_invalid_data;
+        }
+        uint32_t s = *src_ptr++;
+        src_len--;
+        copy_len += s;
+        if (s != 255) {
+          break;
+        }
+      }
+    }
+
+    if (dst_len < copy_len) {
+      if (flags & SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END) {
+        copy_len = (uint32_t)dst_len;
+      } else {
+        const size_t used_len = (size_t)(dst_ptr - original_dst_ptr);
+        if (!growth || !sflz4_private_grow(growth, used_len, copy_len)) {
+          result.status_message =
+              sflz4_status_message__error_dst_is_too_short;
+          return result;
+        }
+        original_dst_ptr = growth->ptr;
+        dst_ptr = original_dst_ptr + used_len;
+        dst_len = growth->len - used_len;
+      }
+    }
+    dst_len -= copy_len;
+    if (copy_off > history_len) {
+      // The match starts in the dictionary. It may continue into the history.
+      size_t dict_off = copy_off - history_len;
+      size_t n = (dict_off < copy_len) ? dict_off : copy_len;
+      memcpy(dst_ptr, dict_ptr + dict_len - dict_off, n);
+      dst_ptr += n;
+      copy_len -= (uint32_t)n;
+    }
+    for (const uint8_t* from = dst_ptr - copy_off; copy_len > 0; copy_len--) {
+      *dst_ptr++ = *from++;
+    }
+  }
+
+  if (flags & SFLZ4_BLOCK_DECODE_FLAGS__ALLOW_TRAILING_MATCH) {
+    goto done;
+  }
+
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+
+done:
+  result.value = ((size_t)(dst_ptr - original_dst_ptr));
+  return result;
+}
+
+static inline sflz4_size_result             //
+sflz4_private_block_decode_with_dict(       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    size_t dst_prefix_len,                  //
+    const uint8_t* dict_ptr,                //
+    size_t dict_len,                        //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags) {
+  return sflz4_private_block_decode_with_growth(
+      dst_ptr, dst_len, dst_prefix_len, dict_ptr, dict_len, src_ptr, src_len,
+      flags, NULL);
+}
+
+static inline sflz4_size_result             //
+sflz4_private_block_decode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    size_t dst_prefix_len,                  //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags) {
+  return sflz4_private_block_decode_with_dict(
+      dst_ptr, dst_len, dst_prefix_len, NULL, 0, src_ptr, src_len, flags);
+}
+
+// sflz4_private_block_decode_counted is sflz4_private_block_decode_with_dict
+// that also counts (for telemetry) as a SFLZ4_TELEMETRY_OP__BLOCK_DECODE
+// call. Every block decode outside of sflz4_frame_decode goes through here.
+static sflz4_size_result                    //
+sflz4_private_block_decode_counted(         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    size_t dst_prefix_len,                  //
+    const uint8_t* dict_ptr,                //
+    size_t dict_len,                        //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_decode_with_dict(
+      dst_ptr, dst_len, dst_prefix_len, dict_ptr, dict_len, src_ptr, src_len,
+      flags);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_DECODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  return sflz4_private_block_decode_counted(dst_ptr, dst_len, 0, NULL, 0,
+                                            src_ptr, src_len, 0);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_prefix(                  //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  return sflz4_private_block_decode_counted(
+      dst_ptr, dst_len, 0, NULL, 0, src_ptr, src_len,
+      SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END);
+}
+
+static sflz4_size_result                    //
+sflz4_private_block_decode_growing(         //
+    uint8_t** dst_ptr,                      //
+    size_t* dst_len,                        //
+    size_t dst_max_len,                     //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_realloc_func realloc_func,        //
+    void* context) {
+  sflz4_size_result result = {NULL, 0};
+  if (!dst_ptr || !dst_len || !realloc_func || (*dst_len > dst_max_len)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  sflz4_private_growth g;
+  g.realloc_func = realloc_func;
+  g.context = context;
+  g.ptr = *dst_ptr;
+  g.len = *dst_len;
+  g.max_len = dst_max_len;
+  if ((g.len == 0) && (src_len <= SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN)) {
+    const size_t initial_len =
+        ((4 * src_len) < dst_max_len) ? (4 * src_len) : dst_max_len;
+    if ((initial_len > 0) && !sflz4_private_grow(&g, 0, initial_len)) {
+      result.status_message = sflz4_status_message__error_dst_is_too_short;
+      return result;
+    }
+  }
+  result = sflz4_private_block_decode_with_growth(
+      g.ptr, g.len, 0, NULL, 0, src_ptr, src_len, 0, &g);
+  *dst_ptr = g.ptr;
+  *dst_len = g.len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_growing(                 //
+    uint8_t** dst_ptr,                      //
+    size_t* dst_len,                        //
+    size_t dst_max_len,                     //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_realloc_func realloc_func,        //
+    void* context) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_decode_growing(
+      dst_ptr, dst_len, dst_max_len, src_ptr, src_len, realloc_func, context);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_DECODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// -------- LZ4 Encode
+
+#define SFLZ4_HASH_TABLE_SHIFT 12
+
+static inline uint32_t  //
+sflz4_private_hash(     //
+    uint32_t x) {
+  // 2654435761u is Knuth's magic constant.
+  return (x * 2654435761u) >> (32 - SFLZ4_HASH_TABLE_SHIFT);
+}
+
+static inline size_t       //
+sflz4_private_min_size_t(  //
+    size_t a,              //
+    size_t b) {
+  return (a < b) ? a : b;
+}
+
+static inline size_t                  //
+sflz4_private_longest_common_prefix(  //
+    const uint8_t* p,                 //
+    const uint8_t* q,                 //
+    const uint8_t* p_limit) {
+  const uint8_t* const original_p = p;
+  size_t n = p_limit - p;
+  while ((n >= 4) &&
+         (sflz4_private_peek_u32le(p) == sflz4_private_peek_u32le(q))) {
+    p += 4;
+    q += 4;
+    n -= 4;
+  }
+  while ((n > 0) && (*p == *q)) {
+    p += 1;
+    q += 1;
+    n -= 1;
+  }
+  return (size_t)(p - original_p);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result    //
+sflz4_block_encode_worst_case_dst_len(  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+
+  if (src_len > SFLZ4_LZ4_BLOCK_ENCODE_MAX_INCL_SRC_LEN) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  // For the curious, if (src_len <= 0x7E000000) then (value <= 0x7E7E7E8E).
+  result.value = src_len + (src_len / 255) + 16;
+  return result;
+}
+
+// sflz4_private_block_encode_worst_case_sum returns an upper bound on the sum
+// of sflz4_block_encode_worst_case_dst_len over num_blocks blocks whose
+// lengths sum to total_len, for sizing a run of worst-case slots before the
+// blocks have been planned. The total itself may exceed
+// SFLZ4_LZ4_BLOCK_ENCODE_MAX_INCL_SRC_LEN (each block may not).
+static inline uint64_t                      //
+sflz4_private_block_encode_worst_case_sum(  //
+    uint64_t total_len,                     //
+    uint64_t num_blocks) {
+  return total_len + (total_len / 255) + (16 * num_blocks);
+}
+
+static inline uint8_t*           //
+sflz4_private_emit_literals(     //
+    uint8_t* SFLZ4_RESTRICT dp,  //
+    const uint8_t* literal_ptr,  //
+    size_t literal_len,          //
+    uint32_t token_low_nibble) {
+  if (literal_len < 15) {
+    *dp++ = (uint8_t)((literal_len << 4) | token_low_nibble);
+  } else {
+    size_t n = literal_len - 15;
+    *dp++ = (uint8_t)(0xF0 | token_low_nibble);
+    for (; n >= 255; n -= 255) {
+      *dp++ = 0xFF;
+    }
+    *dp++ = (uint8_t)n;
+  }
+  memcpy(dp, literal_ptr, literal_len);
+  return dp + literal_len;
+}
+
+// sflz4_private_prime_hash_table inserts every 4-byte window of p[0 .. p_len)
+// into the hash_table, whose values are offsets relative to window_ptr.
+static inline void                        //
+sflz4_private_prime_hash_table(           //
+    uint32_t* SFLZ4_RESTRICT hash_table,  //
+    const uint8_t* window_ptr,            //
+    const uint8_t* p,                     //
+    size_t p_len) {
+  for (; p_len >= 4; p_len--, p++) {
+    hash_table[sflz4_private_hash(sflz4_private_peek_u32le(p))] =
+        (uint32_t)(p - window_ptr);
+  }
+}
+
+// sflz4_private_encode_sequences writes LZ4 sequences (each one a literal
+// run followed by a match) for the bytes from *literal_start_ptr up to (at
+// most) src_ptr + src_len, returning the advanced dp. It does not write the
+// trailing literals (the ones after the final match). It instead updates
+// *literal_start_ptr to point to where those trailing literals start.
+//
+// Matches found start at or after src_ptr and end at or before src_ptr +
+// src_len, but they can refer back as far as window_ptr. The hash_table's
+// values are offsets relative to window_ptr.
+//
+// block_end is the end of the LZ4 block, at or after src_ptr + src_len. See
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md for "The last
+// match must start at least 12 bytes before the end of block" and other file
+// format details, such as the LZ4 token's bit patterns.
+//
+// sflz4_private_encode_sequences_with_dict is the same, except that matches
+// can also refer back into a dictionary: the dict_len (at most 64 KiB) bytes
+// at dict_ptr, treated as if they immediately preceded window_ptr. The
+// hash_table's values are then offsets relative to that virtual start:
+// values below dict_len are dictionary positions and the others are dict_len
+// plus an offset relative to window_ptr. Prime it with
+// sflz4_private_prime_hash_table(hash_table, dict_ptr, dict_ptr, dict_len).
+//
+// It is always inlined so that sflz4_private_encode_sequences (and so most
+// callers), whose dict_len is zero, optimizes away the dictionary checks.
+static SFLZ4_ALWAYS_INLINE uint8_t*        //
+sflz4_private_encode_sequences_with_dict(  //
+    uint8_t* SFLZ4_RESTRICT dp,            //
+    uint32_t* SFLZ4_RESTRICT hash_table,   //
+    const uint8_t* dict_ptr,               //
+    size_t dict_len,                       //
+    const uint8_t* window_ptr,             //
+    const uint8_t* src_ptr,                //
+    size_t src_len,                        //
+    const uint8_t* block_end,              //
+    const uint8_t** literal_start_ptr) {
+  const size_t block_len = (size_t)(block_end - src_ptr);
+  if ((block_len <= 12) || (src_len < 4)) {
+    return dp;
+  }
+  const uint8_t* const match_limit =
+      src_ptr + ((src_len < (block_len - 5)) ? src_len : (block_len - 5));
+  const size_t final_literals_limit =
+      ((src_len - 3) < (block_len - 11)) ? (src_len - 3) : (block_len - 11);
+
+  const uint8_t* sp = src_ptr;
+  const uint8_t* literal_start = *literal_start_ptr;
+  const uint32_t dict_len32 = (uint32_t)dict_len;
+
+  while (1) {
+    // Start with 1-byte steps, accelerating when not finding any matches
+    // (e.g. when compressing binary data, not text data).
+    size_t step = 1;
+    size_t step_counter = 1 << 6;
+
+    // Start with a non-empty literal.
+    const uint8_t* next_sp = sp + 1;
+    uint32_t next_hash = sflz4_private_hash(sflz4_private_peek_u32le(next_sp));
+
+    // Find a match or goto done.
+    const uint8_t* match = NULL;
+    uint32_t copy_off = 0;
+    int match_in_dict = 0;
+    do {
+      sp = next_sp;
+      next_sp += step;
+      step = step_counter++ >> 6;
+      if (((size_t)(next_sp - src_ptr)) > final_literals_limit) {
+        goto done;
+      }
+      uint32_t* hash_table_entry = &hash_table[next_hash];
+      const uint32_t old_offset = *hash_table_entry;
+      const uint32_t new_offset = (uint32_t)(sp - window_ptr) + dict_len32;
+      match_in_dict = old_offset < dict_len32;
+      match = match_in_dict ? (dict_ptr + old_offset)
+                            : (window_ptr + (old_offset - dict_len32));
+      copy_off = new_offset - old_offset;
+      next_hash = sflz4_private_hash(sflz4_private_peek_u32le(next_sp));
+      *hash_table_entry = new_offset;
+    } while ((copy_off > 0xFFFF) || (sflz4_private_peek_u32le(sp) !=
+                                     sflz4_private_peek_u32le(match)));
+
+    // Extend the match backwards. Dictionary matches don't cross the
+    // dictionary's start and window matches don't cross into the dictionary.
+    const uint8_t* const match_floor = match_in_dict ? dict_ptr : window_ptr;
+    while ((sp > literal_start) && (match > match_floor) &&
+           (sp[-1] == match[-1])) {
+      sp--;
+      match--;
+    }
+
+    // Emit half of the LZ4 token, encoding the literal length. We'll fix up
+    // the other half later.
+    uint8_t* token = dp;
+    dp = sflz4_private_emit_literals(dp, literal_start,
+                                     (size_t)(sp - literal_start), 0);
+
+    while (1) {
+      // At this point:
+      //  - sp    points to the start of the match's later   copy.
+      //  - match points to the start of the match's earlier copy.
+      //  - token points to the LZ4 token.
+
+      // Calculate the match length and update the token's other half. A
+      // dictionary match can continue past the dictionary's end into the
+      // start of the window.
+      *dp++ = (uint8_t)(copy_off >> 0);
+      *dp++ = (uint8_t)(copy_off >> 8);
+      size_t adj_copy_len = 0;
+      if (!match_in_dict) {
+        adj_copy_len =
+            sflz4_private_longest_common_prefix(4 + sp, 4 + match, match_limit);
+      } else {
+        const size_t dict_remaining = (size_t)(dict_ptr + dict_len - match);
+        const uint8_t* const limit =
+            (dict_remaining < (size_t)(match_limit - sp))
+                ? (sp + dict_remaining)
+                : match_limit;
+        adj_copy_len =
+            sflz4_private_longest_common_prefix(4 + sp, 4 + match, limit);
+        if ((4 + adj_copy_len) == dict_remaining) {
+          adj_copy_len += sflz4_private_longest_common_prefix(
+              4 + sp + adj_copy_len, window_ptr, match_limit);
+        }
+      }
+      if (adj_copy_len < 15) {
+        *token |= (uint8_t)adj_copy_len;
+      } else {
+        size_t n = adj_copy_len - 15;
+        *token |= 0x0F;
+        for (; n >= 255; n -= 255) {
+          *dp++ = 0xFF;
+        }
+        *dp++ = (uint8_t)n;
+      }
+      sp += 4 + adj_copy_len;
+
+      // Update the literal_start and check the final_literals_limit.
+      literal_start = sp;
+      if (((size_t)(sp - src_ptr)) >= final_literals_limit) {
+        goto done;
+      }
+
+      // We've skipped over hashing everything within the match. Also, the
+      // minimum match length is 4. Update the hash table for one of those
+      // skipped positions.
+      hash_table[sflz4_private_hash(sflz4_private_peek_u32le(sp - 2))] =
+          (uint32_t)(sp - 2 - window_ptr) + dict_len32;
+
+      // Check if this match can be followed immediately by another match.
+      // If so, continue the loop. Otherwise, break.
+      uint32_t* hash_table_entry =
+          &hash_table[sflz4_private_hash(sflz4_private_peek_u32le(sp))];
+      uint32_t old_offset = *hash_table_entry;
+      uint32_t new_offset = (uint32_t)(sp - window_ptr) + dict_len32;
+      *hash_table_entry = new_offset;
+      match_in_dict = old_offset < dict_len32;
+      match = match_in_dict ? (dict_ptr + old_offset)
+                            : (window_ptr + (old_offset - dict_len32));
+      copy_off = new_offset - old_offset;
+      if ((copy_off > 0xFFFF) ||
+          (sflz4_private_peek_u32le(sp) != sflz4_private_peek_u32le(match))) {
+        break;
+      }
+      token = dp++;
+      *token = 0;
+    }
+  }
+
+done:
+  *literal_start_ptr = literal_start;
+  return dp;
+}
+
+static inline uint8_t*                    //
+sflz4_private_encode_sequences(           //
+    uint8_t* SFLZ4_RESTRICT dp,           //
+    uint32_t* SFLZ4_RESTRICT hash_table,  //
+    const uint8_t* window_ptr,            //
+    const uint8_t* src_ptr,               //
+    size_t src_len,                       //
+    const uint8_t* block_end,             //
+    const uint8_t** literal_start_ptr) {
+  return sflz4_private_encode_sequences_with_dict(
+      dp, hash_table, NULL, 0, window_ptr, src_ptr, src_len, block_end,
+      literal_start_ptr);
+}
+
+static sflz4_size_result                    //
+sflz4_private_block_encode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  // hash_table maps from SFLZ4_HASH_TABLE_SHIFT-bit keys to 32-bit values.
+  // Each value is an offset o, relative to src_ptr, initialized to zero.
+  // Each key, when set, is a hash of 4 bytes src_ptr[o .. o+4].
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT] = {0};
+
+  const uint8_t* literal_start = src_ptr;
+  uint8_t* dp = sflz4_private_encode_sequences(
+      dst_ptr, hash_table, src_ptr, src_ptr, src_len, src_ptr + src_len,
+      &literal_start);
+  dp = sflz4_private_emit_literals(
+      dp, literal_start, src_len - (size_t)(literal_start - src_ptr), 0);
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result =
+      sflz4_private_block_encode(dst_ptr, dst_len, src_ptr, src_len);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN is the length of each contiguous chunk that
+// sflz4_block_estimate_encoded_len samples. The chunks are long enough to see
+// typical text-like or record-like repetition but short enough to keep the
+// scratch buffers on the stack.
+#define SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN 8192
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_estimate_encoded_len(           //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  }
+  result.value = 0;
+
+  uint8_t dst[SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN +
+              (SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN / 255) + 16];
+  const size_t num_chunks =
+      SFLZ4_BLOCK_ESTIMATE_MAX_INCL_SAMPLE_LEN / SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN;
+  uint64_t sampled_src_len = 0;
+  uint64_t sampled_dst_len = 0;
+
+  if (src_len <= SFLZ4_BLOCK_ESTIMATE_MAX_INCL_SAMPLE_LEN) {
+    // Short inputs are examined in full (but still chunk by chunk).
+    for (size_t i = 0; i < src_len; i += SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN) {
+      size_t n = sflz4_private_min_size_t(src_len - i,
+                                          SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN);
+      sampled_src_len += n;
+      sampled_dst_len +=
+          sflz4_private_block_encode(dst, sizeof(dst), src_ptr + i, n).value;
+    }
+  } else {
+    // Long inputs are sampled at evenly spaced chunks.
+    const size_t stride = src_len / num_chunks;
+    for (size_t i = 0; i < num_chunks; i++) {
+      sampled_src_len += SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN;
+      sampled_dst_len +=
+          sflz4_private_block_encode(dst, sizeof(dst), src_ptr + (i * stride),
+                                     SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN)
+              .value;
+    }
+  }
+
+  if (sampled_src_len > 0) {
+    result.value =
+        (size_t)((sampled_dst_len * (uint64_t)src_len) / sampled_src_len);
+  } else {
+    result.value =
+        sflz4_private_block_encode(dst, sizeof(dst), src_ptr, 0).value;
+  }
+  return result;
+}
+
+// SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT is the high ratio encoder's hash table
+// size, which is larger than the fast encoder's, as there's only one table
+// (not one per call on the stack) and collisions waste chain steps.
+#define SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT 15
+
+// SFLZ4_HIGH_RATIO_MAX_ATTEMPTS bounds how many chain steps (earlier
+// positions) the high ratio encoder checks per position.
+#define SFLZ4_HIGH_RATIO_MAX_ATTEMPTS 256
+
+// sflz4_private_high_ratio_find_match inserts every position up to and
+// including sp into the hash table and chain and then returns the length of
+// the longest match (or zero if less than 4) for sp, setting *match_ptr to
+// the start of its earlier copy. The match ends at or before match_limit.
+//
+// The hash_table's values are positions (relative to src_ptr) plus one, or
+// zero for none. The chain maps a position (modulo 64 KiB) to the distance
+// back to the previous position with the same hash, or zero for none (or for
+// too far back). Positions older than 64 KiB are never followed, so their
+// overwritten chain entries are never read.
+static inline size_t                      //
+sflz4_private_high_ratio_find_match(      //
+    uint32_t* SFLZ4_RESTRICT hash_table,  //
+    uint16_t* SFLZ4_RESTRICT chain,       //
+    const uint8_t* src_ptr,               //
+    size_t* next_insert,                  //
+    const uint8_t* sp,                    //
+    const uint8_t* match_limit,           //
+    const uint8_t** match_ptr) {
+  const size_t pos = (size_t)(sp - src_ptr);
+  for (size_t i = *next_insert; i <= pos; i++) {
+    const uint32_t h = (sflz4_private_peek_u32le(src_ptr + i) * 2654435761u) >>
+                       (32 - SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT);
+    const size_t delta = hash_table[h] ? ((i + 1) - hash_table[h]) : 0;
+    chain[i & 0xFFFF] = (uint16_t)((delta <= 0xFFFF) ? delta : 0);
+    hash_table[h] = (uint32_t)(i + 1);
+  }
+  *next_insert = pos + 1;
+
+  const size_t max_len = (size_t)(match_limit - sp);
+  const uint32_t sp4 = sflz4_private_peek_u32le(sp);
+  size_t best_len = 0;
+  size_t off = chain[pos & 0xFFFF];
+  for (int attempts = SFLZ4_HIGH_RATIO_MAX_ATTEMPTS;
+       (off > 0) && (off <= 0xFFFF) && (attempts > 0); attempts--) {
+    const uint8_t* const m = sp - off;
+    // Cheaply reject candidates that can't beat best_len.
+    if ((m[best_len] == sp[best_len]) &&
+        (sflz4_private_peek_u32le(m) == sp4)) {
+      const size_t n =
+          4 + sflz4_private_longest_common_prefix(4 + sp, 4 + m, match_limit);
+      if (n > best_len) {
+        best_len = n;
+        *match_ptr = m;
+        if (n >= max_len) {
+          break;
+        }
+      }
+    }
+    const size_t delta = chain[(pos - off) & 0xFFFF];
+    if (delta == 0) {
+      break;
+    }
+    off += delta;
+  }
+  return (best_len >= 4) ? best_len : 0;
+}
+
+static sflz4_size_result                    //
+sflz4_private_block_encode_high_ratio(      //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  } else if (workspace_len < SFLZ4_BLOCK_ENCODE_HIGH_RATIO_WORKSPACE_LEN) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  // The workspace holds, in order: 3 bytes of alignment slack, the hash
+  // table and the chain. The chain doesn't need clearing, as only inserted
+  // positions' entries are read.
+  uint8_t* p = workspace_ptr + ((4 - ((uintptr_t)workspace_ptr & 3)) & 3);
+  uint32_t* const hash_table = (uint32_t*)(void*)p;
+  uint16_t* const chain =
+      (uint16_t*)(void*)(p + (sizeof(uint32_t)
+                              << SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT));
+  memset(hash_table, 0, sizeof(uint32_t) << SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT);
+
+  uint8_t* dp = dst_ptr;
+  const uint8_t* literal_start = src_ptr;
+  if (src_len > 12) {
+    // Matches start at or before sp_limit and end at or before match_limit.
+    // See "The last match must start at least 12 bytes before the end of
+    // block" in the LZ4 block format documentation.
+    const uint8_t* const sp_limit = src_ptr + src_len - 12;
+    const uint8_t* const match_limit = src_ptr + src_len - 5;
+    size_t next_insert = 0;
+    const uint8_t* sp = src_ptr;
+    while (sp <= sp_limit) {
+      const uint8_t* match = NULL;
+      size_t match_len = sflz4_private_high_ratio_find_match(
+          hash_table, chain, src_ptr, &next_insert, sp, match_limit, &match);
+      if (match_len == 0) {
+        sp++;
+        continue;
+      }
+
+      // Lazy matching: prefer a longer match starting one byte later.
+      while (sp < sp_limit) {
+        const uint8_t* next_match = NULL;
+        const size_t next_match_len = sflz4_private_high_ratio_find_match(
+            hash_table, chain, src_ptr, &next_insert, sp + 1, match_limit,
+            &next_match);
+        if (next_match_len <= match_len) {
+          break;
+        }
+        sp++;
+        match = next_match;
+        match_len = next_match_len;
+      }
+
+      uint8_t* const token = dp;
+      dp = sflz4_private_emit_literals(dp, literal_start,
+                                       (size_t)(sp - literal_start), 0);
+      const size_t copy_off = (size_t)(sp - match);
+      *dp++ = (uint8_t)(copy_off >> 0);
+      *dp++ = (uint8_t)(copy_off >> 8);
+      const size_t adj_copy_len = match_len - 4;
+      if (adj_copy_len < 15) {
+        *token |= (uint8_t)adj_copy_len;
+      } else {
+        size_t n = adj_copy_len - 15;
+        *token |= 0x0F;
+        for (; n >= 255; n -= 255) {
+          *dp++ = 0xFF;
+        }
+        *dp++ = (uint8_t)n;
+      }
+      sp += match_len;
+      literal_start = sp;
+    }
+  }
+  dp = sflz4_private_emit_literals(
+      dp, literal_start, src_len - (size_t)(literal_start - src_ptr), 0);
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_high_ratio(              //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_encode_high_ratio(
+      dst_ptr, dst_len, src_ptr, src_len, workspace_ptr, workspace_len);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// -------- LZ4 Parallel Encode
+
+typedef struct sflz4_private_region_struct {
+  const uint8_t* region_ptr;
+  const uint8_t* literal_start;
+  uint8_t* dst_end;
+} sflz4_private_region;
+
+typedef struct sflz4_private_parallel_encode_struct {
+  const uint8_t* src_ptr;
+  size_t src_len;
+  size_t region_len;
+  uint8_t* workspace_ptr;
+  size_t workspace_stride;
+  sflz4_private_region
+      regions[SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS];
+} sflz4_private_parallel_encode;
+
+static void                         //
+sflz4_private_block_encode_region(  //
+    void* func_context,             //
+    size_t i) {
+  sflz4_private_parallel_encode* p =
+      (sflz4_private_parallel_encode*)func_context;
+  const size_t lo = sflz4_private_min_size_t(i * p->region_len, p->src_len);
+  const size_t hi = sflz4_private_min_size_t(lo + p->region_len, p->src_len);
+  const uint8_t* const region_ptr = p->src_ptr + lo;
+  const uint8_t* const window_ptr = region_ptr - ((lo < 0xFFFF) ? lo : 0xFFFF);
+
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT] = {0};
+  sflz4_private_prime_hash_table(hash_table, window_ptr, window_ptr,
+                                 (size_t)(region_ptr - window_ptr));
+
+  const uint8_t* literal_start = region_ptr;
+  p->regions[i].region_ptr = region_ptr;
+  p->regions[i].dst_end = sflz4_private_encode_sequences(
+      p->workspace_ptr + (i * p->workspace_stride), hash_table, window_ptr,
+      region_ptr, hi - lo, p->src_ptr + p->src_len, &literal_start);
+  p->regions[i].literal_start = literal_start;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_parallel_workspace_len(  //
+    size_t src_len,                         //
+    size_t num_regions) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if ((num_regions == 0) ||
+             (num_regions > SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    result.value = 0;
+    return result;
+  }
+  const size_t region_len = (src_len / num_regions) +
+                            (((src_len % num_regions) != 0) ? 1 : 0);
+  const uint64_t n = ((uint64_t)num_regions) *
+                     ((uint64_t)(region_len + (region_len / 255) + 16));
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    result.value = 0;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+static sflz4_size_result                    //
+sflz4_private_block_encode_parallel(        //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len,                   //
+    size_t num_regions,                     //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  sflz4_size_result result =
+      sflz4_block_encode_parallel_workspace_len(src_len, num_regions);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > workspace_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  sflz4_private_parallel_encode p;
+  p.src_ptr = src_ptr;
+  p.src_len = src_len;
+  p.region_len = (src_len / num_regions) +
+                 (((src_len % num_regions) != 0) ? 1 : 0);
+  p.workspace_ptr = workspace_ptr;
+  p.workspace_stride = p.region_len + (p.region_len / 255) + 16;
+  if (parallel_for) {
+    (*parallel_for)(parallel_for_context, num_regions,
+                    &sflz4_private_block_encode_region, &p);
+  } else {
+    for (size_t i = 0; i < num_regions; i++) {
+      sflz4_private_block_encode_region(&p, i);
+    }
+  }
+
+  // Stitch the regions together. Each region's trailing literals (the ones
+  // after its final match) are still pending. They are contiguous in src with
+  // the next region's first literal run, so the two merge into one sequence.
+  uint8_t* dp = dst_ptr;
+  const uint8_t* pending = src_ptr;
+  for (size_t i = 0; i < num_regions; i++) {
+    const uint8_t* rp = workspace_ptr + (i * p.workspace_stride);
+    const uint8_t* const rq = p.regions[i].dst_end;
+    if (rp == rq) {
+      continue;
+    }
+    uint32_t token = *rp++;
+    size_t literal_len = token >> 4;
+    if (literal_len == 15) {
+      while (1) {
+        uint32_t s = *rp++;
+        literal_len += s;
+        if (s != 255) {
+          break;
+        }
+      }
+    }
+    const size_t merged_literal_len =
+        (size_t)(p.regions[i].region_ptr - pending) + literal_len;
+    dp = sflz4_private_emit_literals(dp, pending, merged_literal_len,
+                                     token & 15);
+    rp += literal_len;
+    memcpy(dp, rp, (size_t)(rq - rp));
+    dp += rq - rp;
+    pending = p.regions[i].literal_start;
+  }
+  dp = sflz4_private_emit_literals(
+      dp, pending, src_len - (size_t)(pending - src_ptr), 0);
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_parallel(                //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len,                   //
+    size_t num_regions,                     //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_encode_parallel(
+      dst_ptr, dst_len, src_ptr, src_len, workspace_ptr, workspace_len,
+      num_regions, parallel_for, parallel_for_context);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// -------- LZ4 Segments
+
+static sflz4_size_result                    //
+sflz4_private_block_encode_segmented(       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_segment* segments_ptr,            //
+    size_t segments_len) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  } else if (segments_len == 0) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    result.value = 0;
+    return result;
+  }
+
+  const size_t segment_len = (src_len / segments_len) +
+                             (((src_len % segments_len) != 0) ? 1 : 0);
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT];
+
+  uint8_t* dp = dst_ptr;
+  const uint8_t* literal_start = src_ptr;
+  for (size_t i = 0; i < segments_len; i++) {
+    const size_t lo = sflz4_private_min_size_t(i * segment_len, src_len);
+    const size_t hi = sflz4_private_min_size_t(lo + segment_len, src_len);
+    segments_ptr[i].encoded_offset = (size_t)(dp - dst_ptr);
+    segments_ptr[i].decoded_offset = (size_t)(literal_start - src_ptr);
+
+    // Each segment's window starts at its first literal, so that its matches
+    // never refer to anything decoded by an earlier segment.
+    memset(hash_table, 0, sizeof(hash_table));
+    sflz4_private_prime_hash_table(hash_table, literal_start, literal_start,
+                                   (size_t)((src_ptr + lo) - literal_start));
+    dp = sflz4_private_encode_sequences(dp, hash_table, literal_start,
+                                        src_ptr + lo, hi - lo,
+                                        src_ptr + src_len, &literal_start);
+  }
+  dp = sflz4_private_emit_literals(
+      dp, literal_start, src_len - (size_t)(literal_start - src_ptr), 0);
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_segmented(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_segment* segments_ptr,            //
+    size_t segments_len) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_encode_segmented(
+      dst_ptr, dst_len, src_ptr, src_len, segments_ptr, segments_len);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_segment(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  return sflz4_private_block_decode_counted(
+      dst_ptr, dst_len, 0, NULL, 0, src_ptr, src_len,
+      SFLZ4_BLOCK_DECODE_FLAGS__ALLOW_TRAILING_MATCH);
+}
+
+// -------- LZ4 Dictionaries
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_dictionary_initialize(    //
+    sflz4_dictionary* d,        //
+    uint32_t id,                //
+    const uint8_t* ptr,         //
+    size_t len) {
+  if (!d || (!ptr && (len > 0))) {
+    return sflz4_status_message__error_bad_argument;
+  } else if (len > SFLZ4_DICTIONARY_MAX_INCL_LEN) {
+    ptr += len - SFLZ4_DICTIONARY_MAX_INCL_LEN;
+    len = SFLZ4_DICTIONARY_MAX_INCL_LEN;
+  } else if (len < 4) {
+    // The encoder reads 4 bytes at every match candidate, including an empty
+    // hash table slot's candidate: the dictionary's first byte.
+    len = 0;
+  }
+  d->private_id = id;
+  d->private_ptr = ptr;
+  d->private_len = len;
+  memset(d->private_hash_table, 0, sizeof(d->private_hash_table));
+  sflz4_private_prime_hash_table(d->private_hash_table, ptr, ptr, len);
+  return NULL;
+}
+
+static sflz4_size_result                     //
+sflz4_private_block_encode_with_dictionary(  //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,         //
+    size_t dst_len,                          //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,   //
+    size_t src_len,                          //
+    const sflz4_dictionary* d) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (!d) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    result.value = 0;
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT];
+  memcpy(hash_table, d->private_hash_table, sizeof(hash_table));
+
+  const uint8_t* literal_start = src_ptr;
+  uint8_t* dp = sflz4_private_encode_sequences_with_dict(
+      dst_ptr, hash_table, d->private_ptr, d->private_len, src_ptr, src_ptr,
+      src_len, src_ptr + src_len, &literal_start);
+  dp = sflz4_private_emit_literals(
+      dp, literal_start, src_len - (size_t)(literal_start - src_ptr), 0);
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_encode_with_dictionary(         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary* d) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_block_encode_with_dictionary(
+      dst_ptr, dst_len, src_ptr, src_len, d);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_block_decode_with_dictionary(         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary* d) {
+  if (!d) {
+    const uint64_t start_time = sflz4_private_telemetry_now();
+    sflz4_size_result result = {NULL, 0};
+    result.status_message = sflz4_status_message__error_bad_argument;
+    sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_DECODE,
+                                   start_time, src_len, result);
+    return result;
+  }
+  return sflz4_private_block_decode_counted(dst_ptr, dst_len, 0,
+                                            d->private_ptr, d->private_len,
+                                            src_ptr, src_len, 0);
+}
+
+// A registry's entries are append-only. Adders hold the lock while they
+// check for duplicates and append. The count is published (with release
+// semantics) after the new entry is written, so that lock-free finders
+// (loading the count with acquire semantics) only see complete entries.
+
+SFLZ4_MAYBE_STATIC void                    //
+sflz4_dictionary_registry_initialize(      //
+    sflz4_dictionary_registry* r,          //
+    const sflz4_dictionary** entries_ptr,  //
+    size_t entries_len) {
+  r->private_lock = 0;
+  r->private_count = 0;
+  r->private_capacity = entries_ptr ? entries_len : 0;
+  r->private_entries = entries_ptr;
+}
+
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_dictionary_registry_add(     //
+    sflz4_dictionary_registry* r,  //
+    const sflz4_dictionary* d) {
+  if (!d) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  const char* status_message = NULL;
+  sflz4_private_lock(&r->private_lock);
+  const size_t n = r->private_count;
+  for (size_t i = 0; i < n; i++) {
+    if (r->private_entries[i]->private_id == d->private_id) {
+      status_message = sflz4_status_message__error_bad_argument;
+      goto unlock;
+    }
+  }
+  if (n >= r->private_capacity) {
+    status_message = sflz4_status_message__error_workspace_is_too_short;
+    goto unlock;
+  }
+  r->private_entries[n] = d;
+  sflz4_private_store_release_size_t(&r->private_count, n + 1);
+unlock:
+  sflz4_private_unlock(&r->private_lock);
+  return status_message;
+}
+
+SFLZ4_MAYBE_STATIC const sflz4_dictionary*  //
+sflz4_dictionary_registry_find(             //
+    const sflz4_dictionary_registry* r,     //
+    uint32_t id) {
+  if (!r) {
+    return NULL;
+  }
+  const size_t n = sflz4_private_load_acquire_size_t(&r->private_count);
+  for (size_t i = 0; i < n; i++) {
+    if (r->private_entries[i]->private_id == id) {
+      return r->private_entries[i];
+    }
+  }
+  return NULL;
+}
+
+// -------- LZ4 Frame
+
+#define SFLZ4_FRAME_MAGIC 0x184D2204
+#define SFLZ4_FRAME_SKIPPABLE_MAGIC_MASK 0xFFFFFFF0
+#define SFLZ4_FRAME_SKIPPABLE_MAGIC 0x184D2A50
+
+// SFLZ4_FRAME_FLG__ETC are bits of the frame descriptor's FLG byte. The
+// version number, in the high two bits, must be 0b01.
+#define SFLZ4_FRAME_FLG__VERSION_MASK 0xC0
+#define SFLZ4_FRAME_FLG__VERSION_01 0x40
+#define SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS 0x20
+#define SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS 0x10
+#define SFLZ4_FRAME_FLG__CONTENT_SIZE 0x08
+#define SFLZ4_FRAME_FLG__CONTENT_CHECKSUM 0x04
+#define SFLZ4_FRAME_FLG__RESERVED 0x02
+#define SFLZ4_FRAME_FLG__DICT_ID 0x01
+
+// SFLZ4_FRAME_HEADER_MAX_INCL_LEN is the maximum (inclusive) length of a
+// frame header: 4 bytes magic, 2 bytes FLG and BD, 8 bytes content size, 4
+// bytes dictionary ID and 1 byte header checksum.
+#define SFLZ4_FRAME_HEADER_MAX_INCL_LEN 19
+
+// SFLZ4_FRAME_UNCOMPRESSED_BIT marks (in a block's length prefix) a block
+// whose data is stored verbatim.
+#define SFLZ4_FRAME_UNCOMPRESSED_BIT 0x80000000
+
+// SFLZ4_SEEK_TABLE_MAGIC is a skippable frame magic number. The "E" nibble
+// distinguishes it from other skippable frames. A seek table's overhead is
+// 8 bytes (magic and length) for its skippable frame header and 8 bytes for
+// its footer, plus 8 bytes per block.
+#define SFLZ4_SEEK_TABLE_MAGIC 0x184D2A5E
+#define SFLZ4_SEEK_TABLE_FOOTER_MAGIC 0x4B53345A
+#define SFLZ4_SEEK_TABLE_OVERHEAD_LEN 16
+
+#define SFLZ4_XXH32_PRIME1 2654435761u
+#define SFLZ4_XXH32_PRIME2 2246822519u
+#define SFLZ4_XXH32_PRIME3 3266489917u
+#define SFLZ4_XXH32_PRIME4 668265263u
+#define SFLZ4_XXH32_PRIME5 374761393u
+
+static inline uint32_t  //
+sflz4_private_rotl32(   //
+    uint32_t x,         //
+    uint32_t n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+// sflz4_private_xxh32 returns the xxHash-32 checksum of p[0 .. p_len). See
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+static uint32_t        //
+sflz4_private_xxh32(   //
+    const uint8_t* p,  //
+    size_t p_len,      //
+    uint32_t seed) {
+  const uint32_t len32 = (uint32_t)p_len;
+  uint32_t h;
+  if (p_len >= 16) {
+    uint32_t v1 = seed + SFLZ4_XXH32_PRIME1 + SFLZ4_XXH32_PRIME2;
+    uint32_t v2 = seed + SFLZ4_XXH32_PRIME2;
+    uint32_t v3 = seed;
+    uint32_t v4 = seed - SFLZ4_XXH32_PRIME1;
+    for (; p_len >= 16; p_len -= 16, p += 16) {
+      v1 = sflz4_private_rotl32(
+               v1 + (sflz4_private_peek_u32le(p + 0) * SFLZ4_XXH32_PRIME2),
+               13) *
+           SFLZ4_XXH32_PRIME1;
+      v2 = sflz4_private_rotl32(
+               v2 + (sflz4_private_peek_u32le(p + 4) * SFLZ4_XXH32_PRIME2),
+               13) *
+           SFLZ4_XXH32_PRIME1;
+      v3 = sflz4_private_rotl32(
+               v3 + (sflz4_private_peek_u32le(p + 8) * SFLZ4_XXH32_PRIME2),
+               13) *
+           SFLZ4_XXH32_PRIME1;
+      v4 = sflz4_private_rotl32(
+               v4 + (sflz4_private_peek_u32le(p + 12) * SFLZ4_XXH32_PRIME2),
+               13) *
+           SFLZ4_XXH32_PRIME1;
+    }
+    h = sflz4_private_rotl32(v1, 1) + sflz4_private_rotl32(v2, 7) +
+        sflz4_private_rotl32(v3, 12) + sflz4_private_rotl32(v4, 18);
+  } else {
+    h = seed + SFLZ4_XXH32_PRIME5;
+  }
+
+  h += len32;
+  for (; p_len >= 4; p_len -= 4, p += 4) {
+    h += sflz4_private_peek_u32le(p) * SFLZ4_XXH32_PRIME3;
+    h = sflz4_private_rotl32(h, 17) * SFLZ4_XXH32_PRIME4;
+  }
+  for (; p_len > 0; p_len--, p++) {
+    h += ((uint32_t)(*p)) * SFLZ4_XXH32_PRIME5;
+    h = sflz4_private_rotl32(h, 11) * SFLZ4_XXH32_PRIME1;
+  }
+
+  h ^= h >> 15;
+  h *= SFLZ4_XXH32_PRIME2;
+  h ^= h >> 13;
+  h *= SFLZ4_XXH32_PRIME3;
+  h ^= h >> 16;
+  return h;
+}
+
+typedef struct sflz4_private_frame_header_struct {
+  uint32_t flg;
+  size_t block_max_len;
+  uint64_t content_size;
+  uint32_t dict_id;
+  size_t header_len;
+} sflz4_private_frame_header;
+
+// sflz4_private_frame_parse_header parses the frame header (including the
+// magic number) at the start of src, returning NULL on success or a status
+// message on failure.
+static const char*                  //
+sflz4_private_frame_parse_header(   //
+    sflz4_private_frame_header* h,  //
+    const uint8_t* src_ptr,         //
+    size_t src_len) {
+  if ((src_len < 7) ||
+      (sflz4_private_peek_u32le(src_ptr) != SFLZ4_FRAME_MAGIC)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint32_t flg = src_ptr[4];
+  const uint32_t bd = src_ptr[5];
+  if (((flg & SFLZ4_FRAME_FLG__VERSION_MASK) != SFLZ4_FRAME_FLG__VERSION_01) ||
+      ((flg & SFLZ4_FRAME_FLG__RESERVED) != 0) ||  //
+      ((bd & 0x8F) != 0) ||                        //
+      ((bd >> 4) < 4)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+
+  size_t n = 6;
+  h->flg = flg;
+  h->block_max_len = ((size_t)1) << (8 + (2 * (bd >> 4)));
+  h->content_size = 0;
+  h->dict_id = 0;
+  if (flg & SFLZ4_FRAME_FLG__CONTENT_SIZE) {
+    if ((src_len - n) < 8) {
+      return sflz4_status_message__error_invalid_data;
+    }
+    h->content_size = sflz4_private_peek_u64le(src_ptr + n);
+    n += 8;
+  }
+  if (flg & SFLZ4_FRAME_FLG__DICT_ID) {
+    if ((src_len - n) < 4) {
+      return sflz4_status_message__error_invalid_data;
+    }
+    h->dict_id = sflz4_private_peek_u32le(src_ptr + n);
+    n += 4;
+  }
+  if ((src_len - n) < 1) {
+    return sflz4_status_message__error_invalid_data;
+  } else if (src_ptr[n] !=
+             (uint8_t)(sflz4_private_xxh32(src_ptr + 4, n - 4, 0) >> 8)) {
+    return sflz4_status_message__error_bad_checksum;
+  }
+  h->header_len = n + 1;
+  return NULL;
+}
+
+// sflz4_private_frame_write_header writes a frame header (including the
+// magic number) to dp, returning the advanced dp. The content_size and
+// dict_id are only written if flg has the corresponding bits set.
+static uint8_t*                    //
+sflz4_private_frame_write_header(  //
+    uint8_t* SFLZ4_RESTRICT dp,    //
+    uint32_t flg,                  //
+    size_t block_max_len,          //
+    uint64_t content_size,         //
+    uint32_t dict_id) {
+  sflz4_private_poke_u32le(dp, SFLZ4_FRAME_MAGIC);
+  uint8_t* const descriptor = dp + 4;
+  uint32_t bd = 4;
+  while ((((size_t)1) << (8 + (2 * bd))) < block_max_len) {
+    bd++;
+  }
+  descriptor[0] = (uint8_t)flg;
+  descriptor[1] = (uint8_t)(bd << 4);
+  dp = descriptor + 2;
+  if (flg & SFLZ4_FRAME_FLG__CONTENT_SIZE) {
+    sflz4_private_poke_u64le(dp, content_size);
+    dp += 8;
+  }
+  if (flg & SFLZ4_FRAME_FLG__DICT_ID) {
+    sflz4_private_poke_u32le(dp, dict_id);
+    dp += 4;
+  }
+  *dp = (uint8_t)(sflz4_private_xxh32(descriptor, (size_t)(dp - descriptor),
+                                      0) >>
+                  8);
+  return dp + 1;
+}
+
+// sflz4_private_frame_encode_block writes one frame block (its length prefix,
+// its data and, optionally, its checksum) for the src_len bytes at src_ptr,
+// returning the advanced dp. The arguments are otherwise as per
+// sflz4_private_encode_sequences_with_dict. There must be room for the length
+// prefix, the worst case block encoding and the checksum.
+static uint8_t*                           //
+sflz4_private_frame_encode_block(         //
+    uint8_t* SFLZ4_RESTRICT dp,           //
+    uint32_t* SFLZ4_RESTRICT hash_table,  //
+    const uint8_t* dict_ptr,              //
+    size_t dict_len,                      //
+    const uint8_t* window_ptr,            //
+    const uint8_t* src_ptr,               //
+    size_t src_len,                       //
+    uint32_t flg) {
+  uint8_t* const data = dp + 4;
+  const uint8_t* literal_start = src_ptr;
+  uint8_t* q =
+      (dict_len == 0)
+          ? sflz4_private_encode_sequences(data, hash_table, window_ptr,
+                                           src_ptr, src_len, src_ptr + src_len,
+                                           &literal_start)
+          : sflz4_private_encode_sequences_with_dict(
+                data, hash_table, dict_ptr, dict_len, window_ptr, src_ptr,
+                src_len, src_ptr + src_len, &literal_start);
+  q = sflz4_private_emit_literals(
+      q, literal_start, src_len - (size_t)(literal_start - src_ptr), 0);
+
+  size_t n = (size_t)(q - data);
+  if (n < src_len) {
+    sflz4_private_poke_u32le(dp, (uint32_t)n);
+  } else {
+    n = src_len;
+    memcpy(data, src_ptr, n);
+    sflz4_private_poke_u32le(dp, ((uint32_t)n) | SFLZ4_FRAME_UNCOMPRESSED_BIT);
+  }
+  dp = data + n;
+  if (flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) {
+    sflz4_private_poke_u32le(dp, sflz4_private_xxh32(data, n, 0));
+    dp += 4;
+  }
+  return dp;
+}
+
+// sflz4_private_frame_encode_counted_block is
+// sflz4_private_frame_encode_block that also counts (for telemetry) as a
+// SFLZ4_TELEMETRY_OP__BLOCK_ENCODE call. Framings other than
+// sflz4_frame_encode (which counts as one frame call) use it.
+static uint8_t*                            //
+sflz4_private_frame_encode_counted_block(  //
+    uint8_t* SFLZ4_RESTRICT dp,            //
+    uint32_t* SFLZ4_RESTRICT hash_table,   //
+    const uint8_t* window_ptr,             //
+    const uint8_t* src_ptr,                //
+    size_t src_len,                        //
+    uint32_t flg) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  uint8_t* const dp_end = sflz4_private_frame_encode_block(
+      dp, hash_table, NULL, 0, window_ptr, src_ptr, src_len, flg);
+  const sflz4_size_result counted = {NULL, (size_t)(dp_end - dp)};
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE, start_time,
+                                 src_len, counted);
+  return dp_end;
+}
+
+// sflz4_private_frame_write_seek_table writes a seek table (a skippable frame)
+// for the blocks in [blocks_start, blocks_end), returning the advanced dp.
+// Every block but the last decodes to block_max_len bytes.
+static uint8_t*                                //
+sflz4_private_frame_write_seek_table(          //
+    uint8_t* SFLZ4_RESTRICT dp,                //
+    const uint8_t* SFLZ4_RESTRICT blocks_ptr,  //
+    const uint8_t* blocks_end,                 //
+    uint32_t flg,                              //
+    size_t block_max_len,                      //
+    size_t src_len) {
+  const size_t checksum_len =
+      (flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+  uint8_t* const table = dp + 8;
+  uint8_t* q = table;
+  while (blocks_ptr < blocks_end) {
+    const size_t n = 4 + checksum_len +
+                     (sflz4_private_peek_u32le(blocks_ptr) &
+                      ~SFLZ4_FRAME_UNCOMPRESSED_BIT);
+    const size_t m = sflz4_private_min_size_t(src_len, block_max_len);
+    sflz4_private_poke_u32le(q + 0, (uint32_t)n);
+    sflz4_private_poke_u32le(q + 4, (uint32_t)m);
+    q += 8;
+    blocks_ptr += n;
+    src_len -= m;
+  }
+  sflz4_private_poke_u32le(q + 0, (uint32_t)((size_t)(q - table) / 8));
+  sflz4_private_poke_u32le(q + 4, SFLZ4_SEEK_TABLE_FOOTER_MAGIC);
+  q += 8;
+  sflz4_private_poke_u32le(dp + 0, SFLZ4_SEEK_TABLE_MAGIC);
+  sflz4_private_poke_u32le(dp + 4, (uint32_t)(q - table));
+  return q;
+}
+
+// sflz4_private_rebase_hash_table subtracts delta from every hash_table value
+// (clamping at zero), for when the hash table's window_ptr moves forward by
+// delta bytes.
+static inline void                        //
+sflz4_private_rebase_hash_table(          //
+    uint32_t* SFLZ4_RESTRICT hash_table,  //
+    uint32_t delta) {
+  for (size_t i = 0; i < (1 << SFLZ4_HASH_TABLE_SHIFT); i++) {
+    uint32_t v = hash_table[i];
+    hash_table[i] = (v > delta) ? (v - delta) : 0;
+  }
+}
+
+static inline uint32_t    //
+sflz4_private_frame_flg(  //
+    uint32_t encode_flags) {
+  uint32_t flg = SFLZ4_FRAME_FLG__VERSION_01;
+  if (!(encode_flags & SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS)) {
+    flg |= SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS;
+  }
+  if (encode_flags & SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS) {
+    flg |= SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS;
+  }
+  if (encode_flags & SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_CHECKSUM) {
+    flg |= SFLZ4_FRAME_FLG__CONTENT_CHECKSUM;
+  }
+  if (encode_flags & SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_SIZE) {
+    flg |= SFLZ4_FRAME_FLG__CONTENT_SIZE;
+  }
+  return flg;
+}
+
+SFLZ4_MAYBE_STATIC size_t                   //
+sflz4_frame_auto_block_max_len(             //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags,                         //
+    size_t num_threads) {
+  // Linked blocks compress about as well at every block length, as their
+  // history carries over, so cap them at 256 KiB, which bounds a streaming
+  // decoder's memory requirements. Otherwise, use the shortest block length
+  // that holds all of src.
+  const size_t max_incl_len =
+      (flags & SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS) ? 0x40000 : 0x400000;
+  size_t n = 0x10000;
+  while ((n < max_incl_len) && (n < src_len)) {
+    n <<= 2;
+  }
+  if ((num_threads <= 1) || (flags & SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS)) {
+    return n;
+  }
+
+  // Every independent block starts with an empty history, which costs more
+  // when src is more compressible. Ask for one block per thread when src is
+  // very compressible (better ratio), four when it is barely compressible
+  // (better load balancing, for a negligible ratio cost) and two otherwise.
+  const size_t sample_len = sflz4_private_min_size_t(
+      src_len, SFLZ4_LZ4_BLOCK_ENCODE_MAX_INCL_SRC_LEN);
+  const size_t estimate =
+      sflz4_block_estimate_encoded_len(src_ptr, sample_len).value;
+  uint64_t num_blocks_wanted = 2 * (uint64_t)num_threads;
+  if (estimate <= (sample_len / 2)) {
+    num_blocks_wanted = num_threads;
+  } else if (estimate >= ((sample_len / 10) * 9)) {
+    num_blocks_wanted = 4 * (uint64_t)num_threads;
+  }
+  while ((n > 0x10000) &&
+         ((((uint64_t)src_len) + n - 1) / n) < num_blocks_wanted) {
+    n >>= 2;
+  }
+  return n;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result    //
+sflz4_frame_encode_worst_case_dst_len(  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  // In the worst case, every 64 KiB block is stored uncompressed, with a
+  // 4 byte length prefix, a 4 byte checksum and an 8 byte seek table entry.
+  // Encoding a block needs some slack, for
+  // sflz4_block_encode_worst_case_dst_len, before it can be rejected in favor
+  // of storing it uncompressed.
+  const uint64_t n = ((uint64_t)src_len) +
+                     (16 * ((((uint64_t)src_len) + 0xFFFF) >> 16)) +
+                     (sflz4_private_min_size_t(src_len, 0x400000) / 255) +
+                     (SFLZ4_FRAME_HEADER_MAX_INCL_LEN + 4 + 4 + 16 +
+                      SFLZ4_SEEK_TABLE_OVERHEAD_LEN);
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+static sflz4_size_result                    //
+sflz4_private_frame_encode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_frame_encode_options* options) {
+  sflz4_size_result result = sflz4_frame_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result.value = 0;
+
+  sflz4_frame_encode_options default_options;
+  memset(&default_options, 0, sizeof(default_options));
+  if (!options) {
+    options = &default_options;
+  }
+  size_t block_max_len = options->block_max_len;
+  if (block_max_len == 0) {
+    block_max_len = sflz4_frame_auto_block_max_len(
+        src_ptr, src_len, options->flags, options->num_threads);
+  } else if ((block_max_len != 0x10000) && (block_max_len != 0x40000) &&
+             (block_max_len != 0x100000) && (block_max_len != 0x400000)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  const sflz4_dictionary* const dictionary = options->dictionary;
+  uint32_t flg = sflz4_private_frame_flg(options->flags);
+  if (dictionary) {
+    flg |= SFLZ4_FRAME_FLG__DICT_ID;
+  }
+  uint8_t* dp = sflz4_private_frame_write_header(
+      dst_ptr, flg, block_max_len, src_len,
+      dictionary ? dictionary->private_id : 0);
+  uint8_t* const blocks_start = dp;
+
+  // For linked blocks, the hash table's values are offsets relative to
+  // window_ptr, which moves forward (every 1 GiB) to avoid overflowing the
+  // 32-bit values. For independent blocks, window_ptr is the block start.
+  //
+  // A dictionary (if any) virtually precedes window_ptr. Every independent
+  // block starts afresh from its digested hash table. Linked blocks only
+  // need it for the first block(s), and it is dropped once window_ptr moves.
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT] = {0};
+  const uint8_t* dict_ptr = NULL;
+  size_t dict_len = 0;
+  if (dictionary) {
+    memcpy(hash_table, dictionary->private_hash_table, sizeof(hash_table));
+    dict_ptr = dictionary->private_ptr;
+    dict_len = dictionary->private_len;
+  }
+  const uint8_t* window_ptr = src_ptr;
+  for (size_t i = 0; i < src_len;) {
+    const uint8_t* const block_ptr = src_ptr + i;
+    const size_t n = sflz4_private_min_size_t(src_len - i, block_max_len);
+    if (!(flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS)) {
+      if (((size_t)(block_ptr - window_ptr)) > 0x40000000) {
+        const size_t delta = (size_t)(block_ptr - window_ptr) - 0x10000;
+        sflz4_private_rebase_hash_table(hash_table,
+                                        (uint32_t)(delta + dict_len));
+        window_ptr += delta;
+        dict_ptr = NULL;
+        dict_len = 0;
+      }
+    } else if (i > 0) {
+      if (dictionary) {
+        memcpy(hash_table, dictionary->private_hash_table, sizeof(hash_table));
+      } else {
+        memset(hash_table, 0, sizeof(hash_table));
+      }
+      window_ptr = block_ptr;
+    }
+    dp = sflz4_private_frame_encode_block(dp, hash_table, dict_ptr, dict_len,
+                                          window_ptr, block_ptr, n, flg);
+    i += n;
+  }
+
+  uint8_t* const blocks_end = dp;
+  sflz4_private_poke_u32le(dp, 0);
+  dp += 4;
+  if (flg & SFLZ4_FRAME_FLG__CONTENT_CHECKSUM) {
+    sflz4_private_poke_u32le(dp, sflz4_private_xxh32(src_ptr, src_len, 0));
+    dp += 4;
+  }
+  if (options->flags & SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE) {
+    dp = sflz4_private_frame_write_seek_table(dp, blocks_start, blocks_end,
+                                              flg, block_max_len, src_len);
+  }
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_encode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_frame_encode_options* options) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result =
+      sflz4_private_frame_encode(dst_ptr, dst_len, src_ptr, src_len, options);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__FRAME_ENCODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// sflz4_private_frame_decode_blocks decodes a frame's blocks (after its header)
+// up to and including the end marker, writing to dst and returning the number
+// of bytes written. It sets *src_consumed to the number of src bytes read.
+//
+// The first dst_prefix_len bytes of dst are history that linked blocks'
+// matches may refer to. They are not counted in the returned value and
+// dst_len excludes them. Every block's matches may also refer back into the
+// dict_len bytes at dict_ptr, as per sflz4_private_block_decode_with_dict.
+static sflz4_size_result                    //
+sflz4_private_frame_decode_blocks(          //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    size_t dst_prefix_len,                  //
+    const uint8_t* dict_ptr,                //
+    size_t dict_len,                        //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_private_frame_header* h,    //
+    size_t* src_consumed) {
+  sflz4_size_result result = {NULL, 0};
+  const uint8_t* const original_src_ptr = src_ptr;
+  uint8_t* const data_ptr = dst_ptr + dst_prefix_len;
+  uint8_t* dp = data_ptr;
+  const size_t checksum_len =
+      (h->flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+
+  while (1) {
+    if (src_len < 4) {
+      goto fail_invalid_data;
+    }
+    const uint32_t block_header = sflz4_private_peek_u32le(src_ptr);
+    src_ptr += 4;
+    src_len -= 4;
+    if (block_header == 0) {
+      break;
+    }
+    const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+    if ((n > h->block_max_len) || (n > src_len) ||
+        (checksum_len > (src_len - n))) {
+      goto fail_invalid_data;
+    } else if (checksum_len && (sflz4_private_xxh32(src_ptr, n, 0) !=
+                                sflz4_private_peek_u32le(src_ptr + n))) {
+      result.status_message = sflz4_status_message__error_bad_checksum;
+      return result;
+    }
+
+    const size_t dst_remaining = dst_len - (size_t)(dp - data_ptr);
+    if (block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) {
+      if (n > dst_remaining) {
+        result.status_message = sflz4_status_message__error_dst_is_too_short;
+        return result;
+      }
+      memcpy(dp, src_ptr, n);
+      dp += n;
+    } else {
+      const size_t prefix_len =
+          (h->flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS)
+              ? 0
+              : (size_t)(dp - dst_ptr);
+      sflz4_size_result r = sflz4_private_block_decode_with_dict(
+          dp, sflz4_private_min_size_t(dst_remaining, h->block_max_len),
+          prefix_len, dict_ptr, dict_len, src_ptr, n, 0);
+      if (r.status_message) {
+        if ((r.status_message ==
+             sflz4_status_message__error_dst_is_too_short) &&
+            (dst_remaining > h->block_max_len)) {
+          goto fail_invalid_data;
+        }
+        return r;
+      }
+      dp += r.value;
+    }
+    src_ptr += n + checksum_len;
+    src_len -= n + checksum_len;
+  }
+
+  if ((h->flg & SFLZ4_FRAME_FLG__CONTENT_SIZE) &&
+      (h->content_size != (uint64_t)(dp - data_ptr))) {
+    goto fail_invalid_data;
+  }
+  if (h->flg & SFLZ4_FRAME_FLG__CONTENT_CHECKSUM) {
+    if (src_len < 4) {
+      goto fail_invalid_data;
+    } else if (sflz4_private_xxh32(data_ptr, (size_t)(dp - data_ptr), 0) !=
+               sflz4_private_peek_u32le(src_ptr)) {
+      result.status_message = sflz4_status_message__error_bad_checksum;
+      return result;
+    }
+    src_ptr += 4;
+  }
+
+  *src_consumed = (size_t)(src_ptr - original_src_ptr);
+  result.value = (size_t)(dp - data_ptr);
+  return result;
+
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_decode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  return sflz4_frame_decode_with_dictionaries(dst_ptr, dst_len, src_ptr,
+                                              src_len, NULL);
+}
+
+static sflz4_size_result                    //
+sflz4_private_frame_decode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary_registry* registry) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len == 0) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+
+  uint8_t* dp = dst_ptr;
+  while (src_len > 0) {
+    if (src_len < 8) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    const uint32_t magic = sflz4_private_peek_u32le(src_ptr);
+    if ((magic & SFLZ4_FRAME_SKIPPABLE_MAGIC_MASK) ==
+        SFLZ4_FRAME_SKIPPABLE_MAGIC) {
+      const uint32_t n = sflz4_private_peek_u32le(src_ptr + 4);
+      if (n > (src_len - 8)) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+      src_ptr += 8 + n;
+      src_len -= 8 + n;
+      continue;
+    }
+
+    sflz4_private_frame_header h;
+    const char* status_message =
+        sflz4_private_frame_parse_header(&h, src_ptr, src_len);
+    if (status_message) {
+      result.status_message = status_message;
+      return result;
+    }
+    const sflz4_dictionary* dictionary = NULL;
+    if (h.flg & SFLZ4_FRAME_FLG__DICT_ID) {
+      dictionary = sflz4_dictionary_registry_find(registry, h.dict_id);
+      if (!dictionary) {
+        result.status_message =
+            sflz4_status_message__error_unsupported_feature;
+        return result;
+      }
+    }
+    src_ptr += h.header_len;
+    src_len -= h.header_len;
+
+    size_t n = 0;
+    sflz4_size_result r = sflz4_private_frame_decode_blocks(
+        dp, dst_len - (size_t)(dp - dst_ptr), 0,
+        dictionary ? dictionary->private_ptr : NULL,
+        dictionary ? dictionary->private_len : 0, src_ptr, src_len, &h, &n);
+    if (r.status_message) {
+      return r;
+    }
+    dp += r.value;
+    src_ptr += n;
+    src_len -= n;
+  }
+
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_decode_with_dictionaries(       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    const sflz4_dictionary_registry* registry) {
+  const uint64_t start_time = sflz4_private_telemetry_now();
+  const sflz4_size_result result = sflz4_private_frame_decode(
+      dst_ptr, dst_len, src_ptr, src_len, registry);
+  sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__FRAME_DECODE, start_time,
+                                 src_len, result);
+  return result;
+}
+
+// -------- LZ4 Frame Random Access
+
+// sflz4_private_block_decoded_len returns the number of bytes that
+// sflz4_block_decode would write, for the given src, without writing them.
+static sflz4_size_result          //
+sflz4_private_block_decoded_len(  //
+    const uint8_t* src_ptr,       //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t n = 0;
+  while (src_len > 0) {
+    uint32_t token = *src_ptr++;
+    src_len--;
+
+    uint64_t literal_len = token >> 4;
+    if (literal_len == 15) {
+      while (1) {
+        if (src_len == 0) {
+          goto fail_invalid_data;
+        }
+        uint32_t s = *src_ptr++;
+        src_len--;
+        literal_len += s;
+        if (s != 255) {
+          break;
+        }
+      }
+    }
+    if (literal_len > src_len) {
+      goto fail_invalid_data;
+    }
+    n += literal_len;
+    src_ptr += literal_len;
+    src_len -= (size_t)literal_len;
+    if (src_len == 0) {
+      if (n > SIZE_MAX) {
+        goto fail_invalid_data;
+      }
+      result.value = (size_t)n;
+      return result;
+    } else if (src_len < 2) {
+      goto fail_invalid_data;
+    }
+
+    uint32_t copy_off = ((uint32_t)src_ptr[0]) | (((uint32_t)src_ptr[1]) << 8);
+    src_ptr += 2;
+    src_len -= 2;
+    if ((copy_off == 0) || (copy_off > n)) {
+      goto fail_invalid_data;
+    }
+    uint64_t copy_len = (token & 15) + 4;
+    if (copy_len == 19) {
+      while (1) {
+        if (src_len == 0) {
+          goto fail_invalid_data;
+        }
+        uint32_t s = *src_ptr++;
+        src_len--;
+        copy_len += s;
+        if (s != 255) {
+          break;
+        }
+      }
+    }
+    n += copy_len;
+  }
+
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_index_blocks(                   //
+    sflz4_frame_block* blocks_ptr,          //
+    size_t blocks_len,                      //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_frame_header h;
+  result.status_message =
+      sflz4_private_frame_parse_header(&h, src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  } else if (!(h.flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS) ||
+             (h.flg & SFLZ4_FRAME_FLG__DICT_ID)) {
+    result.status_message = sflz4_status_message__error_unsupported_feature;
+    return result;
+  }
+  const size_t checksum_len =
+      (h.flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+  const size_t content_checksum_len =
+      (h.flg & SFLZ4_FRAME_FLG__CONTENT_CHECKSUM) ? 4 : 0;
+
+  // Look for a seek table at the end of src. It has to describe this frame:
+  // the frame has to end exactly where the seek table starts.
+  if ((src_len - h.header_len) >= (4 + SFLZ4_SEEK_TABLE_OVERHEAD_LEN) &&
+      (sflz4_private_peek_u32le(src_ptr + src_len - 4) ==
+       SFLZ4_SEEK_TABLE_FOOTER_MAGIC)) {
+    const uint64_t num_blocks = sflz4_private_peek_u32le(src_ptr + src_len - 8);
+    const uint64_t table_len = (8 * num_blocks) + 8;
+    if ((table_len + 8) <= (src_len - h.header_len)) {
+      const uint8_t* const table = src_ptr + src_len - table_len;
+      if ((sflz4_private_peek_u32le(table - 8) == SFLZ4_SEEK_TABLE_MAGIC) &&
+          (sflz4_private_peek_u32le(table - 4) == table_len)) {
+        uint64_t encoded_offset = h.header_len;
+        uint64_t decoded_offset = 0;
+        if (blocks_ptr && (blocks_len <= num_blocks)) {
+          result.status_message = sflz4_status_message__error_dst_is_too_short;
+          return result;
+        }
+        for (size_t i = 0; i < num_blocks; i++) {
+          if (blocks_ptr) {
+            blocks_ptr[i].encoded_offset = encoded_offset;
+            blocks_ptr[i].decoded_offset = decoded_offset;
+          }
+          // Cross-check each entry against its block's header, which costs
+          // one (likely cache-missing) load per block but no decoding. For
+          // uncompressed blocks, that also checks the decoded length, as
+          // sflz4_reader_read_at copies them without decoding.
+          const uint32_t encoded_len =
+              sflz4_private_peek_u32le(table + (8 * i) + 0);
+          const uint32_t decoded_len =
+              sflz4_private_peek_u32le(table + (8 * i) + 4);
+          if ((encoded_offset + 4) > (uint64_t)(table - src_ptr)) {
+            result.status_message = sflz4_status_message__error_invalid_data;
+            return result;
+          }
+          const uint32_t block_header =
+              sflz4_private_peek_u32le(src_ptr + encoded_offset);
+          const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+          if ((block_header == 0) ||
+              (encoded_len != (4 + n + checksum_len)) ||
+              (decoded_len > h.block_max_len) ||
+              ((block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) &&
+               (decoded_len != n))) {
+            result.status_message = sflz4_status_message__error_invalid_data;
+            return result;
+          }
+          encoded_offset += encoded_len;
+          decoded_offset += decoded_len;
+        }
+        if ((encoded_offset + 4 + content_checksum_len + 8) ==
+            (uint64_t)(table - src_ptr)) {
+          if (blocks_ptr) {
+            blocks_ptr[num_blocks].encoded_offset = encoded_offset;
+            blocks_ptr[num_blocks].decoded_offset = decoded_offset;
+          }
+          result.value = (size_t)(num_blocks + 1);
+          return result;
+        }
+      }
+    }
+  }
+
+  // There's no (valid) seek table. Walk the frame instead.
+  size_t encoded_offset = h.header_len;
+  uint64_t decoded_offset = 0;
+  size_t num_blocks = 0;
+  while (1) {
+    if ((src_len - encoded_offset) < 4) {
+      goto fail_invalid_data;
+    } else if (blocks_ptr) {
+      if (blocks_len <= num_blocks) {
+        result.status_message = sflz4_status_message__error_dst_is_too_short;
+        return result;
+      }
+      blocks_ptr[num_blocks].encoded_offset = encoded_offset;
+      blocks_ptr[num_blocks].decoded_offset = decoded_offset;
+    }
+    const uint32_t block_header =
+        sflz4_private_peek_u32le(src_ptr + encoded_offset);
+    if (block_header == 0) {
+      break;
+    }
+    const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+    const size_t remaining = src_len - encoded_offset - 4;
+    if ((n > h.block_max_len) || (n > remaining) ||
+        (checksum_len > (remaining - n))) {
+      goto fail_invalid_data;
+    }
+    if (block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) {
+      decoded_offset += n;
+    } else {
+      sflz4_size_result r = sflz4_private_block_decoded_len(
+          src_ptr + encoded_offset + 4, n);
+      if (r.status_message || (r.value > h.block_max_len)) {
+        goto fail_invalid_data;
+      }
+      decoded_offset += r.value;
+    }
+    encoded_offset += 4 + n + checksum_len;
+    num_blocks++;
+  }
+  result.value = num_blocks + 1;
+  return result;
+
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
+
+#define SFLZ4_READER_SLOT_STATE__EMPTY 0
+#define SFLZ4_READER_SLOT_STATE__LOADING 1
+#define SFLZ4_READER_SLOT_STATE__VALID 2
+
+// sflz4_private_reader_shard is padded to 64 bytes, a common cache line
+// length, so that different shards' locks don't share a cache line.
+typedef struct sflz4_private_reader_shard_struct {
+  volatile uint32_t lock;
+  uint64_t tick;
+  uint8_t padding[48];
+} sflz4_private_reader_shard;
+
+typedef struct sflz4_private_reader_slot_struct {
+  size_t block_index;
+  uint64_t last_used;
+  uint32_t state;
+  uint32_t pins;
+} sflz4_private_reader_slot;
+
+static inline size_t        //
+sflz4_private_round_up_64(  //
+    size_t n) {
+  return (n + 63) & ~((size_t)63);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_reader_workspace_len(           //
+    size_t block_max_len,             //
+    size_t num_slots,                 //
+    size_t num_shards) {
+  sflz4_size_result result = {NULL, 0};
+  if ((num_shards == 0) || (num_slots < num_shards)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  // The 63 is slack for aligning the workspace to a 64 byte boundary.
+  const uint64_t n =
+      63 + ((uint64_t)num_shards * sizeof(sflz4_private_reader_shard)) +
+      ((((uint64_t)num_slots * sizeof(sflz4_private_reader_slot)) + 63) &
+       ~((uint64_t)63)) +
+      ((uint64_t)num_slots * (uint64_t)block_max_len);
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*            //
+sflz4_reader_initialize(                  //
+    sflz4_reader* r,                      //
+    const uint8_t* src_ptr,               //
+    size_t src_len,                       //
+    const sflz4_frame_block* blocks_ptr,  //
+    size_t blocks_len,                    //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t num_slots,                     //
+    size_t num_shards) {
+  sflz4_private_frame_header h;
+  const char* status_message =
+      sflz4_private_frame_parse_header(&h, src_ptr, src_len);
+  if (status_message) {
+    return status_message;
+  } else if (!(h.flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS) ||
+             (h.flg & SFLZ4_FRAME_FLG__DICT_ID)) {
+    return sflz4_status_message__error_unsupported_feature;
+  } else if (blocks_len == 0) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  sflz4_size_result wl =
+      sflz4_reader_workspace_len(h.block_max_len, num_slots, num_shards);
+  if (wl.status_message) {
+    return wl.status_message;
+  } else if (wl.value > workspace_len) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+
+  uint8_t* p = workspace_ptr + (sflz4_private_round_up_64(
+                                    (size_t)(uintptr_t)workspace_ptr) -
+                                (size_t)(uintptr_t)workspace_ptr);
+  r->private_src_ptr = src_ptr;
+  r->private_src_len = src_len;
+  r->private_blocks_ptr = blocks_ptr;
+  r->private_blocks_len = blocks_len;
+  r->private_block_max_len = h.block_max_len;
+  r->private_flg = h.flg;
+  r->private_num_shards = num_shards;
+  r->private_num_slots = num_slots;
+  r->private_shards = p;
+  memset(p, 0, num_shards * sizeof(sflz4_private_reader_shard));
+  p += num_shards * sizeof(sflz4_private_reader_shard);
+  r->private_slots = p;
+  memset(p, 0, num_slots * sizeof(sflz4_private_reader_slot));
+  p += sflz4_private_round_up_64(num_slots * sizeof(sflz4_private_reader_slot));
+  r->private_slot_data = p;
+  return NULL;
+}
+
+// sflz4_private_reader_decode_block decodes the block_index'th block into
+// dst, which has room for block_max_len bytes.
+static const char*                  //
+sflz4_private_reader_decode_block(  //
+    const sflz4_reader* r,          //
+    uint8_t* dst_ptr,               //
+    size_t block_index) {
+  const sflz4_frame_block* b = r->private_blocks_ptr + block_index;
+  const uint64_t decoded_len = b[1].decoded_offset - b[0].decoded_offset;
+  if ((b->encoded_offset > r->private_src_len) ||
+      ((r->private_src_len - b->encoded_offset) < 4)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint8_t* src_ptr = r->private_src_ptr + b->encoded_offset;
+  const size_t remaining = r->private_src_len - b->encoded_offset - 4;
+  const size_t n = sflz4_private_peek_u32le(src_ptr) &
+                   ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+  const size_t checksum_len =
+      (r->private_flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+  src_ptr += 4;
+  if ((n > remaining) || (checksum_len > (remaining - n))) {
+    return sflz4_status_message__error_invalid_data;
+  } else if (checksum_len && (sflz4_private_xxh32(src_ptr, n, 0) !=
+                              sflz4_private_peek_u32le(src_ptr + n))) {
+    return sflz4_status_message__error_bad_checksum;
+  }
+  sflz4_size_result d = sflz4_private_block_decode_counted(
+      dst_ptr, r->private_block_max_len, 0, NULL, 0, src_ptr, n, 0);
+  if (d.status_message) {
+    return (d.status_message == sflz4_status_message__error_dst_is_too_short)
+               ? sflz4_status_message__error_invalid_data
+               : d.status_message;
+  } else if (d.value != decoded_len) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  return NULL;
+}
+
+// sflz4_private_reader_copy_cached copies n bytes, starting within bytes
+// into the block_index'th block's decoded content, to dst. It decodes (and
+// caches) that block if it isn't already cached.
+static const char*                 //
+sflz4_private_reader_copy_cached(  //
+    sflz4_reader* r,               //
+    uint8_t* dst_ptr,              //
+    size_t block_index,            //
+    size_t within,                 //
+    size_t n) {
+  const size_t shard_index = block_index % r->private_num_shards;
+  sflz4_private_reader_shard* shard =
+      ((sflz4_private_reader_shard*)(r->private_shards)) + shard_index;
+  sflz4_private_reader_slot* slots =
+      (sflz4_private_reader_slot*)(r->private_slots);
+
+  // The shard's slots are every num_shards'th slot, starting at shard_index.
+  sflz4_private_lock(&shard->lock);
+  sflz4_private_reader_slot* slot = NULL;
+  while (1) {
+    sflz4_private_reader_slot* victim = NULL;
+    for (size_t i = shard_index; i < r->private_num_slots;
+         i += r->private_num_shards) {
+      sflz4_private_reader_slot* s = slots + i;
+      if ((s->state != SFLZ4_READER_SLOT_STATE__EMPTY) &&
+          (s->block_index == block_index)) {
+        slot = s;
+        break;
+      } else if ((s->state != SFLZ4_READER_SLOT_STATE__LOADING) &&
+                 (s->pins == 0) &&
+                 (!victim || (victim->last_used > s->last_used))) {
+        victim = s;
+      }
+    }
+
+    if (slot) {
+      if (slot->state == SFLZ4_READER_SLOT_STATE__VALID) {
+        break;
+      }
+      // Another thread is decoding this block. Wait for it.
+      slot = NULL;
+
+    } else if (victim) {
+      // Evict the least recently used slot and decode into it, outside of
+      // the lock. The LOADING state keeps other threads from using it.
+      victim->block_index = block_index;
+      victim->state = SFLZ4_READER_SLOT_STATE__LOADING;
+      victim->pins = 1;
+      victim->last_used = ++shard->tick;
+      sflz4_private_unlock(&shard->lock);
+      const char* status_message = sflz4_private_reader_decode_block(
+          r, r->private_slot_data +
+                 ((size_t)(victim - slots) * r->private_block_max_len),
+          block_index);
+      sflz4_private_lock(&shard->lock);
+      victim->pins = 0;
+      if (status_message) {
+        victim->state = SFLZ4_READER_SLOT_STATE__EMPTY;
+        sflz4_private_unlock(&shard->lock);
+        return status_message;
+      }
+      victim->state = SFLZ4_READER_SLOT_STATE__VALID;
+      slot = victim;
+      break;
+    }
+
+    // Every slot in this shard is busy. Wait for one to become available.
+    sflz4_private_unlock(&shard->lock);
+    sflz4_private_pause();
+    sflz4_private_lock(&shard->lock);
+  }
+
+  // Pin the slot (so that it isn't evicted) while copying out of it.
+  slot->pins++;
+  slot->last_used = ++shard->tick;
+  sflz4_private_unlock(&shard->lock);
+  memcpy(dst_ptr,
+         r->private_slot_data +
+             ((size_t)(slot - slots) * r->private_block_max_len) + within,
+         n);
+  sflz4_private_lock(&shard->lock);
+  slot->pins--;
+  sflz4_private_unlock(&shard->lock);
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_reader_read_at(                 //
+    sflz4_reader* r,                  //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    uint64_t offset) {
+  sflz4_size_result result = {NULL, 0};
+  const sflz4_frame_block* blocks = r->private_blocks_ptr;
+  const size_t num_blocks = r->private_blocks_len - 1;
+
+  while ((dst_len > 0) && (offset < blocks[num_blocks].decoded_offset)) {
+    // Binary search for the last block starting at or before offset.
+    size_t lo = 0;
+    size_t hi = num_blocks;
+    while ((hi - lo) > 1) {
+      size_t mid = lo + ((hi - lo) / 2);
+      if (blocks[mid].decoded_offset <= offset) {
+        lo = mid;
+      } else {
+        hi = mid;
+      }
+    }
+    const uint64_t block_end = blocks[lo + 1].decoded_offset;
+    if ((block_end <= offset) ||
+        ((block_end - blocks[lo].decoded_offset) > r->private_block_max_len)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    const size_t within = (size_t)(offset - blocks[lo].decoded_offset);
+    const size_t n = (size_t)(((block_end - offset) < dst_len)
+                                  ? (block_end - offset)
+                                  : dst_len);
+
+    const uint64_t encoded_offset = blocks[lo].encoded_offset;
+    if ((encoded_offset > r->private_src_len) ||
+        ((r->private_src_len - encoded_offset) < 4)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    const uint8_t* src_ptr = r->private_src_ptr + encoded_offset;
+    const uint32_t block_header = sflz4_private_peek_u32le(src_ptr);
+    if (block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) {
+      // The block's length has to match the index's, or we would silently
+      // return the wrong bytes.
+      const size_t block_len = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+      if ((block_len != (block_end - blocks[lo].decoded_offset)) ||
+          (block_len > (r->private_src_len - encoded_offset - 4))) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+      memcpy(dst_ptr, src_ptr + 4 + within, n);
+    } else {
+      const char* status_message =
+          sflz4_private_reader_copy_cached(r, dst_ptr, lo, within, n);
+      if (status_message) {
+        result.status_message = status_message;
+        return result;
+      }
+    }
+    dst_ptr += n;
+    dst_len -= n;
+    offset += n;
+    result.value += n;
+  }
+  return result;
+}
+
+// -------- LZ4 Page Pool
+
+// A handle is either (SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT | byte_value), for
+// uniform pages, or (1 + ((slab_index << 8) | object_index)). A slab holds at
+// most (SFLZ4_PAGE_POOL_SLAB_LEN / 64) = 256 objects.
+#define SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT 0x80000000
+#define SFLZ4_PAGE_POOL_MAX_INCL_NUM_SLABS 0x007FFFFF
+#define SFLZ4_PAGE_POOL_NONE 0xFFFFFFFF
+
+// Size class i holds objects of ((i + 1) * 64) bytes. The last class holds
+// pages stored verbatim. The others hold a 2 byte length prefix followed by
+// the LZ4 block compressed page.
+#define SFLZ4_PAGE_POOL_NUM_CLASSES 64
+#define SFLZ4_PAGE_POOL_RAW_CLASS 63
+
+typedef struct sflz4_private_page_pool_slab_struct {
+  uint32_t prev;
+  uint32_t next;
+  uint16_t class_index;
+  uint16_t num_live;
+  uint16_t free_head;
+  uint16_t num_carved;
+} sflz4_private_page_pool_slab;
+
+static inline void                        //
+sflz4_private_page_pool_unlink(           //
+    sflz4_page_pool* pool,                //
+    sflz4_private_page_pool_slab* metas,  //
+    uint32_t slab_index) {
+  sflz4_private_page_pool_slab* s = metas + slab_index;
+  if (s->prev != SFLZ4_PAGE_POOL_NONE) {
+    metas[s->prev].next = s->next;
+  } else {
+    pool->private_partial_slabs[s->class_index] = s->next;
+  }
+  if (s->next != SFLZ4_PAGE_POOL_NONE) {
+    metas[s->next].prev = s->prev;
+  }
+}
+
+static inline void                        //
+sflz4_private_page_pool_link(             //
+    sflz4_page_pool* pool,                //
+    sflz4_private_page_pool_slab* metas,  //
+    uint32_t slab_index) {
+  sflz4_private_page_pool_slab* s = metas + slab_index;
+  s->prev = SFLZ4_PAGE_POOL_NONE;
+  s->next = pool->private_partial_slabs[s->class_index];
+  if (s->next != SFLZ4_PAGE_POOL_NONE) {
+    metas[s->next].prev = slab_index;
+  }
+  pool->private_partial_slabs[s->class_index] = slab_index;
+}
+
+// sflz4_private_page_pool_alloc returns the handle of a new object of the
+// given size class, or zero if the arena is full. The pool's lock must be
+// held.
+static uint32_t                 //
+sflz4_private_page_pool_alloc(  //
+    sflz4_page_pool* pool,      //
+    uint32_t class_index) {
+  sflz4_private_page_pool_slab* metas =
+      (sflz4_private_page_pool_slab*)(pool->private_slab_metas);
+  const uint32_t capacity = SFLZ4_PAGE_POOL_SLAB_LEN / ((class_index + 1) * 64);
+
+  uint32_t slab_index = pool->private_partial_slabs[class_index];
+  if (slab_index == SFLZ4_PAGE_POOL_NONE) {
+    if (pool->private_empty_slabs != SFLZ4_PAGE_POOL_NONE) {
+      slab_index = pool->private_empty_slabs;
+      pool->private_empty_slabs = metas[slab_index].next;
+    } else if (pool->private_num_fresh_slabs < pool->private_num_slabs) {
+      slab_index = pool->private_num_fresh_slabs++;
+    } else {
+      return 0;
+    }
+    sflz4_private_page_pool_slab* s = metas + slab_index;
+    s->class_index = (uint16_t)class_index;
+    s->num_live = 0;
+    s->free_head = 0xFFFF;
+    s->num_carved = 0;
+    sflz4_private_page_pool_link(pool, metas, slab_index);
+    pool->private_stats.num_slabs++;
+  }
+
+  sflz4_private_page_pool_slab* s = metas + slab_index;
+  uint32_t object_index = s->free_head;
+  if (object_index != 0xFFFF) {
+    // A free object's first 2 bytes hold the next free object's index.
+    const uint8_t* p = pool->private_slabs_ptr +
+                       ((size_t)slab_index * SFLZ4_PAGE_POOL_SLAB_LEN) +
+                       (object_index * (class_index + 1) * 64);
+    s->free_head = (uint16_t)(((uint32_t)p[0]) | (((uint32_t)p[1]) << 8));
+  } else {
+    object_index = s->num_carved++;
+  }
+  if (++s->num_live == capacity) {
+    sflz4_private_page_pool_unlink(pool, metas, slab_index);
+  }
+  pool->private_stats.num_object_bytes += (class_index + 1) * 64;
+  return 1 + ((slab_index << 8) | object_index);
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_page_pool_initialize(     //
+    sflz4_page_pool* pool,      //
+    uint8_t* arena_ptr,         //
+    size_t arena_len) {
+  memset(pool, 0, sizeof(*pool));
+  for (size_t i = 0; i < SFLZ4_PAGE_POOL_NUM_CLASSES; i++) {
+    pool->private_partial_slabs[i] = SFLZ4_PAGE_POOL_NONE;
+  }
+  pool->private_empty_slabs = SFLZ4_PAGE_POOL_NONE;
+
+  // Slabs start at a 64 byte aligned address. Their metadata goes after them.
+  const size_t align =
+      sflz4_private_round_up_64((size_t)(uintptr_t)arena_ptr) -
+      (size_t)(uintptr_t)arena_ptr;
+  if (arena_len < align) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+  size_t n = (arena_len - align) / (SFLZ4_PAGE_POOL_SLAB_LEN +
+                                    sizeof(sflz4_private_page_pool_slab));
+  if (n == 0) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  } else if (n > SFLZ4_PAGE_POOL_MAX_INCL_NUM_SLABS) {
+    n = SFLZ4_PAGE_POOL_MAX_INCL_NUM_SLABS;
+  }
+  pool->private_num_slabs = (uint32_t)n;
+  pool->private_slabs_ptr = arena_ptr + align;
+  pool->private_slab_metas =
+      arena_ptr + align + (n * SFLZ4_PAGE_POOL_SLAB_LEN);
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_page_pool_store(                //
+    sflz4_page_pool* pool,            //
+    const uint8_t* page_ptr) {
+  sflz4_size_result result = {NULL, 0};
+
+  // Check for a uniform page, 8 bytes at a time.
+  const uint64_t u = 0x0101010101010101ull * page_ptr[0];
+  size_t i = 0;
+  for (; i < SFLZ4_PAGE_POOL_PAGE_LEN; i += 8) {
+    if (sflz4_private_peek_u64le(page_ptr + i) != u) {
+      break;
+    }
+  }
+  if (i == SFLZ4_PAGE_POOL_PAGE_LEN) {
+    sflz4_private_lock(&pool->private_lock);
+    pool->private_stats.num_pages++;
+    pool->private_stats.num_uniform_pages++;
+    sflz4_private_unlock(&pool->private_lock);
+    result.value = SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT | page_ptr[0];
+    return result;
+  }
+
+  // Compress, outside of the lock. The encoded length (plus its 2 byte
+  // prefix) has to fit in a size class smaller than the raw class.
+  uint8_t buf[2 + SFLZ4_PAGE_POOL_PAGE_LEN + (SFLZ4_PAGE_POOL_PAGE_LEN / 255) +
+              16];
+  sflz4_size_result e = sflz4_block_encode(buf + 2, sizeof(buf) - 2, page_ptr,
+                                           SFLZ4_PAGE_POOL_PAGE_LEN);
+  if (e.status_message) {
+    return e;
+  }
+  const uint8_t* obj_ptr = buf;
+  size_t obj_len = 2 + e.value;
+  uint32_t class_index = (uint32_t)((obj_len - 1) / 64);
+  if (class_index < SFLZ4_PAGE_POOL_RAW_CLASS) {
+    buf[0] = (uint8_t)(e.value >> 0);
+    buf[1] = (uint8_t)(e.value >> 8);
+  } else {
+    obj_ptr = page_ptr;
+    obj_len = SFLZ4_PAGE_POOL_PAGE_LEN;
+    class_index = SFLZ4_PAGE_POOL_RAW_CLASS;
+  }
+
+  sflz4_private_lock(&pool->private_lock);
+  const uint32_t handle = sflz4_private_page_pool_alloc(pool, class_index);
+  if (handle) {
+    pool->private_stats.num_pages++;
+    pool->private_stats.num_raw_pages +=
+        (class_index == SFLZ4_PAGE_POOL_RAW_CLASS) ? 1 : 0;
+  }
+  sflz4_private_unlock(&pool->private_lock);
+  if (!handle) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    return result;
+  }
+
+  // The new object is ours alone, so fill it in outside of the lock.
+  memcpy(pool->private_slabs_ptr +
+             ((size_t)((handle - 1) >> 8) * SFLZ4_PAGE_POOL_SLAB_LEN) +
+             (((handle - 1) & 0xFF) * (class_index + 1) * 64),
+         obj_ptr, obj_len);
+  result.value = handle;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_page_pool_load(           //
+    sflz4_page_pool* pool,      //
+    uint8_t* dst_ptr,           //
+    size_t handle) {
+  if (handle & SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT) {
+    if (handle > (SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT | 0xFF)) {
+      return sflz4_status_message__error_bad_argument;
+    }
+    memset(dst_ptr, (int)(handle & 0xFF), SFLZ4_PAGE_POOL_PAGE_LEN);
+    return NULL;
+  }
+  const uint32_t slab_index = (uint32_t)((handle - 1) >> 8);
+  if ((handle == 0) || (slab_index >= pool->private_num_slabs)) {
+    return sflz4_status_message__error_bad_argument;
+  }
+
+  // Slab metadata and contents only change when allocating or freeing. The
+  // caller promises that this handle isn't concurrently freed, and other
+  // objects are never moved, so no lock is needed.
+  const sflz4_private_page_pool_slab* metas =
+      (const sflz4_private_page_pool_slab*)(pool->private_slab_metas);
+  const uint32_t class_index = metas[slab_index].class_index;
+  const uint8_t* p = pool->private_slabs_ptr +
+                     ((size_t)slab_index * SFLZ4_PAGE_POOL_SLAB_LEN) +
+                     (((handle - 1) & 0xFF) * (class_index + 1) * 64);
+  if (class_index == SFLZ4_PAGE_POOL_RAW_CLASS) {
+    memcpy(dst_ptr, p, SFLZ4_PAGE_POOL_PAGE_LEN);
+    return NULL;
+  }
+  const size_t n = ((size_t)p[0]) | (((size_t)p[1]) << 8);
+  if ((n + 2) > ((class_index + 1) * 64)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  sflz4_size_result d =
+      sflz4_block_decode(dst_ptr, SFLZ4_PAGE_POOL_PAGE_LEN, p + 2, n);
+  if (d.status_message) {
+    return d.status_message;
+  } else if (d.value != SFLZ4_PAGE_POOL_PAGE_LEN) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC void     //
+sflz4_page_pool_free(       //
+    sflz4_page_pool* pool,  //
+    size_t handle) {
+  if (handle == 0) {
+    return;
+  } else if (handle & SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT) {
+    if (handle > (SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT | 0xFF)) {
+      return;
+    }
+    sflz4_private_lock(&pool->private_lock);
+    pool->private_stats.num_pages--;
+    pool->private_stats.num_uniform_pages--;
+    sflz4_private_unlock(&pool->private_lock);
+    return;
+  }
+  sflz4_private_page_pool_slab* metas =
+      (sflz4_private_page_pool_slab*)(pool->private_slab_metas);
+  const uint32_t slab_index = (uint32_t)((handle - 1) >> 8);
+  const uint32_t object_index = (uint32_t)((handle - 1) & 0xFF);
+  if (slab_index >= pool->private_num_slabs) {
+    return;
+  }
+
+  sflz4_private_lock(&pool->private_lock);
+  // Slabs at or after private_num_fresh_slabs have never been used, so their
+  // metadata is uninitialized. An object at or after num_carved was never
+  // allocated, and an empty slab has nothing left to free.
+  sflz4_private_page_pool_slab* s = metas + slab_index;
+  if ((slab_index >= pool->private_num_fresh_slabs) ||
+      (object_index >= s->num_carved) || (s->num_live == 0)) {
+    sflz4_private_unlock(&pool->private_lock);
+    return;
+  }
+  const uint32_t class_index = s->class_index;
+  const uint32_t capacity = SFLZ4_PAGE_POOL_SLAB_LEN / ((class_index + 1) * 64);
+  uint8_t* p = pool->private_slabs_ptr +
+               ((size_t)slab_index * SFLZ4_PAGE_POOL_SLAB_LEN) +
+               (object_index * (class_index + 1) * 64);
+  p[0] = (uint8_t)(s->free_head >> 0);
+  p[1] = (uint8_t)(s->free_head >> 8);
+  s->free_head = (uint16_t)object_index;
+
+  if (s->num_live-- == capacity) {
+    sflz4_private_page_pool_link(pool, metas, slab_index);
+  }
+  if (s->num_live == 0) {
+    sflz4_private_page_pool_unlink(pool, metas, slab_index);
+    s->next = pool->private_empty_slabs;
+    pool->private_empty_slabs = slab_index;
+    pool->private_stats.num_slabs--;
+  }
+  pool->private_stats.num_pages--;
+  pool->private_stats.num_raw_pages -=
+      (class_index == SFLZ4_PAGE_POOL_RAW_CLASS) ? 1 : 0;
+  pool->private_stats.num_object_bytes -= (class_index + 1) * 64;
+  sflz4_private_unlock(&pool->private_lock);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_page_pool_stats  //
+sflz4_page_pool_get_stats(                //
+    sflz4_page_pool* pool) {
+  sflz4_private_lock(&pool->private_lock);
+  sflz4_page_pool_stats stats = pool->private_stats;
+  sflz4_private_unlock(&pool->private_lock);
+  return stats;
+}
+
+// -------- LZ4 Record Container
+
+// A record container is:
+//  - an 8 byte header: SFLZ4_RECORDS_MAGIC and block_max_len (both u32le).
+//  - the blocks. Each is a varint number of records, a varint length per
+//    record, a u32le encoded length and then the LZ4 block encoded records.
+//  - the directory: (num_blocks + 1) entries, each a u64le block offset and
+//    a u64le first record_id. The final entry holds the directory's offset
+//    and the total number of records.
+//  - a 12 byte footer: num_blocks (u64le) and SFLZ4_RECORDS_MAGIC (u32le).
+//
+// Varints are unsigned LEB128 (7 bits per byte, least significant first).
+#define SFLZ4_RECORDS_MAGIC 0x31525A53
+#define SFLZ4_RECORDS_HEADER_LEN 8
+#define SFLZ4_RECORDS_FOOTER_LEN 12
+#define SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN 16
+
+static inline uint8_t*      //
+sflz4_private_poke_varint(  //
+    uint8_t* dp,            //
+    uint64_t x) {
+  while (x >= 0x80) {
+    *dp++ = (uint8_t)(x | 0x80);
+    x >>= 7;
+  }
+  *dp++ = (uint8_t)x;
+  return dp;
+}
+
+// sflz4_private_peek_varint reads a varint from [p, end) into *x, returning
+// the advanced p, or NULL if the varint is invalid or truncated.
+static inline const uint8_t*  //
+sflz4_private_peek_varint(    //
+    const uint8_t* p,         //
+    const uint8_t* end,       //
+    uint64_t* x) {
+  uint64_t v = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if (p >= end) {
+      return NULL;
+    }
+    uint8_t c = *p++;
+    v |= ((uint64_t)(c & 0x7F)) << shift;
+    if (!(c & 0x80)) {
+      *x = v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static inline void              //
+sflz4_private_poke_u64le_pair(  //
+    uint8_t* p,                 //
+    uint64_t x,                 //
+    uint64_t y) {
+  sflz4_private_poke_u64le(p + 0, x);
+  sflz4_private_poke_u64le(p + 8, y);
+}
+
+// sflz4_private_record_writer_flush writes the current block, if any. The
+// directory grows down from the end of dst, in reverse order, until
+// sflz4_record_writer_finish moves it into place.
+static const char*                  //
+sflz4_private_record_writer_flush(  //
+    sflz4_record_writer* w) {
+  if (w->private_block_num_records == 0) {
+    return NULL;
+  }
+  sflz4_size_result wc =
+      sflz4_block_encode_worst_case_dst_len(w->private_payload_len);
+  if (wc.status_message) {
+    return wc.status_message;
+  }
+  // Reserve room for this block's directory entry, the final directory entry
+  // and the footer.
+  const uint64_t reserved =
+      ((w->private_num_blocks + 2) * SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN) +
+      SFLZ4_RECORDS_FOOTER_LEN;
+  const uint64_t needed = 10 + w->private_index_len + 4 + wc.value;
+  if ((reserved + needed) > (w->private_dst_len - w->private_dst_pos)) {
+    return sflz4_status_message__error_dst_is_too_short;
+  }
+
+  uint8_t* const block_ptr = w->private_dst_ptr + w->private_dst_pos;
+  uint8_t* dp =
+      sflz4_private_poke_varint(block_ptr, w->private_block_num_records);
+  memcpy(dp, w->private_index_ptr, w->private_index_len);
+  dp += w->private_index_len;
+  sflz4_size_result e = sflz4_block_encode(dp + 4, wc.value,
+                                           w->private_payload_ptr,
+                                           w->private_payload_len);
+  if (e.status_message) {
+    return e.status_message;
+  }
+  sflz4_private_poke_u32le(dp, (uint32_t)e.value);
+  dp += 4 + e.value;
+
+  sflz4_private_poke_u64le_pair(
+      w->private_dst_ptr + w->private_dst_len -
+          ((w->private_num_blocks + 1) * SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN),
+      w->private_dst_pos,
+      w->private_num_records - w->private_block_num_records);
+  w->private_num_blocks++;
+  w->private_dst_pos = (size_t)(dp - w->private_dst_ptr);
+  w->private_payload_len = 0;
+  w->private_index_len = 0;
+  w->private_block_num_records = 0;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_record_writer_workspace_len(    //
+    size_t block_max_len) {
+  sflz4_size_result result = {NULL, 0};
+  if ((block_max_len == 0) ||
+      (block_max_len > (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2))) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  // The workspace holds the block's records and their varint lengths. Both
+  // halves are block_max_len bytes (and the index gets some slack).
+  result.value = (2 * block_max_len) + 16;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*   //
+sflz4_record_writer_initialize(  //
+    sflz4_record_writer* w,      //
+    uint8_t* dst_ptr,            //
+    size_t dst_len,              //
+    uint8_t* workspace_ptr,      //
+    size_t workspace_len,        //
+    size_t block_max_len) {
+  sflz4_size_result wl = sflz4_record_writer_workspace_len(block_max_len);
+  if (wl.status_message) {
+    return wl.status_message;
+  } else if (wl.value > workspace_len) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  } else if (dst_len < (SFLZ4_RECORDS_HEADER_LEN +
+                        SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN +
+                        SFLZ4_RECORDS_FOOTER_LEN)) {
+    return sflz4_status_message__error_dst_is_too_short;
+  }
+  memset(w, 0, sizeof(*w));
+  w->private_dst_ptr = dst_ptr;
+  w->private_dst_len = dst_len;
+  w->private_dst_pos = SFLZ4_RECORDS_HEADER_LEN;
+  w->private_payload_ptr = workspace_ptr;
+  w->private_index_ptr = workspace_ptr + block_max_len;
+  w->private_block_max_len = block_max_len;
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_RECORDS_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4, (uint32_t)block_max_len);
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_record_writer_add(        //
+    sflz4_record_writer* w,     //
+    const uint8_t* record_ptr,  //
+    size_t record_len) {
+  if (record_len > w->private_block_max_len) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  // A varint length takes at most 4 bytes, as block_max_len < (1 << 28).
+  if ((record_len > (w->private_block_max_len - w->private_payload_len)) ||
+      ((w->private_index_len + 4) > (w->private_block_max_len + 16))) {
+    const char* status_message = sflz4_private_record_writer_flush(w);
+    if (status_message) {
+      return status_message;
+    }
+  }
+  memcpy(w->private_payload_ptr + w->private_payload_len, record_ptr,
+         record_len);
+  w->private_payload_len += record_len;
+  w->private_index_len =
+      (size_t)(sflz4_private_poke_varint(
+                   w->private_index_ptr + w->private_index_len, record_len) -
+               w->private_index_ptr);
+  w->private_block_num_records++;
+  w->private_num_records++;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_record_writer_finish(           //
+    sflz4_record_writer* w) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message = sflz4_private_record_writer_flush(w);
+  if (result.status_message) {
+    return result;
+  }
+  const uint64_t num_blocks = w->private_num_blocks;
+  uint8_t* const dst_end = w->private_dst_ptr + w->private_dst_len;
+  uint8_t* const dir_ptr = w->private_dst_ptr + w->private_dst_pos;
+  const size_t dir_len =
+      (size_t)((num_blocks + 1) * SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN);
+  sflz4_private_poke_u64le_pair(dst_end - dir_len, w->private_dst_pos,
+                                w->private_num_records);
+
+  // Reverse the directory entries (written from the end of dst, backwards)
+  // in place and then move them to just after the blocks.
+  uint8_t* lo = dst_end - dir_len;
+  uint8_t* hi = dst_end - SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN;
+  for (; lo < hi; lo += SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN,
+                  hi -= SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN) {
+    uint8_t tmp[SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN];
+    memcpy(tmp, lo, SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN);
+    memcpy(lo, hi, SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN);
+    memcpy(hi, tmp, SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN);
+  }
+  memmove(dir_ptr, dst_end - dir_len, dir_len);
+
+  sflz4_private_poke_u64le(dir_ptr + dir_len, num_blocks);
+  sflz4_private_poke_u32le(dir_ptr + dir_len + 8, SFLZ4_RECORDS_MAGIC);
+  result.value = w->private_dst_pos + dir_len + SFLZ4_RECORDS_FOOTER_LEN;
+  return result;
+}
+
+// sflz4_private_records_directory returns a pointer to the container's
+// directory, setting *num_blocks, or NULL if the container is invalid.
+static const uint8_t*             //
+sflz4_private_records_directory(  //
+    const uint8_t* src_ptr,       //
+    size_t src_len,               //
+    uint64_t* num_blocks) {
+  if ((src_len < (SFLZ4_RECORDS_HEADER_LEN +
+                  SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN +
+                  SFLZ4_RECORDS_FOOTER_LEN)) ||
+      (sflz4_private_peek_u32le(src_ptr) != SFLZ4_RECORDS_MAGIC) ||
+      (sflz4_private_peek_u32le(src_ptr + src_len - 4) !=
+       SFLZ4_RECORDS_MAGIC)) {
+    return NULL;
+  }
+  const uint64_t n = sflz4_private_peek_u64le(src_ptr + src_len - 12);
+  const uint64_t max_n =
+      (src_len - SFLZ4_RECORDS_HEADER_LEN - SFLZ4_RECORDS_FOOTER_LEN) /
+      SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN;
+  if (n >= max_n) {
+    return NULL;
+  }
+  const uint8_t* dir_ptr = src_ptr + src_len - SFLZ4_RECORDS_FOOTER_LEN -
+                           ((n + 1) * SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN);
+  if (sflz4_private_peek_u64le(dir_ptr + (n * 16)) !=
+      (uint64_t)(dir_ptr - src_ptr)) {
+    return NULL;
+  }
+  *num_blocks = n;
+  return dir_ptr;
+}
+
+// sflz4_private_records_block parses the block_index'th block's header. It
+// sets *index_ptr (the varint lengths), *lz4_ptr and *lz4_len, returning NULL
+// on success or a status message on failure.
+static const char*              //
+sflz4_private_records_block(    //
+    const uint8_t* src_ptr,     //
+    const uint8_t* dir_ptr,     //
+    uint64_t block_index,       //
+    const uint8_t** index_ptr,  //
+    const uint8_t** lz4_ptr,    //
+    size_t* lz4_len) {
+  const uint8_t* d = dir_ptr + (block_index * 16);
+  const uint64_t begin = sflz4_private_peek_u64le(d + 0);
+  const uint64_t end = sflz4_private_peek_u64le(d + 16);
+  const uint64_t num_records =
+      sflz4_private_peek_u64le(d + 24) - sflz4_private_peek_u64le(d + 8);
+  if ((begin < SFLZ4_RECORDS_HEADER_LEN) || (begin >= end) ||
+      (end > (uint64_t)(dir_ptr - src_ptr))) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint8_t* p = src_ptr + begin;
+  const uint8_t* q = src_ptr + end;
+  uint64_t n = 0;
+  p = sflz4_private_peek_varint(p, q, &n);
+  if (!p || (n != num_records)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  *index_ptr = p;
+  for (; n > 0; n--) {
+    uint64_t x = 0;
+    p = sflz4_private_peek_varint(p, q, &x);
+    if (!p) {
+      return sflz4_status_message__error_invalid_data;
+    }
+  }
+  if ((q - p) < 4) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const size_t m = sflz4_private_peek_u32le(p);
+  if (m != (size_t)(q - p - 4)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  *lz4_ptr = p + 4;
+  *lz4_len = m;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_num_records(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t num_blocks = 0;
+  const uint8_t* dir_ptr =
+      sflz4_private_records_directory(src_ptr, src_len, &num_blocks);
+  if (!dir_ptr) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const uint64_t n = sflz4_private_peek_u64le(dir_ptr + (num_blocks * 16) + 8);
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_unsupported_feature;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_scratch_len(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t num_blocks = 0;
+  if (!sflz4_private_records_directory(src_ptr, src_len, &num_blocks)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  result.value = sflz4_private_peek_u32le(src_ptr + 4);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_records_get(                    //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    uint64_t record_id,               //
+    uint8_t* scratch_ptr,             //
+    size_t scratch_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t num_blocks = 0;
+  const uint8_t* dir_ptr =
+      sflz4_private_records_directory(src_ptr, src_len, &num_blocks);
+  if (!dir_ptr) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  } else if (record_id >=
+             sflz4_private_peek_u64le(dir_ptr + (num_blocks * 16) + 8)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+
+  // Binary search for the last block whose first record_id is at or before
+  // record_id.
+  uint64_t lo = 0;
+  uint64_t hi = num_blocks;
+  while ((hi - lo) > 1) {
+    uint64_t mid = lo + ((hi - lo) / 2);
+    if (sflz4_private_peek_u64le(dir_ptr + (mid * 16) + 8) <= record_id) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  const uint8_t* index_ptr = NULL;
+  const uint8_t* lz4_ptr = NULL;
+  size_t lz4_len = 0;
+  result.status_message = sflz4_private_records_block(
+      src_ptr, dir_ptr, lo, &index_ptr, &lz4_ptr, &lz4_len);
+  if (result.status_message) {
+    return result;
+  }
+  const uint64_t first = sflz4_private_peek_u64le(dir_ptr + (lo * 16) + 8);
+  const uint64_t end = sflz4_private_peek_u64le(dir_ptr + (lo * 16) + 24);
+  if ((record_id < first) || (record_id >= end)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+
+  // Sum the lengths of the records before this one. Each length is checked
+  // against what is left of the block, so that a crafted index cannot wrap
+  // record_offset or record_end around.
+  const uint64_t block_max_len = sflz4_private_peek_u32le(src_ptr + 4);
+  uint64_t record_offset = 0;
+  uint64_t record_len = 0;
+  for (uint64_t i = first; i <= record_id; i++) {
+    record_offset += record_len;
+    index_ptr = sflz4_private_peek_varint(index_ptr, lz4_ptr, &record_len);
+    if (!index_ptr || (record_len > (block_max_len - record_offset))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+  }
+  const uint64_t record_end = record_offset + record_len;
+  if (record_end > scratch_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    return result;
+  } else if (record_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+
+  sflz4_size_result d = sflz4_private_block_decode_counted(
+      scratch_ptr, (size_t)record_end, 0, NULL, 0, lz4_ptr, lz4_len,
+      SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END);
+  if (d.status_message) {
+    result.status_message = d.status_message;
+    return result;
+  } else if (d.value != record_end) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  memcpy(dst_ptr, scratch_ptr + record_offset, (size_t)record_len);
+  result.value = (size_t)record_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*               //
+sflz4_records_scan(                          //
+    const uint8_t* src_ptr,                  //
+    size_t src_len,                          //
+    uint8_t* scratch_ptr,                    //
+    size_t scratch_len,                      //
+    void (*func)(void* context,              //
+                 uint64_t record_id,         //
+                 const uint8_t* record_ptr,  //
+                 size_t record_len),         //
+    void* context) {
+  uint64_t num_blocks = 0;
+  const uint8_t* dir_ptr =
+      sflz4_private_records_directory(src_ptr, src_len, &num_blocks);
+  if (!dir_ptr) {
+    return sflz4_status_message__error_invalid_data;
+  } else if (scratch_len < sflz4_private_peek_u32le(src_ptr + 4)) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+  scratch_len = sflz4_private_peek_u32le(src_ptr + 4);
+
+  for (uint64_t b = 0; b < num_blocks; b++) {
+    const uint8_t* index_ptr = NULL;
+    const uint8_t* lz4_ptr = NULL;
+    size_t lz4_len = 0;
+    const char* status_message = sflz4_private_records_block(
+        src_ptr, dir_ptr, b, &index_ptr, &lz4_ptr, &lz4_len);
+    if (status_message) {
+      return status_message;
+    }
+    sflz4_size_result d = sflz4_private_block_decode_counted(
+        scratch_ptr, scratch_len, 0, NULL, 0, lz4_ptr, lz4_len, 0);
+    if (d.status_message) {
+      return d.status_message;
+    }
+
+    const uint64_t first = sflz4_private_peek_u64le(dir_ptr + (b * 16) + 8);
+    const uint64_t end = sflz4_private_peek_u64le(dir_ptr + (b * 16) + 24);
+    size_t offset = 0;
+    for (uint64_t i = first; i < end; i++) {
+      uint64_t record_len = 0;
+      index_ptr = sflz4_private_peek_varint(index_ptr, lz4_ptr, &record_len);
+      if (!index_ptr || (record_len > (d.value - offset))) {
+        return sflz4_status_message__error_invalid_data;
+      }
+      (*func)(context, i, scratch_ptr + offset, (size_t)record_len);
+      offset += (size_t)record_len;
+    }
+    if (offset != d.value) {
+      return sflz4_status_message__error_invalid_data;
+    }
+  }
+  return NULL;
+}
+
+// -------- LZ4 Log Writer
+
+#define SFLZ4_LOG_WRITER_FLG \
+  (SFLZ4_FRAME_FLG__VERSION_01 | SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS)
+#define SFLZ4_LOG_WRITER_HISTORY_LEN 0x10000
+#define SFLZ4_LOG_WRITER_CHECKPOINT_MAGIC 0x43345A53
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_workspace_len(       //
+    size_t block_max_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (block_max_len == 0) {
+    block_max_len = 0x10000;
+  } else if ((block_max_len != 0x10000) && (block_max_len != 0x40000) &&
+             (block_max_len != 0x100000) && (block_max_len != 0x400000)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  // The workspace holds, in order: 3 bytes of alignment slack, the hash
+  // table, the window (history and then pending records) and the encoded
+  // output (an end marker, a frame header and a block).
+  result = sflz4_block_encode_worst_case_dst_len(block_max_len);
+  result.value += 3 + (sizeof(uint32_t) << SFLZ4_HASH_TABLE_SHIFT) +
+                  SFLZ4_LOG_WRITER_HISTORY_LEN + block_max_len + 4 +
+                  SFLZ4_FRAME_HEADER_MAX_INCL_LEN + 4 + 4;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*                     //
+sflz4_log_writer_initialize(                       //
+    sflz4_log_writer* w,                           //
+    uint8_t* workspace_ptr,                        //
+    size_t workspace_len,                          //
+    const sflz4_log_writer_options* options,       //
+    const char* (*write_func)(void* context,       //
+                              const uint8_t* ptr,  //
+                              size_t len),         //
+    const char* (*sync_func)(void* context),       //
+    void* context) {
+  sflz4_log_writer_options o;
+  memset(&o, 0, sizeof(o));
+  if (options) {
+    o = *options;
+  }
+  if (o.block_max_len == 0) {
+    o.block_max_len = 0x10000;
+  }
+  sflz4_size_result wl = sflz4_log_writer_workspace_len(o.block_max_len);
+  if (wl.status_message) {
+    return wl.status_message;
+  } else if (wl.value > workspace_len) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  } else if (!write_func) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  if ((o.flush_len == 0) || (o.flush_len > o.block_max_len)) {
+    o.flush_len = o.block_max_len;
+  }
+
+  memset(w, 0, sizeof(*w));
+  w->private_write_func = write_func;
+  w->private_sync_func = sync_func;
+  w->private_context = context;
+  w->private_options = o;
+  uint8_t* p = workspace_ptr + ((4 - ((uintptr_t)workspace_ptr & 3)) & 3);
+  w->private_hash_table = (uint32_t*)(void*)p;
+  memset(p, 0, sizeof(uint32_t) << SFLZ4_HASH_TABLE_SHIFT);
+  p += sizeof(uint32_t) << SFLZ4_HASH_TABLE_SHIFT;
+  w->private_window_ptr = p;
+  p += SFLZ4_LOG_WRITER_HISTORY_LEN + o.block_max_len;
+  w->private_encoded_ptr = p;
+
+  // Stage the (optional) end marker and frame header, to be written along
+  // with the first block.
+  if (o.flags & SFLZ4_LOG_WRITER_FLAGS__CLOSE_PREVIOUS_FRAME) {
+    sflz4_private_poke_u32le(p, 0);
+    p += 4;
+  }
+  p = sflz4_private_frame_write_header(p, SFLZ4_LOG_WRITER_FLG,
+                                       o.block_max_len, 0, 0);
+  w->private_encoded_len = (size_t)(p - w->private_encoded_ptr);
+  return NULL;
+}
+
+// sflz4_private_log_writer_write writes and syncs the staged encoded bytes.
+static const char*               //
+sflz4_private_log_writer_write(  //
+    sflz4_log_writer* w) {
+  const char* status_message = (*w->private_write_func)(
+      w->private_context, w->private_encoded_ptr, w->private_encoded_len);
+  if (!status_message && w->private_sync_func) {
+    status_message = (*w->private_sync_func)(w->private_context);
+  }
+  w->private_written_len += w->private_encoded_len;
+  w->private_encoded_len = 0;
+  if (status_message) {
+    w->private_status_message = status_message;
+    return status_message;
+  }
+  w->private_synced_len = w->private_appended_len;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_flush(         //
+    sflz4_log_writer* w) {
+  if (w->private_status_message) {
+    return w->private_status_message;
+  } else if (w->private_pending_len == 0) {
+    return NULL;
+  }
+
+  // Encode the pending records as one linked block. Matches can refer back
+  // into the history (the previous blocks' final 64 KiB).
+  uint8_t* const window_ptr = w->private_window_ptr;
+  uint8_t* const pending_ptr = window_ptr + w->private_history_len;
+  uint8_t* dp = sflz4_private_frame_encode_counted_block(
+      w->private_encoded_ptr + w->private_encoded_len,
+      w->private_hash_table, window_ptr, pending_ptr, w->private_pending_len,
+      SFLZ4_LOG_WRITER_FLG);
+  w->private_encoded_len = (size_t)(dp - w->private_encoded_ptr);
+
+  // Slide the window so that the history is (up to) the final 64 KiB.
+  const size_t total_len = w->private_history_len + w->private_pending_len;
+  const size_t keep_len =
+      sflz4_private_min_size_t(total_len, SFLZ4_LOG_WRITER_HISTORY_LEN);
+  const size_t delta = total_len - keep_len;
+  if (delta > 0) {
+    memmove(window_ptr, window_ptr + delta, keep_len);
+    sflz4_private_rebase_hash_table(w->private_hash_table, (uint32_t)delta);
+  }
+  w->private_history_len = keep_len;
+  w->private_pending_len = 0;
+
+  return sflz4_private_log_writer_write(w);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_append(              //
+    sflz4_log_writer* w,              //
+    const uint8_t* record_ptr,        //
+    size_t record_len,                //
+    uint64_t now) {
+  sflz4_size_result result = {NULL, 0};
+  const size_t block_max_len = w->private_options.block_max_len;
+  if (w->private_status_message) {
+    result.status_message = w->private_status_message;
+    return result;
+  } else if (record_len > block_max_len) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  } else if (record_len > (block_max_len - w->private_pending_len)) {
+    result.status_message = sflz4_log_writer_flush(w);
+    if (result.status_message) {
+      return result;
+    }
+  }
+
+  if (w->private_pending_len == 0) {
+    w->private_pending_since = now;
+  }
+  memcpy(w->private_window_ptr + w->private_history_len +
+             w->private_pending_len,
+         record_ptr, record_len);
+  w->private_pending_len += record_len;
+  w->private_appended_len += record_len;
+  result.value = (size_t)(w->private_appended_len);
+
+  if (w->private_pending_len >= w->private_options.flush_len) {
+    result.status_message = sflz4_log_writer_flush(w);
+  } else {
+    result.status_message = sflz4_log_writer_poll(w, now);
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_poll(          //
+    sflz4_log_writer* w,        //
+    uint64_t now) {
+  if (w->private_status_message) {
+    return w->private_status_message;
+  } else if ((w->private_pending_len > 0) &&
+             (w->private_options.flush_delay > 0) &&
+             ((now - w->private_pending_since) >=
+              w->private_options.flush_delay)) {
+    return sflz4_log_writer_flush(w);
+  }
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_log_writer_close(         //
+    sflz4_log_writer* w) {
+  const char* status_message = sflz4_log_writer_flush(w);
+  if (status_message) {
+    return status_message;
+  }
+  sflz4_private_poke_u32le(w->private_encoded_ptr + w->private_encoded_len,
+                           0);
+  w->private_encoded_len += 4;
+  status_message = sflz4_private_log_writer_write(w);
+  if (status_message) {
+    return status_message;
+  }
+  w->private_status_message = sflz4_status_message__error_bad_argument;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC uint64_t   //
+sflz4_log_writer_synced_len(  //
+    const sflz4_log_writer* w) {
+  return w->private_synced_len;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_log_writer_checkpoint(          //
+    sflz4_log_writer* w,              //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message = sflz4_log_writer_flush(w);
+  if (result.status_message) {
+    return result;
+  }
+  const size_t history_len = w->private_history_len;
+  const size_t n = 28 + history_len + 4;
+  if (n > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_LOG_WRITER_CHECKPOINT_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4,
+                           (uint32_t)w->private_options.block_max_len);
+  sflz4_private_poke_u64le(dst_ptr + 8, w->private_written_len);
+  sflz4_private_poke_u64le(dst_ptr + 16, w->private_appended_len);
+  sflz4_private_poke_u32le(dst_ptr + 24, (uint32_t)history_len);
+  memcpy(dst_ptr + 28, w->private_window_ptr, history_len);
+  sflz4_private_poke_u32le(dst_ptr + 28 + history_len,
+                           sflz4_private_xxh32(dst_ptr, 28 + history_len, 0));
+  result.value = n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result               //
+sflz4_log_writer_restore(                          //
+    sflz4_log_writer* w,                           //
+    uint8_t* workspace_ptr,                        //
+    size_t workspace_len,                          //
+    const sflz4_log_writer_options* options,       //
+    const char* (*write_func)(void* context,       //
+                              const uint8_t* ptr,  //
+                              size_t len),         //
+    const char* (*sync_func)(void* context),       //
+    void* context,                                 //
+    const uint8_t* checkpoint_ptr,                 //
+    size_t checkpoint_len) {
+  sflz4_size_result result = {NULL, 0};
+  if ((checkpoint_len < 32) ||
+      (sflz4_private_peek_u32le(checkpoint_ptr) !=
+       SFLZ4_LOG_WRITER_CHECKPOINT_MAGIC)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const size_t history_len = sflz4_private_peek_u32le(checkpoint_ptr + 24);
+  if ((history_len > SFLZ4_LOG_WRITER_HISTORY_LEN) ||
+      (checkpoint_len != (28 + history_len + 4))) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  } else if (sflz4_private_peek_u32le(checkpoint_ptr + 28 + history_len) !=
+             sflz4_private_xxh32(checkpoint_ptr, 28 + history_len, 0)) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  }
+  const uint64_t written_len = sflz4_private_peek_u64le(checkpoint_ptr + 8);
+  if (written_len > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_unsupported_feature;
+    return result;
+  }
+
+  sflz4_log_writer_options o;
+  memset(&o, 0, sizeof(o));
+  if (options) {
+    o = *options;
+  }
+  if (o.block_max_len == 0) {
+    o.block_max_len = 0x10000;
+  }
+  if (o.block_max_len != sflz4_private_peek_u32le(checkpoint_ptr + 4)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  result.status_message = sflz4_log_writer_initialize(
+      w, workspace_ptr, workspace_len, &o, write_func, sync_func, context);
+  if (result.status_message) {
+    return result;
+  }
+
+  // If the frame header has already been written, don't write it again.
+  if (written_len > 0) {
+    w->private_encoded_len = 0;
+  }
+  w->private_written_len = written_len;
+  w->private_appended_len = sflz4_private_peek_u64le(checkpoint_ptr + 16);
+  w->private_synced_len = w->private_appended_len;
+  w->private_history_len = history_len;
+  memcpy(w->private_window_ptr, checkpoint_ptr + 28, history_len);
+  sflz4_private_prime_hash_table(w->private_hash_table, w->private_window_ptr,
+                                 w->private_window_ptr, history_len);
+  result.value = (size_t)written_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_log_recover(                          //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    size_t* src_valid_len,                  //
+    int* src_unterminated) {
+  sflz4_size_result result = {NULL, 0};
+  size_t sp = 0;
+  *src_valid_len = 0;
+  *src_unterminated = 0;
+
+  while ((src_len - sp) >= 4) {
+    const uint32_t magic = sflz4_private_peek_u32le(src_ptr + sp);
+    if ((magic & SFLZ4_FRAME_SKIPPABLE_MAGIC_MASK) ==
+        SFLZ4_FRAME_SKIPPABLE_MAGIC) {
+      if (((src_len - sp) < 8) ||
+          (sflz4_private_peek_u32le(src_ptr + sp + 4) > (src_len - sp - 8))) {
+        break;
+      }
+      sp += 8 + sflz4_private_peek_u32le(src_ptr + sp + 4);
+      *src_valid_len = sp;
+      continue;
+    }
+
+    sflz4_private_frame_header h;
+    if (sflz4_private_frame_parse_header(&h, src_ptr + sp, src_len - sp)) {
+      break;
+    } else if (h.flg & SFLZ4_FRAME_FLG__DICT_ID) {
+      result.status_message = sflz4_status_message__error_unsupported_feature;
+      return result;
+    }
+    const size_t checksum_len =
+        (h.flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+    const size_t frame_start = result.value;
+    sp += h.header_len;
+    *src_valid_len = sp;
+    *src_unterminated = 1;
+
+    while (1) {
+      if ((src_len - sp) < 4) {
+        goto done;
+      }
+      const uint32_t block_header = sflz4_private_peek_u32le(src_ptr + sp);
+      if (block_header == 0) {
+        size_t n = 4;
+        if (h.flg & SFLZ4_FRAME_FLG__CONTENT_CHECKSUM) {
+          if (((src_len - sp) < 8) ||
+              (sflz4_private_peek_u32le(src_ptr + sp + 4) !=
+               sflz4_private_xxh32(dst_ptr + frame_start,
+                                   result.value - frame_start, 0))) {
+            goto done;
+          }
+          n = 8;
+        }
+        sp += n;
+        *src_valid_len = sp;
+        *src_unterminated = 0;
+        break;
+      }
+
+      const uint8_t* const block_ptr = src_ptr + sp + 4;
+      const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+      const size_t remaining = src_len - sp - 4;
+      if ((n > h.block_max_len) || (n > remaining) ||
+          (checksum_len > (remaining - n)) ||
+          (checksum_len && (sflz4_private_peek_u32le(block_ptr + n) !=
+                            sflz4_private_xxh32(block_ptr, n, 0)))) {
+        goto done;
+      }
+
+      const size_t dst_remaining = dst_len - result.value;
+      if (block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) {
+        if (n > dst_remaining) {
+          result.status_message = sflz4_status_message__error_dst_is_too_short;
+          return result;
+        }
+        memcpy(dst_ptr + result.value, block_ptr, n);
+        result.value += n;
+      } else {
+        const size_t prefix_len =
+            (h.flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS)
+                ? 0
+                : (result.value - frame_start);
+        sflz4_size_result r = sflz4_private_block_decode_counted(
+            dst_ptr + result.value,
+            sflz4_private_min_size_t(dst_remaining, h.block_max_len),
+            prefix_len, NULL, 0, block_ptr, n, 0);
+        if (r.status_message) {
+          if ((r.status_message ==
+               sflz4_status_message__error_dst_is_too_short) &&
+              (dst_remaining < h.block_max_len)) {
+            result.status_message = r.status_message;
+            return result;
+          }
+          goto done;
+        }
+        result.value += r.value;
+      }
+      sp += 4 + n + checksum_len;
+      *src_valid_len = sp;
+    }
+  }
+
+done:
+  return result;
+}
+
+// -------- LZ4 Frame Checkpoints
+
+// A checkpoint index is an 8 byte header (SFLZ4_CHECKPOINTS_MAGIC and the
+// number of checkpoints, both u32le) followed by the checkpoints. Each is a
+// u64le encoded offset (of a block header, relative to the frame's start), a
+// u64le decoded offset, a u32le window length, a u32le snapshot length, the
+// snapshot (the window, the decoded bytes immediately before that decoded
+// offset, in LZ4 block compressed form) and then a u32le xxHash32 of the
+// checkpoint's preceding bytes.
+#define SFLZ4_CHECKPOINTS_MAGIC 0x4B43345A
+#define SFLZ4_CHECKPOINTS_HEADER_LEN 8
+#define SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN 24
+#define SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN 4
+#define SFLZ4_CHECKPOINTS_WINDOW_LEN 0x10000
+
+// sflz4_private_frame_cursor decodes an LZ4 frame one block at a time, into
+// a window buffer that holds up to SFLZ4_CHECKPOINTS_WINDOW_LEN bytes of
+// history followed by the latest block.
+typedef struct sflz4_private_frame_cursor_struct {
+  const uint8_t* src_ptr;
+  size_t src_len;
+  size_t src_pos;
+  uint32_t flg;
+  size_t block_max_len;
+  uint8_t* window_ptr;
+  size_t history_len;
+  uint64_t decoded_offset;
+} sflz4_private_frame_cursor;
+
+static const char*                      //
+sflz4_private_frame_cursor_initialize(  //
+    sflz4_private_frame_cursor* c,      //
+    const uint8_t* src_ptr,             //
+    size_t src_len,                     //
+    uint8_t* workspace_ptr,             //
+    size_t workspace_len) {
+  sflz4_private_frame_header h;
+  const char* status_message =
+      sflz4_private_frame_parse_header(&h, src_ptr, src_len);
+  if (status_message) {
+    return status_message;
+  } else if (h.flg & SFLZ4_FRAME_FLG__DICT_ID) {
+    return sflz4_status_message__error_unsupported_feature;
+  } else if ((SFLZ4_CHECKPOINTS_WINDOW_LEN + h.block_max_len) >
+             workspace_len) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+  c->src_ptr = src_ptr;
+  c->src_len = src_len;
+  c->src_pos = h.header_len;
+  c->flg = h.flg;
+  c->block_max_len = h.block_max_len;
+  c->window_ptr = workspace_ptr;
+  c->history_len = 0;
+  c->decoded_offset = 0;
+  return NULL;
+}
+
+// sflz4_private_frame_cursor_next decodes the next block to
+// (window_ptr + history_len), setting *decoded_len to its length (zero at
+// the frame's end marker).
+static const char*                  //
+sflz4_private_frame_cursor_next(    //
+    sflz4_private_frame_cursor* c,  //
+    size_t* decoded_len) {
+  *decoded_len = 0;
+  if ((c->src_len - c->src_pos) < 4) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint32_t block_header =
+      sflz4_private_peek_u32le(c->src_ptr + c->src_pos);
+  if (block_header == 0) {
+    return NULL;
+  }
+  const uint8_t* const block_ptr = c->src_ptr + c->src_pos + 4;
+  const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+  const size_t checksum_len =
+      (c->flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+  const size_t remaining = c->src_len - c->src_pos - 4;
+  if ((n == 0) || (n > c->block_max_len) || (n > remaining) ||
+      (checksum_len > (remaining - n))) {
+    return sflz4_status_message__error_invalid_data;
+  } else if (checksum_len && (sflz4_private_peek_u32le(block_ptr + n) !=
+                              sflz4_private_xxh32(block_ptr, n, 0))) {
+    return sflz4_status_message__error_bad_checksum;
+  }
+
+  uint8_t* const dst_ptr = c->window_ptr + c->history_len;
+  if (block_header & SFLZ4_FRAME_UNCOMPRESSED_BIT) {
+    memcpy(dst_ptr, block_ptr, n);
+    *decoded_len = n;
+  } else {
+    const size_t prefix_len = (c->flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS)
+                                  ? 0
+                                  : c->history_len;
+    sflz4_size_result r = sflz4_private_block_decode_counted(
+        dst_ptr, c->block_max_len, prefix_len, NULL, 0, block_ptr, n, 0);
+    if (r.status_message) {
+      return (r.status_message ==
+              sflz4_status_message__error_dst_is_too_short)
+                 ? sflz4_status_message__error_invalid_data
+                 : r.status_message;
+    }
+    *decoded_len = r.value;
+  }
+  c->src_pos += 4 + n + checksum_len;
+  return NULL;
+}
+
+// sflz4_private_frame_cursor_slide accounts for the latest block's
+// decoded_len bytes, keeping (up to) the final SFLZ4_CHECKPOINTS_WINDOW_LEN
+// decoded bytes as history.
+static inline void                  //
+sflz4_private_frame_cursor_slide(   //
+    sflz4_private_frame_cursor* c,  //
+    size_t decoded_len) {
+  const size_t total_len = c->history_len + decoded_len;
+  const size_t keep_len =
+      sflz4_private_min_size_t(total_len, SFLZ4_CHECKPOINTS_WINDOW_LEN);
+  memmove(c->window_ptr, c->window_ptr + total_len - keep_len, keep_len);
+  c->history_len = keep_len;
+  c->decoded_offset += decoded_len;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_checkpoints_workspace_len(      //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_frame_header h;
+  result.status_message =
+      sflz4_private_frame_parse_header(&h, src_ptr, src_len);
+  if (!result.status_message) {
+    result.value = SFLZ4_CHECKPOINTS_WINDOW_LEN + h.block_max_len;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result         //
+sflz4_frame_checkpoints_worst_case_dst_len(  //
+    uint64_t decoded_len,                    //
+    uint64_t interval) {
+  sflz4_size_result result = {NULL, 0};
+  if (interval == 0) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  const uint64_t snapshot_len =
+      sflz4_block_encode_worst_case_dst_len(SFLZ4_CHECKPOINTS_WINDOW_LEN)
+          .value;
+  const uint64_t num_checkpoints = 1 + (decoded_len / interval);
+  const uint64_t entry_max_len = SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN +
+                                 snapshot_len +
+                                 SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN;
+  const uint64_t n =
+      SFLZ4_CHECKPOINTS_HEADER_LEN + (num_checkpoints * entry_max_len);
+  if ((num_checkpoints > 0xFFFFFFFF) ||
+      ((n / entry_max_len) < num_checkpoints) || (n > SIZE_MAX)) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_frame_build_checkpoints(              //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint64_t interval,                      //
+    uint8_t* workspace_ptr,                 //
+    size_t workspace_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_frame_cursor c;
+  if (interval == 0) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  } else if (dst_len < SFLZ4_CHECKPOINTS_HEADER_LEN) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+  result.status_message = sflz4_private_frame_cursor_initialize(
+      &c, src_ptr, src_len, workspace_ptr, workspace_len);
+  if (result.status_message) {
+    return result;
+  }
+  const size_t snapshot_max_len =
+      sflz4_block_encode_worst_case_dst_len(SFLZ4_CHECKPOINTS_WINDOW_LEN)
+          .value;
+  const size_t entry_max_len = SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN +
+                               snapshot_max_len +
+                               SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN;
+
+  uint8_t* dp = dst_ptr + SFLZ4_CHECKPOINTS_HEADER_LEN;
+  uint32_t num_checkpoints = 0;
+  uint64_t next_checkpoint = 0;
+  while (1) {
+    if (c.decoded_offset >= next_checkpoint) {
+      if (entry_max_len > (dst_len - (size_t)(dp - dst_ptr))) {
+        result.status_message = sflz4_status_message__error_dst_is_too_short;
+        return result;
+      } else if (num_checkpoints == 0xFFFFFFFF) {
+        result.status_message = sflz4_status_message__error_src_is_too_long;
+        return result;
+      }
+      // Empty windows (at the frame's start or for independent blocks) get
+      // empty snapshots.
+      const size_t window_len =
+          (c.flg & SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS) ? 0 : c.history_len;
+      sflz4_size_result e = {NULL, 0};
+      if (window_len > 0) {
+        e = sflz4_block_encode(dp + SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN,
+                               snapshot_max_len,
+                               c.window_ptr + c.history_len - window_len,
+                               window_len);
+        if (e.status_message) {
+          result.status_message = e.status_message;
+          return result;
+        }
+      }
+      sflz4_private_poke_u64le(dp + 0, c.src_pos);
+      sflz4_private_poke_u64le(dp + 8, c.decoded_offset);
+      sflz4_private_poke_u32le(dp + 16, (uint32_t)window_len);
+      sflz4_private_poke_u32le(dp + 20, (uint32_t)e.value);
+      const size_t checksummed_len =
+          SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN + e.value;
+      sflz4_private_poke_u32le(dp + checksummed_len,
+                               sflz4_private_xxh32(dp, checksummed_len, 0));
+      dp += checksummed_len + SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN;
+      num_checkpoints++;
+      next_checkpoint = c.decoded_offset + interval;
+    }
+
+    size_t decoded_len = 0;
+    result.status_message = sflz4_private_frame_cursor_next(&c, &decoded_len);
+    if (result.status_message) {
+      return result;
+    } else if (decoded_len == 0) {
+      break;
+    }
+    sflz4_private_frame_cursor_slide(&c, decoded_len);
+  }
+
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_CHECKPOINTS_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4, num_checkpoints);
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result          //
+sflz4_frame_read_at_checkpoint(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,          //
+    size_t dst_len,                           //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,    //
+    size_t src_len,                           //
+    const uint8_t* SFLZ4_RESTRICT index_ptr,  //
+    size_t index_len,                         //
+    uint64_t offset,                          //
+    uint8_t* workspace_ptr,                   //
+    size_t workspace_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_frame_cursor c;
+  result.status_message = sflz4_private_frame_cursor_initialize(
+      &c, src_ptr, src_len, workspace_ptr, workspace_len);
+  if (result.status_message) {
+    return result;
+  } else if ((index_len < SFLZ4_CHECKPOINTS_HEADER_LEN) ||
+             (sflz4_private_peek_u32le(index_ptr) !=
+              SFLZ4_CHECKPOINTS_MAGIC)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+
+  // Find the last checkpoint at or before offset. The checkpoints are
+  // variable length, so this is a linear scan, but it reads only their
+  // 24 byte headers. Only the chosen checkpoint's checksum is verified: a
+  // corrupted header that ends the scan early only picks an earlier (still
+  // correct) checkpoint, and one that misdirects the scan leads to a
+  // checkpoint whose checksum won't match.
+  const uint32_t num_checkpoints = sflz4_private_peek_u32le(index_ptr + 4);
+  const uint8_t* checkpoint = NULL;
+  const uint8_t* p = index_ptr + SFLZ4_CHECKPOINTS_HEADER_LEN;
+  const uint8_t* const index_end = index_ptr + index_len;
+  for (uint32_t i = 0; i < num_checkpoints; i++) {
+    if ((size_t)(index_end - p) < SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    } else if (sflz4_private_peek_u64le(p + 8) > offset) {
+      break;
+    }
+    checkpoint = p;
+    const size_t remaining =
+        (size_t)(index_end - p - SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN);
+    const size_t snapshot_len = sflz4_private_peek_u32le(p + 20);
+    if ((remaining < SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN) ||
+        (snapshot_len > (remaining - SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    p += SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN + snapshot_len +
+         SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN;
+  }
+  if (!checkpoint) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const size_t checksummed_len = SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN +
+                                 sflz4_private_peek_u32le(checkpoint + 20);
+  if (sflz4_private_peek_u32le(checkpoint + checksummed_len) !=
+      sflz4_private_xxh32(checkpoint, checksummed_len, 0)) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  }
+
+  // Restore the window and the cursor's position.
+  const uint64_t encoded_offset = sflz4_private_peek_u64le(checkpoint + 0);
+  const size_t window_len = sflz4_private_peek_u32le(checkpoint + 16);
+  if ((encoded_offset < c.src_pos) || (encoded_offset > src_len) ||
+      (window_len > SFLZ4_CHECKPOINTS_WINDOW_LEN)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  if (window_len > 0) {
+    sflz4_size_result d = sflz4_block_decode(
+        c.window_ptr, window_len,
+        checkpoint + SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN,
+        sflz4_private_peek_u32le(checkpoint + 20));
+    if (d.status_message || (d.value != window_len)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+  }
+  c.src_pos = (size_t)encoded_offset;
+  c.history_len = window_len;
+  c.decoded_offset = sflz4_private_peek_u64le(checkpoint + 8);
+
+  // Decode forward, copying out the requested bytes.
+  while (dst_len > 0) {
+    size_t decoded_len = 0;
+    result.status_message = sflz4_private_frame_cursor_next(&c, &decoded_len);
+    if (result.status_message) {
+      return result;
+    } else if (decoded_len == 0) {
+      break;
+    }
+    const uint64_t block_end = c.decoded_offset + decoded_len;
+    if (offset < block_end) {
+      const size_t within = (size_t)(offset - c.decoded_offset);
+      const size_t n = sflz4_private_min_size_t(decoded_len - within, dst_len);
+      memcpy(dst_ptr, c.window_ptr + c.history_len + within, n);
+      dst_ptr += n;
+      dst_len -= n;
+      offset += n;
+      result.value += n;
+    }
+    sflz4_private_frame_cursor_slide(&c, decoded_len);
+  }
+  return result;
+}
+
+// -------- LZ4 Dictionary Builder
+
+#define SFLZ4_DICTIONARY_BUILDER_HOLDOUT_INTERVAL 8
+#define SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS 64
+#define SFLZ4_DICTIONARY_BUILDER_SEGMENT_LEN 1024
+#define SFLZ4_DICTIONARY_BUILDER_SUBSTRING_LEN 8
+#define SFLZ4_DICTIONARY_BUILDER_HASH_SHIFT 16
+
+// sflz4_private_dictionary_builder_layout holds the offsets (relative to the
+// 64 byte aligned workspace) of a sflz4_dictionary_builder's arrays. The
+// layout itself is computed once, by sflz4_dictionary_builder_initialize, and
+// kept at the workspace's start (offset zero). After that come:
+//  - train_ring:       the training samples, a ring buffer.
+//  - holdout_ring:     the held-out samples, a ring buffer.
+//  - holdout_starts:   the held-out samples' starting positions (uint64_t).
+//  - train_snapshot:   sflz4_dictionary_builder_refresh's training copy.
+//  - holdout_snapshot: sflz4_dictionary_builder_refresh's held-out copy.
+//  - holdout_lens:     the held-out copy's sample lengths (uint32_t).
+//  - counts:           substring hash frequencies (uint16_t).
+//  - segment_counts:   substring hash frequencies within a segment (uint16_t).
+//  - encoded:          the evaluation's sflz4_block_encode output.
+typedef struct sflz4_private_dictionary_builder_layout_struct {
+  size_t holdout_len;
+  size_t holdout_max_count;
+  size_t max_sample_len;
+  size_t train_ring;
+  size_t holdout_ring;
+  size_t holdout_starts;
+  size_t train_snapshot;
+  size_t holdout_snapshot;
+  size_t holdout_lens;
+  size_t counts;
+  size_t segment_counts;
+  size_t encoded;
+  size_t encoded_len;
+  size_t total;
+} sflz4_private_dictionary_builder_layout;
+
+// sflz4_private_dictionary_builder_make_layout returns NULL on success or a
+// status message on failure.
+static const char*                               //
+sflz4_private_dictionary_builder_make_layout(    //
+    sflz4_private_dictionary_builder_layout* l,  //
+    size_t samples_len) {
+  if (samples_len < (4 * SFLZ4_DICTIONARY_MAX_INCL_LEN)) {
+    return sflz4_status_message__error_bad_argument;
+  } else if (samples_len > (SIZE_MAX / 4)) {
+    return sflz4_status_message__error_src_is_too_long;
+  }
+  l->holdout_len = samples_len / 4;
+  l->holdout_max_count = l->holdout_len / 16;
+  l->max_sample_len = samples_len / 16;
+  sflz4_size_result r =
+      sflz4_block_encode_worst_case_dst_len(l->max_sample_len);
+  if (r.status_message) {
+    return r.status_message;
+  }
+  l->encoded_len = r.value;
+
+  const size_t hash_len = ((size_t)1) << SFLZ4_DICTIONARY_BUILDER_HASH_SHIFT;
+  uint64_t n = sflz4_private_round_up_64(
+      sizeof(sflz4_private_dictionary_builder_layout));
+  l->train_ring = (size_t)n;
+  n += sflz4_private_round_up_64(samples_len);
+  l->holdout_ring = (size_t)n;
+  n += sflz4_private_round_up_64(l->holdout_len);
+  l->holdout_starts = (size_t)n;
+  n += sflz4_private_round_up_64(l->holdout_max_count * sizeof(uint64_t));
+  l->train_snapshot = (size_t)n;
+  n += sflz4_private_round_up_64(samples_len);
+  l->holdout_snapshot = (size_t)n;
+  n += sflz4_private_round_up_64(l->holdout_len);
+  l->holdout_lens = (size_t)n;
+  n += sflz4_private_round_up_64(l->holdout_max_count * sizeof(uint32_t));
+  l->counts = (size_t)n;
+  n += hash_len * sizeof(uint16_t);
+  l->segment_counts = (size_t)n;
+  n += hash_len * sizeof(uint16_t);
+  l->encoded = (size_t)n;
+  n += l->encoded_len;
+  // Leave room to align the workspace.
+  n += 64;
+  if (n > SIZE_MAX) {
+    return sflz4_status_message__error_src_is_too_long;
+  }
+  l->total = (size_t)n;
+  return NULL;
+}
+
+// sflz4_private_ring_write copies p[0 .. p_len) to the ring buffer
+// ring[0 .. ring_len) at the (unwrapped) position pos. p_len must be at most
+// ring_len.
+static inline void         //
+sflz4_private_ring_write(  //
+    uint8_t* ring_ptr,     //
+    size_t ring_len,       //
+    uint64_t pos,          //
+    const uint8_t* p,      //
+    size_t p_len) {
+  const size_t i = (size_t)(pos % ring_len);
+  const size_t n = sflz4_private_min_size_t(p_len, ring_len - i);
+  memcpy(ring_ptr + i, p, n);
+  memcpy(ring_ptr, p + n, p_len - n);
+}
+
+// sflz4_private_ring_read is the inverse of sflz4_private_ring_write.
+static inline void            //
+sflz4_private_ring_read(      //
+    uint8_t* p,               //
+    size_t p_len,             //
+    const uint8_t* ring_ptr,  //
+    size_t ring_len,          //
+    uint64_t pos) {
+  const size_t i = (size_t)(pos % ring_len);
+  const size_t n = sflz4_private_min_size_t(p_len, ring_len - i);
+  memcpy(p, ring_ptr + i, n);
+  memcpy(p + n, ring_ptr, p_len - n);
+}
+
+static inline uint32_t                  //
+sflz4_private_dictionary_builder_hash(  //
+    const uint8_t* p) {
+  return (uint32_t)((sflz4_private_peek_u64le(p) * 0x9E3779B97F4A7C15ull) >>
+                    (64 - SFLZ4_DICTIONARY_BUILDER_HASH_SHIFT));
+}
+
+// sflz4_private_dictionary_builder_train writes a dictionary, trained on the
+// samples in src, to dst (which holds SFLZ4_DICTIONARY_MAX_INCL_LEN bytes).
+// src_len must be at least SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS times
+// SFLZ4_DICTIONARY_BUILDER_SEGMENT_LEN.
+static void                                 //
+sflz4_private_dictionary_builder_train(     //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint16_t* SFLZ4_RESTRICT counts,        //
+    uint16_t* SFLZ4_RESTRICT segment_counts) {
+  const size_t hash_len = ((size_t)1) << SFLZ4_DICTIONARY_BUILDER_HASH_SHIFT;
+  const size_t k = SFLZ4_DICTIONARY_BUILDER_SUBSTRING_LEN;
+  const size_t segment_len = SFLZ4_DICTIONARY_BUILDER_SEGMENT_LEN;
+
+  memset(counts, 0, hash_len * sizeof(uint16_t));
+  for (size_t i = 0; (i + k) <= src_len; i++) {
+    uint16_t* c = &counts[sflz4_private_dictionary_builder_hash(src_ptr + i)];
+    if (*c < 0xFFFF) {
+      (*c)++;
+    }
+  }
+
+  // Pick the best segment from each span, sliding a window over the span and
+  // scoring each distinct substring (counted in segment_counts) once.
+  struct {
+    uint64_t score;
+    size_t start;
+  } picks[SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS];
+  const size_t span_len = src_len / SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS;
+  for (size_t s = 0; s < SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS; s++) {
+    const size_t span_start = s * span_len;
+    const size_t span_end = span_start + span_len;
+    memset(segment_counts, 0, hash_len * sizeof(uint16_t));
+    uint64_t score = 0;
+    uint64_t best_score = 0;
+    size_t best_start = span_start;
+    for (size_t i = span_start; (i + k) <= span_end; i++) {
+      const uint32_t h = sflz4_private_dictionary_builder_hash(src_ptr + i);
+      if (segment_counts[h]++ == 0) {
+        score += counts[h];
+      }
+      if ((i + k) < (span_start + segment_len)) {
+        continue;
+      }
+      const size_t window_start = i + k - segment_len;
+      if (best_score < score) {
+        best_score = score;
+        best_start = window_start;
+      }
+      const uint32_t g =
+          sflz4_private_dictionary_builder_hash(src_ptr + window_start);
+      if (--segment_counts[g] == 0) {
+        score -= counts[g];
+      }
+    }
+
+    // Picked substrings don't count again, so that other segments add new
+    // content instead of repeating this one.
+    for (size_t i = best_start; (i + k) <= (best_start + segment_len); i++) {
+      counts[sflz4_private_dictionary_builder_hash(src_ptr + i)] = 0;
+    }
+
+    // Insertion sort, so that the best segments end up last, which is
+    // closest to (at the shortest match distance from) the data.
+    size_t j = s;
+    for (; (j > 0) && (picks[j - 1].score > best_score); j--) {
+      picks[j] = picks[j - 1];
+    }
+    picks[j].score = best_score;
+    picks[j].start = best_start;
+  }
+
+  for (size_t s = 0; s < SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS; s++) {
+    memcpy(dst_ptr + (s * segment_len), src_ptr + picks[s].start, segment_len);
+  }
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_dictionary_builder_workspace_len(  //
+    size_t samples_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_dictionary_builder_layout l;
+  result.status_message =
+      sflz4_private_dictionary_builder_make_layout(&l, samples_len);
+  if (!result.status_message) {
+    result.value = l.total;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*        //
+sflz4_dictionary_builder_initialize(  //
+    sflz4_dictionary_builder* b,      //
+    uint8_t* workspace_ptr,           //
+    size_t workspace_len,             //
+    size_t samples_len,               //
+    const sflz4_dictionary* current) {
+  sflz4_private_dictionary_builder_layout l;
+  const char* status_message =
+      sflz4_private_dictionary_builder_make_layout(&l, samples_len);
+  if (status_message) {
+    return status_message;
+  } else if (workspace_len < l.total) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+  memset(b, 0, sizeof(*b));
+  b->private_current = current;
+  b->private_workspace_ptr =
+      workspace_ptr + (sflz4_private_round_up_64((size_t)(uintptr_t)
+                                                     workspace_ptr) -
+                       (size_t)(uintptr_t)workspace_ptr);
+  b->private_samples_len = samples_len;
+  memcpy(b->private_workspace_ptr, &l, sizeof(l));
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC void               //
+sflz4_dictionary_builder_add_sample(  //
+    sflz4_dictionary_builder* b,      //
+    const uint8_t* ptr,               //
+    size_t len) {
+  uint8_t* const ws = b->private_workspace_ptr;
+  const sflz4_private_dictionary_builder_layout* const l =
+      (const sflz4_private_dictionary_builder_layout*)(const void*)ws;
+  len = sflz4_private_min_size_t(len, l->max_sample_len);
+
+  sflz4_private_lock(&b->private_lock);
+  if ((b->private_num_samples++ % SFLZ4_DICTIONARY_BUILDER_HOLDOUT_INTERVAL) ==
+      (SFLZ4_DICTIONARY_BUILDER_HOLDOUT_INTERVAL - 1)) {
+    sflz4_private_ring_write(ws + l->holdout_ring, l->holdout_len,
+                             b->private_holdout_written, ptr, len);
+    sflz4_private_poke_u64le(
+        ws + l->holdout_starts +
+            (8 * (size_t)(b->private_holdout_count % l->holdout_max_count)),
+        b->private_holdout_written);
+    b->private_holdout_written += len;
+    b->private_holdout_count++;
+  } else {
+    sflz4_private_ring_write(ws + l->train_ring, b->private_samples_len,
+                             b->private_train_written, ptr, len);
+    b->private_train_written += len;
+  }
+  sflz4_private_unlock(&b->private_lock);
+}
+
+SFLZ4_MAYBE_STATIC const sflz4_dictionary*  //
+sflz4_dictionary_builder_current(           //
+    sflz4_dictionary_builder* b) {
+  sflz4_private_lock(&b->private_lock);
+  const sflz4_dictionary* d = b->private_current;
+  sflz4_private_unlock(&b->private_lock);
+  return d;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_dictionary_builder_refresh(     //
+    sflz4_dictionary_builder* b,      //
+    sflz4_dictionary* d,              //
+    uint8_t* d_buf,                   //
+    uint32_t id,                      //
+    sflz4_dictionary_registry* registry) {
+  sflz4_size_result result = {NULL, 0};
+  uint8_t* const ws = b->private_workspace_ptr;
+  const sflz4_private_dictionary_builder_layout* const l =
+      (const sflz4_private_dictionary_builder_layout*)(const void*)ws;
+  uint8_t* const train = ws + l->train_snapshot;
+  uint8_t* const holdout = ws + l->holdout_snapshot;
+  uint8_t* const holdout_lens = ws + l->holdout_lens;
+
+  // Snapshot the samples, so that adding samples can continue while we
+  // train and evaluate.
+  sflz4_private_lock(&b->private_lock);
+  const size_t train_len =
+      (b->private_train_written < b->private_samples_len)
+          ? (size_t)b->private_train_written
+          : b->private_samples_len;
+  sflz4_private_ring_read(train, train_len, ws + l->train_ring,
+                          b->private_samples_len,
+                          b->private_train_written - train_len);
+  size_t holdout_len = 0;
+  size_t holdout_count = 0;
+  const uint64_t written = b->private_holdout_written;
+  const uint64_t count = b->private_holdout_count;
+  for (uint64_t j = (count > l->holdout_max_count)
+                        ? (count - l->holdout_max_count)
+                        : 0;
+       j < count; j++) {
+    const uint64_t start = sflz4_private_peek_u64le(
+        ws + l->holdout_starts + (8 * (size_t)(j % l->holdout_max_count)));
+    if ((written - start) > l->holdout_len) {
+      continue;  // Overwritten by later samples.
+    }
+    const uint64_t end =
+        ((j + 1) < count)
+            ? sflz4_private_peek_u64le(
+                  ws + l->holdout_starts +
+                  (8 * (size_t)((j + 1) % l->holdout_max_count)))
+            : written;
+    const size_t n = (size_t)(end - start);
+    sflz4_private_ring_read(holdout + holdout_len, n, ws + l->holdout_ring,
+                            l->holdout_len, start);
+    sflz4_private_poke_u32le(holdout_lens + (4 * holdout_count), (uint32_t)n);
+    holdout_len += n;
+    holdout_count++;
+  }
+  const sflz4_dictionary* const current = b->private_current;
+  sflz4_private_unlock(&b->private_lock);
+
+  if ((train_len < (SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS *
+                    SFLZ4_DICTIONARY_BUILDER_SEGMENT_LEN)) ||
+      (holdout_count == 0)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+
+  sflz4_private_dictionary_builder_train(
+      d_buf, train, train_len, (uint16_t*)(void*)(ws + l->counts),
+      (uint16_t*)(void*)(ws + l->segment_counts));
+  sflz4_dictionary_initialize(d, id, d_buf, SFLZ4_DICTIONARY_MAX_INCL_LEN);
+
+  // Evaluate.
+  uint64_t current_total = 0;
+  uint64_t candidate_total = 0;
+  const uint8_t* p = holdout;
+  for (size_t i = 0; i < holdout_count; i++) {
+    const size_t n = sflz4_private_peek_u32le(holdout_lens + (4 * i));
+    sflz4_size_result e =
+        current ? sflz4_block_encode_with_dictionary(
+                      ws + l->encoded, l->encoded_len, p, n, current)
+                : sflz4_block_encode(ws + l->encoded, l->encoded_len, p, n);
+    if (e.status_message) {
+      result.status_message = e.status_message;
+      return result;
+    }
+    current_total += e.value;
+    e = sflz4_block_encode_with_dictionary(ws + l->encoded, l->encoded_len, p,
+                                           n, d);
+    if (e.status_message) {
+      result.status_message = e.status_message;
+      return result;
+    }
+    candidate_total += e.value;
+    p += n;
+  }
+  if ((candidate_total + (current_total / 64)) > current_total) {
+    return result;
+  }
+
+  // Publish.
+  if (registry) {
+    result.status_message = sflz4_dictionary_registry_add(registry, d);
+    if (result.status_message) {
+      return result;
+    }
+  }
+  sflz4_private_lock(&b->private_lock);
+  b->private_current = d;
+  sflz4_private_unlock(&b->private_lock);
+  result.value = 1;
+  return result;
+}
+
+// -------- LZ4 Delta
+
+// A patch starts with a SFLZ4_DELTA_HEADER_LEN byte header:
+//  - u32 magic
+//  - u32 the reference's xxHash-32
+//  - u32 the new version's xxHash-32
+//  - u32 reserved (zero)
+//  - u64 ref_len
+//  - u64 new_len
+//  - u64 literals_len, the total length of the literals
+//  - u64 num_copies
+//  - u64 commands_len
+// followed by commands_len bytes of commands, one per copy, each three
+// varints: the length of the literals before the copy, the copy's length and
+// the (zigzag encoded) difference between the copy's reference offset and
+// where the previous copy ended. Any remaining literals follow the final
+// copy. Last is the literals' LZ4 frame.
+#define SFLZ4_DELTA_MAGIC 0x44345A53
+#define SFLZ4_DELTA_HEADER_LEN 56
+
+// The long-range matcher indexes reference positions that are multiples of
+// SFLZ4_DELTA_STRIDE, so any match at least SFLZ4_DELTA_MIN_MATCH_LEN long
+// contains an indexed position (and an 8 byte hash key after it).
+#define SFLZ4_DELTA_STRIDE 16
+#define SFLZ4_DELTA_MIN_MATCH_LEN 32
+#define SFLZ4_DELTA_MAX_INCL_HASH_TABLE_SHIFT 24
+
+static inline uint32_t                 //
+sflz4_private_delta_hash_table_shift(  //
+    uint64_t ref_len) {
+  uint32_t shift = 10;
+  while ((shift < SFLZ4_DELTA_MAX_INCL_HASH_TABLE_SHIFT) &&
+         ((((uint64_t)1) << shift) < (ref_len / SFLZ4_DELTA_STRIDE))) {
+    shift++;
+  }
+  return shift;
+}
+
+static inline uint32_t     //
+sflz4_private_delta_hash(  //
+    const uint8_t* p,      //
+    uint32_t shift) {
+  return (uint32_t)((sflz4_private_peek_u64le(p) * 0x9E3779B97F4A7C15ull) >>
+                    (64 - shift));
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_delta_encode_workspace_len(     //
+    size_t ref_len,                   //
+    size_t new_len) {
+  sflz4_size_result result = {NULL, 0};
+  const uint64_t n =
+      (((uint64_t)4) << sflz4_private_delta_hash_table_shift(ref_len)) +
+      (uint64_t)new_len;
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result    //
+sflz4_delta_encode_worst_case_dst_len(  //
+    size_t new_len) {
+  // Every copy's command (at most 30 bytes) replaces at least
+  // SFLZ4_DELTA_MIN_MATCH_LEN bytes of literals, so the commands and literals
+  // together are never longer than new_len.
+  sflz4_size_result result = sflz4_frame_encode_worst_case_dst_len(new_len);
+  if (!result.status_message) {
+    if (result.value > (SIZE_MAX - SFLZ4_DELTA_HEADER_LEN)) {
+      result.status_message = sflz4_status_message__error_src_is_too_long;
+      result.value = 0;
+    } else {
+      result.value += SFLZ4_DELTA_HEADER_LEN;
+    }
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_delta_encode(                         //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT ref_ptr,  //
+    size_t ref_len,                         //
+    const uint8_t* SFLZ4_RESTRICT new_ptr,  //
+    size_t new_len,                         //
+    uint8_t* workspace_ptr,                 //
+    size_t workspace_len) {
+  sflz4_size_result result = sflz4_delta_encode_worst_case_dst_len(new_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result = sflz4_delta_encode_workspace_len(ref_len, new_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > workspace_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result.value = 0;
+
+  // Index the reference. Hash table values are 1 + (position / stride), or
+  // zero for an empty slot.
+  const uint32_t shift = sflz4_private_delta_hash_table_shift(ref_len);
+  uint8_t* const hash_table = workspace_ptr;
+  uint8_t* const literals_ptr = workspace_ptr + (((size_t)4) << shift);
+  memset(hash_table, 0, ((size_t)4) << shift);
+  for (size_t i = 0; (i + 8) <= ref_len; i += SFLZ4_DELTA_STRIDE) {
+    sflz4_private_poke_u32le(
+        hash_table + (4 * sflz4_private_delta_hash(ref_ptr + i, shift)),
+        (uint32_t)(1 + (i / SFLZ4_DELTA_STRIDE)));
+  }
+
+  // Find copies. A copy is first looked for at the same offset relative to
+  // the reference as the previous copy (as unchanged regions tend to follow
+  // each other, between insertions and deletions), then in the hash table.
+  uint8_t* const commands_ptr = dst_ptr + SFLZ4_DELTA_HEADER_LEN;
+  uint8_t* cp = commands_ptr;
+  size_t literals_len = 0;
+  uint64_t num_copies = 0;
+  size_t literal_start = 0;
+  size_t prev_ref_end = 0;
+  size_t p = 0;
+  while ((p + 8) <= new_len) {
+    size_t r = p + prev_ref_end - literal_start;
+    if (((r + 8) > ref_len) || (sflz4_private_peek_u64le(new_ptr + p) !=
+                                sflz4_private_peek_u64le(ref_ptr + r))) {
+      const uint32_t v = sflz4_private_peek_u32le(
+          hash_table + (4 * sflz4_private_delta_hash(new_ptr + p, shift)));
+      r = ((size_t)(v - 1)) * SFLZ4_DELTA_STRIDE;
+      if ((v == 0) || (sflz4_private_peek_u64le(new_ptr + p) !=
+                       sflz4_private_peek_u64le(ref_ptr + r))) {
+        p++;
+        continue;
+      }
+    }
+
+    // Extend the match forwards and backwards.
+    size_t q = p + 8;
+    q += sflz4_private_longest_common_prefix(
+        new_ptr + q, ref_ptr + r + 8,
+        new_ptr + q + sflz4_private_min_size_t(new_len - q, ref_len - r - 8));
+    size_t start = p;
+    while ((start > literal_start) && (r > 0) &&
+           (new_ptr[start - 1] == ref_ptr[r - 1])) {
+      start--;
+      r--;
+    }
+    if ((q - start) < SFLZ4_DELTA_MIN_MATCH_LEN) {
+      p++;
+      continue;
+    }
+
+    const size_t n = start - literal_start;
+    memcpy(literals_ptr + literals_len, new_ptr + literal_start, n);
+    literals_len += n;
+    const int64_t delta = (int64_t)r - (int64_t)prev_ref_end;
+    cp = sflz4_private_poke_varint(cp, n);
+    cp = sflz4_private_poke_varint(cp, q - start);
+    cp = sflz4_private_poke_varint(
+        cp, (((uint64_t)delta) << 1) ^ ((uint64_t)(delta >> 63)));
+    num_copies++;
+    prev_ref_end = r + (q - start);
+    literal_start = q;
+    p = q;
+  }
+  memcpy(literals_ptr + literals_len, new_ptr + literal_start,
+         new_len - literal_start);
+  literals_len += new_len - literal_start;
+
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.flags = SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS;
+  sflz4_size_result r = sflz4_frame_encode(
+      cp, dst_len - (size_t)(cp - dst_ptr), literals_ptr, literals_len,
+      &options);
+  if (r.status_message) {
+    return r;
+  }
+
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_DELTA_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4,
+                           sflz4_private_xxh32(ref_ptr, ref_len, 0));
+  sflz4_private_poke_u32le(dst_ptr + 8,
+                           sflz4_private_xxh32(new_ptr, new_len, 0));
+  sflz4_private_poke_u32le(dst_ptr + 12, 0);
+  sflz4_private_poke_u64le(dst_ptr + 16, ref_len);
+  sflz4_private_poke_u64le(dst_ptr + 24, new_len);
+  sflz4_private_poke_u64le(dst_ptr + 32, literals_len);
+  sflz4_private_poke_u64le(dst_ptr + 40, num_copies);
+  sflz4_private_poke_u64le(dst_ptr + 48, (uint64_t)(cp - commands_ptr));
+  result.value = (size_t)(cp - dst_ptr) + r.value;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_delta_decoded_len(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if ((src_len < SFLZ4_DELTA_HEADER_LEN) ||
+      (sflz4_private_peek_u32le(src_ptr) != SFLZ4_DELTA_MAGIC)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const uint64_t n = sflz4_private_peek_u64le(src_ptr + 24);
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_unsupported_feature;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_delta_apply(                          //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT ref_ptr,  //
+    size_t ref_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_delta_decoded_len(src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  }
+  const size_t new_len = result.value;
+  result.value = 0;
+  const uint64_t literals_len = sflz4_private_peek_u64le(src_ptr + 32);
+  const uint64_t num_copies = sflz4_private_peek_u64le(src_ptr + 40);
+  const uint64_t commands_len = sflz4_private_peek_u64le(src_ptr + 48);
+  if ((sflz4_private_peek_u32le(src_ptr + 12) != 0) ||
+      (literals_len > new_len) ||
+      (commands_len > (src_len - SFLZ4_DELTA_HEADER_LEN))) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  } else if ((sflz4_private_peek_u64le(src_ptr + 16) != (uint64_t)ref_len) ||
+             (sflz4_private_peek_u32le(src_ptr + 4) !=
+              sflz4_private_xxh32(ref_ptr, ref_len, 0))) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  } else if (new_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+
+  // Decode the literals into the end of dst. Applying the commands moves
+  // them (forwards) into place, never overwriting literals not yet moved.
+  const uint8_t* cp = src_ptr + SFLZ4_DELTA_HEADER_LEN;
+  const uint8_t* const commands_end = cp + commands_len;
+  size_t lp = new_len - (size_t)literals_len;
+  size_t dp = 0;
+  size_t prev_ref_end = 0;
+  sflz4_size_result r =
+      sflz4_frame_decode(dst_ptr + lp, (size_t)literals_len, commands_end,
+                         src_len - SFLZ4_DELTA_HEADER_LEN - commands_len);
+  if (r.status_message) {
+    return r;
+  } else if (r.value != literals_len) {
+    goto fail_invalid_data;
+  }
+
+  for (uint64_t i = 0; i < num_copies; i++) {
+    uint64_t n = 0;
+    uint64_t copy_len = 0;
+    uint64_t zigzag = 0;
+    cp = cp ? sflz4_private_peek_varint(cp, commands_end, &n) : NULL;
+    cp = cp ? sflz4_private_peek_varint(cp, commands_end, &copy_len) : NULL;
+    cp = cp ? sflz4_private_peek_varint(cp, commands_end, &zigzag) : NULL;
+    const uint64_t ref_off =
+        ((uint64_t)prev_ref_end) +
+        ((zigzag >> 1) ^ (uint64_t)(-(int64_t)(zigzag & 1)));
+    if (!cp || (n > (new_len - lp)) || (copy_len > (lp - dp)) ||
+        (ref_off > ref_len) || (copy_len > (ref_len - ref_off))) {
+      goto fail_invalid_data;
+    }
+    memmove(dst_ptr + dp, dst_ptr + lp, (size_t)n);
+    dp += (size_t)n;
+    lp += (size_t)n;
+    memcpy(dst_ptr + dp, ref_ptr + ref_off, (size_t)copy_len);
+    dp += (size_t)copy_len;
+    prev_ref_end = (size_t)(ref_off + copy_len);
+  }
+  if (cp != commands_end) {
+    goto fail_invalid_data;
+  }
+  memmove(dst_ptr + dp, dst_ptr + lp, new_len - lp);
+  dp += new_len - lp;
+  if (dp != new_len) {
+    goto fail_invalid_data;
+  } else if (sflz4_private_peek_u32le(src_ptr + 8) !=
+             sflz4_private_xxh32(dst_ptr, new_len, 0)) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  }
+  result.value = new_len;
+  return result;
+
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
+
+// -------- LZ4 Memory Checkpoints
+
+// A checkpoint starts with a SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN byte header:
+//  - u32 magic
+//  - u32 page_len
+//  - u64 mem_len
+//  - u64 num_runs
+//  - u32 the index's xxHash-32
+//  - u32 reserved (zero)
+// followed by the index, num_runs SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN byte
+// entries (in increasing first_page order, not overlapping), each:
+//  - u64 first_page
+//  - u64 offset, of the run's data, relative to the start of the checkpoint
+//  - u32 num_pages
+//  - u32 encoded_len, with SFLZ4_MEMORY_CHECKPOINT_RAW_BIT set if the data
+//    is stored verbatim instead of being an LZ4 block
+//  - u32 the run's pages' xxHash-32
+//  - u32 the run's data's xxHash-32
+// followed by each run's data, contiguous and in index order.
+#define SFLZ4_MEMORY_CHECKPOINT_MAGIC 0x434D5A53
+#define SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN 32
+#define SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN 32
+#define SFLZ4_MEMORY_CHECKPOINT_RAW_BIT 0x80000000u
+#define SFLZ4_MEMORY_CHECKPOINT_MAX_INCL_RUN_LEN 0x10000
+
+#define SFLZ4_MEMORY_FINGERPRINT_PRIME1 0x9E3779B185EBCA87ull
+#define SFLZ4_MEMORY_FINGERPRINT_PRIME2 0xC2B2AE3D27D4EB4Full
+
+static inline const char*             //
+sflz4_private_memory_check_page_len(  //
+    size_t mem_len,                   //
+    size_t page_len) {
+  if ((page_len < 64) || (page_len > 65536) ||
+      ((page_len & (page_len - 1)) != 0) || ((mem_len & (page_len - 1)) != 0)) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  return NULL;
+}
+
+static inline uint64_t             //
+sflz4_private_memory_fingerprint(  //
+    const uint8_t* p,              //
+    size_t n) {
+  // This is xxHash-64's inner loop (four independent lanes, so that the CPU
+  // can overlap the multiplies) but with a cheaper final mix. n is a
+  // multiple of 32.
+  uint64_t v[4] = {
+      SFLZ4_MEMORY_FINGERPRINT_PRIME1,
+      SFLZ4_MEMORY_FINGERPRINT_PRIME2,
+      0,
+      (uint64_t)n,
+  };
+  for (const uint8_t* q = p + n; p < q; p += 32) {
+    for (int k = 0; k < 4; k++) {
+      uint64_t x = v[k] + (sflz4_private_peek_u64le(p + (8 * k)) *
+                           SFLZ4_MEMORY_FINGERPRINT_PRIME2);
+      v[k] = ((x << 31) | (x >> 33)) * SFLZ4_MEMORY_FINGERPRINT_PRIME1;
+    }
+  }
+  uint64_t h = v[0] ^ ((v[1] << 7) | (v[1] >> 57)) ^
+               ((v[2] << 12) | (v[2] >> 52)) ^ ((v[3] << 18) | (v[3] >> 46));
+  h ^= h >> 33;
+  h *= SFLZ4_MEMORY_FINGERPRINT_PRIME2;
+  h ^= h >> 29;
+  return h;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_memory_find_dirty_pages(        //
+    uint8_t* dirty_bitmap_ptr,        //
+    uint64_t* fingerprints_ptr,       //
+    const uint8_t* mem_ptr,           //
+    size_t mem_len,                   //
+    size_t page_len) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message =
+      sflz4_private_memory_check_page_len(mem_len, page_len);
+  if (result.status_message) {
+    return result;
+  }
+
+  const size_t num_pages = mem_len / page_len;
+  memset(dirty_bitmap_ptr, 0, (num_pages + 7) / 8);
+  for (size_t i = 0; i < num_pages; i++) {
+    const uint64_t f =
+        sflz4_private_memory_fingerprint(mem_ptr + (i * page_len), page_len);
+    if (fingerprints_ptr[i] != f) {
+      fingerprints_ptr[i] = f;
+      dirty_bitmap_ptr[i >> 3] |= (uint8_t)(1 << (i & 7));
+      result.value++;
+    }
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result         //
+sflz4_memory_checkpoint_worst_case_dst_len(  //
+    size_t mem_len,                          //
+    size_t page_len) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message =
+      sflz4_private_memory_check_page_len(mem_len, page_len);
+  if (result.status_message) {
+    return result;
+  }
+
+  // Each run is first compressed into a slot as long as its
+  // sflz4_block_encode_worst_case_dst_len, before being compacted. A run of
+  // k pages has a worst case of at most k times a page's, so the slots (and
+  // the index, with at most one entry per page) fit in this.
+  sflz4_size_result w = sflz4_block_encode_worst_case_dst_len(page_len);
+  if (w.status_message) {
+    return w;
+  }
+  const uint64_t num_pages = (uint64_t)(mem_len / page_len);
+  const uint64_t n =
+      SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN +
+      (num_pages * (SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN + (uint64_t)w.value));
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+static inline int                     //
+sflz4_private_memory_page_is_dirty(   //
+    const uint8_t* dirty_bitmap_ptr,  //
+    size_t i) {
+  return !dirty_bitmap_ptr || ((dirty_bitmap_ptr[i >> 3] >> (i & 7)) & 1);
+}
+
+typedef struct sflz4_private_memory_checkpoint_struct {
+  uint8_t* ckpt_ptr;
+  uint8_t* mem_ptr;
+  size_t page_len;
+  volatile uint32_t lock;
+  const char* status_message;
+} sflz4_private_memory_checkpoint;
+
+static inline void                       //
+sflz4_private_memory_set_status(         //
+    sflz4_private_memory_checkpoint* c,  //
+    const char* status_message) {
+  sflz4_private_lock(&c->lock);
+  if (!c->status_message) {
+    c->status_message = status_message;
+  }
+  sflz4_private_unlock(&c->lock);
+}
+
+static void                       //
+sflz4_private_memory_encode_run(  //
+    void* func_context,           //
+    size_t i) {
+  sflz4_private_memory_checkpoint* c =
+      (sflz4_private_memory_checkpoint*)func_context;
+  uint8_t* const entry = c->ckpt_ptr + SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN +
+                         (i * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+  const uint8_t* const run_ptr =
+      c->mem_ptr + ((size_t)sflz4_private_peek_u64le(entry) * c->page_len);
+  const size_t run_len =
+      (size_t)sflz4_private_peek_u32le(entry + 16) * c->page_len;
+  // Until compaction, the offset field holds the run's worst-case slot.
+  uint8_t* const slot_ptr =
+      c->ckpt_ptr + (size_t)sflz4_private_peek_u64le(entry + 8);
+
+  sflz4_size_result e = sflz4_block_encode_worst_case_dst_len(run_len);
+  if (!e.status_message) {
+    e = sflz4_block_encode(slot_ptr, e.value, run_ptr, run_len);
+  }
+  if (e.status_message) {
+    sflz4_private_memory_set_status(c, e.status_message);
+    return;
+  }
+  uint32_t encoded_len = (uint32_t)e.value;
+  const uint32_t pages_checksum = sflz4_private_xxh32(run_ptr, run_len, 0);
+  uint32_t data_checksum = pages_checksum;
+  if (encoded_len >= run_len) {
+    memcpy(slot_ptr, run_ptr, run_len);
+    encoded_len = ((uint32_t)run_len) | SFLZ4_MEMORY_CHECKPOINT_RAW_BIT;
+  } else {
+    data_checksum = sflz4_private_xxh32(slot_ptr, encoded_len, 0);
+  }
+  sflz4_private_poke_u32le(entry + 20, encoded_len);
+  sflz4_private_poke_u32le(entry + 24, pages_checksum);
+  sflz4_private_poke_u32le(entry + 28, data_checksum);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_memory_checkpoint_encode(             //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT mem_ptr,  //
+    size_t mem_len,                         //
+    size_t page_len,                        //
+    const uint8_t* dirty_bitmap_ptr,        //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  sflz4_size_result result =
+      sflz4_memory_checkpoint_worst_case_dst_len(mem_len, page_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  const size_t num_pages = mem_len / page_len;
+  const size_t max_run_pages =
+      SFLZ4_MEMORY_CHECKPOINT_MAX_INCL_RUN_LEN / page_len;
+
+  // Group the dirty pages into runs, twice. The first pass counts them (to
+  // find where the index ends) and the second writes the index.
+  size_t num_runs = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    uint8_t* entry = dst_ptr + SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN;
+    size_t slot = SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN +
+                  (num_runs * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+    size_t n = 0;
+    for (size_t i = 0; i < num_pages;) {
+      if (!sflz4_private_memory_page_is_dirty(dirty_bitmap_ptr, i)) {
+        i++;
+        continue;
+      }
+      size_t j = i + 1;
+      while ((j < num_pages) && ((j - i) < max_run_pages) &&
+             sflz4_private_memory_page_is_dirty(dirty_bitmap_ptr, j)) {
+        j++;
+      }
+      if (pass) {
+        sflz4_size_result w =
+            sflz4_block_encode_worst_case_dst_len((j - i) * page_len);
+        if (w.status_message) {
+          result.status_message = w.status_message;
+          result.value = 0;
+          return result;
+        }
+        sflz4_private_poke_u64le(entry + 0, (uint64_t)i);
+        sflz4_private_poke_u64le(entry + 8, (uint64_t)slot);
+        sflz4_private_poke_u32le(entry + 16, (uint32_t)(j - i));
+        entry += SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN;
+        slot += w.value;
+      }
+      n++;
+      i = j;
+    }
+    num_runs = n;
+  }
+
+  sflz4_private_memory_checkpoint c;
+  c.ckpt_ptr = dst_ptr;
+  c.mem_ptr = (uint8_t*)mem_ptr;
+  c.page_len = page_len;
+  c.lock = 0;
+  c.status_message = NULL;
+  if (parallel_for) {
+    (*parallel_for)(parallel_for_context, num_runs,
+                    &sflz4_private_memory_encode_run, &c);
+  } else {
+    for (size_t i = 0; i < num_runs; i++) {
+      sflz4_private_memory_encode_run(&c, i);
+    }
+  }
+  if (c.status_message) {
+    result.status_message = c.status_message;
+    result.value = 0;
+    return result;
+  }
+
+  // Compact the runs' data, moving each one down from its slot.
+  uint8_t* const index_ptr = dst_ptr + SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN;
+  const size_t index_len = num_runs * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN;
+  size_t offset = SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN + index_len;
+  for (size_t i = 0; i < num_runs; i++) {
+    uint8_t* const entry = index_ptr + (i * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+    const size_t slot = (size_t)sflz4_private_peek_u64le(entry + 8);
+    const size_t encoded_len = sflz4_private_peek_u32le(entry + 20) &
+                               ~SFLZ4_MEMORY_CHECKPOINT_RAW_BIT;
+    memmove(dst_ptr + offset, dst_ptr + slot, encoded_len);
+    sflz4_private_poke_u64le(entry + 8, (uint64_t)offset);
+    offset += encoded_len;
+  }
+
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_MEMORY_CHECKPOINT_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4, (uint32_t)page_len);
+  sflz4_private_poke_u64le(dst_ptr + 8, (uint64_t)mem_len);
+  sflz4_private_poke_u64le(dst_ptr + 16, (uint64_t)num_runs);
+  sflz4_private_poke_u32le(dst_ptr + 24,
+                           sflz4_private_xxh32(index_ptr, index_len, 0));
+  sflz4_private_poke_u32le(dst_ptr + 28, 0);
+  result.value = offset;
+  return result;
+}
+
+static void                       //
+sflz4_private_memory_verify_run(  //
+    void* func_context,           //
+    size_t i) {
+  sflz4_private_memory_checkpoint* c =
+      (sflz4_private_memory_checkpoint*)func_context;
+  const uint8_t* const entry = c->ckpt_ptr +
+                               SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN +
+                               (i * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+  const uint8_t* const data_ptr =
+      c->ckpt_ptr + (size_t)sflz4_private_peek_u64le(entry + 8);
+  const size_t data_len = sflz4_private_peek_u32le(entry + 20) &
+                          ~SFLZ4_MEMORY_CHECKPOINT_RAW_BIT;
+  if (sflz4_private_xxh32(data_ptr, data_len, 0) !=
+      sflz4_private_peek_u32le(entry + 28)) {
+    sflz4_private_memory_set_status(c,
+                                    sflz4_status_message__error_bad_checksum);
+  }
+}
+
+static void                        //
+sflz4_private_memory_restore_run(  //
+    void* func_context,            //
+    size_t i) {
+  sflz4_private_memory_checkpoint* c =
+      (sflz4_private_memory_checkpoint*)func_context;
+  const uint8_t* const entry = c->ckpt_ptr +
+                               SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN +
+                               (i * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+  uint8_t* const run_ptr =
+      c->mem_ptr + ((size_t)sflz4_private_peek_u64le(entry) * c->page_len);
+  const size_t run_len =
+      (size_t)sflz4_private_peek_u32le(entry + 16) * c->page_len;
+  const uint8_t* const data_ptr =
+      c->ckpt_ptr + (size_t)sflz4_private_peek_u64le(entry + 8);
+  const uint32_t encoded_len = sflz4_private_peek_u32le(entry + 20);
+
+  const char* status_message = NULL;
+  if (encoded_len & SFLZ4_MEMORY_CHECKPOINT_RAW_BIT) {
+    memcpy(run_ptr, data_ptr, run_len);
+  } else {
+    sflz4_size_result r =
+        sflz4_block_decode(run_ptr, run_len, data_ptr, encoded_len);
+    if (r.status_message) {
+      status_message = r.status_message;
+    } else if (r.value != run_len) {
+      status_message = sflz4_status_message__error_invalid_data;
+    }
+  }
+  if (!status_message && (sflz4_private_xxh32(run_ptr, run_len, 0) !=
+                          sflz4_private_peek_u32le(entry + 24))) {
+    status_message = sflz4_status_message__error_bad_checksum;
+  }
+  if (status_message) {
+    sflz4_private_memory_set_status(c, status_message);
+  }
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_memory_checkpoint_restore(            //
+    uint8_t* SFLZ4_RESTRICT mem_ptr,        //
+    size_t mem_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  sflz4_size_result result = {NULL, 0};
+  if ((src_len < SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN) ||
+      (sflz4_private_peek_u32le(src_ptr + 0) !=
+       SFLZ4_MEMORY_CHECKPOINT_MAGIC) ||
+      (sflz4_private_peek_u32le(src_ptr + 28) != 0)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const size_t page_len = sflz4_private_peek_u32le(src_ptr + 4);
+  if (sflz4_private_memory_check_page_len(mem_len, page_len)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  } else if (sflz4_private_peek_u64le(src_ptr + 8) != (uint64_t)mem_len) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  const uint64_t num_runs = sflz4_private_peek_u64le(src_ptr + 16);
+  if (num_runs > ((src_len - SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN) /
+                  SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const uint8_t* const index_ptr = src_ptr + SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN;
+  const size_t index_len =
+      (size_t)num_runs * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN;
+  if (sflz4_private_xxh32(index_ptr, index_len, 0) !=
+      sflz4_private_peek_u32le(src_ptr + 24)) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  }
+
+  // Validate the whole index before writing to mem. In particular, the runs
+  // must not overlap, as they are restored concurrently.
+  const uint64_t num_pages = (uint64_t)(mem_len / page_len);
+  const uint64_t max_run_pages =
+      SFLZ4_MEMORY_CHECKPOINT_MAX_INCL_RUN_LEN / page_len;
+  uint64_t next_page = 0;
+  uint64_t offset = SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN + index_len;
+  for (size_t i = 0; i < (size_t)num_runs; i++) {
+    const uint8_t* const entry =
+        index_ptr + (i * SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN);
+    const uint64_t first_page = sflz4_private_peek_u64le(entry + 0);
+    const uint64_t run_pages = sflz4_private_peek_u32le(entry + 16);
+    const uint32_t encoded_len = sflz4_private_peek_u32le(entry + 20);
+    const uint64_t n = encoded_len & ~SFLZ4_MEMORY_CHECKPOINT_RAW_BIT;
+    if ((first_page < next_page) || (first_page > num_pages) ||
+        (run_pages == 0) || (run_pages > max_run_pages) ||
+        (run_pages > (num_pages - first_page)) ||
+        (sflz4_private_peek_u64le(entry + 8) != offset) ||
+        (n > (src_len - offset)) ||
+        ((encoded_len & SFLZ4_MEMORY_CHECKPOINT_RAW_BIT) &&
+         (n != (run_pages * page_len)))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    next_page = first_page + run_pages;
+    offset += n;
+    result.value += (size_t)(run_pages * page_len);
+  }
+
+  sflz4_private_memory_checkpoint c;
+  c.ckpt_ptr = (uint8_t*)src_ptr;
+  c.mem_ptr = mem_ptr;
+  c.page_len = page_len;
+  c.lock = 0;
+  c.status_message = NULL;
+
+  // Verify every run's encoded data, then decode them all. Both phases
+  // touch each run independently, so both can run in parallel.
+  for (int phase = 0; !c.status_message && (phase < 2); phase++) {
+    void (*func)(void* func_context, size_t i) =
+        phase ? &sflz4_private_memory_restore_run
+              : &sflz4_private_memory_verify_run;
+    if (parallel_for) {
+      (*parallel_for)(parallel_for_context, (size_t)num_runs, func, &c);
+    } else {
+      for (size_t i = 0; i < (size_t)num_runs; i++) {
+        (*func)(&c, i);
+      }
+    }
+  }
+  if (c.status_message) {
+    result.status_message = c.status_message;
+    result.value = 0;
+  }
+  return result;
+}
+
+// -------- LZ4 Archive
+
+// An archive starts with a SFLZ4_ARCHIVE_HEADER_LEN byte header:
+//  - u32 magic
+//  - u32 block_max_len
+//  - u64 num_blocks
+//  - u64 num_files
+//  - u64 contents_len, the total length of the files' contents
+//  - u64 index_offset
+//  - u32 the index's xxHash-32, seeded with the xxHash-32 of the header's
+//    first 40 bytes (so that it also covers them)
+//  - u32 dict_len
+// followed by the dictionary's dict_len bytes, then each block's data and
+// then the index, which runs to the end of the archive. The index is:
+//  - num_blocks SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN byte entries, each:
+//     - u64 offset, of the block's data, relative to the start of the archive
+//     - u64 contents_offset, of the block's first decoded byte
+//     - u32 encoded_len, with SFLZ4_ARCHIVE_RAW_BIT set if the data is
+//       stored verbatim instead of being an LZ4 block
+//     - u32 decoded_len
+//     - u32 the decoded bytes' xxHash-32
+//     - u32 reserved (zero)
+//  - num_files SFLZ4_ARCHIVE_FILE_ENTRY_LEN byte entries, each:
+//     - u64 contents_offset
+//     - u64 data_len
+//     - u32 name_offset, relative to the start of the names
+//     - u32 name_len
+//  - num_files u32 file_index values, sorted by name (compared as bytes).
+//  - the names.
+#define SFLZ4_ARCHIVE_MAGIC 0x41345A53
+#define SFLZ4_ARCHIVE_HEADER_LEN 48
+#define SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN 32
+#define SFLZ4_ARCHIVE_FILE_ENTRY_LEN 24
+#define SFLZ4_ARCHIVE_RAW_BIT 0x80000000u
+
+// sflz4_private_archive_totals sums the files' contents and names lengths.
+static const char*                        //
+sflz4_private_archive_totals(             //
+    uint64_t* contents_len,               //
+    uint64_t* names_len,                  //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len) {
+  *contents_len = 0;
+  *names_len = 0;
+  if ((uint64_t)files_len > 0xFFFFFFFF) {
+    return sflz4_status_message__error_src_is_too_long;
+  }
+  for (size_t i = 0; i < files_len; i++) {
+    *contents_len += files_ptr[i].data_len;
+    *names_len += files_ptr[i].name_len;
+    if ((*contents_len > SIZE_MAX) || (*names_len > 0xFFFFFFFF)) {
+      return sflz4_status_message__error_src_is_too_long;
+    }
+  }
+  return NULL;
+}
+
+// sflz4_private_archive_plan cuts the files' concatenated contents into
+// blocks, returning how many. If blocks_ptr is non-NULL, it also fills in
+// each block entry's contents_offset and decoded_len.
+//
+// A file is never split if it fits in one block. A file longer than that
+// starts a new block and is cut into block_max_len pieces.
+static uint64_t                           //
+sflz4_private_archive_plan(               //
+    uint8_t* blocks_ptr,                  //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len,                     //
+    size_t block_max_len) {
+  uint64_t num_blocks = 0;
+  uint64_t block_start = 0;
+  uint64_t pos = 0;
+  for (size_t i = 0; i <= files_len; i++) {
+    const uint64_t n = (i < files_len) ? files_ptr[i].data_len : 0;
+    // Cut before this file, if it doesn't fit in the current block, or
+    // before the end of the contents.
+    int cut = (pos > block_start) &&
+              ((i == files_len) || ((pos - block_start) + n > block_max_len));
+    pos += n;
+    while (cut || ((pos - block_start) >= block_max_len)) {
+      const uint64_t block_end =
+          cut ? (pos - n) : (block_start + block_max_len);
+      if (blocks_ptr) {
+        uint8_t* const entry =
+            blocks_ptr + (num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+        sflz4_private_poke_u64le(entry + 8, block_start);
+        sflz4_private_poke_u32le(entry + 20,
+                                 (uint32_t)(block_end - block_start));
+        sflz4_private_poke_u32le(entry + 28, 0);
+      }
+      num_blocks++;
+      block_start = block_end;
+      cut = 0;
+    }
+  }
+  return num_blocks;
+}
+
+static inline int                     //
+sflz4_private_archive_compare_names(  //
+    const uint8_t* p,                 //
+    size_t p_len,                     //
+    const uint8_t* q,                 //
+    size_t q_len) {
+  const int c = (p_len && q_len)
+                    ? memcmp(p, q, sflz4_private_min_size_t(p_len, q_len))
+                    : 0;
+  if (c != 0) {
+    return c;
+  }
+  return (p_len < q_len) ? -1 : ((p_len > q_len) ? +1 : 0);
+}
+
+static inline int                         //
+sflz4_private_archive_sorted_less(        //
+    const uint8_t* sorted_ptr,            //
+    const sflz4_archive_file* files_ptr,  //
+    size_t i,                             //
+    size_t j) {
+  const sflz4_archive_file* const f =
+      files_ptr + sflz4_private_peek_u32le(sorted_ptr + (4 * i));
+  const sflz4_archive_file* const g =
+      files_ptr + sflz4_private_peek_u32le(sorted_ptr + (4 * j));
+  return sflz4_private_archive_compare_names(f->name_ptr, f->name_len,
+                                             g->name_ptr, g->name_len) < 0;
+}
+
+static inline void                  //
+sflz4_private_archive_sorted_swap(  //
+    uint8_t* sorted_ptr,            //
+    size_t i,                       //
+    size_t j) {
+  const uint32_t x = sflz4_private_peek_u32le(sorted_ptr + (4 * i));
+  sflz4_private_poke_u32le(sorted_ptr + (4 * i),
+                           sflz4_private_peek_u32le(sorted_ptr + (4 * j)));
+  sflz4_private_poke_u32le(sorted_ptr + (4 * j), x);
+}
+
+// sflz4_private_archive_sort_names heap sorts the n u32le file_index values
+// at sorted_ptr by their files' names. qsort has no context argument.
+static void                               //
+sflz4_private_archive_sort_names(         //
+    uint8_t* sorted_ptr,                  //
+    const sflz4_archive_file* files_ptr,  //
+    size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    sflz4_private_poke_u32le(sorted_ptr + (4 * i), (uint32_t)i);
+  }
+  for (size_t phase = 0; phase < 2; phase++) {
+    // Phase 0 builds a max-heap. Phase 1 repeatedly moves its root to the
+    // end.
+    for (size_t k = phase ? n : (n / 2); k-- > (phase ? 1 : 0);) {
+      size_t root = phase ? 0 : k;
+      const size_t end = phase ? k : n;
+      if (phase) {
+        sflz4_private_archive_sorted_swap(sorted_ptr, 0, k);
+      }
+      while (1) {
+        size_t child = (2 * root) + 1;
+        if (child >= end) {
+          break;
+        } else if (((child + 1) < end) &&
+                   sflz4_private_archive_sorted_less(sorted_ptr, files_ptr,
+                                                     child, child + 1)) {
+          child++;
+        }
+        if (!sflz4_private_archive_sorted_less(sorted_ptr, files_ptr, root,
+                                               child)) {
+          break;
+        }
+        sflz4_private_archive_sorted_swap(sorted_ptr, root, child);
+        root = child;
+      }
+    }
+  }
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_archive_encode_workspace_len(       //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t contents_len = 0;
+  uint64_t names_len = 0;
+  result.status_message = sflz4_private_archive_totals(
+      &contents_len, &names_len, files_ptr, files_len);
+  if (!result.status_message) {
+    result.value = (size_t)contents_len;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_archive_worst_case_dst_len(         //
+    const sflz4_archive_file* files_ptr,  //
+    size_t files_len,                     //
+    size_t block_max_len) {
+  sflz4_size_result result = {NULL, 0};
+  if ((block_max_len == 0) ||
+      (block_max_len > (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2))) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  uint64_t contents_len = 0;
+  uint64_t names_len = 0;
+  result.status_message = sflz4_private_archive_totals(
+      &contents_len, &names_len, files_ptr, files_len);
+  if (result.status_message) {
+    return result;
+  }
+
+  // Each block is first compressed into a slot as long as its
+  // sflz4_block_encode_worst_case_dst_len, and those slots sum to at most
+  // sflz4_private_block_encode_worst_case_sum, before being compacted. A
+  // num_blocks bound, instead of calling sflz4_private_archive_plan, would be
+  // looser.
+  const uint64_t num_blocks = sflz4_private_archive_plan(
+      NULL, files_ptr, files_len, block_max_len);
+  const uint64_t n =
+      SFLZ4_ARCHIVE_HEADER_LEN + SFLZ4_DICTIONARY_MAX_INCL_LEN +
+      sflz4_private_block_encode_worst_case_sum(contents_len, num_blocks) +
+      (num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN) +
+      (((uint64_t)files_len) * (SFLZ4_ARCHIVE_FILE_ENTRY_LEN + 4)) +
+      names_len;
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+typedef struct sflz4_private_archive_encode_struct {
+  uint8_t* dst_ptr;
+  uint8_t* blocks_ptr;
+  const uint8_t* workspace_ptr;
+  const sflz4_dictionary* dictionary;
+  volatile uint32_t lock;
+  const char* status_message;
+} sflz4_private_archive_encode;
+
+static inline void                    //
+sflz4_private_archive_set_status(     //
+    sflz4_private_archive_encode* e,  //
+    const char* status_message) {
+  sflz4_private_lock(&e->lock);
+  if (!e->status_message) {
+    e->status_message = status_message;
+  }
+  sflz4_private_unlock(&e->lock);
+}
+
+static void                          //
+sflz4_private_archive_encode_block(  //
+    void* func_context,              //
+    size_t i) {
+  sflz4_private_archive_encode* e =
+      (sflz4_private_archive_encode*)func_context;
+  uint8_t* const entry =
+      e->blocks_ptr + (i * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+  // Until compaction, the offset field holds the block's worst-case slot.
+  uint8_t* const slot_ptr =
+      e->dst_ptr + (size_t)sflz4_private_peek_u64le(entry + 0);
+  const uint8_t* const src_ptr =
+      e->workspace_ptr + (size_t)sflz4_private_peek_u64le(entry + 8);
+  const size_t src_len = sflz4_private_peek_u32le(entry + 20);
+
+  sflz4_size_result r = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (!r.status_message) {
+    r = e->dictionary
+            ? sflz4_block_encode_with_dictionary(slot_ptr, r.value, src_ptr,
+                                                 src_len, e->dictionary)
+            : sflz4_block_encode(slot_ptr, r.value, src_ptr, src_len);
+  }
+  if (r.status_message) {
+    sflz4_private_archive_set_status(e, r.status_message);
+    return;
+  }
+  uint32_t encoded_len = (uint32_t)r.value;
+  if (encoded_len >= src_len) {
+    memcpy(slot_ptr, src_ptr, src_len);
+    encoded_len = ((uint32_t)src_len) | SFLZ4_ARCHIVE_RAW_BIT;
+  }
+  sflz4_private_poke_u32le(entry + 16, encoded_len);
+  sflz4_private_poke_u32le(entry + 24,
+                           sflz4_private_xxh32(src_ptr, src_len, 0));
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_archive_encode(                       //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const sflz4_archive_file* files_ptr,    //
+    size_t files_len,                       //
+    size_t block_max_len,                   //
+    const sflz4_dictionary* dictionary,     //
+    uint8_t* SFLZ4_RESTRICT workspace_ptr,  //
+    size_t workspace_len,                   //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  sflz4_size_result result =
+      sflz4_archive_worst_case_dst_len(files_ptr, files_len, block_max_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  uint64_t contents_len = 0;
+  uint64_t names_len = 0;
+  sflz4_private_archive_totals(&contents_len, &names_len, files_ptr,
+                               files_len);
+  if (contents_len > workspace_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  const size_t dict_len = dictionary ? dictionary->private_len : 0;
+  if (dict_len) {
+    memcpy(dst_ptr + SFLZ4_ARCHIVE_HEADER_LEN, dictionary->private_ptr,
+           dict_len);
+  }
+
+  // Write the block entries after the last possible slot, then assign each
+  // block its slot.
+  const size_t data_offset = SFLZ4_ARCHIVE_HEADER_LEN + dict_len;
+  const size_t num_blocks =
+      (size_t)sflz4_private_archive_plan(NULL, files_ptr, files_len,
+                                         block_max_len);
+  uint8_t* const blocks_ptr =
+      dst_ptr + data_offset +
+      (size_t)sflz4_private_block_encode_worst_case_sum(contents_len,
+                                                        num_blocks);
+  sflz4_private_archive_plan(blocks_ptr, files_ptr, files_len, block_max_len);
+  size_t slot = data_offset;
+  for (size_t i = 0; i < num_blocks; i++) {
+    uint8_t* const entry = blocks_ptr + (i * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+    sflz4_size_result w = sflz4_block_encode_worst_case_dst_len(
+        sflz4_private_peek_u32le(entry + 20));
+    if (w.status_message) {
+      result.status_message = w.status_message;
+      result.value = 0;
+      return result;
+    }
+    sflz4_private_poke_u64le(entry + 0, (uint64_t)slot);
+    slot += w.value;
+  }
+
+  // Gather the files' contents, then compress the blocks.
+  size_t pos = 0;
+  for (size_t i = 0; i < files_len; i++) {
+    if (files_ptr[i].data_len) {
+      memcpy(workspace_ptr + pos, files_ptr[i].data_ptr,
+             files_ptr[i].data_len);
+      pos += files_ptr[i].data_len;
+    }
+  }
+  sflz4_private_archive_encode e;
+  e.dst_ptr = dst_ptr;
+  e.blocks_ptr = blocks_ptr;
+  e.workspace_ptr = workspace_ptr;
+  e.dictionary = dict_len ? dictionary : NULL;
+  e.lock = 0;
+  e.status_message = NULL;
+  if (parallel_for) {
+    (*parallel_for)(parallel_for_context, num_blocks,
+                    &sflz4_private_archive_encode_block, &e);
+  } else {
+    for (size_t i = 0; i < num_blocks; i++) {
+      sflz4_private_archive_encode_block(&e, i);
+    }
+  }
+  if (e.status_message) {
+    result.status_message = e.status_message;
+    result.value = 0;
+    return result;
+  }
+
+  // Compact the blocks' data, moving each one down from its slot, and then
+  // the block entries, which start the index.
+  size_t offset = data_offset;
+  for (size_t i = 0; i < num_blocks; i++) {
+    uint8_t* const entry = blocks_ptr + (i * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+    const size_t n =
+        sflz4_private_peek_u32le(entry + 16) & ~SFLZ4_ARCHIVE_RAW_BIT;
+    memmove(dst_ptr + offset,
+            dst_ptr + (size_t)sflz4_private_peek_u64le(entry + 0), n);
+    sflz4_private_poke_u64le(entry + 0, (uint64_t)offset);
+    offset += n;
+  }
+  const size_t index_offset = offset;
+  uint8_t* dp = dst_ptr + index_offset;
+  memmove(dp, blocks_ptr, num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+  dp += num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN;
+
+  uint64_t contents_offset = 0;
+  uint32_t name_offset = 0;
+  for (size_t i = 0; i < files_len; i++) {
+    sflz4_private_poke_u64le(dp + 0, contents_offset);
+    sflz4_private_poke_u64le(dp + 8, (uint64_t)files_ptr[i].data_len);
+    sflz4_private_poke_u32le(dp + 16, name_offset);
+    sflz4_private_poke_u32le(dp + 20, (uint32_t)files_ptr[i].name_len);
+    dp += SFLZ4_ARCHIVE_FILE_ENTRY_LEN;
+    contents_offset += files_ptr[i].data_len;
+    name_offset += (uint32_t)files_ptr[i].name_len;
+  }
+  sflz4_private_archive_sort_names(dp, files_ptr, files_len);
+  dp += 4 * files_len;
+  for (size_t i = 0; i < files_len; i++) {
+    if (files_ptr[i].name_len) {
+      memcpy(dp, files_ptr[i].name_ptr, files_ptr[i].name_len);
+      dp += files_ptr[i].name_len;
+    }
+  }
+
+  sflz4_private_poke_u32le(dst_ptr + 0, SFLZ4_ARCHIVE_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 4, (uint32_t)block_max_len);
+  sflz4_private_poke_u64le(dst_ptr + 8, (uint64_t)num_blocks);
+  sflz4_private_poke_u64le(dst_ptr + 16, (uint64_t)files_len);
+  sflz4_private_poke_u64le(dst_ptr + 24, contents_len);
+  sflz4_private_poke_u64le(dst_ptr + 32, (uint64_t)index_offset);
+  sflz4_private_poke_u32le(dst_ptr + 44, (uint32_t)dict_len);
+  sflz4_private_poke_u32le(
+      dst_ptr + 40,
+      sflz4_private_xxh32(dst_ptr + index_offset,
+                          (size_t)(dp - (dst_ptr + index_offset)),
+                          sflz4_private_xxh32(dst_ptr, 40, 0)));
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+// sflz4_private_archive holds a parsed archive header. Parsing checks that
+// the header is consistent, in O(1) time, but not the index's entries.
+typedef struct sflz4_private_archive_struct {
+  const uint8_t* src_ptr;
+  size_t src_len;
+  size_t block_max_len;
+  uint64_t num_blocks;
+  uint64_t num_files;
+  uint64_t contents_len;
+  size_t data_offset;
+  size_t index_offset;
+  const uint8_t* dict_ptr;
+  size_t dict_len;
+  const uint8_t* blocks_ptr;
+  const uint8_t* files_ptr;
+  const uint8_t* sorted_ptr;
+  const uint8_t* names_ptr;
+  size_t names_len;
+} sflz4_private_archive;
+
+static const char*             //
+sflz4_private_archive_parse(   //
+    sflz4_private_archive* a,  //
+    const uint8_t* src_ptr,    //
+    size_t src_len) {
+  if ((src_len < SFLZ4_ARCHIVE_HEADER_LEN) ||
+      (sflz4_private_peek_u32le(src_ptr + 0) != SFLZ4_ARCHIVE_MAGIC)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  a->src_ptr = src_ptr;
+  a->src_len = src_len;
+  a->block_max_len = sflz4_private_peek_u32le(src_ptr + 4);
+  a->num_blocks = sflz4_private_peek_u64le(src_ptr + 8);
+  a->num_files = sflz4_private_peek_u64le(src_ptr + 16);
+  a->contents_len = sflz4_private_peek_u64le(src_ptr + 24);
+  const uint64_t index_offset = sflz4_private_peek_u64le(src_ptr + 32);
+  a->dict_len = sflz4_private_peek_u32le(src_ptr + 44);
+  a->data_offset = SFLZ4_ARCHIVE_HEADER_LEN + a->dict_len;
+  if ((a->block_max_len == 0) ||
+      (a->block_max_len > (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2)) ||
+      (a->dict_len > SFLZ4_DICTIONARY_MAX_INCL_LEN) ||
+      (a->contents_len > SIZE_MAX) || (index_offset < a->data_offset) ||
+      (index_offset > src_len)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  a->index_offset = (size_t)index_offset;
+  size_t remaining = src_len - a->index_offset;
+  if (a->num_blocks > (remaining / SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  remaining -= (size_t)a->num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN;
+  if (a->num_files > (remaining / (SFLZ4_ARCHIVE_FILE_ENTRY_LEN + 4))) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  a->dict_ptr = src_ptr + SFLZ4_ARCHIVE_HEADER_LEN;
+  a->blocks_ptr = src_ptr + a->index_offset;
+  a->files_ptr =
+      a->blocks_ptr + ((size_t)a->num_blocks * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+  a->sorted_ptr =
+      a->files_ptr + ((size_t)a->num_files * SFLZ4_ARCHIVE_FILE_ENTRY_LEN);
+  a->names_ptr = a->sorted_ptr + ((size_t)a->num_files * 4);
+  a->names_len = (size_t)((src_ptr + src_len) - a->names_ptr);
+  return NULL;
+}
+
+typedef struct sflz4_private_archive_block_struct {
+  const uint8_t* data_ptr;
+  uint32_t encoded_len;
+  uint64_t contents_offset;
+  size_t decoded_len;
+  uint32_t checksum;
+} sflz4_private_archive_block;
+
+static const char*                   //
+sflz4_private_archive_block_at(      //
+    sflz4_private_archive_block* b,  //
+    const sflz4_private_archive* a,  //
+    uint64_t block_index) {
+  if (block_index >= a->num_blocks) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint8_t* const entry =
+      a->blocks_ptr + ((size_t)block_index * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN);
+  const uint64_t offset = sflz4_private_peek_u64le(entry + 0);
+  b->contents_offset = sflz4_private_peek_u64le(entry + 8);
+  b->encoded_len = sflz4_private_peek_u32le(entry + 16);
+  b->decoded_len = sflz4_private_peek_u32le(entry + 20);
+  b->checksum = sflz4_private_peek_u32le(entry + 24);
+  const uint64_t n = b->encoded_len & ~SFLZ4_ARCHIVE_RAW_BIT;
+  if ((offset < a->data_offset) || (offset > a->index_offset) ||
+      (n > (a->index_offset - offset)) || (b->decoded_len == 0) ||
+      (b->decoded_len > a->block_max_len) ||
+      (b->contents_offset > a->contents_len) ||
+      (b->decoded_len > (a->contents_len - b->contents_offset)) ||
+      ((b->encoded_len & SFLZ4_ARCHIVE_RAW_BIT) && (n != b->decoded_len)) ||
+      (sflz4_private_peek_u32le(entry + 28) != 0)) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  b->data_ptr = a->src_ptr + (size_t)offset;
+  return NULL;
+}
+
+// sflz4_private_archive_decode_block writes b's b->decoded_len bytes to dst.
+static const char*                    //
+sflz4_private_archive_decode_block(   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,  //
+    const sflz4_private_archive* a,   //
+    const sflz4_private_archive_block* b) {
+  if (b->encoded_len & SFLZ4_ARCHIVE_RAW_BIT) {
+    memcpy(dst_ptr, b->data_ptr, b->decoded_len);
+  } else {
+    sflz4_size_result r = sflz4_private_block_decode_counted(
+        dst_ptr, b->decoded_len, 0, a->dict_ptr, a->dict_len, b->data_ptr,
+        b->encoded_len, 0);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (r.value != b->decoded_len) {
+      return sflz4_status_message__error_invalid_data;
+    }
+  }
+  if (sflz4_private_xxh32(dst_ptr, b->decoded_len, 0) != b->checksum) {
+    return sflz4_status_message__error_bad_checksum;
+  }
+  return NULL;
+}
+
+static const char*                   //
+sflz4_private_archive_file_at(       //
+    sflz4_archive_file* f,           //
+    uint64_t* contents_offset,       //
+    const sflz4_private_archive* a,  //
+    uint64_t file_index) {
+  if (file_index >= a->num_files) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  const uint8_t* const entry =
+      a->files_ptr + ((size_t)file_index * SFLZ4_ARCHIVE_FILE_ENTRY_LEN);
+  *contents_offset = sflz4_private_peek_u64le(entry + 0);
+  const uint64_t data_len = sflz4_private_peek_u64le(entry + 8);
+  const size_t name_offset = sflz4_private_peek_u32le(entry + 16);
+  const size_t name_len = sflz4_private_peek_u32le(entry + 20);
+  if ((*contents_offset > a->contents_len) ||
+      (data_len > (a->contents_len - *contents_offset)) ||
+      (name_offset > a->names_len) ||
+      (name_len > (a->names_len - name_offset))) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  f->name_ptr = a->names_ptr + name_offset;
+  f->name_len = name_len;
+  f->data_ptr = NULL;
+  f->data_len = (size_t)data_len;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_num_files(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (!result.status_message) {
+    result.value = (size_t)a.num_files;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_find(                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    const uint8_t* name_ptr,          //
+    size_t name_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  }
+  size_t lo = 0;
+  size_t hi = (size_t)a.num_files;
+  while (lo < hi) {
+    const size_t mid = lo + ((hi - lo) / 2);
+    const uint32_t file_index =
+        sflz4_private_peek_u32le(a.sorted_ptr + (4 * mid));
+    sflz4_archive_file f;
+    uint64_t contents_offset = 0;
+    if (sflz4_private_archive_file_at(&f, &contents_offset, &a,
+                                      file_index)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    const int c = sflz4_private_archive_compare_names(
+        f.name_ptr, f.name_len, name_ptr, name_len);
+    if (c == 0) {
+      result.value = file_index;
+      return result;
+    } else if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  result.status_message = sflz4_status_message__error_bad_argument;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_archive_file_at(          //
+    sflz4_archive_file* f,      //
+    const uint8_t* src_ptr,     //
+    size_t src_len,             //
+    uint64_t file_index,        //
+    const uint8_t* contents_ptr) {
+  sflz4_private_archive a;
+  const char* status_message =
+      sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (status_message) {
+    return status_message;
+  }
+  uint64_t contents_offset = 0;
+  status_message =
+      sflz4_private_archive_file_at(f, &contents_offset, &a, file_index);
+  if (!status_message && contents_ptr) {
+    f->data_ptr = contents_ptr + (size_t)contents_offset;
+  }
+  return status_message;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_scratch_len(            //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (!result.status_message) {
+    result.value = a.block_max_len;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_extract(                //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    const uint8_t* src_ptr,           //
+    size_t src_len,                   //
+    uint64_t file_index,              //
+    uint8_t* scratch_ptr,             //
+    size_t scratch_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  sflz4_archive_file f;
+  uint64_t file_start = 0;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (!result.status_message) {
+    result.status_message =
+        sflz4_private_archive_file_at(&f, &file_start, &a, file_index);
+  }
+  if (result.status_message) {
+    return result;
+  } else if (f.data_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  } else if (scratch_len < a.block_max_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    return result;
+  } else if (f.data_len == 0) {
+    return result;
+  }
+  const uint64_t file_end = file_start + f.data_len;
+
+  // Find the last block that starts at or before the file. Block entries
+  // are in contents_offset order.
+  uint64_t lo = 0;
+  uint64_t hi = a.num_blocks;
+  while ((hi - lo) > 1) {
+    const uint64_t mid = lo + ((hi - lo) / 2);
+    const uint64_t mid_start = sflz4_private_peek_u64le(
+        a.blocks_ptr + ((size_t)mid * SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN) + 8);
+    if (mid_start <= file_start) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  // Decode blocks wholly within the file directly into dst. Decode the
+  // others (shared with other files) into scratch.
+  for (uint64_t pos = file_start; pos < file_end; lo++) {
+    sflz4_private_archive_block b;
+    result.status_message = sflz4_private_archive_block_at(&b, &a, lo);
+    if (!result.status_message &&
+        ((b.contents_offset > pos) ||
+         ((b.contents_offset + b.decoded_len) <= pos))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+    }
+    if (result.status_message) {
+      return result;
+    }
+    const uint64_t block_end = b.contents_offset + b.decoded_len;
+    if ((b.contents_offset == pos) && (block_end <= file_end)) {
+      result.status_message = sflz4_private_archive_decode_block(
+          dst_ptr + (size_t)(pos - file_start), &a, &b);
+    } else {
+      result.status_message =
+          sflz4_private_archive_decode_block(scratch_ptr, &a, &b);
+      if (!result.status_message) {
+        const uint64_t n =
+            ((block_end < file_end) ? block_end : file_end) - pos;
+        memcpy(dst_ptr + (size_t)(pos - file_start),
+               scratch_ptr + (size_t)(pos - b.contents_offset), (size_t)n);
+      }
+    }
+    if (result.status_message) {
+      return result;
+    }
+    pos = block_end;
+  }
+  result.value = f.data_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_archive_contents_len(           //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (!result.status_message) {
+    result.value = (size_t)a.contents_len;
+  }
+  return result;
+}
+
+typedef struct sflz4_private_archive_decode_struct {
+  uint8_t* dst_ptr;
+  const sflz4_private_archive* archive;
+  volatile uint32_t lock;
+  const char* status_message;
+} sflz4_private_archive_decode;
+
+static void                         //
+sflz4_private_archive_decode_task(  //
+    void* func_context,             //
+    size_t i) {
+  sflz4_private_archive_decode* d =
+      (sflz4_private_archive_decode*)func_context;
+  sflz4_private_archive_block b;
+  const char* status_message =
+      sflz4_private_archive_block_at(&b, d->archive, i);
+  if (!status_message) {
+    status_message = sflz4_private_archive_decode_block(
+        d->dst_ptr + (size_t)b.contents_offset, d->archive, &b);
+  }
+  if (status_message) {
+    sflz4_private_lock(&d->lock);
+    if (!d->status_message) {
+      d->status_message = status_message;
+    }
+    sflz4_private_unlock(&d->lock);
+  }
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_archive_decode_all(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    sflz4_parallel_for_func parallel_for,   //
+    void* parallel_for_context) {
+  sflz4_size_result result = {NULL, 0};
+  sflz4_private_archive a;
+  result.status_message = sflz4_private_archive_parse(&a, src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  } else if (sflz4_private_xxh32(a.blocks_ptr, src_len - a.index_offset,
+                                 sflz4_private_xxh32(src_ptr, 40, 0)) !=
+             sflz4_private_peek_u32le(src_ptr + 40)) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  } else if (a.contents_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+
+  // The blocks must tile the contents exactly, as they are decoded
+  // concurrently.
+  uint64_t pos = 0;
+  for (uint64_t i = 0; i < a.num_blocks; i++) {
+    sflz4_private_archive_block b;
+    result.status_message = sflz4_private_archive_block_at(&b, &a, i);
+    if (!result.status_message && (b.contents_offset != pos)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+    }
+    if (result.status_message) {
+      return result;
+    }
+    pos += b.decoded_len;
+  }
+  if (pos != a.contents_len) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+
+  sflz4_private_archive_decode d;
+  d.dst_ptr = dst_ptr;
+  d.archive = &a;
+  d.lock = 0;
+  d.status_message = NULL;
+  if (parallel_for) {
+    (*parallel_for)(parallel_for_context, (size_t)a.num_blocks,
+                    &sflz4_private_archive_decode_task, &d);
+  } else {
+    for (size_t i = 0; i < (size_t)a.num_blocks; i++) {
+      sflz4_private_archive_decode_task(&d, i);
+    }
+  }
+  if (d.status_message) {
+    result.status_message = d.status_message;
+    return result;
+  }
+  result.value = (size_t)a.contents_len;
+  return result;
+}
+
+// -------- LZ4 Sparse Streams
+
+// A record starts with a SFLZ4_SPARSE_RECORD_HEADER_LEN byte header:
+//  - u32 magic
+//  - u32 encoded_len, with SFLZ4_SPARSE_HOLE_BIT set for a hole (whose
+//    encoded_len is otherwise zero), SFLZ4_SPARSE_RAW_BIT set if the data
+//    is stored verbatim instead of being an LZ4 block and
+//    SFLZ4_SPARSE_CRC32C_BIT set if the checksum is CRC-32C
+//  - u64 decoded_len
+// followed by encoded_len bytes of data and then the u32 checksum of the
+// decoded data (empty, for a hole). An xxHash-32 checksum is seeded with the
+// xxHash-32 of the header. A CRC-32C checksum covers the header and then the
+// decoded data.
+#define SFLZ4_SPARSE_MAGIC 0x50345A53
+#define SFLZ4_SPARSE_HOLE_BIT 0x80000000u
+#define SFLZ4_SPARSE_RAW_BIT 0x40000000u
+#define SFLZ4_SPARSE_CRC32C_BIT 0x20000000u
+#define SFLZ4_SPARSE_LEN_MASK 0x1FFFFFFFu
+
+static inline int           //
+sflz4_private_is_all_zero(  //
+    const uint8_t* p,       //
+    size_t n) {
+  for (; n >= 32; n -= 32, p += 32) {
+    if (sflz4_private_peek_u64le(p + 0) | sflz4_private_peek_u64le(p + 8) |
+        sflz4_private_peek_u64le(p + 16) | sflz4_private_peek_u64le(p + 24)) {
+      return 0;
+    }
+  }
+  for (; n > 0; n--, p++) {
+    if (*p) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// sflz4_private_sparse_checksum returns the checksum of a record's header
+// (at header_ptr) and decoded data (at data_ptr).
+static uint32_t                 //
+sflz4_private_sparse_checksum(  //
+    const uint8_t* header_ptr,  //
+    const uint8_t* data_ptr,    //
+    size_t data_len) {
+  if (sflz4_private_peek_u32le(header_ptr + 4) & SFLZ4_SPARSE_CRC32C_BIT) {
+    return sflz4_crc32c_update(
+        sflz4_crc32c_update(0, header_ptr, SFLZ4_SPARSE_RECORD_HEADER_LEN),
+        data_ptr, data_len);
+  }
+  return sflz4_private_xxh32(
+      data_ptr, data_len,
+      sflz4_private_xxh32(header_ptr, SFLZ4_SPARSE_RECORD_HEADER_LEN, 0));
+}
+
+// sflz4_private_sparse_emit writes one record, for the src_len bytes at
+// src_ptr or, if src_ptr is NULL, for a src_len byte hole, returning the
+// record's length. The caller has checked that dp has room for it.
+static sflz4_size_result         //
+sflz4_private_sparse_emit(       //
+    uint8_t* SFLZ4_RESTRICT dp,  //
+    const uint8_t* src_ptr,      //
+    uint64_t src_len,            //
+    uint32_t flags) {
+  uint32_t encoded_len = SFLZ4_SPARSE_HOLE_BIT;
+  if (src_ptr) {
+    const size_t n = (size_t)src_len;
+    sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(n);
+    if (result.status_message) {
+      return result;
+    }
+    result = sflz4_block_encode(dp + SFLZ4_SPARSE_RECORD_HEADER_LEN,
+                                result.value, src_ptr, n);
+    if (result.status_message) {
+      return result;
+    }
+    encoded_len = (uint32_t)result.value;
+    if (encoded_len >= n) {
+      memcpy(dp + SFLZ4_SPARSE_RECORD_HEADER_LEN, src_ptr, n);
+      encoded_len = ((uint32_t)n) | SFLZ4_SPARSE_RAW_BIT;
+    }
+  }
+  const size_t n = encoded_len & SFLZ4_SPARSE_LEN_MASK;
+  if (flags & SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C) {
+    encoded_len |= SFLZ4_SPARSE_CRC32C_BIT;
+  }
+  sflz4_private_poke_u32le(dp + 0, SFLZ4_SPARSE_MAGIC);
+  sflz4_private_poke_u32le(dp + 4, encoded_len);
+  sflz4_private_poke_u64le(dp + 8, src_len);
+  sflz4_private_poke_u32le(
+      dp + SFLZ4_SPARSE_RECORD_HEADER_LEN + n,
+      src_ptr ? sflz4_private_sparse_checksum(dp, src_ptr, (size_t)src_len)
+              : sflz4_private_sparse_checksum(dp, dp, 0));
+  sflz4_size_result result = {NULL, SFLZ4_SPARSE_RECORD_HEADER_LEN + n + 4};
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_sparse_encode_worst_case_dst_len(  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len > SFLZ4_SPARSE_MAX_INCL_DATA_LEN) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  // At worst, data and zero chunks alternate, so that every chunk is its own
+  // record, each with a worst-case block.
+  const size_t num_chunks = (src_len + SFLZ4_SPARSE_ZERO_CHUNK_LEN - 1) /
+                            SFLZ4_SPARSE_ZERO_CHUNK_LEN;
+  result.value =
+      (size_t)sflz4_private_block_encode_worst_case_sum(src_len, num_chunks) +
+      (num_chunks * (SFLZ4_SPARSE_RECORD_HEADER_LEN + 4));
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_sparse_encode_data(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint32_t flags) {
+  sflz4_size_result result = sflz4_sparse_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+
+  // Group consecutive chunks that are all zero (or not) into records. Only
+  // whole chunks can be holes.
+  uint8_t* dp = dst_ptr;
+  size_t run_start = 0;
+  int run_is_hole = 0;
+  for (size_t pos = 0; pos < src_len; pos += SFLZ4_SPARSE_ZERO_CHUNK_LEN) {
+    const size_t n = sflz4_private_min_size_t(SFLZ4_SPARSE_ZERO_CHUNK_LEN,
+                                              src_len - pos);
+    const int is_hole = (n == SFLZ4_SPARSE_ZERO_CHUNK_LEN) &&
+                        sflz4_private_is_all_zero(src_ptr + pos, n);
+    if ((pos > run_start) && (is_hole != run_is_hole)) {
+      result = sflz4_private_sparse_emit(
+          dp, run_is_hole ? NULL : (src_ptr + run_start), pos - run_start,
+          flags);
+      if (result.status_message) {
+        return result;
+      }
+      dp += result.value;
+      run_start = pos;
+    }
+    run_is_hole = is_hole;
+  }
+  if (src_len > run_start) {
+    result = sflz4_private_sparse_emit(
+        dp, run_is_hole ? NULL : (src_ptr + run_start), src_len - run_start,
+        flags);
+    if (result.status_message) {
+      return result;
+    }
+    dp += result.value;
+  }
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_sparse_encode_hole(             //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len,                   //
+    uint64_t hole_len,                //
+    uint32_t flags) {
+  sflz4_size_result result = {NULL, 0};
+  if (hole_len == 0) {
+    return result;
+  } else if (dst_len < (SFLZ4_SPARSE_RECORD_HEADER_LEN + 4)) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+  return sflz4_private_sparse_emit(dst_ptr, NULL, hole_len, flags);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_sparse_record_len(              //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len < SFLZ4_SPARSE_RECORD_HEADER_LEN) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const uint32_t encoded_len = sflz4_private_peek_u32le(src_ptr + 4);
+  const uint64_t decoded_len = sflz4_private_peek_u64le(src_ptr + 8);
+  const uint32_t n = encoded_len & SFLZ4_SPARSE_LEN_MASK;
+  if ((sflz4_private_peek_u32le(src_ptr + 0) != SFLZ4_SPARSE_MAGIC) ||
+      ((encoded_len & SFLZ4_SPARSE_HOLE_BIT)
+           ? ((n != 0) || (encoded_len & SFLZ4_SPARSE_RAW_BIT) ||
+              (decoded_len == 0))
+           : ((decoded_len == 0) ||
+              (decoded_len > SFLZ4_SPARSE_MAX_INCL_DATA_LEN) ||
+              ((encoded_len & SFLZ4_SPARSE_RAW_BIT) &&
+               (n != decoded_len)) ||
+              (n > SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN)))) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  result.value = SFLZ4_SPARSE_RECORD_HEADER_LEN + n + 4;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_sparse_decode_record(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    uint64_t* hole_len) {
+  *hole_len = 0;
+  sflz4_size_result result = sflz4_sparse_record_len(src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > src_len) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    result.value = 0;
+    return result;
+  }
+  const size_t record_len = result.value;
+  const uint32_t encoded_len = sflz4_private_peek_u32le(src_ptr + 4);
+  const uint64_t decoded_len = sflz4_private_peek_u64le(src_ptr + 8);
+  const uint32_t checksum = sflz4_private_peek_u32le(src_ptr + record_len - 4);
+  const uint8_t* const data_ptr = src_ptr + SFLZ4_SPARSE_RECORD_HEADER_LEN;
+  result.value = 0;
+
+  if (encoded_len & SFLZ4_SPARSE_HOLE_BIT) {
+    if (sflz4_private_sparse_checksum(src_ptr, data_ptr, 0) != checksum) {
+      result.status_message = sflz4_status_message__error_bad_checksum;
+      return result;
+    }
+    *hole_len = decoded_len;
+    return result;
+  } else if (decoded_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+  const size_t n = (size_t)decoded_len;
+  if (encoded_len & SFLZ4_SPARSE_RAW_BIT) {
+    memcpy(dst_ptr, data_ptr, n);
+  } else {
+    sflz4_size_result r = sflz4_block_decode(
+        dst_ptr, n, data_ptr, record_len - SFLZ4_SPARSE_RECORD_HEADER_LEN - 4);
+    if (r.status_message) {
+      result.status_message = r.status_message;
+      return result;
+    } else if (r.value != n) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+  }
+  if (sflz4_private_sparse_checksum(src_ptr, dst_ptr, n) != checksum) {
+    result.status_message = sflz4_status_message__error_bad_checksum;
+    return result;
+  }
+  result.value = n;
+  return result;
+}
+
+// -------- LZ4 Aligned Streams
+
+static inline const char*          //
+sflz4_private_aligned_check(       //
+    const uint8_t* workspace_ptr,  //
+    size_t block_max_len,          //
+    size_t alignment) {
+  if ((alignment < 512) || (alignment > 65536) ||
+      ((alignment & (alignment - 1)) != 0) ||
+      ((((uintptr_t)workspace_ptr) & (alignment - 1)) != 0) ||
+      ((block_max_len != 0x10000) && (block_max_len != 0x40000) &&
+       (block_max_len != 0x100000) && (block_max_len != 0x400000))) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  return NULL;
+}
+
+static inline size_t          //
+sflz4_private_round_up_pow2(  //
+    size_t x,                 //
+    size_t alignment) {
+  return (x + alignment - 1) & ~(alignment - 1);
+}
+
+// sflz4_private_aligned_encode_output_len is the length of the encoder's
+// output buffer: less than alignment bytes carried over from the previous
+// write, plus the frame header, one worst-case block (with its length
+// prefix and checksum) and the end marker.
+static inline size_t                      //
+sflz4_private_aligned_encode_output_len(  //
+    size_t block_max_len,                 //
+    size_t alignment) {
+  return sflz4_private_round_up_pow2(
+      alignment + SFLZ4_FRAME_HEADER_MAX_INCL_LEN + 4 + block_max_len +
+          (block_max_len / 255) + 16 + 4 + 4,
+      alignment);
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_aligned_encode_workspace_len(   //
+    size_t block_max_len,             //
+    size_t alignment) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message =
+      sflz4_private_aligned_check(NULL, block_max_len, alignment);
+  if (!result.status_message) {
+    result.value =
+        block_max_len +
+        sflz4_private_aligned_encode_output_len(block_max_len, alignment);
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_aligned_encode(                     //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t block_max_len,                 //
+    size_t alignment,                     //
+    sflz4_aligned_read_func read_func,    //
+    sflz4_aligned_write_func write_func,  //
+    void* context) {
+  sflz4_size_result result =
+      sflz4_aligned_encode_workspace_len(block_max_len, alignment);
+  if (!result.status_message) {
+    result.status_message =
+        sflz4_private_aligned_check(workspace_ptr, block_max_len, alignment);
+  }
+  if (result.status_message) {
+    result.value = 0;
+    return result;
+  } else if (result.value > workspace_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result.value = 0;
+
+  uint8_t* const input_ptr = workspace_ptr;
+  uint8_t* const output_ptr = workspace_ptr + block_max_len;
+  const uint32_t flg = SFLZ4_FRAME_FLG__VERSION_01 |
+                       SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS |
+                       SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS;
+  size_t output_len = (size_t)(sflz4_private_frame_write_header(
+                                   output_ptr, flg, block_max_len, 0, 0) -
+                               output_ptr);
+
+  uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT];
+  while (1) {
+    sflz4_size_result r = (*read_func)(context, input_ptr, block_max_len);
+    if (r.status_message) {
+      result.status_message = r.status_message;
+      return result;
+    } else if (r.value > block_max_len) {
+      result.status_message = sflz4_status_message__error_bad_argument;
+      return result;
+    } else if (r.value > 0) {
+      memset(hash_table, 0, sizeof(hash_table));
+      output_len = (size_t)(sflz4_private_frame_encode_counted_block(
+                                output_ptr + output_len, hash_table,
+                                input_ptr, input_ptr, r.value, flg) -
+                            output_ptr);
+    }
+    if (r.value < block_max_len) {
+      break;
+    }
+
+    // Write the whole aligned chunks, carrying the rest over.
+    const size_t n = output_len & ~(alignment - 1);
+    if (n > 0) {
+      result.status_message = (*write_func)(context, output_ptr, n);
+      if (result.status_message) {
+        return result;
+      }
+      memcpy(output_ptr, output_ptr + n, output_len - n);
+      output_len -= n;
+      result.value += n;
+    }
+  }
+
+  sflz4_private_poke_u32le(output_ptr + output_len, 0);
+  output_len += 4;
+  const size_t padded_len = sflz4_private_round_up_pow2(output_len, alignment);
+  memset(output_ptr + output_len, 0, padded_len - output_len);
+  result.status_message = (*write_func)(context, output_ptr, padded_len);
+  if (result.status_message) {
+    result.value = 0;
+    return result;
+  }
+  result.value += output_len;
+  return result;
+}
+
+// The decoder's workspace holds:
+//  - the window: SFLZ4_CHECKPOINTS_WINDOW_LEN bytes of history and then the
+//    latest block, as per sflz4_private_frame_cursor.
+//  - the output buffer, for decoded bytes that are not yet written: less
+//    than alignment bytes carried over plus (if it is unaligned) a block.
+//  - the input buffer: the chunk most recently read, preceded by room for
+//    the previous chunk's leftover bytes (a partial block) to be moved in
+//    front of it, so that the two are contiguous.
+typedef struct sflz4_private_aligned_decode_layout_struct {
+  size_t window;
+  size_t output;
+  size_t input;
+  size_t chunk_len;
+  size_t total_len;
+} sflz4_private_aligned_decode_layout;
+
+static inline sflz4_private_aligned_decode_layout  //
+sflz4_private_aligned_decode_layout_for(           //
+    size_t block_max_len,                          //
+    size_t alignment) {
+  sflz4_private_aligned_decode_layout l;
+  l.chunk_len = sflz4_private_round_up_pow2(4 + block_max_len + 4, alignment);
+  l.window = 0;
+  l.output = l.window + SFLZ4_CHECKPOINTS_WINDOW_LEN + block_max_len;
+  l.input = l.output +
+            sflz4_private_round_up_pow2(alignment + block_max_len, alignment);
+  l.total_len = l.input + (2 * l.chunk_len);
+  return l;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_aligned_decode_workspace_len(   //
+    size_t block_max_len,             //
+    size_t alignment) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message =
+      sflz4_private_aligned_check(NULL, block_max_len, alignment);
+  if (!result.status_message) {
+    result.value =
+        sflz4_private_aligned_decode_layout_for(block_max_len, alignment)
+            .total_len;
+  }
+  return result;
+}
+
+// sflz4_private_aligned_decode_refill reads another chunk if c holds fewer
+// than need unconsumed bytes (and the input hasn't ended), returning NULL on
+// success or a status message on failure. need is at most chunk_len.
+static const char*                      //
+sflz4_private_aligned_decode_refill(    //
+    sflz4_private_frame_cursor* c,      //
+    int* eof,                           //
+    size_t need,                        //
+    uint8_t* chunk_ptr,                 //
+    size_t chunk_len,                   //
+    sflz4_aligned_read_func read_func,  //
+    void* context) {
+  const size_t remaining = c->src_len - c->src_pos;
+  if ((remaining >= need) || *eof) {
+    return NULL;
+  }
+  memmove(chunk_ptr - remaining, c->src_ptr + c->src_pos, remaining);
+  sflz4_size_result r = (*read_func)(context, chunk_ptr, chunk_len);
+  if (r.status_message) {
+    return r.status_message;
+  } else if (r.value > chunk_len) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  c->src_ptr = chunk_ptr - remaining;
+  c->src_pos = 0;
+  c->src_len = remaining + r.value;
+  *eof = r.value < chunk_len;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_aligned_decode(                     //
+    uint8_t* workspace_ptr,               //
+    size_t workspace_len,                 //
+    size_t alignment,                     //
+    sflz4_aligned_read_func read_func,    //
+    sflz4_aligned_write_func write_func,  //
+    void* context) {
+  sflz4_size_result result = {NULL, 0};
+  result.status_message =
+      sflz4_private_aligned_check(workspace_ptr, 0x10000, alignment);
+  if (result.status_message) {
+    return result;
+  } else if (workspace_len < alignment) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    return result;
+  }
+
+  // Read the first chunk (which holds the frame header) to find the block
+  // maximum length, and so the layout. Then move it into the input buffer.
+  sflz4_size_result r = (*read_func)(context, workspace_ptr, alignment);
+  if (r.status_message) {
+    result.status_message = r.status_message;
+    return result;
+  } else if (r.value > alignment) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  sflz4_private_frame_header h;
+  result.status_message =
+      sflz4_private_frame_parse_header(&h, workspace_ptr, r.value);
+  if (result.status_message) {
+    return result;
+  }
+  const sflz4_private_aligned_decode_layout l =
+      sflz4_private_aligned_decode_layout_for(h.block_max_len, alignment);
+  if (l.total_len > workspace_len) {
+    result.status_message = sflz4_status_message__error_workspace_is_too_short;
+    return result;
+  }
+  uint8_t* const chunk_ptr = workspace_ptr + l.input + l.chunk_len;
+  memcpy(chunk_ptr, workspace_ptr, r.value);
+  sflz4_private_frame_cursor c;
+  result.status_message = sflz4_private_frame_cursor_initialize(
+      &c, chunk_ptr, r.value, workspace_ptr + l.window, l.output - l.window);
+  if (result.status_message) {
+    return result;
+  }
+  int eof = r.value < alignment;
+  const size_t checksum_len =
+      (c.flg & SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS) ? 4 : 0;
+  uint8_t* const output_ptr = workspace_ptr + l.output;
+  size_t output_len = 0;
+
+  while (1) {
+    result.status_message = sflz4_private_aligned_decode_refill(
+        &c, &eof, 4, chunk_ptr, l.chunk_len, read_func, context);
+    if (result.status_message) {
+      goto fail;
+    } else if ((c.src_len - c.src_pos) < 4) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      goto fail;
+    }
+    const uint32_t block_header =
+        sflz4_private_peek_u32le(c.src_ptr + c.src_pos);
+    if (block_header == 0) {
+      break;
+    }
+    const size_t n = block_header & ~SFLZ4_FRAME_UNCOMPRESSED_BIT;
+    if (n > c.block_max_len) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      goto fail;
+    }
+    result.status_message = sflz4_private_aligned_decode_refill(
+        &c, &eof, 4 + n + checksum_len, chunk_ptr, l.chunk_len, read_func,
+        context);
+    if (result.status_message) {
+      goto fail;
+    }
+    size_t decoded_len = 0;
+    result.status_message = sflz4_private_frame_cursor_next(&c, &decoded_len);
+    if (result.status_message) {
+      goto fail;
+    }
+
+    // Write the decoded block directly, if it and the output buffer allow,
+    // or else via the output buffer.
+    const uint8_t* p = c.window_ptr + c.history_len;
+    size_t p_len = decoded_len;
+    if ((output_len > 0) || ((((uintptr_t)p) & (alignment - 1)) != 0)) {
+      memcpy(output_ptr + output_len, p, p_len);
+      p = output_ptr;
+      p_len += output_len;
+    }
+    const size_t m = p_len & ~(alignment - 1);
+    if (m > 0) {
+      result.status_message = (*write_func)(context, p, m);
+      if (result.status_message) {
+        goto fail;
+      }
+    }
+    memmove(output_ptr, p + m, p_len - m);
+    output_len = p_len - m;
+    result.value += m;
+    sflz4_private_frame_cursor_slide(&c, decoded_len);
+  }
+
+  // Skip the end marker and content checksum, then write the output buffer.
+  c.src_pos += 4;
+  if (c.flg & SFLZ4_FRAME_FLG__CONTENT_CHECKSUM) {
+    result.status_message = sflz4_private_aligned_decode_refill(
+        &c, &eof, 4, chunk_ptr, l.chunk_len, read_func, context);
+    if (result.status_message) {
+      goto fail;
+    } else if ((c.src_len - c.src_pos) < 4) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      goto fail;
+    }
+  }
+  if (output_len > 0) {
+    const size_t padded_len =
+        sflz4_private_round_up_pow2(output_len, alignment);
+    memset(output_ptr + output_len, 0, padded_len - output_len);
+    result.status_message = (*write_func)(context, output_ptr, padded_len);
+    if (result.status_message) {
+      goto fail;
+    }
+    result.value += output_len;
+  }
+  return result;
+
+fail:
+  result.value = 0;
+  return result;
+}
+
+// -------- LZ4 Message Channels
+
+// A message is a header and then encoded_len bytes of payload. The header is
+// a varint, ((encoded_len << 2) | kind), and then, for
+// SFLZ4_MESSAGE_KIND__LZ4, a varint decoded_len. Each varint is at most
+// SFLZ4_MESSAGE_VARINT_MAX_INCL_LEN bytes long and may be padded with
+// redundant continuation bytes (0x80). Varints are as per the LZ4 Record
+// Container.
+//
+// A hello message's payload is SFLZ4_MESSAGE_HELLO_MAGIC, the flags and the
+// dictionary id (all u32le).
+#define SFLZ4_MESSAGE_HELLO_MAGIC 0x4D345A53
+#define SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN 12
+#define SFLZ4_MESSAGE_HISTORY_LEN 0x10000
+#define SFLZ4_MESSAGE_VARINT_MAX_INCL_LEN 4
+
+static inline size_t       //
+sflz4_private_varint_len(  //
+    uint64_t x) {
+  size_t n = 1;
+  for (; x >= 0x80; x >>= 7) {
+    n++;
+  }
+  return n;
+}
+
+// sflz4_private_poke_varint_padded is like sflz4_private_poke_varint but
+// always writes n bytes, where n is at least sflz4_private_varint_len(x).
+static inline uint8_t*             //
+sflz4_private_poke_varint_padded(  //
+    uint8_t* dp,                   //
+    uint64_t x,                    //
+    size_t n) {
+  for (; n > 1; n--) {
+    *dp++ = (uint8_t)(x | 0x80);
+    x >>= 7;
+  }
+  *dp++ = (uint8_t)x;
+  return dp;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_encoder_workspace_len(  //
+    size_t message_max_len,           //
+    uint32_t flags) {
+  sflz4_size_result result = {NULL, 0};
+  if ((message_max_len > SFLZ4_MESSAGE_MAX_INCL_LEN) ||
+      (flags & ~(uint32_t)SFLZ4_MESSAGE_FLAGS__INDEPENDENT)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+  } else if (!(flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT)) {
+    // The workspace holds, in order: 3 bytes of alignment slack, the hash
+    // table and the window. The window holds the history and then the next
+    // message. It only slides (down to the final 64 KiB of history) when
+    // that message wouldn't otherwise fit, so that sliding doesn't cost a
+    // 64 KiB memmove per (small) message.
+    result.value = 3 + (sizeof(uint32_t) << SFLZ4_HASH_TABLE_SHIFT) +
+                   (2 * SFLZ4_MESSAGE_HISTORY_LEN) + message_max_len;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_message_encoder_initialize(  //
+    sflz4_message_encoder* e,      //
+    uint8_t* workspace_ptr,        //
+    size_t workspace_len,          //
+    size_t message_max_len,        //
+    uint32_t flags,                //
+    const sflz4_dictionary* d) {
+  sflz4_size_result wl =
+      sflz4_message_encoder_workspace_len(message_max_len, flags);
+  if (wl.status_message) {
+    return wl.status_message;
+  } else if (wl.value > workspace_len) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+
+  memset(e, 0, sizeof(*e));
+  e->private_message_max_len = message_max_len;
+  e->private_dictionary = d;
+  e->private_flags = flags;
+  e->private_hello_pending = 1;
+  if (flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT) {
+    return NULL;
+  }
+
+  uint8_t* p = workspace_ptr + ((4 - ((uintptr_t)workspace_ptr & 3)) & 3);
+  e->private_hash_table = (uint32_t*)(void*)p;
+  p += sizeof(uint32_t) << SFLZ4_HASH_TABLE_SHIFT;
+  e->private_window_ptr = p;
+  e->private_window_len = (2 * SFLZ4_MESSAGE_HISTORY_LEN) + message_max_len;
+
+  // The dictionary is the initial history. Its hash table's values are
+  // offsets relative to its start, which is also the window's start.
+  if (d) {
+    memcpy(e->private_window_ptr, d->private_ptr, d->private_len);
+    memcpy(e->private_hash_table, d->private_hash_table,
+           sizeof(d->private_hash_table));
+    e->private_history_len = d->private_len;
+  } else {
+    memset(e->private_hash_table, 0, sizeof(uint32_t)
+                                         << SFLZ4_HASH_TABLE_SHIFT);
+  }
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result      //
+sflz4_message_encode_worst_case_dst_len(  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len > SFLZ4_MESSAGE_MAX_INCL_LEN) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    return result;
+  }
+  result = sflz4_block_encode_worst_case_dst_len(src_len);
+  result.value += 1 + SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN +
+                  SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_encode_hello(           //
+    sflz4_message_encoder* e,         //
+    uint8_t* dst_ptr,                 //
+    size_t dst_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (!e->private_hello_pending) {
+    return result;
+  } else if (dst_len < (1 + SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN)) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+  const sflz4_dictionary* d = e->private_dictionary;
+  dst_ptr[0] = (uint8_t)((SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN << 2) |
+                         SFLZ4_MESSAGE_KIND__HELLO);
+  sflz4_private_poke_u32le(dst_ptr + 1, SFLZ4_MESSAGE_HELLO_MAGIC);
+  sflz4_private_poke_u32le(dst_ptr + 5, e->private_flags);
+  sflz4_private_poke_u32le(dst_ptr + 9, d ? d->private_id : 0);
+  e->private_hello_pending = 0;
+  result.value = 1 + SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_message_encode(                       //
+    sflz4_message_encoder* e,               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_message_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (src_len > e->private_message_max_len) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    result.value = 0;
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  uint8_t* dp = dst_ptr + sflz4_message_encode_hello(e, dst_ptr, dst_len).value;
+
+  // Reserve the header's worst case length (the encoded_len is at most the
+  // src_len, else the message is stored) and encode the payload after it.
+  // Padding the varint afterwards, instead of moving the payload down, can
+  // cost a byte but never a memmove.
+  const size_t n0 = sflz4_private_varint_len(((uint64_t)src_len) << 2);
+  const size_t n1 = sflz4_private_varint_len(src_len);
+  uint8_t* const payload_ptr = dp + n0 + n1;
+  size_t n = 0;
+  if (e->private_flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT) {
+    const size_t payload_len = dst_len - (size_t)(payload_ptr - dst_ptr);
+    result = e->private_dictionary
+                 ? sflz4_block_encode_with_dictionary(
+                       payload_ptr, payload_len, src_ptr, src_len,
+                       e->private_dictionary)
+                 : sflz4_block_encode(payload_ptr, payload_len, src_ptr,
+                                      src_len);
+    if (result.status_message) {
+      return result;
+    }
+    n = result.value;
+  } else {
+    // Slide the window if the message wouldn't otherwise fit.
+    uint8_t* const window_ptr = e->private_window_ptr;
+    if ((e->private_history_len + src_len) > e->private_window_len) {
+      const size_t keep_len = sflz4_private_min_size_t(
+          e->private_history_len, SFLZ4_MESSAGE_HISTORY_LEN);
+      const size_t delta = e->private_history_len - keep_len;
+      memmove(window_ptr, window_ptr + delta, keep_len);
+      sflz4_private_rebase_hash_table(e->private_hash_table, (uint32_t)delta);
+      e->private_history_len = keep_len;
+    }
+
+    uint8_t* const sp = window_ptr + e->private_history_len;
+    if (src_len > 0) {
+      memcpy(sp, src_ptr, src_len);
+    }
+    const uint64_t start_time = sflz4_private_telemetry_now();
+    const uint8_t* literal_start = sp;
+    uint8_t* q = sflz4_private_encode_sequences(
+        payload_ptr, e->private_hash_table, window_ptr, sp, src_len,
+        sp + src_len, &literal_start);
+    q = sflz4_private_emit_literals(
+        q, literal_start, src_len - (size_t)(literal_start - sp), 0);
+    n = (size_t)(q - payload_ptr);
+    e->private_history_len += src_len;
+    const sflz4_size_result counted = {NULL, n};
+    sflz4_private_telemetry_record(SFLZ4_TELEMETRY_OP__BLOCK_ENCODE,
+                                   start_time, src_len, counted);
+  }
+
+  if (n < src_len) {
+    dp = sflz4_private_poke_varint_padded(
+        dp, (((uint64_t)n) << 2) | SFLZ4_MESSAGE_KIND__LZ4, n0);
+    dp = sflz4_private_poke_varint_padded(dp, src_len, n1);
+    dp += n;
+  } else {
+    dp = sflz4_private_poke_varint(
+        dp, (((uint64_t)src_len) << 2) | SFLZ4_MESSAGE_KIND__STORED);
+    if (src_len > 0) {
+      memcpy(dp, src_ptr, src_len);
+    }
+    dp += src_len;
+  }
+  result.status_message = NULL;
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*     //
+sflz4_message_decoder_initialize(  //
+    sflz4_message_decoder* d,      //
+    uint8_t* workspace_ptr,        //
+    size_t workspace_len,          //
+    const sflz4_dictionary_registry* r) {
+  if (workspace_len < SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN) {
+    return sflz4_status_message__error_workspace_is_too_short;
+  }
+  memset(d, 0, sizeof(*d));
+  d->private_registry = r;
+  d->private_history_ptr = workspace_ptr;
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_message_parse_header(           //
+    sflz4_message_header* h,          //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  memset(h, 0, sizeof(*h));
+  if (src_len == 0) {
+    return result;
+  }
+
+  // Parse a zero-padded copy. A truncated varint then ends early (at the
+  // padding) but the header_len check below still catches that.
+  uint8_t buf[SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN] = {0};
+  memcpy(buf, src_ptr,
+         sflz4_private_min_size_t(src_len, SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN));
+  uint64_t x = 0;
+  uint64_t y = 0;
+  const uint8_t* p = sflz4_private_peek_varint(
+      buf, buf + SFLZ4_MESSAGE_VARINT_MAX_INCL_LEN, &x);
+  const uint32_t kind = (uint32_t)(x & 3);
+  if (p && (kind == SFLZ4_MESSAGE_KIND__LZ4)) {
+    p = sflz4_private_peek_varint(p, p + SFLZ4_MESSAGE_VARINT_MAX_INCL_LEN,
+                                  &y);
+  }
+  if (!p) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  const size_t header_len = (size_t)(p - buf);
+  if (header_len > src_len) {
+    return result;
+  }
+
+  const uint64_t encoded_len = x >> 2;
+  switch (kind) {
+    case SFLZ4_MESSAGE_KIND__LZ4:
+      if ((y > SFLZ4_MESSAGE_MAX_INCL_LEN) ||
+          (encoded_len > SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN)) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+      break;
+    case SFLZ4_MESSAGE_KIND__STORED:
+      if (encoded_len > SFLZ4_MESSAGE_MAX_INCL_LEN) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+      y = encoded_len;
+      break;
+    case SFLZ4_MESSAGE_KIND__HELLO:
+      if (encoded_len != SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+      break;
+    default:
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+  }
+
+  h->header_len = header_len;
+  h->encoded_len = (size_t)encoded_len;
+  h->decoded_len = (size_t)y;
+  h->kind = kind;
+  result.value = header_len + (size_t)encoded_len;
+  return result;
+}
+
+// sflz4_private_message_decode_hello starts a new session, with the hello
+// message's flags and dictionary.
+static const char*                   //
+sflz4_private_message_decode_hello(  //
+    sflz4_message_decoder* d,        //
+    const uint8_t* payload_ptr) {
+  if (sflz4_private_peek_u32le(payload_ptr + 0) !=
+      SFLZ4_MESSAGE_HELLO_MAGIC) {
+    return sflz4_status_message__error_invalid_data;
+  }
+  const uint32_t flags = sflz4_private_peek_u32le(payload_ptr + 4);
+  const uint32_t id = sflz4_private_peek_u32le(payload_ptr + 8);
+  if (flags & ~(uint32_t)SFLZ4_MESSAGE_FLAGS__INDEPENDENT) {
+    return sflz4_status_message__error_unsupported_feature;
+  }
+  const sflz4_dictionary* dictionary = NULL;
+  if (id != 0) {
+    dictionary = sflz4_dictionary_registry_find(d->private_registry, id);
+    if (!dictionary) {
+      return sflz4_status_message__error_unsupported_feature;
+    }
+  }
+
+  d->private_dictionary = dictionary;
+  d->private_flags = flags;
+  d->private_history_len = 0;
+  if (dictionary && !(flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT)) {
+    memcpy(d->private_history_ptr, dictionary->private_ptr,
+           dictionary->private_len);
+    d->private_history_len = dictionary->private_len;
+  }
+  d->private_hello_received = 1;
+  return NULL;
+}
+
+// sflz4_private_message_decoder_remember appends a decoded message to the
+// history. Like the encoder's window, the history buffer only slides (down
+// to the final 64 KiB) when the message wouldn't otherwise fit.
+static void                              //
+sflz4_private_message_decoder_remember(  //
+    sflz4_message_decoder* d,            //
+    const uint8_t* p,                    //
+    size_t n) {
+  uint8_t* const history_ptr = d->private_history_ptr;
+  if (n >= SFLZ4_MESSAGE_HISTORY_LEN) {
+    memcpy(history_ptr, p + n - SFLZ4_MESSAGE_HISTORY_LEN,
+           SFLZ4_MESSAGE_HISTORY_LEN);
+    d->private_history_len = SFLZ4_MESSAGE_HISTORY_LEN;
+    return;
+  } else if ((d->private_history_len + n) >
+             SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN) {
+    const size_t keep_len = SFLZ4_MESSAGE_HISTORY_LEN - n;
+    memmove(history_ptr, history_ptr + d->private_history_len - keep_len,
+            keep_len);
+    d->private_history_len = keep_len;
+  }
+  if (n > 0) {
+    memcpy(history_ptr + d->private_history_len, p, n);
+  }
+  d->private_history_len += n;
+}
+
+static sflz4_size_result                    //
+sflz4_private_message_decode(               //
+    sflz4_message_decoder* d,               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_message_header h;
+  sflz4_size_result result = sflz4_message_parse_header(&h, src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value != src_len) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    result.value = 0;
+    return result;
+  }
+  result.value = 0;
+  const uint8_t* const payload_ptr = src_ptr + h.header_len;
+
+  if (h.kind == SFLZ4_MESSAGE_KIND__HELLO) {
+    result.status_message =
+        sflz4_private_message_decode_hello(d, payload_ptr);
+    return result;
+  } else if (!d->private_hello_received) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  } else if (h.decoded_len > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    return result;
+  }
+
+  const int independent =
+      (d->private_flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT) != 0;
+  if (h.kind == SFLZ4_MESSAGE_KIND__STORED) {
+    if (h.decoded_len > 0) {
+      memcpy(dst_ptr, payload_ptr, h.decoded_len);
+    }
+  } else {
+    // Matches may refer back to the dictionary or to (up to) the final 64
+    // KiB of history, which (for linked messages) starts with the
+    // dictionary.
+    const uint8_t* dict_ptr = NULL;
+    size_t dict_len = 0;
+    if (!independent) {
+      dict_len = sflz4_private_min_size_t(d->private_history_len,
+                                          SFLZ4_MESSAGE_HISTORY_LEN);
+      dict_ptr = d->private_history_ptr + d->private_history_len - dict_len;
+    } else if (d->private_dictionary) {
+      dict_ptr = d->private_dictionary->private_ptr;
+      dict_len = d->private_dictionary->private_len;
+    }
+    sflz4_size_result r = sflz4_private_block_decode_counted(
+        dst_ptr, h.decoded_len, 0, dict_ptr, dict_len, payload_ptr,
+        h.encoded_len, 0);
+    if (r.status_message || (r.value != h.decoded_len)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+  }
+
+  if (!independent) {
+    sflz4_private_message_decoder_remember(d, dst_ptr, h.decoded_len);
+  }
+  result.value = h.decoded_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_message_decode(                       //
+    sflz4_message_decoder* d,               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result =
+      sflz4_private_message_decode(d, dst_ptr, dst_len, src_ptr, src_len);
+  if (result.status_message) {
+    d->private_hello_received = 0;
+  }
+  return result;
+}
+
+// -------- LZ4 Shared Memory Rings
+
+// The shared memory's header holds:
+//  - at offset 0, SFLZ4_RING_MAGIC, data_len and message_max_len (u32le).
+//  - at SFLZ4_RING_WRITE_POS_OFFSET, the producer's position (a size_t).
+//  - at SFLZ4_RING_READ_POS_OFFSET, the consumer's position (a size_t).
+//
+// Positions count bytes since the ring was initialized, wrapping around at
+// (SIZE_MAX + 1), a multiple of the power of two data_len. Each message is a
+// record at an 8 byte aligned position: a u32le encoded_len (with
+// SFLZ4_RING_RAW_BIT set if stored uncompressed), a u32le decoded_len and the
+// encoded bytes. A record never wraps around the end of the data. Where the
+// next slot wouldn't fit before the end, the producer writes
+// SFLZ4_RING_WRAP_MARKER and skips to the start.
+#define SFLZ4_RING_MAGIC 0x52345A53
+#define SFLZ4_RING_RAW_BIT 0x80000000
+#define SFLZ4_RING_RECORD_HEADER_LEN 8
+#define SFLZ4_RING_WRAP_MARKER 0xFFFFFFFF
+#define SFLZ4_RING_WRITE_POS_OFFSET 128
+#define SFLZ4_RING_READ_POS_OFFSET 256
+
+static inline volatile size_t*  //
+sflz4_private_ring_pos(         //
+    uint8_t* shared_ptr,        //
+    size_t offset) {
+  return (volatile size_t*)(void*)(shared_ptr + offset);
+}
+
+// sflz4_private_ring_slot_len returns how many bytes a src_len byte message
+// could take in the ring, in the worst case.
+static inline size_t          //
+sflz4_private_ring_slot_len(  //
+    size_t src_len) {
+  return (SFLZ4_RING_RECORD_HEADER_LEN +
+          sflz4_block_encode_worst_case_dst_len(src_len).value + 7) &
+         ~(size_t)7;
+}
+
+// sflz4_private_ring_attach checks the shared memory's header, returning its
+// data_len (and message_max_len).
+static sflz4_size_result    //
+sflz4_private_ring_attach(  //
+    uint8_t* shared_ptr,    //
+    size_t shared_len,      //
+    size_t* message_max_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (!shared_ptr || ((uintptr_t)shared_ptr & 7) ||
+      (shared_len < SFLZ4_RING_HEADER_LEN)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  const size_t data_len = sflz4_private_peek_u32le(shared_ptr + 4);
+  *message_max_len = sflz4_private_peek_u32le(shared_ptr + 8);
+  if ((sflz4_private_peek_u32le(shared_ptr + 0) != SFLZ4_RING_MAGIC) ||
+      sflz4_ring_shared_len(data_len).value != shared_len) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  result.value = data_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_ring_shared_len(                //
+    size_t data_len) {
+  sflz4_size_result result = {NULL, 0};
+  if ((data_len < 0x1000) || (data_len > 0x40000000) ||
+      (data_len & (data_len - 1))) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  result.value = SFLZ4_RING_HEADER_LEN + data_len;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_initialize(          //
+    uint8_t* shared_ptr,        //
+    size_t shared_len,          //
+    size_t message_max_len) {
+  if (!shared_ptr || ((uintptr_t)shared_ptr & 7) ||
+      (shared_len <= SFLZ4_RING_HEADER_LEN) ||
+      (message_max_len > (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2))) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  const size_t data_len = shared_len - SFLZ4_RING_HEADER_LEN;
+  sflz4_size_result sl = sflz4_ring_shared_len(data_len);
+  if (sl.status_message) {
+    return sl.status_message;
+  } else if (sflz4_private_ring_slot_len(message_max_len) > data_len) {
+    return sflz4_status_message__error_bad_argument;
+  }
+  memset(shared_ptr, 0, SFLZ4_RING_HEADER_LEN);
+  sflz4_private_poke_u32le(shared_ptr + 0, SFLZ4_RING_MAGIC);
+  sflz4_private_poke_u32le(shared_ptr + 4, (uint32_t)data_len);
+  sflz4_private_poke_u32le(shared_ptr + 8, (uint32_t)message_max_len);
+  sflz4_private_store_release_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_WRITE_POS_OFFSET), 0);
+  sflz4_private_store_release_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_READ_POS_OFFSET), 0);
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_producer_attach(     //
+    sflz4_ring_producer* p,     //
+    uint8_t* shared_ptr,        //
+    size_t shared_len) {
+  size_t message_max_len = 0;
+  sflz4_size_result a =
+      sflz4_private_ring_attach(shared_ptr, shared_len, &message_max_len);
+  if (a.status_message) {
+    return a.status_message;
+  }
+  p->private_shared_ptr = shared_ptr;
+  p->private_data_len = a.value;
+  p->private_message_max_len = message_max_len;
+  p->private_write_pos = sflz4_private_load_acquire_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_WRITE_POS_OFFSET));
+  p->private_cached_read_pos = sflz4_private_load_acquire_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_READ_POS_OFFSET));
+  return NULL;
+}
+
+SFLZ4_MAYBE_STATIC const char*  //
+sflz4_ring_consumer_attach(     //
+    sflz4_ring_consumer* c,     //
+    uint8_t* shared_ptr,        //
+    size_t shared_len) {
+  size_t message_max_len = 0;
+  sflz4_size_result a =
+      sflz4_private_ring_attach(shared_ptr, shared_len, &message_max_len);
+  if (a.status_message) {
+    return a.status_message;
+  }
+  c->private_shared_ptr = shared_ptr;
+  c->private_data_len = a.value;
+  c->private_read_pos = sflz4_private_load_acquire_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_READ_POS_OFFSET));
+  c->private_cached_write_pos = sflz4_private_load_acquire_size_t(
+      sflz4_private_ring_pos(shared_ptr, SFLZ4_RING_WRITE_POS_OFFSET));
+  return NULL;
+}
+
+// sflz4_private_ring_has_room returns whether the n bytes after p's write
+// position are free, re-reading the consumer's position only if the cached
+// one says that they aren't.
+static inline int             //
+sflz4_private_ring_has_room(  //
+    sflz4_ring_producer* p,   //
+    size_t n) {
+  const size_t data_len = p->private_data_len;
+  if ((p->private_write_pos - p->private_cached_read_pos + n) <= data_len) {
+    return 1;
+  }
+  p->private_cached_read_pos = sflz4_private_load_acquire_size_t(
+      sflz4_private_ring_pos(p->private_shared_ptr,
+                             SFLZ4_RING_READ_POS_OFFSET));
+  return (p->private_write_pos - p->private_cached_read_pos + n) <= data_len;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_ring_send(                            //
+    sflz4_ring_producer* p,                 //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len > p->private_message_max_len) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    return result;
+  }
+  uint8_t* const data_ptr = p->private_shared_ptr + SFLZ4_RING_HEADER_LEN;
+  const size_t data_len = p->private_data_len;
+  const size_t slot_len = sflz4_private_ring_slot_len(src_len);
+
+  // If the slot wouldn't fit before the end of the data, skip to the start.
+  // The skip is published on its own, so a full ring's retries don't
+  // re-skip.
+  size_t offset = p->private_write_pos & (data_len - 1);
+  if (slot_len > (data_len - offset)) {
+    const size_t skip_len = data_len - offset;
+    if (!sflz4_private_ring_has_room(p, skip_len)) {
+      return result;
+    }
+    sflz4_private_poke_u32le(data_ptr + offset, SFLZ4_RING_WRAP_MARKER);
+    p->private_write_pos += skip_len;
+    sflz4_private_store_release_size_t(
+        sflz4_private_ring_pos(p->private_shared_ptr,
+                               SFLZ4_RING_WRITE_POS_OFFSET),
+        p->private_write_pos);
+    offset = 0;
+  }
+  if (!sflz4_private_ring_has_room(p, slot_len)) {
+    return result;
+  }
+
+  uint8_t* const record_ptr = data_ptr + offset;
+  uint8_t* const encoded_ptr = record_ptr + SFLZ4_RING_RECORD_HEADER_LEN;
+  result = sflz4_block_encode(encoded_ptr,
+                              slot_len - SFLZ4_RING_RECORD_HEADER_LEN,
+                              src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  }
+  uint32_t encoded_len = (uint32_t)result.value;
+  if (result.value >= src_len) {
+    if (src_len > 0) {
+      memcpy(encoded_ptr, src_ptr, src_len);
+    }
+    encoded_len = ((uint32_t)src_len) | SFLZ4_RING_RAW_BIT;
+    result.value = src_len;
+  }
+  sflz4_private_poke_u32le(record_ptr + 0, encoded_len);
+  sflz4_private_poke_u32le(record_ptr + 4, (uint32_t)src_len);
+
+  // Publish the record. Only its (8 byte aligned) actual length is used.
+  result.value =
+      (SFLZ4_RING_RECORD_HEADER_LEN + result.value + 7) & ~(size_t)7;
+  p->private_write_pos += result.value;
+  sflz4_private_store_release_size_t(
+      sflz4_private_ring_pos(p->private_shared_ptr,
+                             SFLZ4_RING_WRITE_POS_OFFSET),
+      p->private_write_pos);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_ring_receive(                   //
+    sflz4_ring_consumer* c,           //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,  //
+    size_t dst_len,                   //
+    int* received) {
+  sflz4_size_result result = {NULL, 0};
+  *received = 0;
+  uint8_t* const data_ptr = c->private_shared_ptr + SFLZ4_RING_HEADER_LEN;
+  const size_t data_len = c->private_data_len;
+  volatile size_t* const read_pos_ptr = sflz4_private_ring_pos(
+      c->private_shared_ptr, SFLZ4_RING_READ_POS_OFFSET);
+
+  while (1) {
+    if (c->private_read_pos == c->private_cached_write_pos) {
+      c->private_cached_write_pos = sflz4_private_load_acquire_size_t(
+          sflz4_private_ring_pos(c->private_shared_ptr,
+                                 SFLZ4_RING_WRITE_POS_OFFSET));
+      if (c->private_read_pos == c->private_cached_write_pos) {
+        return result;
+      }
+    }
+
+    // Check the record against both the end of the data and the producer's
+    // position, as the shared memory isn't trusted.
+    const size_t offset = c->private_read_pos & (data_len - 1);
+    const size_t available = sflz4_private_min_size_t(
+        data_len - offset,
+        c->private_cached_write_pos - c->private_read_pos);
+    if ((available < 4) || (offset & 7)) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    }
+    const uint8_t* const record_ptr = data_ptr + offset;
+    const uint32_t x = sflz4_private_peek_u32le(record_ptr + 0);
+    if (x == SFLZ4_RING_WRAP_MARKER) {
+      c->private_read_pos += data_len - offset;
+      sflz4_private_store_release_size_t(read_pos_ptr, c->private_read_pos);
+      continue;
+    }
+
+    const size_t encoded_len = x & ~(uint32_t)SFLZ4_RING_RAW_BIT;
+    const size_t decoded_len = sflz4_private_peek_u32le(record_ptr + 4);
+    if ((available < SFLZ4_RING_RECORD_HEADER_LEN) ||
+        (encoded_len > (available - SFLZ4_RING_RECORD_HEADER_LEN)) ||
+        ((x & SFLZ4_RING_RAW_BIT) && (encoded_len != decoded_len))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+      return result;
+    } else if (decoded_len > dst_len) {
+      result.status_message = sflz4_status_message__error_dst_is_too_short;
+      return result;
+    }
+
+    const uint8_t* const encoded_ptr =
+        record_ptr + SFLZ4_RING_RECORD_HEADER_LEN;
+    if (x & SFLZ4_RING_RAW_BIT) {
+      if (decoded_len > 0) {
+        memcpy(dst_ptr, encoded_ptr, decoded_len);
+      }
+    } else {
+      sflz4_size_result r =
+          sflz4_block_decode(dst_ptr, decoded_len, encoded_ptr, encoded_len);
+      if (r.status_message || (r.value != decoded_len)) {
+        result.status_message = sflz4_status_message__error_invalid_data;
+        return result;
+      }
+    }
+
+    // Release the record only after decoding it, as the producer may then
+    // overwrite it.
+    c->private_read_pos +=
+        (SFLZ4_RING_RECORD_HEADER_LEN + encoded_len + 7) & ~(size_t)7;
+    sflz4_private_store_release_size_t(read_pos_ptr, c->private_read_pos);
+    *received = 1;
+    result.value = decoded_len;
+    return result;
+  }
+}
+
+// -------- LZ4 Foreign Framings
+
+static inline uint32_t     //
+sflz4_private_peek_u32be(  //
+    const uint8_t* p) {
+  return (((uint32_t)(p[0])) << 24) | (((uint32_t)(p[1])) << 16) |
+         (((uint32_t)(p[2])) << 8) | (((uint32_t)(p[3])) << 0);
+}
+
+static inline void         //
+sflz4_private_poke_u32be(  //
+    uint8_t* p,            //
+    uint32_t x) {
+  p[0] = (uint8_t)(x >> 24);
+  p[1] = (uint8_t)(x >> 16);
+  p[2] = (uint8_t)(x >> 8);
+  p[3] = (uint8_t)(x >> 0);
+}
+
+// sflz4_private_block_decode_exact decodes src to exactly dst_len bytes. An
+// empty dst also accepts the 1 byte block (a zero token) that LZ4 encoders
+// (including sflz4_block_encode) produce for empty input, which isn't
+// otherwise valid for sflz4_block_decode.
+static sflz4_size_result                    //
+sflz4_private_block_decode_exact(           //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (dst_len == 0) {
+    if ((src_len > 1) || ((src_len == 1) && (src_ptr[0] != 0))) {
+      result.status_message = sflz4_status_message__error_invalid_data;
+    }
+    return result;
+  }
+  result = sflz4_block_decode(dst_ptr, dst_len, src_ptr, src_len);
+  if (result.status_message || (result.value != dst_len)) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    result.value = 0;
+  }
+  return result;
+}
+
+// sflz4_private_hadoop_skip_empty_sub_block returns the length (5 or 0) of
+// the empty sub-block, if any, at the start of src. Hadoop writes one after
+// the zero chunk length that ends an empty stream.
+static inline size_t                        //
+sflz4_private_hadoop_skip_empty_sub_block(  //
+    const uint8_t* src_ptr,                 //
+    size_t src_len) {
+  return ((src_len >= 5) && (sflz4_private_peek_u32be(src_ptr) == 1) &&
+          (src_ptr[4] == 0))
+             ? 5
+             : 0;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result     //
+sflz4_hadoop_encode_worst_case_dst_len(  //
+    size_t src_len,                      //
+    size_t chunk_max_len) {
+  if (chunk_max_len == 0) {
+    chunk_max_len = SFLZ4_HADOOP_DEFAULT_CHUNK_LEN;
+  }
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (chunk_max_len > (SFLZ4_LZ4_BLOCK_DECODE_MAX_INCL_SRC_LEN / 2)) {
+    result.status_message = sflz4_status_message__error_bad_argument;
+    result.value = 0;
+    return result;
+  }
+  // Each chunk costs 8 bytes of framing and at most (chunk_len / 255) + 16
+  // bytes of LZ4 expansion.
+  const uint64_t num_chunks =
+      (((uint64_t)src_len) + chunk_max_len - 1) / chunk_max_len;
+  const uint64_t n = ((uint64_t)src_len) + (src_len / 255) + (24 * num_chunks);
+  if (n > SIZE_MAX) {
+    result.status_message = sflz4_status_message__error_src_is_too_long;
+    result.value = 0;
+    return result;
+  }
+  result.value = (size_t)n;
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_hadoop_encode(                        //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len,                         //
+    size_t chunk_max_len) {
+  sflz4_size_result result =
+      sflz4_hadoop_encode_worst_case_dst_len(src_len, chunk_max_len);
   if (result.status_message) {
     return result;
   } else if (result.value > dst_len) {
     result.status_message = sflz4_status_message__error_dst_is_too_short;
     result.value = 0;
     return result;
+  } else if (chunk_max_len == 0) {
+    chunk_max_len = SFLZ4_HADOOP_DEFAULT_CHUNK_LEN;
   }
-  result.value = 0;
 
   uint8_t* dp = dst_ptr;
-  const uint8_t* sp = src_ptr;
-  const uint8_t* literal_start = src_ptr;
+  while (src_len > 0) {
+    const size_t n = sflz4_private_min_size_t(src_len, chunk_max_len);
+    sflz4_size_result r = sflz4_block_encode(
+        dp + 8, dst_len - (size_t)(dp + 8 - dst_ptr), src_ptr, n);
+    if (r.status_message) {
+      return r;
+    }
+    sflz4_private_poke_u32be(dp + 0, (uint32_t)n);
+    sflz4_private_poke_u32be(dp + 4, (uint32_t)r.value);
+    dp += 8 + r.value;
+    src_ptr += n;
+    src_len -= n;
+  }
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
+}
 
-  // See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md for "The
-  // last match must start at least 12 bytes before the end of block" and other
-  // file format details, such as the LZ4 token's bit patterns.
-  if (src_len > 12) {
-    const uint8_t* const match_limit = src_ptr + src_len - 5;
-    const size_t final_literals_limit = src_len - 11;
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_hadoop_decoded_len(             //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint64_t total = 0;
+  while (src_len > 0) {
+    if (src_len < 4) {
+      goto fail_invalid_data;
+    }
+    size_t remaining = sflz4_private_peek_u32be(src_ptr);
+    src_ptr += 4;
+    src_len -= 4;
+    total += remaining;
+    if (remaining == 0) {
+      const size_t n =
+          sflz4_private_hadoop_skip_empty_sub_block(src_ptr, src_len);
+      src_ptr += n;
+      src_len -= n;
+    }
 
-    // hash_table maps from SFLZ4_HASH_TABLE_SHIFT-bit keys to 32-bit values.
-    // Each value is an offset o, relative to src_ptr, initialized to zero.
-    // Each key, when set, is a hash of 4 bytes src_ptr[o .. o+4].
-    uint32_t hash_table[1 << SFLZ4_HASH_TABLE_SHIFT] = {0};
+    // A chunk's sub-blocks don't record their decoded lengths, so scan (but
+    // don't decode) each one to find where the chunk ends.
+    while (remaining > 0) {
+      if (src_len < 4) {
+        goto fail_invalid_data;
+      }
+      const size_t encoded_len = sflz4_private_peek_u32be(src_ptr);
+      src_ptr += 4;
+      src_len -= 4;
+      if (encoded_len > src_len) {
+        goto fail_invalid_data;
+      }
+      sflz4_size_result r =
+          sflz4_private_block_decoded_len(src_ptr, encoded_len);
+      if (r.status_message || (r.value == 0) || (r.value > remaining)) {
+        goto fail_invalid_data;
+      }
+      remaining -= r.value;
+      src_ptr += encoded_len;
+      src_len -= encoded_len;
+    }
+  }
+  if (total > SIZE_MAX) {
+    goto fail_invalid_data;
+  }
+  result.value = (size_t)total;
+  return result;
 
-    while (1) {
-      // Start with 1-byte steps, accelerating when not finding any matches
-      // (e.g. when compressing binary data, not text data).
-      size_t step = 1;
-      size_t step_counter = 1 << 6;
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
 
-      // Start with a non-empty literal.
-      const uint8_t* next_sp = sp + 1;
-      uint32_t next_hash =
-          sflz4_private_hash(sflz4_private_peek_u32le(next_sp));
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_hadoop_decode(                        //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  uint8_t* dp = dst_ptr;
+  while (src_len > 0) {
+    if (src_len < 4) {
+      goto fail_invalid_data;
+    }
+    size_t remaining = sflz4_private_peek_u32be(src_ptr);
+    src_ptr += 4;
+    src_len -= 4;
+    if (remaining > (dst_len - (size_t)(dp - dst_ptr))) {
+      result.status_message = sflz4_status_message__error_dst_is_too_short;
+      return result;
+    } else if (remaining == 0) {
+      const size_t n =
+          sflz4_private_hadoop_skip_empty_sub_block(src_ptr, src_len);
+      src_ptr += n;
+      src_len -= n;
+    }
 
-      // Find a match or goto final_literals.
-      const uint8_t* match = NULL;
-      do {
-        sp = next_sp;
-        next_sp += step;
-        step = step_counter++ >> 6;
-        if (((size_t)(next_sp - src_ptr)) > final_literals_limit) {
-          goto final_literals;
-        }
-        uint32_t* hash_table_entry = &hash_table[next_hash];
-        match = src_ptr + *hash_table_entry;
-        next_hash = sflz4_private_hash(sflz4_private_peek_u32le(next_sp));
-        *hash_table_entry = (uint32_t)(sp - src_ptr);
-      } while (((sp - match) > 0xFFFF) || (sflz4_private_peek_u32le(sp) !=
-                                           sflz4_private_peek_u32le(match)));
-
-      // Extend the match backwards.
-      while ((sp > literal_start) && (match > src_ptr) &&
-             (sp[-1] == match[-1])) {
-        sp--;
-        match--;
+    // Each sub-block decodes independently, into what's left of the chunk.
+    while (remaining > 0) {
+      if (src_len < 4) {
+        goto fail_invalid_data;
       }
-
-      // Emit half of the LZ4 token, encoding the literal length. We'll fix up
-      // the other half later.
-      uint8_t* token = dp;
-      size_t literal_len = (size_t)(sp - literal_start);
-      if (literal_len < 15) {
-        *dp++ = (uint8_t)(literal_len << 4);
-      } else {
-        size_t n = literal_len - 15;
-        *dp++ = 0xF0;
-        for (; n >= 255; n -= 255) {
-          *dp++ = 0xFF;
-        }
-        *dp++ = (uint8_t)n;
+      const size_t encoded_len = sflz4_private_peek_u32be(src_ptr);
+      src_ptr += 4;
+      src_len -= 4;
+      if (encoded_len > src_len) {
+        goto fail_invalid_data;
+      }
+      sflz4_size_result r =
+          sflz4_block_decode(dp, remaining, src_ptr, encoded_len);
+      if (r.status_message || (r.value == 0)) {
+        goto fail_invalid_data;
       }
-      memcpy(dp, literal_start, literal_len);
-      dp += literal_len;
+      dp += r.value;
+      remaining -= r.value;
+      src_ptr += encoded_len;
+      src_len -= encoded_len;
+    }
+  }
+  result.value = (size_t)(dp - dst_ptr);
+  return result;
 
-      while (1) {
-        // At this point:
-        //  - sp    points to the start of the match's later   copy.
-        //  - match points to the start of the match's earlier copy.
-        //  - token points to the LZ4 token.
-
-        // Calculate the match length and update the token's other half.
-        size_t copy_off = (size_t)(sp - match);
-        *dp++ = (uint8_t)(copy_off >> 0);
-        *dp++ = (uint8_t)(copy_off >> 8);
-        size_t adj_copy_len =
-            sflz4_private_longest_common_prefix(4 + sp, 4 + match, match_limit);
-        if (adj_copy_len < 15) {
-          *token |= (uint8_t)adj_copy_len;
-        } else {
-          size_t n = adj_copy_len - 15;
-          *token |= 0x0F;
-          for (; n >= 255; n -= 255) {
-            *dp++ = 0xFF;
-          }
-          *dp++ = (uint8_t)n;
-        }
-        sp += 4 + adj_copy_len;
+fail_invalid_data:
+  result.status_message = sflz4_status_message__error_invalid_data;
+  return result;
+}
 
-        // Update the literal_start and check the final_literals_limit.
-        literal_start = sp;
-        if (((size_t)(sp - src_ptr)) >= final_literals_limit) {
-          goto final_literals;
-        }
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_parquet_lz4_raw_decode(               //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  return sflz4_private_block_decode_exact(dst_ptr, dst_len, src_ptr, src_len);
+}
 
-        // We've skipped over hashing everything within the match. Also, the
-        // minimum match length is 4. Update the hash table for one of those
-        // skipped positions.
-        hash_table[sflz4_private_hash(sflz4_private_peek_u32le(sp - 2))] =
-            (uint32_t)(sp - 2 - src_ptr);
-
-        // Check if this match can be followed immediately by another match.
-        // If so, continue the loop. Otherwise, break.
-        uint32_t* hash_table_entry =
-            &hash_table[sflz4_private_hash(sflz4_private_peek_u32le(sp))];
-        uint32_t old_offset = *hash_table_entry;
-        uint32_t new_offset = (uint32_t)(sp - src_ptr);
-        *hash_table_entry = new_offset;
-        match = src_ptr + old_offset;
-        if (((new_offset - old_offset) > 0xFFFF) ||
-            (sflz4_private_peek_u32le(sp) != sflz4_private_peek_u32le(match))) {
-          break;
-        }
-        token = dp++;
-        *token = 0;
-      }
-    }
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_parquet_lz4_decode(                   //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  // A bare LZ4 block is very unlikely to also parse as Hadoop framing that
+  // decodes to exactly dst_len bytes.
+  sflz4_size_result result =
+      sflz4_hadoop_decode(dst_ptr, dst_len, src_ptr, src_len);
+  if (!result.status_message && (result.value == dst_len)) {
+    return result;
   }
+  return sflz4_private_block_decode_exact(dst_ptr, dst_len, src_ptr, src_len);
+}
 
-final_literals:
-  do {
-    size_t final_literal_len = src_len - (size_t)(literal_start - src_ptr);
-    if (final_literal_len < 15) {
-      *dp++ = (uint8_t)(final_literal_len << 4);
-    } else {
-      size_t n = final_literal_len - 15;
-      *dp++ = 0xF0;
-      for (; n >= 255; n -= 255) {
-        *dp++ = 0xFF;
-      }
-      *dp++ = (uint8_t)n;
+SFLZ4_MAYBE_STATIC sflz4_size_result            //
+sflz4_size_prefixed_encode_worst_case_dst_len(  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_block_encode_worst_case_dst_len(src_len);
+  if (!result.status_message) {
+    result.value += 4;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_size_prefixed_encode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result =
+      sflz4_size_prefixed_encode_worst_case_dst_len(src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  result = sflz4_block_encode(dst_ptr + 4, dst_len - 4, src_ptr, src_len);
+  if (!result.status_message) {
+    sflz4_private_poke_u32le(dst_ptr, (uint32_t)src_len);
+    result.value += 4;
+  }
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_size_prefixed_decoded_len(      //
+    const uint8_t* src_ptr,           //
+    size_t src_len) {
+  sflz4_size_result result = {NULL, 0};
+  if (src_len < 4) {
+    result.status_message = sflz4_status_message__error_invalid_data;
+    return result;
+  }
+  result.value = sflz4_private_peek_u32le(src_ptr);
+  return result;
+}
+
+SFLZ4_MAYBE_STATIC sflz4_size_result        //
+sflz4_size_prefixed_decode(                 //
+    uint8_t* SFLZ4_RESTRICT dst_ptr,        //
+    size_t dst_len,                         //
+    const uint8_t* SFLZ4_RESTRICT src_ptr,  //
+    size_t src_len) {
+  sflz4_size_result result = sflz4_size_prefixed_decoded_len(src_ptr, src_len);
+  if (result.status_message) {
+    return result;
+  } else if (result.value > dst_len) {
+    result.status_message = sflz4_status_message__error_dst_is_too_short;
+    result.value = 0;
+    return result;
+  }
+  return sflz4_private_block_decode_exact(dst_ptr, result.value, src_ptr + 4,
+                                          src_len - 4);
+}
+
+// -------- LZ4 Embedded Assets
+
+// sflz4_asset_decode decodes the asset at most once, under double-checked
+// locking: the unlocked acquire load is the fast path for every call after
+// the first, and only callers that see private_state as zero take the lock
+// (re-checking private_state under it, as another thread may have decoded
+// the asset meanwhile). After a successful call returns, the calling thread
+// may read a->decoded_ptr's bytes without locking: the acquire load (or the
+// lock) orders them after the decoding thread's writes, and nothing ever
+// writes to them again.
+SFLZ4_MAYBE_STATIC sflz4_size_result  //
+sflz4_asset_decode(                   //
+    sflz4_asset* a) {
+  // private_state is zero until decoded. It is then published (with release
+  // semantics, so that the decoded bytes and private_status_message are
+  // visible to every thread that sees it) as one.
+  if (!sflz4_private_load_acquire_size_t(&a->private_state)) {
+    sflz4_private_lock(&a->private_lock);
+    if (!a->private_state) {
+      a->private_status_message =
+          sflz4_private_block_decode_exact(a->decoded_ptr, a->decoded_len,
+                                           a->encoded_ptr, a->encoded_len)
+              .status_message;
+      sflz4_private_store_release_size_t(&a->private_state, 1);
     }
-    memcpy(dp, literal_start, final_literal_len);
-    dp += final_literal_len;
-  } while (0);
+    sflz4_private_unlock(&a->private_lock);
+  }
 
-  result.value = (size_t)(dp - dst_ptr);
+  sflz4_size_result result = {NULL, 0};
+  result.status_message = a->private_status_message;
+  result.value = result.status_message ? 0 : a->decoded_len;
   return result;
 }
 
 // -------- Private Macros
 
+#undef SFLZ4_ALWAYS_INLINE
+#undef SFLZ4_ARCHIVE_BLOCK_ENTRY_LEN
+#undef SFLZ4_ARCHIVE_FILE_ENTRY_LEN
+#undef SFLZ4_ARCHIVE_HEADER_LEN
+#undef SFLZ4_ARCHIVE_MAGIC
+#undef SFLZ4_ARCHIVE_RAW_BIT
+#undef SFLZ4_ATTRIBUTE_TARGET_X86_64_CRC32C
+#undef SFLZ4_BLOCK_DECODE_FLAGS__ALLOW_TRAILING_MATCH
+#undef SFLZ4_BLOCK_DECODE_FLAGS__STOP_AT_DST_END
+#undef SFLZ4_BLOCK_ESTIMATE_CHUNK_LEN
+#undef SFLZ4_CHECKPOINTS_ENTRY_CHECKSUM_LEN
+#undef SFLZ4_CHECKPOINTS_ENTRY_HEADER_LEN
+#undef SFLZ4_CHECKPOINTS_HEADER_LEN
+#undef SFLZ4_CHECKPOINTS_MAGIC
+#undef SFLZ4_CHECKPOINTS_WINDOW_LEN
+#undef SFLZ4_CRC32C_LANE_LEN
+#undef SFLZ4_CRC32C_SHIFT_1_LANE
+#undef SFLZ4_CRC32C_SHIFT_2_LANES
+#undef SFLZ4_DELTA_HEADER_LEN
+#undef SFLZ4_DELTA_MAGIC
+#undef SFLZ4_DELTA_MAX_INCL_HASH_TABLE_SHIFT
+#undef SFLZ4_DELTA_MIN_MATCH_LEN
+#undef SFLZ4_DELTA_STRIDE
+#undef SFLZ4_DICTIONARY_BUILDER_HASH_SHIFT
+#undef SFLZ4_DICTIONARY_BUILDER_HOLDOUT_INTERVAL
+#undef SFLZ4_DICTIONARY_BUILDER_NUM_SEGMENTS
+#undef SFLZ4_DICTIONARY_BUILDER_SEGMENT_LEN
+#undef SFLZ4_DICTIONARY_BUILDER_SUBSTRING_LEN
+#undef SFLZ4_FRAME_FLG__BLOCK_CHECKSUMS
+#undef SFLZ4_FRAME_FLG__CONTENT_CHECKSUM
+#undef SFLZ4_FRAME_FLG__CONTENT_SIZE
+#undef SFLZ4_FRAME_FLG__DICT_ID
+#undef SFLZ4_FRAME_FLG__INDEPENDENT_BLOCKS
+#undef SFLZ4_FRAME_FLG__RESERVED
+#undef SFLZ4_FRAME_FLG__VERSION_01
+#undef SFLZ4_FRAME_FLG__VERSION_MASK
+#undef SFLZ4_FRAME_HEADER_MAX_INCL_LEN
+#undef SFLZ4_FRAME_MAGIC
+#undef SFLZ4_FRAME_SKIPPABLE_MAGIC
+#undef SFLZ4_FRAME_SKIPPABLE_MAGIC_MASK
+#undef SFLZ4_FRAME_UNCOMPRESSED_BIT
 #undef SFLZ4_HASH_TABLE_SHIFT
+#undef SFLZ4_HIGH_RATIO_HASH_TABLE_SHIFT
+#undef SFLZ4_HIGH_RATIO_MAX_ATTEMPTS
+#undef SFLZ4_LOG_WRITER_CHECKPOINT_MAGIC
+#undef SFLZ4_LOG_WRITER_FLG
+#undef SFLZ4_LOG_WRITER_HISTORY_LEN
+#undef SFLZ4_MEMORY_CHECKPOINT_ENTRY_LEN
+#undef SFLZ4_MEMORY_CHECKPOINT_HEADER_LEN
+#undef SFLZ4_MEMORY_CHECKPOINT_MAGIC
+#undef SFLZ4_MEMORY_CHECKPOINT_MAX_INCL_RUN_LEN
+#undef SFLZ4_MEMORY_CHECKPOINT_RAW_BIT
+#undef SFLZ4_MEMORY_FINGERPRINT_PRIME1
+#undef SFLZ4_MEMORY_FINGERPRINT_PRIME2
+#undef SFLZ4_MESSAGE_HELLO_MAGIC
+#undef SFLZ4_MESSAGE_HELLO_PAYLOAD_LEN
+#undef SFLZ4_MESSAGE_HISTORY_LEN
+#undef SFLZ4_MESSAGE_VARINT_MAX_INCL_LEN
+#undef SFLZ4_PAGE_POOL_HANDLE_UNIFORM_BIT
+#undef SFLZ4_PAGE_POOL_MAX_INCL_NUM_SLABS
+#undef SFLZ4_PAGE_POOL_NONE
+#undef SFLZ4_PAGE_POOL_NUM_CLASSES
+#undef SFLZ4_PAGE_POOL_RAW_CLASS
+#undef SFLZ4_READER_SLOT_STATE__EMPTY
+#undef SFLZ4_READER_SLOT_STATE__LOADING
+#undef SFLZ4_READER_SLOT_STATE__VALID
+#undef SFLZ4_RECORDS_DIRECTORY_ENTRY_LEN
+#undef SFLZ4_RECORDS_FOOTER_LEN
+#undef SFLZ4_RECORDS_HEADER_LEN
+#undef SFLZ4_RECORDS_MAGIC
+#undef SFLZ4_RING_MAGIC
+#undef SFLZ4_RING_RAW_BIT
+#undef SFLZ4_RING_READ_POS_OFFSET
+#undef SFLZ4_RING_RECORD_HEADER_LEN
+#undef SFLZ4_RING_WRAP_MARKER
+#undef SFLZ4_RING_WRITE_POS_OFFSET
+#undef SFLZ4_SEEK_TABLE_FOOTER_MAGIC
+#undef SFLZ4_SEEK_TABLE_MAGIC
+#undef SFLZ4_SEEK_TABLE_OVERHEAD_LEN
+#undef SFLZ4_SPARSE_CRC32C_BIT
+#undef SFLZ4_SPARSE_HOLE_BIT
+#undef SFLZ4_SPARSE_LEN_MASK
+#undef SFLZ4_SPARSE_MAGIC
+#undef SFLZ4_SPARSE_RAW_BIT
+#undef SFLZ4_THREAD_LOCAL
+#undef SFLZ4_USE_ARM_CRC32C
 #undef SFLZ4_USE_MEMCPY_LE_PEEK_POKE
+#undef SFLZ4_USE_X86_64_CRC32C
+#undef SFLZ4_XXH32_PRIME1
+#undef SFLZ4_XXH32_PRIME2
+#undef SFLZ4_XXH32_PRIME3
+#undef SFLZ4_XXH32_PRIME4
+#undef SFLZ4_XXH32_PRIME5
 
 // ================================ -Private Implementation
 
@@ -501,4 +10729,294 @@ final_literals:
 }  // extern "C"
 #endif
 
+// ================================ +C++20 Constexpr Interface
+
+// With C++20 (or later), this section adds compile-time (constexpr) LZ4
+// block compression, so that string tables and other constant data can be
+// compressed by the C++ compiler, without a separate build step (compare
+// embed.c), and kept compressed in the binary's read-only data:
+//
+//   static constexpr auto blob = sflz4::compress<"...">();
+//
+// blob.encoded is a regular LZ4 block, exactly blob.encoded_len bytes long
+// (not the worst case length), that decodes to blob.decoded_len bytes. At
+// run time, decode it with sflz4_block_decode or, to decode it lazily, wrap
+// it in an sflz4_asset:
+//
+//   static uint8_t buf[blob.decoded_len];
+//   sflz4_asset a = SFLZ4_ASSET_INITIALIZER(
+//       blob.encoded.data(), blob.encoded_len, buf, blob.decoded_len);
+//
+// blob.decode() also decodes at compile time, e.g. to verify a round trip
+// in a static_assert.
+//
+// The constexpr encoder is a simpler (greedy, single hash table probe)
+// variant of sflz4_block_encode. It is much slower, as it runs in the
+// compiler, and compilers limit constexpr evaluation, so it suits inputs of
+// tens of kilobytes (e.g. with GCC, each loop is limited to 262144
+// iterations by default: see -fconstexpr-loop-limit). Use embed.c, with
+// sflz4_block_encode_high_ratio, for larger or binary files.
+
+#if (defined(__cplusplus) && (__cplusplus >= 202002L)) || \
+    (defined(_MSVC_LANG) && (_MSVC_LANG >= 202002L))
+
+#include <array>
+
+namespace sflz4 {
+
+// string_literal holds a string literal, excluding its terminating NUL, so
+// that it can be a template argument.
+template <size_t N>
+struct string_literal {
+  char chars[N];
+
+  constexpr string_literal(const char (&s)[N]) : chars() {
+    for (size_t i = 0; i < N; i++) {
+      chars[i] = s[i];
+    }
+  }
+
+  constexpr size_t size() const { return N - 1; }
+  constexpr uint8_t operator[](size_t i) const { return (uint8_t)chars[i]; }
+};
+
+// private_decode writes the decoded form of src[0 .. src_len) to dst,
+// returning whether src was valid and decoded to exactly dst.size() bytes.
+// It never reads or writes out of bounds, even for invalid src.
+template <typename Dst, typename Src>
+constexpr bool       //
+private_decode(      //
+    Dst& dst,        //
+    const Src& src,  //
+    size_t src_len) {
+  const size_t dst_len = dst.size();
+  size_t dp = 0;
+  size_t sp = 0;
+  while (sp < src_len) {
+    const uint32_t token = src[sp++];
+
+    size_t literal_len = token >> 4;
+    if (literal_len == 15) {
+      uint32_t c = 255;
+      while (c == 255) {
+        if (sp >= src_len) {
+          return false;
+        }
+        c = src[sp++];
+        literal_len += c;
+      }
+    }
+    if ((literal_len > (src_len - sp)) || (literal_len > (dst_len - dp))) {
+      return false;
+    }
+    for (; literal_len > 0; literal_len--) {
+      dst[dp++] = src[sp++];
+    }
+    if (sp == src_len) {
+      break;
+    }
+
+    if ((src_len - sp) < 2) {
+      return false;
+    }
+    const size_t copy_off = (size_t)src[sp] | ((size_t)src[sp + 1] << 8);
+    sp += 2;
+    size_t copy_len = token & 15;
+    if (copy_len == 15) {
+      uint32_t c = 255;
+      while (c == 255) {
+        if (sp >= src_len) {
+          return false;
+        }
+        c = src[sp++];
+        copy_len += c;
+      }
+    }
+    copy_len += 4;
+    if ((copy_off == 0) || (copy_off > dp) || (copy_len > (dst_len - dp))) {
+      return false;
+    }
+    for (; copy_len > 0; copy_len--, dp++) {
+      dst[dp] = dst[dp - copy_off];
+    }
+  }
+  return dp == dst_len;
+}
+
+// private_emit writes an LZ4 sequence (literals, then a match unless
+// copy_len is zero) to dst at *dp.
+template <typename Dst, typename Src>
+constexpr void             //
+private_emit(              //
+    Dst& dst,              //
+    size_t* dp,            //
+    const Src& src,        //
+    size_t literal_start,  //
+    size_t literal_len,    //
+    size_t copy_off,       //
+    size_t copy_len) {
+  const size_t adj_copy_len = (copy_len > 0) ? (copy_len - 4) : 0;
+  dst[(*dp)++] = (uint8_t)(((literal_len < 15) ? (literal_len << 4) : 0xF0) |
+                           ((adj_copy_len < 15) ? adj_copy_len : 0x0F));
+  if (literal_len >= 15) {
+    size_t n = literal_len - 15;
+    for (; n >= 255; n -= 255) {
+      dst[(*dp)++] = 0xFF;
+    }
+    dst[(*dp)++] = (uint8_t)n;
+  }
+  for (size_t i = 0; i < literal_len; i++) {
+    dst[(*dp)++] = (uint8_t)src[literal_start + i];
+  }
+  if (copy_len == 0) {
+    return;
+  }
+  dst[(*dp)++] = (uint8_t)(copy_off >> 0);
+  dst[(*dp)++] = (uint8_t)(copy_off >> 8);
+  if (adj_copy_len >= 15) {
+    size_t n = adj_copy_len - 15;
+    for (; n >= 255; n -= 255) {
+      dst[(*dp)++] = 0xFF;
+    }
+    dst[(*dp)++] = (uint8_t)n;
+  }
+}
+
+template <typename Src>
+constexpr uint32_t   //
+private_peek_u32le(  //
+    const Src& src,  //
+    size_t i) {
+  return ((uint32_t)(uint8_t)src[i + 0] << 0) |
+         ((uint32_t)(uint8_t)src[i + 1] << 8) |
+         ((uint32_t)(uint8_t)src[i + 2] << 16) |
+         ((uint32_t)(uint8_t)src[i + 3] << 24);
+}
+
+// private_encode writes the LZ4 block compressed form of src to dst, which
+// must be at least sflz4_block_encode_worst_case_dst_len(src.size()) bytes
+// long, returning the number of bytes written.
+template <typename Dst, typename Src>
+constexpr size_t  //
+private_encode(   //
+    Dst& dst,     //
+    const Src& src) {
+  const size_t src_len = src.size();
+  size_t dp = 0;
+  size_t literal_start = 0;
+  if (src_len > 12) {
+    // The hash_table's values are positions plus one, or zero for none.
+    std::array<uint32_t, 4096> hash_table = {};
+    // Matches start at or before sp_limit and end at or before match_limit.
+    const size_t sp_limit = src_len - 12;
+    const size_t match_limit = src_len - 5;
+    size_t sp = 0;
+    while (sp <= sp_limit) {
+      const uint32_t x = private_peek_u32le(src, sp);
+      uint32_t& entry = hash_table[(x * 2654435761u) >> 20];
+      const size_t candidate = entry;
+      entry = (uint32_t)(sp + 1);
+      if ((candidate == 0) || (((sp + 1) - candidate) > 0xFFFF) ||
+          (private_peek_u32le(src, candidate - 1) != x)) {
+        sp++;
+        continue;
+      }
+
+      size_t match = candidate - 1;
+      size_t copy_len = 4;
+      while (((sp + copy_len) < match_limit) &&
+             (src[match + copy_len] == src[sp + copy_len])) {
+        copy_len++;
+      }
+      while ((sp > literal_start) && (match > 0) &&
+             (src[sp - 1] == src[match - 1])) {
+        sp--;
+        match--;
+        copy_len++;
+      }
+      private_emit(dst, &dp, src, literal_start, sp - literal_start,
+                   sp - match, copy_len);
+      sp += copy_len;
+      literal_start = sp;
+    }
+  }
+  private_emit(dst, &dp, src, literal_start, src_len - literal_start, 0, 0);
+  return dp;
+}
+
+// compressed holds an LZ4 block compressed at compile time by
+// sflz4::compress.
+template <size_t EncodedLen, size_t DecodedLen>
+struct compressed {
+  static constexpr size_t encoded_len = EncodedLen;
+  static constexpr size_t decoded_len = DecodedLen;
+
+  std::array<uint8_t, EncodedLen> encoded;
+
+  // decode returns the decoded bytes. It can run at compile time. At run
+  // time, sflz4_block_decode is much faster. If encoded was modified to be
+  // invalid, the result is unspecified (but decode stays in bounds).
+  constexpr std::array<uint8_t, DecodedLen> decode() const {
+    std::array<uint8_t, DecodedLen> dst = {};
+    private_decode(dst, encoded, EncodedLen);
+    return dst;
+  }
+};
+
+// private_encoded holds private_encode's output, in a worst case length
+// buffer.
+template <size_t N>
+struct private_encoded {
+  std::array<uint8_t, N + (N / 255) + 16> bytes;
+  size_t len;
+};
+
+template <auto Src>
+constexpr auto              //
+private_encode_worst_case(  //
+    void) {
+  private_encoded<Src.size()> e = {};
+  e.len = private_encode(e.bytes, Src);
+  return e;
+}
+
+// private_compress runs the encoder (at compile time) into a worst case
+// length buffer, a constexpr local that never reaches the binary, and then
+// copies its output to an array of exactly the encoded length.
+template <auto Src>
+constexpr auto     //
+private_compress(  //
+    void) {
+  constexpr auto e = private_encode_worst_case<Src>();
+  compressed<e.len, Src.size()> c = {};
+  for (size_t i = 0; i < e.len; i++) {
+    c.encoded[i] = e.bytes[i];
+  }
+  return c;
+}
+
+// compress returns the LZ4 block compressed form of Src, a string literal
+// (excluding its terminating NUL), e.g. sflz4::compress<"Hello">().
+template <string_literal Src>
+constexpr auto  //
+compress(       //
+    void) {
+  return private_compress<Src>();
+}
+
+// compress returns the LZ4 block compressed form of Src, a std::array of
+// bytes (uint8_t or char).
+template <std::array Src>
+constexpr auto  //
+compress(       //
+    void) {
+  return private_compress<Src>();
+}
+
+}  // namespace sflz4
+
+#endif  // C++20
+
+// ================================ -C++20 Constexpr Interface
+
 #endif  // SFLZ4_INCLUDE_GUARD
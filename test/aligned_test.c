@@ -0,0 +1,230 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// aligned_test.c tests the "LZ4 Aligned Streams" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/aligned_test.c && ./a.out
+
+#define _POSIX_C_SOURCE 200112L
+#include "test.h"
+
+#define DATA_LEN 5000000
+
+uint8_t text[DATA_LEN];
+uint8_t noise[DATA_LEN];
+
+// stream is an in-memory input and output that checks, like O_DIRECT, that
+// every buffer and length is aligned. Its output is one alignment longer
+// than out_len, for the final write's padding.
+typedef struct stream_struct {
+  size_t alignment;
+  const uint8_t* in_ptr;
+  size_t in_len;
+  size_t in_pos;
+  uint8_t* out_ptr;
+  size_t out_len;
+  size_t out_pos;
+} stream;
+
+static sflz4_size_result  //
+read_func(                //
+    void* context,        //
+    uint8_t* ptr,         //
+    size_t len) {
+  stream* s = (stream*)context;
+  CHECK(((((uintptr_t)ptr) | len) & (s->alignment - 1)) == 0);
+  sflz4_size_result result = {NULL, 0};
+  result.value = s->in_len - s->in_pos;
+  if (result.value > len) {
+    result.value = len;
+  }
+  memcpy(ptr, s->in_ptr + s->in_pos, result.value);
+  s->in_pos += result.value;
+  return result;
+}
+
+static const char*       //
+write_func(              //
+    void* context,       //
+    const uint8_t* ptr,  //
+    size_t len) {
+  stream* s = (stream*)context;
+  CHECK(((((uintptr_t)ptr) | len) & (s->alignment - 1)) == 0);
+  if (len > (s->out_len + s->alignment - s->out_pos)) {
+    return "#test: output is full";
+  }
+  memcpy(s->out_ptr + s->out_pos, ptr, len);
+  s->out_pos += len;
+  return NULL;
+}
+
+static void                 //
+init_stream(                //
+    stream* s,              //
+    size_t alignment,       //
+    const uint8_t* in_ptr,  //
+    size_t in_len,          //
+    uint8_t* out_ptr,       //
+    size_t out_len) {
+  s->alignment = alignment;
+  s->in_ptr = in_ptr;
+  s->in_len = in_len;
+  s->in_pos = 0;
+  s->out_ptr = out_ptr;
+  s->out_len = out_len;
+  s->out_pos = 0;
+}
+
+// alloc_workspace uses posix_memalign, not C11's aligned_alloc, so that this
+// test also builds with -std=c99. It returns NULL on failure.
+static uint8_t*        //
+alloc_workspace(       //
+    size_t alignment,  //
+    size_t len) {
+  void* ptr = NULL;
+  return posix_memalign(&ptr, alignment, len) ? NULL : (uint8_t*)ptr;
+}
+
+static void  //
+test_round_trip() {
+  static const size_t block_max_lens[] = {0x10000, 0x40000, 0x100000,
+                                          0x400000};
+  static const size_t alignments[] = {512, 4096, 65536};
+  static const size_t src_lens[] = {0, 1, 511, 512, 100000, 0x400001,
+                                    DATA_LEN};
+  const size_t cap = sflz4_frame_encode_worst_case_dst_len(DATA_LEN).value;
+  uint8_t* enc = (uint8_t*)malloc(cap + 65536);
+  uint8_t* dec = (uint8_t*)malloc(DATA_LEN + 65536);
+  for (size_t b = 0; b < 4; b++) {
+    for (size_t a = 0; a < 3; a++) {
+      const size_t alignment = alignments[a];
+      sflz4_size_result ewl =
+          sflz4_aligned_encode_workspace_len(block_max_lens[b], alignment);
+      sflz4_size_result dwl =
+          sflz4_aligned_decode_workspace_len(block_max_lens[b], alignment);
+      CHECK(!ewl.status_message && !dwl.status_message);
+      uint8_t* ews = alloc_workspace(alignment, ewl.value);
+      uint8_t* dws = alloc_workspace(alignment, dwl.value);
+      for (size_t i = 0; i < (sizeof(src_lens) / sizeof(src_lens[0])); i++) {
+        const size_t n = src_lens[i];
+        const uint8_t* src = (i & 1) ? noise : text;
+        stream s;
+        init_stream(&s, alignment, src, n, enc, cap);
+        sflz4_size_result e =
+            sflz4_aligned_encode(ews, ewl.value, block_max_lens[b], alignment,
+                                 &read_func, &write_func, &s);
+        CHECK(!e.status_message && (e.value <= s.out_pos) &&
+              ((s.out_pos - e.value) < alignment));
+
+        // The output is an ordinary LZ4 frame.
+        sflz4_size_result d = sflz4_frame_decode(dec, n, enc, e.value);
+        CHECK(!d.status_message && (d.value == n) && !memcmp(dec, src, n));
+
+        init_stream(&s, alignment, enc, e.value, dec, n);
+        d = sflz4_aligned_decode(dws, dwl.value, alignment, &read_func,
+                                 &write_func, &s);
+        CHECK(!d.status_message && (d.value == n) && !memcmp(dec, src, n));
+      }
+      free(dws);
+      free(ews);
+    }
+  }
+
+  // A workspace that is too short or unaligned, or a bad alignment.
+  sflz4_size_result ewl = sflz4_aligned_encode_workspace_len(0x10000, 4096);
+  uint8_t* ews = alloc_workspace(4096, ewl.value + 4096);
+  stream s;
+  init_stream(&s, 4096, text, 1000, enc, cap);
+  CHECK(sflz4_aligned_encode(ews, ewl.value - 4096, 0x10000, 4096,
+                             &read_func, &write_func, &s)
+            .status_message);
+  CHECK(sflz4_aligned_encode(ews + 512, ewl.value, 0x10000, 4096, &read_func,
+                             &write_func, &s)
+            .status_message);
+  CHECK(sflz4_aligned_encode_workspace_len(0x10000, 1000).status_message);
+  CHECK(sflz4_aligned_encode_workspace_len(0x20000, 4096).status_message);
+  free(ews);
+  free(dec);
+  free(enc);
+}
+
+// test_decode_frames decodes frames from sflz4_frame_encode, with every
+// combination of flags, including linked blocks.
+static void  //
+test_decode_frames() {
+  const size_t n = 3000000;
+  const size_t cap = sflz4_frame_encode_worst_case_dst_len(n).value;
+  uint8_t* enc = (uint8_t*)malloc(cap);
+  uint8_t* dec = (uint8_t*)malloc(n + 4096);
+  sflz4_size_result dwl = sflz4_aligned_decode_workspace_len(0x400000, 4096);
+  uint8_t* dws = alloc_workspace(4096, dwl.value);
+  for (uint32_t flags = 0; flags < 0x20; flags++) {
+    sflz4_frame_encode_options options;
+    memset(&options, 0, sizeof(options));
+    options.block_max_len = (flags & 1) ? 0x10000 : 0x40000;
+    options.flags = flags;
+    options.num_threads = 1;
+    sflz4_size_result e = sflz4_frame_encode(enc, cap, text, n, &options);
+    CHECK(!e.status_message);
+    stream s;
+    init_stream(&s, 4096, enc, e.value, dec, n);
+    sflz4_size_result d = sflz4_aligned_decode(dws, dwl.value, 4096,
+                                               &read_func, &write_func, &s);
+    CHECK(!d.status_message && (d.value == n) && !memcmp(dec, text, n));
+
+    // Truncated frames are rejected.
+    for (size_t t = 0; t < 4; t++) {
+      const size_t len = (e.value * t) / 4;
+      init_stream(&s, 4096, enc, len, dec, n);
+      d = sflz4_aligned_decode(dws, dwl.value, 4096, &read_func, &write_func,
+                               &s);
+      CHECK(d.status_message);
+    }
+  }
+
+  // Block checksums are verified.
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.flags = SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS;
+  sflz4_size_result e = sflz4_frame_encode(enc, cap, text, n, &options);
+  CHECK(!e.status_message);
+  enc[e.value / 2] ^= 0x10;
+  stream s;
+  init_stream(&s, 4096, enc, e.value, dec, n);
+  sflz4_size_result d = sflz4_aligned_decode(dws, dwl.value, 4096, &read_func,
+                                             &write_func, &s);
+  CHECK(d.status_message);
+
+  free(dws);
+  free(dec);
+  free(enc);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(text, DATA_LEN, 93);
+  uint32_t state = 93;
+  for (size_t i = 0; i < DATA_LEN; i++) {
+    noise[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  test_round_trip();
+  test_decode_frames();
+  return test_finish("aligned_test");
+}
@@ -0,0 +1,221 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// archive_test.c tests the "LZ4 Archive" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/archive_test.c && ./a.out
+
+#include "test.h"
+
+#define NUM_FILES 40
+#define BLOCK_MAX_LEN 8192
+
+sflz4_archive_file files[NUM_FILES];
+char names[NUM_FILES][32];
+uint8_t* datas[NUM_FILES];
+size_t contents_len;
+
+// make_files makes files of varied lengths: empty, small, longer than a
+// block and incompressible, with names out of sorted order and one name
+// used twice.
+static void  //
+make_files() {
+  uint32_t state = 91;
+  contents_len = 0;
+  for (int i = 0; i < NUM_FILES; i++) {
+    size_t len = test_rand(&state) % 2000;
+    if ((i % 10) == 3) {
+      len = 0;
+    } else if ((i % 10) == 7) {
+      len = BLOCK_MAX_LEN + (test_rand(&state) % (3 * BLOCK_MAX_LEN));
+    }
+    datas[i] = (uint8_t*)malloc(len ? len : 1);
+    if ((i % 10) == 5) {
+      for (size_t j = 0; j < len; j++) {
+        datas[i][j] = (uint8_t)(test_rand(&state) >> 24);
+      }
+    } else {
+      test_make_data(datas[i], len, 1000 + i);
+    }
+    snprintf(names[i], sizeof(names[i]), "dir/file%02d.txt",
+             (i == 17) ? 4 : ((i * 7) % NUM_FILES));
+    files[i].name_ptr = (const uint8_t*)names[i];
+    files[i].name_len = strlen(names[i]);
+    files[i].data_ptr = datas[i];
+    files[i].data_len = len;
+    contents_len += len;
+  }
+}
+
+static uint8_t*                          //
+encode(                                  //
+    const sflz4_dictionary* dictionary,  //
+    size_t* len) {
+  const size_t cap =
+      sflz4_archive_worst_case_dst_len(files, NUM_FILES, BLOCK_MAX_LEN).value;
+  sflz4_size_result wl = sflz4_archive_encode_workspace_len(files, NUM_FILES);
+  CHECK(!wl.status_message && (wl.value == contents_len));
+  uint8_t* dst = (uint8_t*)malloc(cap);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value);
+  sflz4_size_result r =
+      sflz4_archive_encode(dst, cap - 1, files, NUM_FILES, BLOCK_MAX_LEN,
+                           dictionary, workspace, wl.value, NULL, NULL);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+  r = sflz4_archive_encode(dst, cap, files, NUM_FILES, BLOCK_MAX_LEN,
+                           dictionary, workspace, wl.value - 1, NULL, NULL);
+  CHECK(r.status_message ==
+        sflz4_status_message__error_workspace_is_too_short);
+  r = sflz4_archive_encode(dst, cap, files, NUM_FILES, BLOCK_MAX_LEN,
+                           dictionary, workspace, wl.value, NULL, NULL);
+  CHECK(!r.status_message && (r.value < contents_len));
+  free(workspace);
+  *len = r.value;
+  return dst;
+}
+
+static void                //
+check_archive(             //
+    const uint8_t* a_ptr,  //
+    size_t a_len) {
+  sflz4_size_result r = sflz4_archive_num_files(a_ptr, a_len);
+  CHECK(!r.status_message && (r.value == NUM_FILES));
+  r = sflz4_archive_contents_len(a_ptr, a_len);
+  CHECK(!r.status_message && (r.value == contents_len));
+  r = sflz4_archive_scratch_len(a_ptr, a_len);
+  CHECK(!r.status_message && (r.value == BLOCK_MAX_LEN));
+
+  uint8_t* contents = (uint8_t*)malloc(contents_len);
+  r = sflz4_archive_decode_all(contents, contents_len - 1, a_ptr, a_len, NULL,
+                               NULL);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+  r = sflz4_archive_decode_all(contents, contents_len, a_ptr, a_len, NULL,
+                               NULL);
+  CHECK(!r.status_message && (r.value == contents_len));
+
+  uint8_t scratch[BLOCK_MAX_LEN];
+  for (int i = 0; i < NUM_FILES; i++) {
+    sflz4_archive_file f;
+    CHECK(!sflz4_archive_file_at(&f, a_ptr, a_len, i, contents));
+    CHECK((f.name_len == files[i].name_len) &&
+          !memcmp(f.name_ptr, files[i].name_ptr, f.name_len) &&
+          (f.data_len == files[i].data_len) &&
+          !memcmp(f.data_ptr, datas[i], f.data_len));
+
+    // Files 12 and 17 share a name, so either one may be found.
+    r = sflz4_archive_find(a_ptr, a_len, files[i].name_ptr, files[i].name_len);
+    CHECK(!r.status_message &&
+          ((r.value == (size_t)i) ||
+           (((i == 12) || (i == 17)) && ((r.value == 12) || (r.value == 17)))));
+
+    const size_t n = files[i].data_len;
+    uint8_t* dst = (uint8_t*)malloc(n ? n : 1);
+    r = sflz4_archive_extract(dst, n, a_ptr, a_len, i, scratch,
+                              sizeof(scratch));
+    CHECK(!r.status_message && (r.value == n) && !memcmp(dst, datas[i], n));
+    if (n > 0) {
+      r = sflz4_archive_extract(dst, n - 1, a_ptr, a_len, i, scratch,
+                                sizeof(scratch));
+      CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+    }
+    free(dst);
+  }
+
+  sflz4_archive_file f;
+  CHECK(sflz4_archive_file_at(&f, a_ptr, a_len, NUM_FILES, NULL));
+  r = sflz4_archive_find(a_ptr, a_len, (const uint8_t*)"dir/file", 8);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+  free(contents);
+}
+
+static void  //
+test_round_trip() {
+  size_t len = 0;
+  uint8_t* a = encode(NULL, &len);
+  check_archive(a, len);
+
+  // A dictionary helps when block_max_len is small.
+  static sflz4_dictionary d;
+  uint8_t dict_bytes[4096];
+  test_make_data(dict_bytes, sizeof(dict_bytes), 1);
+  CHECK(!sflz4_dictionary_initialize(&d, 0, dict_bytes, sizeof(dict_bytes)));
+  size_t dict_len = 0;
+  uint8_t* ad = encode(&d, &dict_len);
+  check_archive(ad, dict_len);
+
+  free(ad);
+  free(a);
+}
+
+static void  //
+test_corruption() {
+  size_t len = 0;
+  uint8_t* a = encode(NULL, &len);
+  uint8_t* c = (uint8_t*)malloc(len);
+  uint8_t* contents = (uint8_t*)malloc(contents_len);
+  uint8_t* dst = (uint8_t*)malloc(4 * BLOCK_MAX_LEN);
+  uint8_t scratch[BLOCK_MAX_LEN];
+
+  // Everything that decode_all returns is checksummed. The other functions
+  // check only what they use, so they must merely not crash.
+  uint32_t state = 92;
+  for (int k = 0; k < 3000; k++) {
+    memcpy(c, a, len);
+    uint32_t x = test_rand(&state);
+    size_t i = (k < 500) ? (len - 1 - (x % 4096)) : ((x >> 3) % len);
+    c[i] ^= (uint8_t)(1 << (x & 7));
+    sflz4_size_result r =
+        sflz4_archive_decode_all(contents, contents_len, c, len, NULL, NULL);
+    if (!r.status_message) {
+      CHECK(r.value == contents_len);
+      size_t offset = 0;
+      for (int j = 0; j < NUM_FILES; j++) {
+        CHECK(!memcmp(contents + offset, datas[j], files[j].data_len));
+        offset += files[j].data_len;
+      }
+    }
+    const uint64_t file_index = x % NUM_FILES;
+    sflz4_archive_extract(dst, 4 * BLOCK_MAX_LEN, c, len, file_index, scratch,
+                          sizeof(scratch));
+    sflz4_archive_find(c, len, files[file_index].name_ptr,
+                       files[file_index].name_len);
+    sflz4_archive_file f;
+    sflz4_archive_file_at(&f, c, len, file_index, NULL);
+
+    r = sflz4_archive_decode_all(contents, contents_len, a, (x >> 3) % len,
+                                 NULL, NULL);
+    CHECK(r.status_message);
+  }
+
+  free(dst);
+  free(contents);
+  free(c);
+  free(a);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  make_files();
+  test_round_trip();
+  test_corruption();
+  for (int i = 0; i < NUM_FILES; i++) {
+    free(datas[i]);
+  }
+  return test_finish("archive_test");
+}
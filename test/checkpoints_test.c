@@ -0,0 +1,220 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// checkpoints_test.c tests the "LZ4 Frame Checkpoints" section of
+// src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/checkpoints_test.c && ./a.out
+
+#include "test.h"
+
+#define BLOCK_LEN 0x10000
+#define DATA_LEN ((9 * BLOCK_LEN) + 1234)
+#define INDEX_MAX_LEN 0x200000
+
+uint8_t data[DATA_LEN];
+uint8_t buf[DATA_LEN];
+uint8_t frame[2 * DATA_LEN];
+size_t frame_len;
+uint8_t index_buf[INDEX_MAX_LEN];
+uint8_t corrupted[INDEX_MAX_LEN];
+uint8_t* workspace;
+size_t workspace_len;
+
+static void  //
+make_frame(  //
+    uint32_t flags) {
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.block_max_len = BLOCK_LEN;
+  options.flags = flags;
+  sflz4_size_result r =
+      sflz4_frame_encode(frame, sizeof(frame), data, DATA_LEN, &options);
+  CHECK(!r.status_message);
+  frame_len = r.value;
+
+  r = sflz4_frame_checkpoints_workspace_len(frame, frame_len);
+  CHECK(!r.status_message && (r.value == (0x10000 + BLOCK_LEN)));
+  free(workspace);
+  workspace_len = r.value;
+  workspace = (uint8_t*)malloc(workspace_len);
+}
+
+static size_t  //
+build_index(   //
+    uint64_t interval) {
+  sflz4_size_result r =
+      sflz4_frame_checkpoints_worst_case_dst_len(DATA_LEN, interval);
+  CHECK(!r.status_message);
+  // The worst case assumes a checkpoint every interval bytes, but there is at
+  // most one per block.
+  const size_t dst_len = (r.value < INDEX_MAX_LEN) ? r.value : INDEX_MAX_LEN;
+  r = sflz4_frame_build_checkpoints(index_buf, dst_len, frame, frame_len,
+                                    interval, workspace, workspace_len);
+  CHECK(!r.status_message && (r.value <= dst_len));
+  return r.value;
+}
+
+// read_at reads len bytes at offset, returning its status message and
+// checking that any bytes read match data.
+static const char*             //
+read_at(                       //
+    const uint8_t* index_ptr,  //
+    size_t index_len,          //
+    uint64_t offset,           //
+    size_t len) {
+  memset(buf, 0, len);
+  sflz4_size_result r = sflz4_frame_read_at_checkpoint(
+      buf, len, frame, frame_len, index_ptr, index_len, offset, workspace,
+      workspace_len);
+  if (!r.status_message) {
+    const size_t want = (offset >= DATA_LEN)
+                            ? 0
+                            : (size_t)(((DATA_LEN - offset) < len)
+                                           ? (DATA_LEN - offset)
+                                           : len);
+    CHECK((r.value == want) && !memcmp(buf, data + offset, want));
+  }
+  return r.status_message;
+}
+
+static void  //
+test_reads() {
+  static const uint32_t flags[] = {
+      SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS,
+      SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS |
+          SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS,
+      0,
+  };
+  static const uint64_t intervals[] = {1, 1000, BLOCK_LEN, 200000, DATA_LEN,
+                                       0xFFFFFFFFFFull};
+  for (size_t f = 0; f < (sizeof(flags) / sizeof(flags[0])); f++) {
+    make_frame(flags[f]);
+    for (size_t i = 0; i < (sizeof(intervals) / sizeof(intervals[0])); i++) {
+      const size_t index_len = build_index(intervals[i]);
+      // There is a checkpoint at the first block boundary (including the
+      // frame's start and end) at or after every interval decoded bytes.
+      const uint32_t num_checkpoints =
+          (uint32_t)index_buf[4] | ((uint32_t)index_buf[5] << 8);
+      uint32_t want = 0;
+      uint64_t next = 0;
+      for (uint64_t b = 0;; b += BLOCK_LEN) {
+        const uint64_t boundary = (b < DATA_LEN) ? b : DATA_LEN;
+        if (boundary >= next) {
+          want++;
+          next = boundary + intervals[i];
+        }
+        if (boundary == DATA_LEN) {
+          break;
+        }
+      }
+      CHECK(num_checkpoints == want);
+
+      uint32_t state = (uint32_t)(86 + i);
+      for (size_t j = 0; j < 50; j++) {
+        const uint64_t offset = test_rand(&state) % DATA_LEN;
+        const size_t len = 1 + (test_rand(&state) % (3 * BLOCK_LEN));
+        CHECK(!read_at(index_buf, index_len, offset, len));
+      }
+      CHECK(!read_at(index_buf, index_len, 0, DATA_LEN));
+      CHECK(!read_at(index_buf, index_len, DATA_LEN - 1, 100));
+      CHECK(!read_at(index_buf, index_len, DATA_LEN, 100));
+      CHECK(!read_at(index_buf, index_len, DATA_LEN + 1, 100));
+      CHECK(!read_at(index_buf, index_len, 0xFFFFFFFFFFFFull, 100));
+    }
+  }
+}
+
+static void  //
+test_corrupted_index() {
+  make_frame(SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS);
+  const size_t index_len = build_index(BLOCK_LEN);
+
+  // Corrupt the second checkpoint's snapshot. Reads that start from it fail
+  // and other reads are unaffected.
+  const size_t entry1 = 8 + 24 +
+                        ((size_t)index_buf[28] | ((size_t)index_buf[29] << 8) |
+                         ((size_t)index_buf[30] << 16)) +
+                        4;
+  const uint64_t decoded1 =
+      (uint64_t)index_buf[entry1 + 8] |
+      ((uint64_t)index_buf[entry1 + 9] << 8) |
+      ((uint64_t)index_buf[entry1 + 10] << 16);
+  CHECK(decoded1 == BLOCK_LEN);
+  memcpy(corrupted, index_buf, index_len);
+  corrupted[entry1 + 24] ^= 0x01;
+  CHECK(read_at(corrupted, index_len, decoded1 + 10, 10) ==
+        sflz4_status_message__error_bad_checksum);
+  CHECK(!read_at(corrupted, index_len, 10, 10));
+  CHECK(!read_at(corrupted, index_len, (2 * BLOCK_LEN) + 10, 10));
+
+  // Wrong magic, and an index too short for its header.
+  memcpy(corrupted, index_buf, index_len);
+  corrupted[0] ^= 0x01;
+  CHECK(read_at(corrupted, index_len, 10, 10) ==
+        sflz4_status_message__error_invalid_data);
+  CHECK(read_at(index_buf, 7, 10, 10) ==
+        sflz4_status_message__error_invalid_data);
+
+  // Truncating the index makes its later checkpoints unusable, but never
+  // makes a read return wrong content.
+  for (size_t n = 8; n < index_len; n += 97) {
+    CHECK(read_at(index_buf, n, DATA_LEN - 10, 10) != NULL);
+    read_at(index_buf, n, 10, 10);
+  }
+
+  // Flipping any one bit either fails the read or doesn't matter (as an
+  // earlier checkpoint is used instead). read_at checks the content.
+  uint32_t state = 86;
+  for (size_t i = 0; i < 2000; i++) {
+    memcpy(corrupted, index_buf, index_len);
+    const size_t pos = test_rand(&state) % index_len;
+    corrupted[pos] ^= (uint8_t)(1 << (test_rand(&state) & 7));
+    read_at(corrupted, index_len, test_rand(&state) % DATA_LEN, 1000);
+  }
+}
+
+static void  //
+test_bad_arguments() {
+  make_frame(SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS);
+  CHECK(sflz4_frame_checkpoints_worst_case_dst_len(DATA_LEN, 0)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_frame_build_checkpoints(index_buf, INDEX_MAX_LEN, frame,
+                                      frame_len, 0, workspace, workspace_len)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_frame_build_checkpoints(index_buf, INDEX_MAX_LEN, frame,
+                                      frame_len, BLOCK_LEN, workspace,
+                                      workspace_len - 1)
+            .status_message ==
+        sflz4_status_message__error_workspace_is_too_short);
+  CHECK(sflz4_frame_build_checkpoints(index_buf, 100, frame, frame_len,
+                                      BLOCK_LEN, workspace, workspace_len)
+            .status_message == sflz4_status_message__error_dst_is_too_short);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(data, DATA_LEN, 86);
+  test_reads();
+  test_corrupted_index();
+  test_bad_arguments();
+  free(workspace);
+  return test_finish("checkpoints_test");
+}
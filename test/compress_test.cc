@@ -0,0 +1,144 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// compress_test.cc tests the "C++20 Constexpr Interface" section of
+// src/sflz4.h. Most of its checks are static_assert's, which run when it is
+// compiled.
+//
+// $ g++ -std=c++20 -fsanitize=address,undefined test/compress_test.cc
+// $ ./a.out
+
+#include "test.h"
+
+// make_text returns N bytes of text-like data (compare test_make_data, which
+// isn't constexpr), mostly words from a small vocabulary with a random byte
+// one time in 64.
+template <size_t N>
+constexpr std::array<uint8_t, N>  //
+make_text() {
+  const char* words[8] = {"the ",   "quick ", "brown ", "fox ",
+                          "jumps ", "over ",  "lazy ",  "dog\n"};
+  std::array<uint8_t, N> a = {};
+  uint32_t state = 99;
+  for (size_t i = 0; i < N;) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    if ((state & 63) == 0) {
+      a[i++] = (uint8_t)(state >> 24);
+      continue;
+    }
+    for (const char* w = words[(state >> 8) & 7]; *w && (i < N); w++) {
+      a[i++] = (uint8_t)*w;
+    }
+  }
+  return a;
+}
+
+template <typename T>
+constexpr bool   //
+decodes_to(      //
+    const T& c,  //
+    const char* s) {
+  auto d = c.decode();
+  for (size_t i = 0; i < d.size(); i++) {
+    if (d[i] != (uint8_t)s[i]) {
+      return false;
+    }
+  }
+  return s[d.size()] == '\x00';
+}
+
+static constexpr auto hello =
+    sflz4::compress<"Hello, hello, hello, hello, hello world!">();
+static_assert(hello.decoded_len == 40);
+static_assert(hello.encoded_len < 30);
+static_assert(decodes_to(hello, "Hello, hello, hello, hello, hello world!"));
+
+static constexpr auto empty = sflz4::compress<"">();
+static_assert((empty.decoded_len == 0) && (empty.encoded_len == 1));
+
+// Inputs shorter than 13 bytes are all literals.
+static constexpr auto twelve = sflz4::compress<"aaaaaaaaaaaa">();
+static_assert(twelve.encoded_len == 13);
+static_assert(decodes_to(twelve, "aaaaaaaaaaaa"));
+
+static constexpr std::array<uint8_t, 1000> zeroes = {};
+static constexpr auto zeroes_c = sflz4::compress<zeroes>();
+static_assert(zeroes_c.encoded_len < 20);
+static_assert(zeroes_c.decode() == zeroes);
+
+static constexpr std::array<char, 5> chars = {'\xFF', '\x80', 'a', 'a', 'a'};
+static constexpr auto chars_c = sflz4::compress<chars>();
+static_assert((chars_c.decode()[0] == 0xFF) && (chars_c.decode()[1] == 0x80));
+
+static constexpr auto text = make_text<20000>();
+static constexpr auto text_c = sflz4::compress<text>();
+static_assert(text_c.encoded_len < ((text.size() * 3) / 5));
+static_assert(text_c.decode() == text);
+
+// check_run_time checks that c's encoding also decodes with the (run time)
+// sflz4_block_decode, that it is not much longer than sflz4_block_encode's
+// and that an sflz4_asset can wrap it.
+template <typename T, typename U>
+static void      //
+check_run_time(  //
+    const T& c,  //
+    const U& src) {
+  static uint8_t dst[65536];
+  sflz4_size_result r =
+      sflz4_block_decode(dst, sizeof(dst), c.encoded.data(), c.encoded_len);
+  CHECK(!r.status_message && (r.value == c.decoded_len) &&
+        !memcmp(dst, src.data(), c.decoded_len));
+
+  static uint8_t fast[65536 + 1024];
+  r = sflz4_block_encode(fast, sizeof(fast), (const uint8_t*)src.data(),
+                         src.size());
+  CHECK(!r.status_message && (c.encoded_len <= ((r.value * 5) / 4)));
+
+  static uint8_t asset_buf[65536];
+  sflz4_asset a = SFLZ4_ASSET_INITIALIZER(c.encoded.data(), c.encoded_len,
+                                          asset_buf, c.decoded_len);
+  r = sflz4_asset_decode(&a);
+  CHECK(!r.status_message && (r.value == c.decoded_len) &&
+        !memcmp(asset_buf, src.data(), c.decoded_len));
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  static constexpr std::array<char, 40> hello_src = {
+      'H', 'e', 'l', 'l', 'o', ',', ' ', 'h', 'e', 'l', 'l', 'o', ',', ' ',
+      'h', 'e', 'l', 'l', 'o', ',', ' ', 'h', 'e', 'l', 'l', 'o', ',', ' ',
+      'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd', '!'};
+  check_run_time(hello, hello_src);
+  check_run_time(zeroes_c, zeroes);
+  check_run_time(text_c, text);
+
+  // decode stays in bounds even if encoded was modified to be invalid.
+  auto modified = text_c;
+  uint32_t state = 99;
+  for (int k = 0; k < 1000; k++) {
+    uint32_t x = test_rand(&state);
+    modified.encoded[(x >> 3) % modified.encoded_len] ^=
+        (uint8_t)(1 << (x & 7));
+    (void)modified.decode();
+  }
+  return test_finish("compress_test");
+}
@@ -0,0 +1,162 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// crc32c_test.c tests the "CRC-32C" section of src/sflz4.h and its use as
+// the LZ4 Sparse Streams' SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C checksum.
+//
+// $ gcc -fsanitize=address,undefined test/crc32c_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 100000
+
+uint8_t data[DATA_LEN + 8];
+uint8_t enc[2 * DATA_LEN];
+uint8_t dec[DATA_LEN];
+
+// slow_crc32c is a bit-at-a-time reference implementation.
+static uint32_t        //
+slow_crc32c(           //
+    const uint8_t* p,  //
+    size_t n) {
+  uint32_t c = 0xFFFFFFFF;
+  for (; n > 0; n--) {
+    c ^= *p++;
+    for (int i = 0; i < 8; i++) {
+      c = (c >> 1) ^ (0x82F63B78 & (0u - (c & 1)));
+    }
+  }
+  return ~c;
+}
+
+static void  //
+test_known_values() {
+  static const uint8_t digits[9] = {'1', '2', '3', '4', '5', '6', '7', '8',
+                                    '9'};
+  uint8_t buf[32];
+  CHECK(sflz4_crc32c_update(0, digits, 9) == 0xE3069283);
+  CHECK(sflz4_crc32c_update(0, digits, 0) == 0);
+  // These are from RFC 3720 section B.4.
+  memset(buf, 0x00, 32);
+  CHECK(sflz4_crc32c_update(0, buf, 32) == 0x8A9136AA);
+  memset(buf, 0xFF, 32);
+  CHECK(sflz4_crc32c_update(0, buf, 32) == 0x62A8AB43);
+}
+
+// test_lengths compares against slow_crc32c, for lengths on both sides of
+// the hardware path's thresholds and at every alignment mod 8.
+static void  //
+test_lengths() {
+  static const size_t lens[] = {1,     7,     8,     9,     63,    64,
+                                4095,  4096,  12287, 12288, 12289, 24576,
+                                40000, 65537, DATA_LEN};
+  for (size_t i = 0; i < (sizeof(lens) / sizeof(lens[0])); i++) {
+    for (size_t align = 0; align < 8; align++) {
+      const uint8_t* p = data + align;
+      CHECK(sflz4_crc32c_update(0, p, lens[i]) == slow_crc32c(p, lens[i]));
+    }
+  }
+}
+
+static void  //
+test_incremental() {
+  const uint32_t want = slow_crc32c(data, DATA_LEN);
+  uint32_t state = 7;
+  for (int k = 0; k < 50; k++) {
+    uint32_t crc = 0;
+    size_t i = 0;
+    while (i < DATA_LEN) {
+      size_t n = test_rand(&state) % 20000;
+      n = (n < (DATA_LEN - i)) ? n : (DATA_LEN - i);
+      crc = sflz4_crc32c_update(crc, data + i, n);
+      i += n;
+    }
+    CHECK(crc == want);
+  }
+}
+
+// test_sparse_crc32c round-trips a sparse stream that mixes xxHash-32 and
+// CRC-32C records, then checks that corruption is caught either way.
+static void  //
+test_sparse_crc32c() {
+  memset(data + 20000, 0, 3 * SFLZ4_SPARSE_ZERO_CHUNK_LEN);
+  size_t n = 0;
+  sflz4_size_result r = sflz4_sparse_encode_data(
+      enc + n, sizeof(enc) - n, data, DATA_LEN / 2,
+      SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C);
+  CHECK(!r.status_message);
+  n += r.value;
+  r = sflz4_sparse_encode_hole(enc + n, sizeof(enc) - n, 12345,
+                               SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C);
+  CHECK(!r.status_message);
+  n += r.value;
+  r = sflz4_sparse_encode_data(enc + n, sizeof(enc) - n, data + (DATA_LEN / 2),
+                               DATA_LEN / 2, 0);
+  CHECK(!r.status_message);
+  n += r.value;
+  const size_t enc_len = n;
+
+  size_t pos = 0;
+  size_t dec_len = 0;
+  uint64_t total_holes = 0;
+  while (pos < enc_len) {
+    uint64_t hole_len = 0;
+    r = sflz4_sparse_decode_record(dec + dec_len, sizeof(dec) - dec_len,
+                                   enc + pos, enc_len - pos, &hole_len);
+    CHECK(!r.status_message);
+    if (r.status_message) {
+      return;
+    }
+    if (hole_len == 12345) {
+      total_holes += hole_len;
+    } else {
+      memset(dec + dec_len, 0, (size_t)hole_len);
+      dec_len += (size_t)hole_len;
+    }
+    dec_len += r.value;
+    pos += sflz4_sparse_record_len(enc + pos, enc_len - pos).value;
+  }
+  CHECK((pos == enc_len) && (total_holes == 12345) &&
+        (dec_len == DATA_LEN) && !memcmp(dec, data, DATA_LEN));
+
+  // Every bit flip in the first (CRC-32C) record must be caught, unless it
+  // only changes a match offset to another one that copies the same bytes.
+  const size_t first_len = sflz4_sparse_record_len(enc, enc_len).value;
+  uint32_t state = 11;
+  for (int k = 0; k < 500; k++) {
+    uint32_t x = test_rand(&state);
+    const size_t i = (x >> 3) % first_len;
+    enc[i] ^= (uint8_t)(1 << (x & 7));
+    uint64_t hole_len = 0;
+    r = sflz4_sparse_decode_record(dec, sizeof(dec), enc, enc_len, &hole_len);
+    CHECK(r.status_message || !memcmp(dec, data, r.value));
+    enc[i] ^= (uint8_t)(1 << (x & 7));
+  }
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(data, sizeof(data), 50);
+  test_known_values();
+  test_lengths();
+  test_incremental();
+  test_sparse_crc32c();
+  return test_finish("crc32c_test");
+}
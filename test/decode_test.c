@@ -0,0 +1,284 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// decode_test.c tests the "LZ4 Decode" section of src/sflz4.h, in particular
+// sflz4_block_decode_growing.
+//
+// $ gcc -fsanitize=address,undefined test/decode_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 200000
+
+uint8_t text[DATA_LEN];
+uint8_t noise[DATA_LEN];
+uint8_t encoded[DATA_LEN + (DATA_LEN / 255) + 16];
+
+// tiny is a hand-written block: 4 literals ("abcd"), a 16 byte match at
+// offset 4 and then 5 final literals ("efghi"). Starting with a 1 byte buffer
+// grows it part-way through the first literals. Starting with a 7 byte
+// buffer grows it part-way through the match.
+static const uint8_t tiny[] = {
+    0x4C, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x50, 'e', 'f', 'g', 'h', 'i',
+};
+static const char tiny_decoded[] = "abcdabcdabcdabcdabcdefghi";
+#define TINY_DECODED_LEN (sizeof(tiny_decoded) - 1)
+
+// allocator is a sflz4_realloc_func context. It fails every call after its
+// first num_successes calls, and it remembers the last buffer it returned.
+typedef struct {
+  size_t num_calls;
+  size_t num_successes;
+  void* last_ptr;
+  size_t last_len;
+} allocator;
+
+static void*         //
+test_realloc(        //
+    void* context,   //
+    void* ptr,       //
+    size_t old_len,  //
+    size_t new_len) {
+  allocator* a = (allocator*)context;
+  CHECK((ptr == a->last_ptr) && (old_len == a->last_len) &&
+        (new_len > old_len));
+  if (a->num_calls++ >= a->num_successes) {
+    return NULL;
+  }
+  void* p = realloc(ptr, new_len);
+  if (p) {
+    a->last_ptr = p;
+    a->last_len = new_len;
+  }
+  return p;
+}
+
+// start allocates a len byte buffer (NULL for zero) for a to grow.
+static void                //
+start(                     //
+    allocator* a,          //
+    size_t num_successes,  //
+    uint8_t** ptr,         //
+    size_t* len,           //
+    size_t initial_len) {
+  a->num_calls = 0;
+  a->num_successes = num_successes;
+  a->last_ptr = initial_len ? malloc(initial_len) : NULL;
+  a->last_len = initial_len;
+  *ptr = (uint8_t*)a->last_ptr;
+  *len = initial_len;
+}
+
+// round_trip decodes src through a buffer that starts initial_len bytes
+// long, checking that it decodes to want.
+static void               //
+round_trip(               //
+    const uint8_t* src,   //
+    size_t src_len,       //
+    const uint8_t* want,  //
+    size_t want_len,      //
+    size_t initial_len) {
+  allocator a;
+  uint8_t* ptr;
+  size_t len;
+  const size_t max_len = want_len + initial_len + 1000;
+  start(&a, (size_t)-1, &ptr, &len, initial_len);
+  sflz4_size_result r = sflz4_block_decode_growing(
+      &ptr, &len, max_len, src, src_len, &test_realloc, &a);
+  CHECK(!r.status_message && (r.value == want_len) &&
+        !memcmp(ptr, want, want_len));
+  CHECK((ptr == a.last_ptr) && (len == a.last_len) && (len >= want_len) &&
+        (len <= max_len));
+  if (initial_len < want_len) {
+    CHECK(a.num_calls > 0);
+  }
+  free(ptr);
+}
+
+static void  //
+test_round_trips() {
+  static const size_t initial_lens[] = {0, 1, 7, 100, 4096};
+  for (size_t i = 0; i < (sizeof(initial_lens) / sizeof(initial_lens[0]));
+       i++) {
+    round_trip(tiny, sizeof(tiny), (const uint8_t*)tiny_decoded,
+               TINY_DECODED_LEN, initial_lens[i]);
+    for (size_t j = 0; j < 2; j++) {
+      const uint8_t* data = j ? noise : text;
+      sflz4_size_result r =
+          sflz4_block_encode(encoded, sizeof(encoded), data, DATA_LEN);
+      CHECK(!r.status_message);
+      round_trip(encoded, r.value, data, DATA_LEN, initial_lens[i]);
+    }
+  }
+  // A buffer that is already long enough isn't grown.
+  round_trip(tiny, sizeof(tiny), (const uint8_t*)tiny_decoded,
+             TINY_DECODED_LEN, TINY_DECODED_LEN);
+}
+
+static void  //
+test_dst_max_len() {
+  sflz4_size_result r =
+      sflz4_block_encode(encoded, sizeof(encoded), text, DATA_LEN);
+  CHECK(!r.status_message);
+  const size_t encoded_len = r.value;
+
+  static const size_t initial_lens[] = {0, 1, 7};
+  static const size_t max_lens[] = {1, 7, 8, 1000, DATA_LEN - 1};
+  for (size_t i = 0; i < (sizeof(initial_lens) / sizeof(initial_lens[0]));
+       i++) {
+    for (size_t j = 0; j < (sizeof(max_lens) / sizeof(max_lens[0])); j++) {
+      if (initial_lens[i] > max_lens[j]) {
+        continue;
+      }
+      allocator a;
+      uint8_t* ptr;
+      size_t len;
+      start(&a, (size_t)-1, &ptr, &len, initial_lens[i]);
+      r = sflz4_block_decode_growing(&ptr, &len, max_lens[j], encoded,
+                                     encoded_len, &test_realloc, &a);
+      CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+      CHECK((ptr == a.last_ptr) && (len == a.last_len) &&
+            (len <= max_lens[j]));
+      free(ptr);
+    }
+  }
+
+  // The tiny block decodes to exactly TINY_DECODED_LEN bytes, which fits.
+  for (size_t initial_len = 0; initial_len < 8; initial_len += 7) {
+    allocator a;
+    uint8_t* ptr;
+    size_t len;
+    start(&a, (size_t)-1, &ptr, &len, initial_len);
+    r = sflz4_block_decode_growing(&ptr, &len, TINY_DECODED_LEN, tiny,
+                                   sizeof(tiny), &test_realloc, &a);
+    CHECK(!r.status_message && (r.value == TINY_DECODED_LEN) &&
+          (len == TINY_DECODED_LEN) &&
+          !memcmp(ptr, tiny_decoded, TINY_DECODED_LEN));
+    free(ptr);
+    start(&a, (size_t)-1, &ptr, &len, initial_len);
+    r = sflz4_block_decode_growing(&ptr, &len, TINY_DECODED_LEN - 1, tiny,
+                                   sizeof(tiny), &test_realloc, &a);
+    CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+    CHECK((ptr == a.last_ptr) && (len == a.last_len) &&
+          (len <= (TINY_DECODED_LEN - 1)));
+    free(ptr);
+  }
+}
+
+static void  //
+test_realloc_failure() {
+  sflz4_size_result r =
+      sflz4_block_encode(encoded, sizeof(encoded), text, DATA_LEN);
+  CHECK(!r.status_message);
+  const size_t encoded_len = r.value;
+
+  // When realloc_func fails, the buffer it last returned (or the initial
+  // buffer, if it never succeeded) is handed back, as is, for the caller to
+  // free. Its decoded prefix is intact. An empty initial buffer starts at
+  // (4 * encoded_len) bytes, which may need no further growth.
+  static const size_t initial_lens[] = {0, 1, 7};
+  for (size_t i = 0; i < (sizeof(initial_lens) / sizeof(initial_lens[0]));
+       i++) {
+    for (size_t num_successes = 0; num_successes < 4; num_successes++) {
+      allocator a;
+      uint8_t* ptr;
+      size_t len;
+      start(&a, num_successes, &ptr, &len, initial_lens[i]);
+      uint8_t* const initial_ptr = ptr;
+      r = sflz4_block_decode_growing(&ptr, &len, DATA_LEN, encoded,
+                                     encoded_len, &test_realloc, &a);
+      CHECK((ptr == a.last_ptr) && (len == a.last_len));
+      if (a.num_calls <= num_successes) {
+        CHECK(!r.status_message && (r.value == DATA_LEN) &&
+              !memcmp(ptr, text, DATA_LEN));
+        free(ptr);
+        continue;
+      }
+      CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+      if (num_successes == 0) {
+        CHECK((ptr == initial_ptr) && (len == initial_lens[i]));
+      } else if (len > 0) {
+        CHECK(ptr[0] == text[0]);
+      }
+      free(ptr);
+    }
+
+    // The same, for a failure part-way through the tiny block's literals
+    // (from 1 byte) or match (from 7 bytes).
+    allocator a;
+    uint8_t* ptr;
+    size_t len;
+    start(&a, 0, &ptr, &len, initial_lens[i]);
+    uint8_t* const initial_ptr = ptr;
+    if (initial_lens[i] == 7) {
+      memset(ptr, 0, 7);
+    }
+    r = sflz4_block_decode_growing(&ptr, &len, 1000, tiny, sizeof(tiny),
+                                   &test_realloc, &a);
+    CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+    CHECK((ptr == initial_ptr) && (len == initial_lens[i]) &&
+          (a.num_calls == 1));
+    if (initial_lens[i] == 7) {
+      CHECK(!memcmp(ptr, tiny_decoded, 4));
+    }
+    free(ptr);
+  }
+}
+
+static void  //
+test_bad_arguments() {
+  allocator a;
+  uint8_t* ptr;
+  size_t len;
+  start(&a, (size_t)-1, &ptr, &len, 7);
+  CHECK(sflz4_block_decode_growing(&ptr, &len, 6, tiny, sizeof(tiny),
+                                   &test_realloc, &a)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_block_decode_growing(&ptr, &len, 1000, tiny, sizeof(tiny), NULL,
+                                   &a)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_block_decode_growing(NULL, &len, 1000, tiny, sizeof(tiny),
+                                   &test_realloc, &a)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK((ptr == a.last_ptr) && (len == 7) && (a.num_calls == 0));
+  free(ptr);
+
+  // Truncated input fails as invalid data, still returning the buffer.
+  start(&a, (size_t)-1, &ptr, &len, 0);
+  CHECK(sflz4_block_decode_growing(&ptr, &len, 1000, tiny, 6, &test_realloc,
+                                   &a)
+            .status_message == sflz4_status_message__error_invalid_data);
+  CHECK((ptr == a.last_ptr) && (len == a.last_len));
+  free(ptr);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(text, DATA_LEN, 96);
+  uint32_t state = 96;
+  for (size_t i = 0; i < DATA_LEN; i++) {
+    noise[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  test_round_trips();
+  test_dst_max_len();
+  test_realloc_failure();
+  test_bad_arguments();
+  return test_finish("decode_test");
+}
@@ -0,0 +1,147 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// delta_test.c tests the "LZ4 Delta" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/delta_test.c && ./a.out
+
+#include "test.h"
+
+#define REF_LEN 1000000
+#define NEW_MAX_LEN (REF_LEN + 100000)
+
+uint8_t ref[REF_LEN];
+uint8_t new_version[NEW_MAX_LEN];
+size_t new_len;
+uint8_t dec[NEW_MAX_LEN];
+
+// make_new_version edits ref: it swaps two distant chunks (further apart
+// than LZ4's 64 KiB window), deletes some bytes, inserts fresh ones and
+// overwrites a few single bytes.
+static void  //
+make_new_version() {
+  uint32_t state = 90;
+  for (size_t i = 0; i < REF_LEN; i++) {
+    ref[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  size_t n = 0;
+  memcpy(new_version + n, ref + 700000, 200000);
+  n += 200000;
+  memcpy(new_version + n, ref + 200000, 300000);
+  n += 300000;
+  test_make_data(new_version + n, 50000, 91);
+  n += 50000;
+  memcpy(new_version + n, ref + 520000, 180000);
+  n += 180000;
+  memcpy(new_version + n, ref, 200000);
+  n += 200000;
+  for (size_t i = 0; i < 50; i++) {
+    new_version[(test_rand(&state) % n)] ^= 0x55;
+  }
+  new_len = n;
+}
+
+static size_t                //
+encode(                      //
+    uint8_t* dst_ptr,        //
+    size_t dst_len,          //
+    const uint8_t* ref_ptr,  //
+    size_t ref_len,          //
+    const uint8_t* new_ptr,  //
+    size_t new_len) {
+  sflz4_size_result wl = sflz4_delta_encode_workspace_len(ref_len, new_len);
+  CHECK(!wl.status_message);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value ? wl.value : 1);
+  sflz4_size_result r =
+      sflz4_delta_encode(dst_ptr, dst_len, ref_ptr, ref_len, new_ptr, new_len,
+                         workspace, wl.value);
+  CHECK(!r.status_message);
+  free(workspace);
+  return r.value;
+}
+
+static void  //
+test_round_trip() {
+  const size_t patch_cap = sflz4_delta_encode_worst_case_dst_len(new_len).value;
+  uint8_t* patch = (uint8_t*)malloc(patch_cap);
+  const size_t patch_len =
+      encode(patch, patch_cap, ref, REF_LEN, new_version, new_len);
+  // The reference is random, so only the copies make the patch small.
+  CHECK(patch_len < (new_len / 10));
+
+  sflz4_size_result r = sflz4_delta_decoded_len(patch, patch_len);
+  CHECK(!r.status_message && (r.value == new_len));
+  r = sflz4_delta_apply(dec, new_len, ref, REF_LEN, patch, patch_len);
+  CHECK(!r.status_message && (r.value == new_len) &&
+        !memcmp(dec, new_version, new_len));
+  r = sflz4_delta_apply(dec, new_len - 1, ref, REF_LEN, patch, patch_len);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+
+  // The wrong reference.
+  ref[12345] ^= 1;
+  r = sflz4_delta_apply(dec, new_len, ref, REF_LEN, patch, patch_len);
+  CHECK(r.status_message == sflz4_status_message__error_bad_checksum);
+  ref[12345] ^= 1;
+  r = sflz4_delta_apply(dec, new_len, ref, REF_LEN - 1, patch, patch_len);
+  CHECK(r.status_message);
+
+  // Corrupt and truncated patches either fail or, thanks to the new
+  // version's checksum, produce exactly the new version.
+  uint8_t* c = (uint8_t*)malloc(patch_len);
+  uint32_t state = 92;
+  for (int k = 0; k < 500; k++) {
+    memcpy(c, patch, patch_len);
+    uint32_t x = test_rand(&state);
+    c[(x >> 3) % patch_len] ^= (uint8_t)(1 << (x & 7));
+    r = sflz4_delta_apply(dec, new_len, ref, REF_LEN, c, patch_len);
+    CHECK(r.status_message ||
+          ((r.value == new_len) && !memcmp(dec, new_version, new_len)));
+    r = sflz4_delta_apply(dec, new_len, ref, REF_LEN, patch,
+                          (x >> 3) % patch_len);
+    CHECK(r.status_message);
+  }
+  free(c);
+  free(patch);
+}
+
+static void  //
+test_edge_cases() {
+  uint8_t patch[1024];
+  uint8_t one = 0;
+  // An empty reference, an empty new version and both.
+  const size_t lens[3][2] = {{0, 100}, {100, 0}, {0, 0}};
+  for (int i = 0; i < 3; i++) {
+    const size_t a = lens[i][0];
+    const size_t b = lens[i][1];
+    const size_t n = encode(patch, sizeof(patch), ref, a, new_version, b);
+    sflz4_size_result r =
+        sflz4_delta_apply(b ? dec : &one, b, ref, a, patch, n);
+    CHECK(!r.status_message && (r.value == b) &&
+          !memcmp(dec, new_version, b));
+  }
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  make_new_version();
+  test_round_trip();
+  test_edge_cases();
+  return test_finish("delta_test");
+}
@@ -0,0 +1,214 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// dictionary_builder_test.c tests the "LZ4 Dictionary Builder" section of
+// src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/dictionary_builder_test.c && ./a.out
+
+#include "test.h"
+
+#define SAMPLES_LEN (4 * SFLZ4_DICTIONARY_MAX_INCL_LEN)
+#define SAMPLE_MAX_LEN 1024
+#define NUM_DICTIONARIES 4
+
+uint8_t sample[SAMPLE_MAX_LEN];
+uint8_t frame[2 * SAMPLE_MAX_LEN];
+uint8_t decoded[SAMPLE_MAX_LEN];
+uint8_t d_bufs[NUM_DICTIONARIES][SFLZ4_DICTIONARY_MAX_INCL_LEN];
+sflz4_dictionary dictionaries[NUM_DICTIONARIES];
+
+// make_sample writes a JSON-like message to sample, returning its length.
+// Messages of the same schema share their field names and much of their
+// values, as real messages do, but differ in their details.
+static size_t                   //
+make_sample(                    //
+    const char* const* schema,  //
+    uint32_t* state) {
+  size_t n = 0;
+  sample[n++] = '{';
+  for (size_t i = 0; schema[i]; i++) {
+    n += (size_t)snprintf((char*)sample + n, SAMPLE_MAX_LEN - n,
+                          "\"%s\":\"%s-%u\",", schema[i], schema[i] + 1,
+                          (unsigned)(test_rand(state) % 1000));
+  }
+  sample[n - 1] = '}';
+  return n;
+}
+
+static const char* const schema_a[] = {
+    "account_identifier", "billing_address_line", "customer_loyalty_tier",
+    "delivery_window_start", "estimated_arrival_time", "fulfillment_center",
+    "gift_wrapping_requested", NULL,
+};
+
+static const char* const schema_b[] = {
+    "sensor_calibration_offset", "telemetry_sampling_period",
+    "ultraviolet_index_reading", "voltage_regulator_status",
+    "wind_direction_degrees", "xenon_lamp_hours_used",
+    "yaw_rate_gyroscope_axis", NULL,
+};
+
+static void                       //
+add_samples(                      //
+    sflz4_dictionary_builder* b,  //
+    const char* const* schema,    //
+    size_t num_samples,           //
+    uint32_t seed) {
+  for (size_t i = 0; i < num_samples; i++) {
+    sflz4_dictionary_builder_add_sample(b, sample,
+                                        make_sample(schema, &seed));
+  }
+}
+
+// check_round_trip encodes a fresh sample of the schema as a frame with the
+// builder's current dictionary, checking that the frame records want_id as
+// its Dict-ID and that it decodes through the registry.
+static void                                     //
+check_round_trip(                               //
+    sflz4_dictionary_builder* b,                //
+    const sflz4_dictionary_registry* registry,  //
+    const char* const* schema,                  //
+    uint32_t want_id) {
+  uint32_t seed = 88;
+  const size_t n = make_sample(schema, &seed);
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.dictionary = sflz4_dictionary_builder_current(b);
+  CHECK(options.dictionary &&
+        (sflz4_dictionary_registry_find(registry, want_id) ==
+         options.dictionary));
+  sflz4_size_result r =
+      sflz4_frame_encode(frame, sizeof(frame), sample, n, &options);
+  CHECK(!r.status_message);
+  // The Dict-ID follows the 4 byte magic and the FLG and BD bytes.
+  const uint32_t dict_id =
+      (uint32_t)frame[6] | ((uint32_t)frame[7] << 8) |
+      ((uint32_t)frame[8] << 16) | ((uint32_t)frame[9] << 24);
+  CHECK(dict_id == want_id);
+  sflz4_size_result d = sflz4_frame_decode_with_dictionaries(
+      decoded, sizeof(decoded), frame, r.value, registry);
+  CHECK(!d.status_message && (d.value == n) && !memcmp(decoded, sample, n));
+  // Without the registry, the frame can't be decoded.
+  CHECK(sflz4_frame_decode(decoded, sizeof(decoded), frame, r.value)
+            .status_message);
+}
+
+static void  //
+test_refresh() {
+  sflz4_size_result wl = sflz4_dictionary_builder_workspace_len(SAMPLES_LEN);
+  CHECK(!wl.status_message);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value);
+  sflz4_dictionary_builder b;
+  CHECK(sflz4_dictionary_builder_initialize(&b, workspace, wl.value - 1,
+                                            SAMPLES_LEN, NULL) ==
+        sflz4_status_message__error_workspace_is_too_short);
+  CHECK(!sflz4_dictionary_builder_initialize(&b, workspace, wl.value,
+                                             SAMPLES_LEN, NULL));
+  CHECK(!sflz4_dictionary_builder_current(&b));
+
+  const sflz4_dictionary* entries[NUM_DICTIONARIES];
+  sflz4_dictionary_registry registry;
+  sflz4_dictionary_registry_initialize(&registry, entries, NUM_DICTIONARIES);
+
+  // Too few samples to train on.
+  add_samples(&b, schema_a, 10, 1);
+  sflz4_size_result r = sflz4_dictionary_builder_refresh(
+      &b, &dictionaries[0], d_bufs[0], 1, &registry);
+  CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+
+  // Any trained dictionary beats no dictionary on small messages.
+  add_samples(&b, schema_a, 3000, 2);
+  r = sflz4_dictionary_builder_refresh(&b, &dictionaries[0], d_bufs[0], 1,
+                                       &registry);
+  CHECK(!r.status_message && (r.value == 1));
+  CHECK(sflz4_dictionary_builder_current(&b) == &dictionaries[0]);
+  check_round_trip(&b, &registry, schema_a, 1);
+
+  // Refreshing again, without new samples, trains the same dictionary. As it
+  // isn't better than the current one, it isn't published and the Dict-ID
+  // stays the same.
+  r = sflz4_dictionary_builder_refresh(&b, &dictionaries[1], d_bufs[1], 2,
+                                       &registry);
+  CHECK(!r.status_message && (r.value == 0));
+  CHECK(sflz4_dictionary_builder_current(&b) == &dictionaries[0]);
+  CHECK(!sflz4_dictionary_registry_find(&registry, 2));
+  check_round_trip(&b, &registry, schema_a, 1);
+
+  // The data drifts to another schema, which the current dictionary
+  // doesn't know, so the next candidate is published under a new Dict-ID.
+  add_samples(&b, schema_b, 6000, 4);
+  r = sflz4_dictionary_builder_refresh(&b, &dictionaries[1], d_bufs[1], 2,
+                                       &registry);
+  CHECK(!r.status_message && (r.value == 1));
+  CHECK(sflz4_dictionary_builder_current(&b) == &dictionaries[1]);
+  check_round_trip(&b, &registry, schema_b, 2);
+
+  // Frames made with the older dictionary still decode.
+  CHECK(sflz4_dictionary_registry_find(&registry, 1) == &dictionaries[0]);
+
+  // Publishing fails if the registry already has the candidate's id.
+  add_samples(&b, schema_a, 6000, 5);
+  r = sflz4_dictionary_builder_refresh(&b, &dictionaries[2], d_bufs[2], 1,
+                                       &registry);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_dictionary_builder_current(&b) == &dictionaries[1]);
+
+  free(workspace);
+}
+
+static void  //
+test_initial_dictionary() {
+  // A builder that starts with a dictionary only replaces it with a better
+  // one, which a dictionary trained on the same samples is not.
+  sflz4_size_result wl = sflz4_dictionary_builder_workspace_len(SAMPLES_LEN);
+  CHECK(!wl.status_message);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value);
+  sflz4_dictionary_builder b;
+  CHECK(!sflz4_dictionary_builder_initialize(&b, workspace, wl.value,
+                                             SAMPLES_LEN, NULL));
+  add_samples(&b, schema_a, 3000, 6);
+  sflz4_size_result r = sflz4_dictionary_builder_refresh(
+      &b, &dictionaries[3], d_bufs[3], 7, NULL);
+  CHECK(!r.status_message && (r.value == 1));
+
+  CHECK(!sflz4_dictionary_builder_initialize(&b, workspace, wl.value,
+                                             SAMPLES_LEN, &dictionaries[3]));
+  add_samples(&b, schema_a, 3000, 6);
+  r = sflz4_dictionary_builder_refresh(&b, &dictionaries[2], d_bufs[2], 8,
+                                       NULL);
+  CHECK(!r.status_message && (r.value == 0));
+  CHECK(sflz4_dictionary_builder_current(&b) == &dictionaries[3]);
+  free(workspace);
+}
+
+static void  //
+test_bad_arguments() {
+  CHECK(sflz4_dictionary_builder_workspace_len(SAMPLES_LEN - 1)
+            .status_message == sflz4_status_message__error_bad_argument);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_refresh();
+  test_initial_dictionary();
+  test_bad_arguments();
+  return test_finish("dictionary_builder_test");
+}
@@ -0,0 +1,143 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// dictionary_test.c tests the "LZ4 Dictionaries" section of src/sflz4.h,
+// along with plain (dictionary-less) block and frame encoding.
+//
+// $ gcc -fsanitize=address,undefined test/dictionary_test.c && ./a.out
+
+#include "test.h"
+
+#define SRC_MAX_LEN 100000
+
+uint8_t src[SRC_MAX_LEN];
+uint8_t enc[SRC_MAX_LEN + (SRC_MAX_LEN / 128) + 1024];
+uint8_t dec[SRC_MAX_LEN];
+
+static const size_t src_lens[] = {1, 2, 4, 12, 13, 20, 100, 4096, SRC_MAX_LEN};
+
+#define NUM_SRC_LENS (sizeof(src_lens) / sizeof(src_lens[0]))
+
+static void  //
+test_block_round_trip() {
+  test_make_data(src, SRC_MAX_LEN, 10);
+  for (size_t i = 0; i < NUM_SRC_LENS; i++) {
+    const size_t n = src_lens[i];
+    sflz4_size_result e = sflz4_block_encode(enc, sizeof(enc), src, n);
+    CHECK(!e.status_message);
+    if (e.status_message) {
+      continue;
+    }
+    sflz4_size_result d = sflz4_block_decode(dec, n, enc, e.value);
+    CHECK(!d.status_message && (d.value == n) && !memcmp(dec, src, n));
+    if (n > 0) {
+      d = sflz4_block_decode(dec, n - 1, enc, e.value);
+      CHECK(d.status_message);
+    }
+  }
+}
+
+// test_dictionary_round_trip encodes with a dictionary of dict_len bytes,
+// each copied into an exactly sized allocation so that the address
+// sanitizer catches any read past its end.
+static void                  //
+test_dictionary_round_trip(  //
+    size_t dict_len) {
+  uint8_t* dict = (uint8_t*)malloc(dict_len ? dict_len : 1);
+  test_make_data(dict, dict_len, 20);
+  sflz4_dictionary* d = (sflz4_dictionary*)malloc(sizeof(sflz4_dictionary));
+  CHECK(!sflz4_dictionary_initialize(d, 0x1234, dict, dict_len));
+
+  for (size_t i = 0; i < NUM_SRC_LENS; i++) {
+    const size_t n = src_lens[i];
+    sflz4_size_result e =
+        sflz4_block_encode_with_dictionary(enc, sizeof(enc), src, n, d);
+    CHECK(!e.status_message);
+    if (e.status_message) {
+      continue;
+    }
+    sflz4_size_result r =
+        sflz4_block_decode_with_dictionary(dec, n, enc, e.value, d);
+    CHECK(!r.status_message && (r.value == n) && !memcmp(dec, src, n));
+
+    // Bit flips must fail cleanly or decode to something, without reading
+    // outside of the dictionary or enc.
+    uint32_t state = (uint32_t)(dict_len + 1);
+    for (int k = 0; (k < 50) && (e.value > 0); k++) {
+      uint8_t* c = (uint8_t*)malloc(e.value);
+      memcpy(c, enc, e.value);
+      uint32_t x = test_rand(&state);
+      c[(x >> 3) % e.value] ^= (uint8_t)(1 << (x & 7));
+      sflz4_block_decode_with_dictionary(dec, n, c, e.value, d);
+      free(c);
+    }
+  }
+
+  // The frame encoder, with the dictionary's id in the frame header.
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.flags = SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_CHECKSUM;
+  options.dictionary = d;
+  uint8_t* frame = (uint8_t*)malloc(2 * SRC_MAX_LEN);
+  sflz4_size_result e =
+      sflz4_frame_encode(frame, 2 * SRC_MAX_LEN, src, 5000, &options);
+  CHECK(!e.status_message);
+  const sflz4_dictionary* entries[1];
+  sflz4_dictionary_registry registry;
+  sflz4_dictionary_registry_initialize(&registry, entries, 1);
+  sflz4_size_result r = sflz4_frame_decode_with_dictionaries(
+      dec, sizeof(dec), frame, e.value, &registry);
+  CHECK(r.status_message == sflz4_status_message__error_unsupported_feature);
+  CHECK(!sflz4_dictionary_registry_add(&registry, d));
+  r = sflz4_frame_decode_with_dictionaries(dec, sizeof(dec), frame, e.value,
+                                           &registry);
+  CHECK(!r.status_message && (r.value == 5000) && !memcmp(dec, src, 5000));
+  free(frame);
+
+  free(d);
+  free(dict);
+}
+
+// test_dictionary_helps checks that a dictionary holding the data's
+// vocabulary shrinks a short input.
+static void  //
+test_dictionary_helps() {
+  uint8_t dict[4096];
+  test_make_data(dict, sizeof(dict), 30);
+  sflz4_dictionary d;
+  CHECK(!sflz4_dictionary_initialize(&d, 1, dict, sizeof(dict)));
+  sflz4_size_result plain = sflz4_block_encode(enc, sizeof(enc), src, 200);
+  sflz4_size_result with =
+      sflz4_block_encode_with_dictionary(enc, sizeof(enc), src, 200, &d);
+  CHECK(!plain.status_message && !with.status_message &&
+        (with.value < plain.value));
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_block_round_trip();
+  for (size_t dict_len = 0; dict_len <= 4; dict_len++) {
+    test_dictionary_round_trip(dict_len);
+  }
+  test_dictionary_round_trip(1000);
+  test_dictionary_round_trip(SFLZ4_DICTIONARY_MAX_INCL_LEN + 5);
+  test_dictionary_helps();
+  return test_finish("dictionary_test");
+}
@@ -0,0 +1,139 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// frame_test.c tests the "LZ4 Frame" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/frame_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 3000000
+
+uint8_t text[DATA_LEN];
+uint8_t noise[DATA_LEN];
+uint8_t dec[DATA_LEN];
+
+static void  //
+test_round_trip() {
+  static const size_t block_max_lens[] = {0, 0x10000, 0x40000, 0x100000,
+                                          0x400000};
+  static const size_t src_lens[] = {0, 1, 1000, 0x10000, 0x10001, 300000};
+  const size_t enc_len =
+      sflz4_frame_encode_worst_case_dst_len(DATA_LEN).value;
+  uint8_t* enc = (uint8_t*)malloc(enc_len);
+  for (size_t b = 0; b < 5; b++) {
+    for (uint32_t flags = 0; flags < 0x20; flags++) {
+      for (size_t i = 0; i < (sizeof(src_lens) / sizeof(src_lens[0])); i++) {
+        const size_t n = src_lens[i];
+        sflz4_frame_encode_options options;
+        memset(&options, 0, sizeof(options));
+        options.block_max_len = block_max_lens[b];
+        options.flags = flags;
+        options.num_threads = 4;
+        sflz4_size_result e =
+            sflz4_frame_encode(enc, enc_len, text, n, &options);
+        CHECK(!e.status_message);
+        sflz4_size_result d = sflz4_frame_decode(dec, n, enc, e.value);
+        CHECK(!d.status_message && (d.value == n) && !memcmp(dec, text, n));
+      }
+    }
+  }
+  free(enc);
+}
+
+static void  //
+test_corrupt_input() {
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.block_max_len = 0x10000;
+  options.flags = SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS |
+                  SFLZ4_FRAME_ENCODE_FLAGS__CONTENT_CHECKSUM;
+  const size_t n = 200000;
+  const size_t enc_len = sflz4_frame_encode_worst_case_dst_len(n).value;
+  uint8_t* enc = (uint8_t*)malloc(enc_len);
+  sflz4_size_result e = sflz4_frame_encode(enc, enc_len, text, n, &options);
+  CHECK(!e.status_message);
+  uint8_t* c = (uint8_t*)malloc(e.value);
+  uint32_t state = 60;
+  for (int k = 0; k < 500; k++) {
+    memcpy(c, enc, e.value);
+    uint32_t x = test_rand(&state);
+    c[(x >> 3) % e.value] ^= (uint8_t)(1 << (x & 7));
+    sflz4_size_result d = sflz4_frame_decode(dec, n, c, e.value);
+    CHECK(d.status_message || !memcmp(dec, text, n));
+    d = sflz4_frame_decode(dec, n, enc, (x >> 3) % e.value);
+    CHECK(d.status_message);
+  }
+  free(c);
+  free(enc);
+}
+
+// check_auto_block_max_len checks, for several thread counts, that
+// sflz4_frame_auto_block_max_len picks the largest block length that gives
+// every thread at least N blocks.
+static void                  //
+check_auto_block_max_len(    //
+    const uint8_t* src_ptr,  //
+    size_t src_len) {
+  const size_t estimate =
+      sflz4_block_estimate_encoded_len(src_ptr, src_len).value;
+  size_t min_blocks_per_thread = 2;
+  if (estimate <= (src_len / 2)) {
+    min_blocks_per_thread = 1;
+  } else if (estimate >= ((src_len / 10) * 9)) {
+    min_blocks_per_thread = 4;
+  }
+  for (size_t num_threads = 2; num_threads <= 64; num_threads *= 2) {
+    const size_t want = min_blocks_per_thread * num_threads;
+    const size_t n =
+        sflz4_frame_auto_block_max_len(src_ptr, src_len, 0, num_threads);
+    CHECK((n == 0x10000) || (((src_len + n - 1) / n) >= want));
+    CHECK((n == 0x400000) || (((src_len + (4 * n) - 1) / (4 * n)) < want));
+  }
+}
+
+static void  //
+test_auto_block_max_len() {
+  CHECK(sflz4_frame_auto_block_max_len(text, 1000, 0, 1) == 0x10000);
+  CHECK(sflz4_frame_auto_block_max_len(text, 0x10001, 0, 1) == 0x40000);
+  CHECK(sflz4_frame_auto_block_max_len(text, DATA_LEN, 0, 1) == 0x400000);
+  CHECK(sflz4_frame_auto_block_max_len(
+            text, DATA_LEN, SFLZ4_FRAME_ENCODE_FLAGS__LINKED_BLOCKS, 8) ==
+        0x40000);
+
+  uint8_t* zeroes = (uint8_t*)calloc(DATA_LEN, 1);
+  check_auto_block_max_len(zeroes, DATA_LEN);
+  check_auto_block_max_len(text, DATA_LEN);
+  check_auto_block_max_len(noise, DATA_LEN);
+  free(zeroes);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(text, DATA_LEN, 70);
+  uint32_t state = 71;
+  for (size_t i = 0; i < DATA_LEN; i++) {
+    noise[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  test_round_trip();
+  test_corrupt_input();
+  test_auto_block_max_len();
+  return test_finish("frame_test");
+}
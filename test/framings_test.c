@@ -0,0 +1,177 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// framings_test.c tests the "LZ4 Foreign Framings" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/framings_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 1000000
+
+uint8_t data[DATA_LEN];
+uint8_t enc[DATA_LEN + (DATA_LEN / 8)];
+uint8_t dec[DATA_LEN];
+
+static void  //
+put_u32be(uint8_t* p, uint32_t x) {
+  p[0] = (uint8_t)(x >> 24);
+  p[1] = (uint8_t)(x >> 16);
+  p[2] = (uint8_t)(x >> 8);
+  p[3] = (uint8_t)(x >> 0);
+}
+
+static void  //
+test_hadoop() {
+  static const size_t chunk_max_lens[] = {0, 1, 1000, 0x10000};
+  static const size_t src_lens[] = {0, 1, 999, 1000, 1001, 300000, DATA_LEN};
+  for (size_t c = 0; c < 4; c++) {
+    for (size_t i = 0; i < (sizeof(src_lens) / sizeof(src_lens[0])); i++) {
+      const size_t n = src_lens[i];
+      if ((chunk_max_lens[c] == 1) && (n > 1000)) {
+        continue;
+      }
+      sflz4_size_result w =
+          sflz4_hadoop_encode_worst_case_dst_len(n, chunk_max_lens[c]);
+      CHECK(!w.status_message && (w.value <= sizeof(enc)));
+      sflz4_size_result e =
+          sflz4_hadoop_encode(enc, w.value, data, n, chunk_max_lens[c]);
+      CHECK(!e.status_message);
+      sflz4_size_result d = sflz4_hadoop_decoded_len(enc, e.value);
+      CHECK(!d.status_message && (d.value == n));
+      d = sflz4_hadoop_decode(dec, n, enc, e.value);
+      CHECK(!d.status_message && (d.value == n) && !memcmp(dec, data, n));
+      if (n > 0) {
+        d = sflz4_hadoop_decode(dec, n - 1, enc, e.value);
+        CHECK(d.status_message == sflz4_status_message__error_dst_is_too_short);
+        d = sflz4_hadoop_decode(dec, n, enc, e.value - 1);
+        CHECK(d.status_message);
+      }
+      // Hadoop's older LZ4 codec in Parquet.
+      d = sflz4_parquet_lz4_decode(dec, n, enc, e.value);
+      CHECK(!d.status_message && (d.value == n) && !memcmp(dec, data, n));
+    }
+  }
+
+  // Hadoop's compressor can split a chunk into several sub-blocks, and
+  // concatenates the streams of successive writes.
+  uint8_t* p = enc;
+  for (int k = 0; k < 2; k++) {
+    put_u32be(p, 3000);
+    p += 4;
+    for (size_t offset = 0; offset < 3000; offset += 1000) {
+      sflz4_size_result b = sflz4_block_encode(p + 4, 2000, data + offset,
+                                               1000);
+      CHECK(!b.status_message);
+      put_u32be(p, (uint32_t)b.value);
+      p += 4 + b.value;
+    }
+  }
+  const size_t len = (size_t)(p - enc);
+  sflz4_size_result d = sflz4_hadoop_decode(dec, 6000, enc, len);
+  CHECK(!d.status_message && (d.value == 6000) &&
+        !memcmp(dec, data, 3000) && !memcmp(dec + 3000, data, 3000));
+
+  // Sub-blocks that decode to more (or less) than their chunk's length.
+  put_u32be(enc, 2999);
+  CHECK(sflz4_hadoop_decode(dec, 6000, enc, len).status_message);
+  put_u32be(enc, 3001);
+  CHECK(sflz4_hadoop_decode(dec, 6000, enc, len).status_message);
+}
+
+static void  //
+test_parquet_lz4_raw() {
+  const size_t n = 300000;
+  sflz4_size_result e = sflz4_block_encode(enc, sizeof(enc), data, n);
+  CHECK(!e.status_message);
+  sflz4_size_result d = sflz4_parquet_lz4_raw_decode(dec, n, enc, e.value);
+  CHECK(!d.status_message && (d.value == n) && !memcmp(dec, data, n));
+  d = sflz4_parquet_lz4_raw_decode(dec, n + 1, enc, e.value);
+  CHECK(d.status_message == sflz4_status_message__error_invalid_data);
+  d = sflz4_parquet_lz4_raw_decode(dec, n - 1, enc, e.value);
+  CHECK(d.status_message);
+
+  // A bare block in Parquet's older LZ4 codec.
+  d = sflz4_parquet_lz4_decode(dec, n, enc, e.value);
+  CHECK(!d.status_message && (d.value == n) && !memcmp(dec, data, n));
+}
+
+static void  //
+test_size_prefixed() {
+  // As written by python-lz4's lz4.block.compress(b"hello").
+  static const uint8_t hello[10] = {0x05, 0x00, 0x00, 0x00, 0x50,
+                                    'h',  'e',  'l',  'l',  'o'};
+  sflz4_size_result r = sflz4_size_prefixed_decoded_len(hello, 10);
+  CHECK(!r.status_message && (r.value == 5));
+  r = sflz4_size_prefixed_decode(dec, 5, hello, 10);
+  CHECK(!r.status_message && (r.value == 5) && !memcmp(dec, "hello", 5));
+  r = sflz4_size_prefixed_decode(dec, 4, hello, 10);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+  CHECK(sflz4_size_prefixed_decoded_len(hello, 3).status_message);
+  r = sflz4_size_prefixed_encode(enc, sizeof(enc), (const uint8_t*)"hello",
+                                 5);
+  CHECK(!r.status_message && (r.value == 10) && !memcmp(enc, hello, 10));
+
+  static const size_t src_lens[] = {1, 1000, 300000, DATA_LEN};
+  for (size_t i = 0; i < 4; i++) {
+    const size_t n = src_lens[i];
+    sflz4_size_result w = sflz4_size_prefixed_encode_worst_case_dst_len(n);
+    CHECK(!w.status_message && (w.value <= sizeof(enc)));
+    sflz4_size_result e = sflz4_size_prefixed_encode(enc, w.value, data, n);
+    CHECK(!e.status_message);
+    sflz4_size_result d = sflz4_size_prefixed_decode(dec, n, enc, e.value);
+    CHECK(!d.status_message && (d.value == n) && !memcmp(dec, data, n));
+    d = sflz4_size_prefixed_decode(dec, n, enc, e.value - 1);
+    CHECK(d.status_message);
+  }
+}
+
+// test_corruption checks that bit flips, which none of these framings
+// detect, never make the decoders read or write out of bounds.
+static void  //
+test_corruption() {
+  const size_t n = 20000;
+  sflz4_size_result e = sflz4_hadoop_encode(enc, sizeof(enc), data, n, 3000);
+  CHECK(!e.status_message);
+  uint8_t* c = (uint8_t*)malloc(e.value);
+  uint32_t state = 97;
+  for (int k = 0; k < 3000; k++) {
+    memcpy(c, enc, e.value);
+    uint32_t x = test_rand(&state);
+    c[(x >> 3) % e.value] ^= (uint8_t)(1 << (x & 7));
+    sflz4_size_result d = sflz4_hadoop_decode(dec, n, c, e.value);
+    CHECK(d.status_message || (d.value <= n));
+    sflz4_hadoop_decoded_len(c, e.value);
+    sflz4_parquet_lz4_decode(dec, n, c, e.value);
+    sflz4_parquet_lz4_raw_decode(dec, n, c, e.value);
+    sflz4_size_prefixed_decode(dec, n, c, e.value);
+  }
+  free(c);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(data, DATA_LEN, 97);
+  test_hadoop();
+  test_parquet_lz4_raw();
+  test_size_prefixed();
+  test_corruption();
+  return test_finish("framings_test");
+}
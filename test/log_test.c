@@ -0,0 +1,277 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// log_test.c tests the "LZ4 Log Writer" section of src/sflz4.h: writing a
+// log, recovering it (whole, torn and corrupted) and resuming it.
+//
+// $ gcc -fsanitize=address,undefined test/log_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 300000
+#define LOG_MAX_LEN (2 * DATA_LEN)
+
+uint8_t data[DATA_LEN];
+uint8_t recovered[DATA_LEN];
+
+// memory_log is the write_func and sync_func context: an in-memory file.
+typedef struct {
+  uint8_t ptr[LOG_MAX_LEN];
+  size_t len;
+  size_t synced_len;
+  int num_writes;
+  int num_syncs;
+} memory_log;
+
+memory_log log0;
+
+static const char*       //
+write_func(              //
+    void* context,       //
+    const uint8_t* ptr,  //
+    size_t len) {
+  memory_log* m = (memory_log*)context;
+  if (len > (LOG_MAX_LEN - m->len)) {
+    return "#log_test: log is full";
+  }
+  memcpy(m->ptr + m->len, ptr, len);
+  m->len += len;
+  m->num_writes++;
+  return NULL;
+}
+
+static const char*  //
+sync_func(          //
+    void* context) {
+  memory_log* m = (memory_log*)context;
+  m->synced_len = m->len;
+  m->num_syncs++;
+  return NULL;
+}
+
+static uint8_t*  //
+new_workspace(   //
+    size_t block_max_len) {
+  sflz4_size_result r = sflz4_log_writer_workspace_len(block_max_len);
+  CHECK(!r.status_message);
+  return (uint8_t*)malloc(r.value);
+}
+
+// append_records appends data[begin .. end) as records of varying lengths,
+// with the clock advancing by 1 per record. w's offsets are relative to
+// data[session_begin].
+static void                //
+append_records(            //
+    sflz4_log_writer* w,   //
+    size_t session_begin,  //
+    size_t begin,          //
+    size_t end) {
+  uint32_t state = (uint32_t)begin + 1;
+  for (size_t i = begin; i < end;) {
+    size_t n = 1 + (test_rand(&state) % 500);
+    n = (n < (end - i)) ? n : (end - i);
+    sflz4_size_result r = sflz4_log_writer_append(w, data + i, n, i);
+    CHECK(!r.status_message && (r.value == (i + n - session_begin)));
+    CHECK(sflz4_log_writer_synced_len(w) <= (i + n - session_begin));
+    i += n;
+  }
+}
+
+static void  //
+test_round_trip() {
+  sflz4_log_writer_options options;
+  memset(&options, 0, sizeof(options));
+  options.flush_len = 10000;
+  options.flush_delay = 1000000;
+  uint8_t* workspace = new_workspace(0);
+  sflz4_size_result wl = sflz4_log_writer_workspace_len(0);
+  sflz4_log_writer w;
+  memset(&log0, 0, sizeof(log0));
+  CHECK(sflz4_log_writer_initialize(&w, workspace, wl.value - 1, &options,
+                                    &write_func, &sync_func, &log0) ==
+        sflz4_status_message__error_workspace_is_too_short);
+  CHECK(!sflz4_log_writer_initialize(&w, workspace, wl.value, &options,
+                                     &write_func, &sync_func, &log0));
+
+  append_records(&w, 0, 0, DATA_LEN);
+  // Group commit: far fewer writes and syncs than records.
+  CHECK((log0.num_writes > 0) && (log0.num_writes < (DATA_LEN / 5000)));
+  CHECK(log0.num_syncs == log0.num_writes);
+  CHECK(log0.synced_len == log0.len);
+  CHECK(!sflz4_log_writer_close(&w));
+  CHECK(sflz4_log_writer_synced_len(&w) == DATA_LEN);
+
+  size_t valid_len = 0;
+  int unterminated = 1;
+  sflz4_size_result r = sflz4_log_recover(recovered, DATA_LEN, log0.ptr,
+                                          log0.len, &valid_len, &unterminated);
+  CHECK(!r.status_message && (r.value == DATA_LEN) &&
+        !memcmp(recovered, data, DATA_LEN));
+  CHECK((valid_len == log0.len) && !unterminated);
+  r = sflz4_log_recover(recovered, DATA_LEN - 1, log0.ptr, log0.len,
+                        &valid_len, &unterminated);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+
+  // The log is also a plain LZ4 frame.
+  r = sflz4_frame_decode(recovered, DATA_LEN, log0.ptr, log0.len);
+  CHECK(!r.status_message && (r.value == DATA_LEN) &&
+        !memcmp(recovered, data, DATA_LEN));
+  free(workspace);
+}
+
+static void  //
+test_flush_delay() {
+  sflz4_log_writer_options options;
+  memset(&options, 0, sizeof(options));
+  options.flush_delay = 100;
+  uint8_t* workspace = new_workspace(0);
+  sflz4_log_writer w;
+  memory_log* m = (memory_log*)calloc(1, sizeof(memory_log));
+  CHECK(!sflz4_log_writer_initialize(
+      &w, workspace, sflz4_log_writer_workspace_len(0).value, &options,
+      &write_func, &sync_func, m));
+  CHECK(!sflz4_log_writer_append(&w, data, 10, 1000).status_message);
+  CHECK(!sflz4_log_writer_poll(&w, 1050) && (m->num_writes == 0));
+  CHECK(!sflz4_log_writer_poll(&w, 1100) && (m->num_writes == 1));
+  CHECK(sflz4_log_writer_synced_len(&w) == 10);
+  free(m);
+  free(workspace);
+}
+
+// test_torn_tail truncates the log at every length in a range, recovers it
+// and then resumes appending to it.
+static void  //
+test_torn_tail() {
+  uint8_t* workspace = new_workspace(0);
+  memory_log* m = (memory_log*)malloc(sizeof(memory_log));
+  size_t prev_r = 0;
+  for (size_t torn_len = 0; torn_len <= log0.len; torn_len += 97) {
+    size_t valid_len = 0;
+    int unterminated = 0;
+    sflz4_size_result r = sflz4_log_recover(
+        recovered, DATA_LEN, log0.ptr, torn_len, &valid_len, &unterminated);
+    CHECK(!r.status_message && (valid_len <= torn_len) &&
+          !memcmp(recovered, data, r.value) && (r.value >= prev_r));
+    prev_r = r.value;
+    if ((torn_len % 9991) != 0) {
+      continue;
+    }
+
+    // Resume: truncate to valid_len and append the rest of the data.
+    memcpy(m->ptr, log0.ptr, valid_len);
+    m->len = valid_len;
+    sflz4_log_writer_options options;
+    memset(&options, 0, sizeof(options));
+    options.flags =
+        unterminated ? SFLZ4_LOG_WRITER_FLAGS__CLOSE_PREVIOUS_FRAME : 0;
+    sflz4_log_writer w;
+    CHECK(!sflz4_log_writer_initialize(
+        &w, workspace, sflz4_log_writer_workspace_len(0).value, &options,
+        &write_func, &sync_func, m));
+    append_records(&w, r.value, r.value, DATA_LEN);
+    CHECK(!sflz4_log_writer_close(&w));
+    sflz4_size_result r2 = sflz4_log_recover(recovered, DATA_LEN, m->ptr,
+                                             m->len, &valid_len,
+                                             &unterminated);
+    CHECK(!r2.status_message && (r2.value == DATA_LEN) &&
+          !memcmp(recovered, data, DATA_LEN) && (valid_len == m->len) &&
+          !unterminated);
+  }
+  free(m);
+  free(workspace);
+}
+
+static void  //
+test_corrupt_input() {
+  uint8_t* c = (uint8_t*)malloc(log0.len);
+  uint32_t state = 5;
+  for (int k = 0; k < 300; k++) {
+    memcpy(c, log0.ptr, log0.len);
+    uint32_t x = test_rand(&state);
+    size_t pos = (x >> 3) % log0.len;
+    c[pos] ^= (uint8_t)(1 << (x & 7));
+    size_t valid_len = 0;
+    int unterminated = 0;
+    sflz4_size_result r = sflz4_log_recover(recovered, DATA_LEN, c, log0.len,
+                                            &valid_len, &unterminated);
+    // Block checksums stop recovery at (or before) the corrupt block, so
+    // what is recovered is always a prefix of the data.
+    CHECK(r.status_message || !memcmp(recovered, data, r.value));
+    CHECK(valid_len <= log0.len);
+  }
+  free(c);
+}
+
+static void  //
+test_checkpoint_restore() {
+  uint8_t* workspace = new_workspace(0);
+  const size_t workspace_len = sflz4_log_writer_workspace_len(0).value;
+  memory_log* m = (memory_log*)calloc(1, sizeof(memory_log));
+  uint8_t* checkpoint =
+      (uint8_t*)malloc(SFLZ4_LOG_WRITER_CHECKPOINT_MAX_INCL_LEN);
+
+  sflz4_log_writer w;
+  CHECK(!sflz4_log_writer_initialize(&w, workspace, workspace_len, NULL,
+                                     &write_func, &sync_func, m));
+  append_records(&w, 0, 0, DATA_LEN / 2);
+  sflz4_size_result c = sflz4_log_writer_checkpoint(
+      &w, checkpoint, SFLZ4_LOG_WRITER_CHECKPOINT_MAX_INCL_LEN);
+  CHECK(!c.status_message);
+  const size_t len_at_checkpoint = m->len;
+
+  // A new writer, as if in a new process, carries on the same frame.
+  memset(&w, 0, sizeof(w));
+  memset(workspace, 0, workspace_len);
+  sflz4_size_result r =
+      sflz4_log_writer_restore(&w, workspace, workspace_len, NULL, &write_func,
+                               &sync_func, m, checkpoint, c.value);
+  CHECK(!r.status_message && (r.value == len_at_checkpoint));
+  append_records(&w, 0, DATA_LEN / 2, DATA_LEN);
+  CHECK(!sflz4_log_writer_close(&w));
+
+  size_t valid_len = 0;
+  int unterminated = 0;
+  r = sflz4_log_recover(recovered, DATA_LEN, m->ptr, m->len, &valid_len,
+                        &unterminated);
+  CHECK(!r.status_message && (r.value == DATA_LEN) &&
+        !memcmp(recovered, data, DATA_LEN) && !unterminated);
+
+  // A corrupt checkpoint is rejected.
+  checkpoint[c.value / 2] ^= 1;
+  r = sflz4_log_writer_restore(&w, workspace, workspace_len, NULL,
+                               &write_func, &sync_func, m, checkpoint,
+                               c.value);
+  CHECK(r.status_message);
+
+  free(checkpoint);
+  free(m);
+  free(workspace);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(data, DATA_LEN, 40);
+  test_round_trip();
+  test_flush_delay();
+  test_torn_tail();
+  test_corrupt_input();
+  test_checkpoint_restore();
+  return test_finish("log_test");
+}
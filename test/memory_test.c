@@ -0,0 +1,199 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// memory_test.c tests the "LZ4 Memory Checkpoints" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/memory_test.c && ./a.out
+
+#include "test.h"
+
+#define PAGE_LEN 4096
+#define NUM_PAGES 300
+#define MEM_LEN (PAGE_LEN * NUM_PAGES)
+
+uint8_t mem[MEM_LEN];
+uint8_t restored[MEM_LEN];
+uint8_t saved[MEM_LEN];
+uint64_t fingerprints[NUM_PAGES];
+uint8_t bitmap[(NUM_PAGES + 7) / 8];
+
+// backwards_parallel_for is a sflz4_parallel_for_func that runs the calls
+// on the calling thread, but in reverse order, so that the runs are not
+// visited in index order.
+static void                                      //
+backwards_parallel_for(                          //
+    void* context,                               //
+    size_t n,                                    //
+    void (*func)(void* func_context, size_t i),  //
+    void* func_context) {
+  (void)context;
+  while (n > 0) {
+    (*func)(func_context, --n);
+  }
+}
+
+static uint8_t*                       //
+checkpoint(                           //
+    const uint8_t* dirty_bitmap_ptr,  //
+    size_t* len) {
+  const size_t cap =
+      sflz4_memory_checkpoint_worst_case_dst_len(MEM_LEN, PAGE_LEN).value;
+  uint8_t* dst = (uint8_t*)malloc(cap);
+  sflz4_size_result r = sflz4_memory_checkpoint_encode(
+      dst, cap - 1, mem, MEM_LEN, PAGE_LEN, dirty_bitmap_ptr, NULL, NULL);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+  r = sflz4_memory_checkpoint_encode(dst, cap, mem, MEM_LEN, PAGE_LEN,
+                                     dirty_bitmap_ptr, &backwards_parallel_for,
+                                     NULL);
+  CHECK(!r.status_message);
+  *len = r.value;
+  return dst;
+}
+
+// dirty_some_pages changes a few pages: some with neighbours (so that runs
+// span several pages), some random (incompressible) and one single byte.
+static void  //
+dirty_some_pages(uint32_t seed) {
+  uint32_t state = seed;
+  for (int k = 0; k < 10; k++) {
+    size_t p = test_rand(&state) % (NUM_PAGES - 3);
+    test_make_data(mem + (p * PAGE_LEN), 3 * PAGE_LEN, test_rand(&state));
+  }
+  size_t p = test_rand(&state) % NUM_PAGES;
+  for (size_t i = 0; i < PAGE_LEN; i++) {
+    mem[(p * PAGE_LEN) + i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  mem[test_rand(&state) % MEM_LEN] ^= 0x80;
+}
+
+static size_t  //
+count_bits() {
+  size_t n = 0;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    n += (bitmap[i >> 3] >> (i & 7)) & 1;
+  }
+  return n;
+}
+
+static void  //
+test_find_dirty_pages() {
+  sflz4_size_result r =
+      sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN, 100);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+  r = sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN - 64,
+                                    PAGE_LEN);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+
+  r = sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN,
+                                    PAGE_LEN);
+  CHECK(!r.status_message && (r.value == NUM_PAGES) &&
+        (count_bits() == NUM_PAGES));
+  r = sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN,
+                                    PAGE_LEN);
+  CHECK(!r.status_message && (r.value == 0) && (count_bits() == 0));
+  mem[(7 * PAGE_LEN) + 5] ^= 1;
+  mem[(299 * PAGE_LEN) + 4095] ^= 1;
+  r = sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN,
+                                    PAGE_LEN);
+  CHECK(!r.status_message && (r.value == 2) && (count_bits() == 2) &&
+        (bitmap[0] == 0x80) && (bitmap[299 >> 3] == (1 << (299 & 7))));
+}
+
+static void  //
+test_full_and_incremental() {
+  // The first checkpoint is a full one, the others incremental.
+  uint8_t* ckpts[4];
+  size_t lens[4];
+  uint8_t* snapshots[4];
+  for (int i = 0; i < 4; i++) {
+    if (i) {
+      dirty_some_pages(100 + i);
+      sflz4_memory_find_dirty_pages(bitmap, fingerprints, mem, MEM_LEN,
+                                    PAGE_LEN);
+    }
+    ckpts[i] = checkpoint(i ? bitmap : NULL, &lens[i]);
+    if (i) {
+      CHECK(lens[i] < (MEM_LEN / 4));
+    }
+    snapshots[i] = (uint8_t*)malloc(MEM_LEN);
+    memcpy(snapshots[i], mem, MEM_LEN);
+  }
+
+  memset(restored, 0xAA, MEM_LEN);
+  for (int i = 0; i < 4; i++) {
+    sflz4_parallel_for_func parallel_for =
+        (i & 1) ? &backwards_parallel_for : NULL;
+    sflz4_size_result r = sflz4_memory_checkpoint_restore(
+        restored, MEM_LEN, ckpts[i], lens[i], parallel_for, NULL);
+    CHECK(!r.status_message && !memcmp(restored, snapshots[i], MEM_LEN));
+    CHECK(!i || ((r.value > 0) && (r.value < MEM_LEN)));
+  }
+  sflz4_size_result r = sflz4_memory_checkpoint_restore(
+      restored, MEM_LEN - PAGE_LEN, ckpts[0], lens[0], NULL, NULL);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+
+  for (int i = 0; i < 4; i++) {
+    free(ckpts[i]);
+    free(snapshots[i]);
+  }
+}
+
+static void  //
+test_corruption() {
+  test_make_data(mem, MEM_LEN, 200);
+  size_t len = 0;
+  uint8_t* ckpt = checkpoint(NULL, &len);
+  uint8_t* c = (uint8_t*)malloc(len);
+  memset(saved, 0x5A, MEM_LEN);
+
+  // A failed restore, of a corrupt or truncated checkpoint, must not write
+  // to mem at all.
+  uint32_t state = 201;
+  for (int k = 0; k < 2000; k++) {
+    memcpy(c, ckpt, len);
+    uint32_t x = test_rand(&state);
+    size_t i = (k < 200) ? (x % 32) : (x >> 3) % len;
+    c[i] ^= (uint8_t)(1 << (x & 7));
+    memcpy(restored, saved, MEM_LEN);
+    sflz4_size_result r =
+        sflz4_memory_checkpoint_restore(restored, MEM_LEN, c, len, NULL, NULL);
+    if (r.status_message) {
+      CHECK(!memcmp(restored, saved, MEM_LEN));
+    } else {
+      CHECK(!memcmp(restored, mem, MEM_LEN));
+    }
+
+    memcpy(restored, saved, MEM_LEN);
+    r = sflz4_memory_checkpoint_restore(restored, MEM_LEN, ckpt,
+                                        (x >> 3) % len, NULL, NULL);
+    CHECK(r.status_message && !memcmp(restored, saved, MEM_LEN));
+  }
+  free(c);
+  free(ckpt);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(mem, MEM_LEN, 1);
+  test_find_dirty_pages();
+  test_full_and_incremental();
+  test_corruption();
+  return test_finish("memory_test");
+}
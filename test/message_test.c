@@ -0,0 +1,225 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// message_test.c tests the "LZ4 Message Channels" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/message_test.c && ./a.out
+
+#include "test.h"
+
+#define NUM_MESSAGES 300
+#define MESSAGE_MAX_LEN 100000
+
+uint8_t messages[NUM_MESSAGES][1000];
+size_t message_lens[NUM_MESSAGES];
+uint8_t big[MESSAGE_MAX_LEN];
+
+uint8_t* channel;
+size_t channel_len;
+
+sflz4_dictionary dictionary;
+uint8_t dictionary_bytes[2000];
+
+// make_messages makes RPC-like messages that resemble each other: a common
+// prefix, a varying id and a random-length body.
+static void  //
+make_messages() {
+  uint32_t state = 94;
+  for (int i = 0; i < NUM_MESSAGES; i++) {
+    int n = snprintf((char*)messages[i], sizeof(messages[i]),
+                     "{\"method\":\"Store.Put\",\"id\":%d,\"body\":\"", i);
+    const size_t body_len = test_rand(&state) % 900;
+    test_make_data(messages[i] + n, body_len, test_rand(&state) % 8);
+    message_lens[i] = (size_t)n + body_len;
+  }
+  message_lens[7] = 0;
+  test_make_data(big, MESSAGE_MAX_LEN, 95);
+  memcpy(dictionary_bytes, messages[1], message_lens[1]);
+  test_make_data(dictionary_bytes + 1000, 1000, 3);
+  sflz4_dictionary_initialize(&dictionary, 0x1234, dictionary_bytes,
+                              sizeof(dictionary_bytes));
+}
+
+// encode_channel encodes the messages (with big as message 100) as one
+// channel, setting channel and channel_len.
+static void          //
+encode_channel(      //
+    uint32_t flags,  //
+    const sflz4_dictionary* d) {
+  sflz4_size_result wl =
+      sflz4_message_encoder_workspace_len(MESSAGE_MAX_LEN, flags);
+  CHECK(!wl.status_message &&
+        ((wl.value == 0) == !!(flags & SFLZ4_MESSAGE_FLAGS__INDEPENDENT)));
+  uint8_t* workspace = (uint8_t*)malloc(wl.value + 1);
+  sflz4_message_encoder e;
+  if (wl.value > 0) {
+    CHECK(sflz4_message_encoder_initialize(&e, workspace, wl.value - 1,
+                                           MESSAGE_MAX_LEN, flags, d));
+  }
+  CHECK(!sflz4_message_encoder_initialize(&e, workspace, wl.value,
+                                          MESSAGE_MAX_LEN, flags, d));
+
+  const size_t cap =
+      sflz4_message_encode_worst_case_dst_len(MESSAGE_MAX_LEN).value;
+  channel = (uint8_t*)realloc(channel, (NUM_MESSAGES + 1) * cap);
+  uint8_t* p = channel;
+  sflz4_size_result r = sflz4_message_encode_hello(&e, p, cap);
+  CHECK(!r.status_message && (r.value > 0));
+  p += r.value;
+  r = sflz4_message_encode_hello(&e, p, cap);
+  CHECK(!r.status_message && (r.value == 0));
+  for (int i = 0; i < NUM_MESSAGES; i++) {
+    const uint8_t* src = (i == 100) ? big : messages[i];
+    const size_t src_len = (i == 100) ? MESSAGE_MAX_LEN : message_lens[i];
+    r = sflz4_message_encode(&e, p, cap, src, src_len);
+    CHECK(!r.status_message &&
+          (r.value <= sflz4_message_encode_worst_case_dst_len(src_len).value));
+    p += r.value;
+  }
+  r = sflz4_message_encode(&e, p, cap, big, MESSAGE_MAX_LEN + 1);
+  CHECK(r.status_message);
+  channel_len = (size_t)(p - channel);
+  free(workspace);
+}
+
+// decode_channel decodes channel, parsing each header from as few bytes as
+// possible, returning NULL on success. On success, it checks that each
+// message matches. An independent channel's blocks also decode on their own.
+static const char*                       //
+decode_channel(                          //
+    const uint8_t* c_ptr,                //
+    size_t c_len,                        //
+    const sflz4_dictionary_registry* r,  //
+    int independent) {
+  uint8_t* workspace = (uint8_t*)malloc(SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN);
+  uint8_t* dst = (uint8_t*)malloc(MESSAGE_MAX_LEN);
+  uint8_t* dst2 = (uint8_t*)malloc(MESSAGE_MAX_LEN);
+  sflz4_message_decoder d;
+  const char* status_message = sflz4_message_decoder_initialize(
+      &d, workspace, SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN, r);
+  CHECK(!status_message);
+
+  for (int i = -1; !status_message && (c_len > 0); i++) {
+    sflz4_message_header h;
+    sflz4_size_result hr = {NULL, 0};
+    for (size_t n = 0; (n <= c_len) && !hr.status_message && !hr.value; n++) {
+      CHECK(n <= SFLZ4_MESSAGE_HEADER_MAX_INCL_LEN);
+      hr = sflz4_message_parse_header(&h, c_ptr, n);
+    }
+    if (hr.status_message) {
+      status_message = hr.status_message;
+      break;
+    } else if (!hr.value || (hr.value > c_len)) {
+      status_message = "#test: truncated";
+      break;
+    }
+    sflz4_size_result mr = sflz4_message_decode(
+        &d, dst, h.decoded_len ? h.decoded_len : 1, c_ptr, hr.value);
+    if (mr.status_message) {
+      status_message = mr.status_message;
+      break;
+    }
+    CHECK(mr.value == h.decoded_len);
+    if (i < 0) {
+      CHECK((h.kind == SFLZ4_MESSAGE_KIND__HELLO) && (mr.value == 0));
+    } else if (i < NUM_MESSAGES) {
+      const uint8_t* want = (i == 100) ? big : messages[i];
+      const size_t want_len = (i == 100) ? MESSAGE_MAX_LEN : message_lens[i];
+      if ((mr.value != want_len) || memcmp(dst, want, want_len)) {
+        status_message = "#test: wrong message";
+      }
+    }
+
+    if (independent && (h.kind == SFLZ4_MESSAGE_KIND__LZ4)) {
+      const sflz4_dictionary* dict =
+          r ? sflz4_dictionary_registry_find(r, 0x1234) : NULL;
+      sflz4_size_result br =
+          dict ? sflz4_block_decode_with_dictionary(
+                     dst2, h.decoded_len, c_ptr + h.header_len, h.encoded_len,
+                     dict)
+               : sflz4_block_decode(dst2, h.decoded_len,
+                                    c_ptr + h.header_len, h.encoded_len);
+      CHECK(!br.status_message && (br.value == mr.value) &&
+            !memcmp(dst2, dst, mr.value));
+    }
+    c_ptr += hr.value;
+    c_len -= hr.value;
+  }
+
+  free(dst2);
+  free(dst);
+  free(workspace);
+  return status_message;
+}
+
+static void  //
+test_round_trip() {
+  const sflz4_dictionary* entries[1];
+  sflz4_dictionary_registry registry;
+  sflz4_dictionary_registry_initialize(&registry, entries, 1);
+  CHECK(!sflz4_dictionary_registry_add(&registry, &dictionary));
+
+  size_t lens[4];
+  for (int i = 0; i < 4; i++) {
+    const uint32_t flags = (i & 1) ? SFLZ4_MESSAGE_FLAGS__INDEPENDENT : 0;
+    const sflz4_dictionary* d = (i & 2) ? &dictionary : NULL;
+    encode_channel(flags, d);
+    lens[i] = channel_len;
+    CHECK(!decode_channel(channel, channel_len, &registry, i & 1));
+    if (d) {
+      // The receiver doesn't know the dictionary.
+      CHECK(decode_channel(channel, channel_len, NULL, i & 1) ==
+            sflz4_status_message__error_unsupported_feature);
+    }
+  }
+  // History helps more than a dictionary, and both beat neither.
+  CHECK(lens[0] < lens[3]);
+  CHECK(lens[3] < lens[1]);
+}
+
+static void  //
+test_corruption() {
+  encode_channel(0, NULL);
+  uint8_t* c = (uint8_t*)malloc(channel_len);
+  uint32_t state = 96;
+  for (int k = 0; k < 300; k++) {
+    // Messages are not checksummed, so corrupt input may decode to wrong
+    // bytes, but it must not crash.
+    memcpy(c, channel, channel_len);
+    uint32_t x = test_rand(&state);
+    c[(x >> 3) % channel_len] ^= (uint8_t)(1 << (x & 7));
+    decode_channel(c, channel_len, NULL, 0);
+
+    // A truncated channel is noticed, unless it ends between messages.
+    const char* status_message =
+        decode_channel(channel, (x >> 3) % channel_len, NULL, 0);
+    CHECK(!status_message || !strcmp(status_message, "#test: truncated"));
+  }
+  free(c);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  make_messages();
+  test_round_trip();
+  test_corruption();
+  free(channel);
+  return test_finish("message_test");
+}
@@ -0,0 +1,206 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// page_pool_test.c tests the "LZ4 Page Pool" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/page_pool_test.c && ./a.out
+
+#include "test.h"
+
+#define PAGE_LEN SFLZ4_PAGE_POOL_PAGE_LEN
+#define NUM_PAGES 300
+#define ARENA_LEN (256 * (SFLZ4_PAGE_POOL_SLAB_LEN + 64))
+
+uint8_t arena[ARENA_LEN];
+uint8_t pages[NUM_PAGES][PAGE_LEN];
+uint8_t loaded[PAGE_LEN];
+size_t handles[NUM_PAGES];
+
+// make_page fills pages[i] with one of three kinds of page: uniform (every
+// byte the same), raw (incompressible) or compressible.
+static void  //
+make_page(   //
+    size_t i) {
+  uint32_t state = (uint32_t)(82 + i);
+  switch (i % 3) {
+    case 0:
+      memset(pages[i], (int)(i & 0xFF), PAGE_LEN);
+      break;
+    case 1:
+      for (size_t j = 0; j < PAGE_LEN; j++) {
+        pages[i][j] = (uint8_t)(test_rand(&state) >> 24);
+      }
+      break;
+    default:
+      test_make_data(pages[i], PAGE_LEN, (uint32_t)i);
+      break;
+  }
+}
+
+static void                 //
+check_stats(                //
+    sflz4_page_pool* pool,  //
+    uint64_t num_pages,     //
+    uint64_t num_uniform,   //
+    uint64_t num_raw) {
+  sflz4_page_pool_stats s = sflz4_page_pool_get_stats(pool);
+  CHECK(s.num_pages == num_pages);
+  CHECK(s.num_uniform_pages == num_uniform);
+  CHECK(s.num_raw_pages == num_raw);
+  if (num_pages == 0) {
+    CHECK((s.num_object_bytes == 0) && (s.num_slabs == 0));
+  }
+}
+
+static void  //
+test_round_trips() {
+  sflz4_page_pool pool;
+  CHECK(!sflz4_page_pool_initialize(&pool, arena, ARENA_LEN));
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    sflz4_size_result r = sflz4_page_pool_store(&pool, pages[i]);
+    CHECK(!r.status_message && (r.value != 0));
+    handles[i] = r.value;
+  }
+  check_stats(&pool, NUM_PAGES, NUM_PAGES / 3, NUM_PAGES / 3);
+  sflz4_page_pool_stats s = sflz4_page_pool_get_stats(&pool);
+  CHECK((s.num_slabs * SFLZ4_PAGE_POOL_SLAB_LEN) < (NUM_PAGES * PAGE_LEN));
+
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    CHECK(!sflz4_page_pool_load(&pool, loaded, handles[i]) &&
+          !memcmp(loaded, pages[i], PAGE_LEN));
+  }
+
+  // Free every other page, re-store them (reusing the freed objects) and
+  // check that every page still loads.
+  for (size_t i = 0; i < NUM_PAGES; i += 2) {
+    sflz4_page_pool_free(&pool, handles[i]);
+  }
+  for (size_t i = 0; i < NUM_PAGES; i += 2) {
+    sflz4_size_result r = sflz4_page_pool_store(&pool, pages[i]);
+    CHECK(!r.status_message && (r.value != 0));
+    handles[i] = r.value;
+  }
+  check_stats(&pool, NUM_PAGES, NUM_PAGES / 3, NUM_PAGES / 3);
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    CHECK(!sflz4_page_pool_load(&pool, loaded, handles[i]) &&
+          !memcmp(loaded, pages[i], PAGE_LEN));
+  }
+
+  // Free everything, backwards, and every slab goes back to the arena.
+  for (size_t i = NUM_PAGES; i > 0; i--) {
+    sflz4_page_pool_free(&pool, handles[i - 1]);
+  }
+  check_stats(&pool, 0, 0, 0);
+  sflz4_page_pool_free(&pool, 0);
+  check_stats(&pool, 0, 0, 0);
+}
+
+static void  //
+test_full_arena() {
+  // An arena with room for exactly one slab (plus its alignment).
+  sflz4_page_pool pool;
+  CHECK(!sflz4_page_pool_initialize(&pool, arena,
+                                    SFLZ4_PAGE_POOL_SLAB_LEN + 64 + 16));
+  CHECK(sflz4_page_pool_initialize(&pool, arena, SFLZ4_PAGE_POOL_SLAB_LEN) ==
+        sflz4_status_message__error_workspace_is_too_short);
+  CHECK(!sflz4_page_pool_initialize(&pool, arena,
+                                    SFLZ4_PAGE_POOL_SLAB_LEN + 64 + 16));
+
+  // A slab holds SFLZ4_PAGE_POOL_SLAB_LEN / PAGE_LEN raw pages.
+  const size_t n = SFLZ4_PAGE_POOL_SLAB_LEN / PAGE_LEN;
+  for (size_t i = 0; i < n; i++) {
+    sflz4_size_result r = sflz4_page_pool_store(&pool, pages[1 + (3 * i)]);
+    CHECK(!r.status_message);
+    handles[i] = r.value;
+  }
+  sflz4_size_result r = sflz4_page_pool_store(&pool, pages[1 + (3 * n)]);
+  CHECK(r.status_message == sflz4_status_message__error_workspace_is_too_short);
+  // The slab is full of raw pages, so compressible pages don't fit either.
+  r = sflz4_page_pool_store(&pool, pages[2]);
+  CHECK(r.status_message == sflz4_status_message__error_workspace_is_too_short);
+  // Uniform pages need no arena memory.
+  r = sflz4_page_pool_store(&pool, pages[0]);
+  CHECK(!r.status_message);
+  handles[n] = r.value;
+  check_stats(&pool, n + 1, 1, n);
+
+  // Freeing one raw page makes room for one more.
+  sflz4_page_pool_free(&pool, handles[0]);
+  r = sflz4_page_pool_store(&pool, pages[1 + (3 * n)]);
+  CHECK(!r.status_message);
+  handles[0] = r.value;
+  CHECK(!sflz4_page_pool_load(&pool, loaded, handles[0]) &&
+        !memcmp(loaded, pages[1 + (3 * n)], PAGE_LEN));
+
+  // Once the slab is empty, it can be reused by another size class.
+  for (size_t i = 0; i <= n; i++) {
+    sflz4_page_pool_free(&pool, handles[i]);
+  }
+  check_stats(&pool, 0, 0, 0);
+  r = sflz4_page_pool_store(&pool, pages[2]);
+  CHECK(!r.status_message);
+  CHECK(!sflz4_page_pool_load(&pool, loaded, r.value) &&
+        !memcmp(loaded, pages[2], PAGE_LEN));
+  sflz4_page_pool_free(&pool, r.value);
+  check_stats(&pool, 0, 0, 0);
+}
+
+static void  //
+test_bad_handles() {
+  sflz4_page_pool pool;
+  CHECK(!sflz4_page_pool_initialize(&pool, arena, ARENA_LEN));
+  sflz4_size_result r = sflz4_page_pool_store(&pool, pages[2]);
+  CHECK(!r.status_message);
+
+  static const size_t bad_handles[] = {
+      0x80000100,           // A uniform handle but not a byte value.
+      1 + (0x7FFFFF << 8),  // Past the arena's slabs.
+      1 + (1 << 8),         // A never used slab.
+      2,                    // A never used object.
+  };
+  for (size_t i = 0; i < (sizeof(bad_handles) / sizeof(bad_handles[0]));
+       i++) {
+    if (i < 2) {
+      CHECK(sflz4_page_pool_load(&pool, loaded, bad_handles[i]) ==
+            sflz4_status_message__error_bad_argument);
+    }
+    sflz4_page_pool_free(&pool, bad_handles[i]);
+    check_stats(&pool, 1, 0, 0);
+  }
+  CHECK(sflz4_page_pool_load(&pool, loaded, 0) ==
+        sflz4_status_message__error_bad_argument);
+
+  sflz4_page_pool_free(&pool, r.value);
+  check_stats(&pool, 0, 0, 0);
+  // The slab is now empty, so freeing the same handle again is ignored.
+  sflz4_page_pool_free(&pool, r.value);
+  check_stats(&pool, 0, 0, 0);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    make_page(i);
+  }
+  test_round_trips();
+  test_full_arena();
+  test_bad_handles();
+  return test_finish("page_pool_test");
+}
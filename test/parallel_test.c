@@ -0,0 +1,186 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// parallel_test.c tests the "LZ4 Parallel Encode" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined -pthread test/parallel_test.c && ./a.out
+
+#include <pthread.h>
+
+#include "test.h"
+
+#define SRC_MAX_LEN 0x100000
+#define NUM_THREADS 4
+
+uint8_t src[SRC_MAX_LEN];
+uint8_t decoded[SRC_MAX_LEN];
+
+// threaded_call is one thread's share of a threaded_parallel_for: every
+// NUM_THREADS'th call, from the highest index down.
+typedef struct {
+  size_t thread_index;
+  size_t n;
+  void (*func)(void* func_context, size_t i);
+  void* func_context;
+} threaded_call;
+
+static void*   //
+run_threaded(  //
+    void* arg) {
+  threaded_call* c = (threaded_call*)arg;
+  for (size_t i = c->n; i > 0; i--) {
+    if (((i - 1) % NUM_THREADS) == c->thread_index) {
+      (*c->func)(c->func_context, i - 1);
+    }
+  }
+  return NULL;
+}
+
+// threaded_parallel_for is a sflz4_parallel_for_func that spreads the calls
+// over NUM_THREADS threads.
+static void                                      //
+threaded_parallel_for(                           //
+    void* context,                               //
+    size_t n,                                    //
+    void (*func)(void* func_context, size_t i),  //
+    void* func_context) {
+  (void)context;
+  pthread_t threads[NUM_THREADS];
+  threaded_call calls[NUM_THREADS];
+  for (size_t t = 0; t < NUM_THREADS; t++) {
+    calls[t].thread_index = t;
+    calls[t].n = n;
+    calls[t].func = func;
+    calls[t].func_context = func_context;
+    if (pthread_create(&threads[t], NULL, &run_threaded, &calls[t])) {
+      run_threaded(&calls[t]);
+      threads[t] = pthread_self();
+    }
+  }
+  for (size_t t = 0; t < NUM_THREADS; t++) {
+    if (!pthread_equal(threads[t], pthread_self())) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+}
+
+// backwards_parallel_for is a sflz4_parallel_for_func that runs the calls
+// on the calling thread, in reverse order.
+static void                                      //
+backwards_parallel_for(                          //
+    void* context,                               //
+    size_t n,                                    //
+    void (*func)(void* func_context, size_t i),  //
+    void* func_context) {
+  (void)context;
+  while (n > 0) {
+    (*func)(func_context, --n);
+  }
+}
+
+// round_trip encodes src_len bytes of src with num_regions regions, once per
+// way of running the regions, checking that the outputs are identical and
+// that they decode back to src.
+static void          //
+round_trip(          //
+    size_t src_len,  //
+    size_t num_regions) {
+  sflz4_size_result r = sflz4_block_encode_worst_case_dst_len(src_len);
+  CHECK(!r.status_message);
+  const size_t dst_len = r.value;
+  r = sflz4_block_encode_parallel_workspace_len(src_len, num_regions);
+  CHECK(!r.status_message);
+  const size_t workspace_len = r.value;
+  uint8_t* workspace = (uint8_t*)malloc(workspace_len + 1);
+  uint8_t* dsts[3];
+  size_t lens[3];
+
+  static const sflz4_parallel_for_func funcs[3] = {
+      NULL,
+      &backwards_parallel_for,
+      &threaded_parallel_for,
+  };
+  for (int i = 0; i < 3; i++) {
+    dsts[i] = (uint8_t*)malloc(dst_len + 1);
+    r = sflz4_block_encode_parallel(dsts[i], dst_len, src, src_len, workspace,
+                                    workspace_len, num_regions, funcs[i],
+                                    NULL);
+    CHECK(!r.status_message);
+    lens[i] = r.value;
+    CHECK((lens[i] == lens[0]) && !memcmp(dsts[i], dsts[0], lens[0]));
+  }
+
+  r = sflz4_block_decode(decoded, src_len, dsts[0], lens[0]);
+  CHECK(!r.status_message && (r.value == src_len) &&
+        !memcmp(decoded, src, src_len));
+
+  r = sflz4_block_encode_parallel(dsts[0], dst_len, src, src_len, workspace,
+                                  workspace_len - 1, num_regions, NULL, NULL);
+  CHECK(r.status_message == sflz4_status_message__error_workspace_is_too_short);
+  r = sflz4_block_encode_parallel(dsts[0], dst_len - 1, src, src_len,
+                                  workspace, workspace_len, num_regions, NULL,
+                                  NULL);
+  CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+
+  for (int i = 0; i < 3; i++) {
+    free(dsts[i]);
+  }
+  free(workspace);
+}
+
+static void  //
+test_round_trips() {
+  for (size_t n = 1; n <= SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS;
+       n++) {
+    round_trip(30000, n);
+  }
+  static const size_t src_lens[] = {1, 15, 1000, 65536, SRC_MAX_LEN};
+  for (size_t i = 0; i < (sizeof(src_lens) / sizeof(src_lens[0])); i++) {
+    round_trip(src_lens[i], 1);
+    round_trip(src_lens[i], 7);
+    round_trip(src_lens[i], SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS);
+  }
+}
+
+static void  //
+test_bad_num_regions() {
+  uint8_t dst[64];
+  uint8_t workspace[64];
+  sflz4_size_result r =
+      sflz4_block_encode_parallel(dst, sizeof(dst), src, 10, workspace,
+                                  sizeof(workspace), 0, NULL, NULL);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+  r = sflz4_block_encode_parallel_workspace_len(
+      10, SFLZ4_BLOCK_ENCODE_PARALLEL_MAX_INCL_NUM_REGIONS + 1);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(src, SRC_MAX_LEN, 76);
+  // Make some of src incompressible, so that some regions have no matches.
+  uint32_t state = 76;
+  for (size_t i = 0x40000; i < 0x50000; i++) {
+    src[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  test_round_trips();
+  test_bad_num_regions();
+  return test_finish("parallel_test");
+}
@@ -0,0 +1,211 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// reader_test.c tests the "LZ4 Frame Random Access" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/reader_test.c && ./a.out
+
+#include "test.h"
+
+#define BLOCK_LEN 0x10000
+#define DATA_LEN ((7 * BLOCK_LEN) + 1000)
+#define MAX_BLOCKS 16
+
+uint8_t data[DATA_LEN];
+uint8_t buf[DATA_LEN];
+uint8_t frame[2 * DATA_LEN];
+size_t frame_len;
+sflz4_frame_block blocks[MAX_BLOCKS];
+size_t num_blocks;
+
+// make_frame encodes data, whose odd-numbered blocks are incompressible and
+// so are stored uncompressed.
+static void  //
+make_frame(  //
+    uint32_t flags) {
+  test_make_data(data, DATA_LEN, 80);
+  uint32_t state = 81;
+  for (size_t b = 1; (b * BLOCK_LEN) < DATA_LEN; b += 2) {
+    const size_t end = ((b + 1) * BLOCK_LEN < DATA_LEN) ? ((b + 1) * BLOCK_LEN)
+                                                        : DATA_LEN;
+    for (size_t i = b * BLOCK_LEN; i < end; i++) {
+      data[i] = (uint8_t)(test_rand(&state) >> 24);
+    }
+  }
+  sflz4_frame_encode_options options;
+  memset(&options, 0, sizeof(options));
+  options.block_max_len = BLOCK_LEN;
+  options.flags = flags;
+  sflz4_size_result r =
+      sflz4_frame_encode(frame, sizeof(frame), data, DATA_LEN, &options);
+  CHECK(!r.status_message);
+  frame_len = r.value;
+}
+
+// read_all reads the whole content into buf through a reader, in odd-sized
+// pieces and in a scattered order, returning NULL or the first failure.
+static const char*                //
+read_all(                         //
+    const sflz4_frame_block* bs,  //
+    size_t bs_len) {
+  sflz4_size_result wl = sflz4_reader_workspace_len(BLOCK_LEN, 3, 2);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value);
+  sflz4_reader r;
+  const char* status_message = sflz4_reader_initialize(
+      &r, frame, frame_len, bs, bs_len, workspace, wl.value, 3, 2);
+  memset(buf, 0, sizeof(buf));
+  for (size_t k = 0; !status_message && (k < 2); k++) {
+    const size_t piece = k ? 10007 : 333;
+    const size_t num_pieces = (DATA_LEN + piece - 1) / piece;
+    for (size_t j = 0; j < num_pieces; j++) {
+      // 7919 is prime and coprime with num_pieces for these lengths.
+      const size_t offset = ((j * 7919) % num_pieces) * piece;
+      sflz4_size_result g = sflz4_reader_read_at(&r, buf + offset, piece,
+                                                 offset);
+      if (g.status_message) {
+        status_message = g.status_message;
+        break;
+      }
+      CHECK(g.value == (((DATA_LEN - offset) < piece) ? (DATA_LEN - offset)
+                                                      : piece));
+    }
+  }
+  free(workspace);
+  return status_message;
+}
+
+static void  //
+test_round_trip() {
+  for (int seek_table = 0; seek_table < 2; seek_table++) {
+    make_frame(SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS |
+               (seek_table ? SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE : 0));
+    sflz4_size_result r = sflz4_frame_index_blocks(NULL, 0, frame, frame_len);
+    CHECK(!r.status_message && (r.value == 9));
+    num_blocks = r.value;
+    r = sflz4_frame_index_blocks(blocks, num_blocks - 1, frame, frame_len);
+    CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+    r = sflz4_frame_index_blocks(blocks, MAX_BLOCKS, frame, frame_len);
+    CHECK(!r.status_message && (r.value == num_blocks) &&
+          (blocks[num_blocks - 1].decoded_offset == DATA_LEN));
+    CHECK(!read_all(blocks, num_blocks) && !memcmp(buf, data, DATA_LEN));
+
+    sflz4_reader rd;
+    uint8_t one_byte = 0;
+    sflz4_size_result wl = sflz4_reader_workspace_len(BLOCK_LEN, 1, 1);
+    uint8_t* workspace = (uint8_t*)malloc(wl.value);
+    CHECK(!sflz4_reader_initialize(&rd, frame, frame_len, blocks, num_blocks,
+                                   workspace, wl.value, 1, 1));
+    r = sflz4_reader_read_at(&rd, &one_byte, 1, DATA_LEN);
+    CHECK(!r.status_message && (r.value == 0));
+    free(workspace);
+  }
+}
+
+// test_mismatched_seek_table moves 10 bytes of decoded length from an
+// uncompressed block's seek table entry to the next (compressed) block's.
+// The totals still add up, so only cross-checking against the block
+// headers catches it.
+static void  //
+test_mismatched_seek_table() {
+  make_frame(SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE);
+  const size_t n = 8;
+  uint8_t* table = frame + frame_len - ((8 * n) + 8);
+  const uint32_t d1 = sflz4_private_peek_u32le(table + 8 + 4);
+  const uint32_t d2 = sflz4_private_peek_u32le(table + 16 + 4);
+  CHECK((d1 == BLOCK_LEN) && (d2 == BLOCK_LEN));
+  sflz4_private_poke_u32le(table + 8 + 4, d1 - 10);
+  sflz4_private_poke_u32le(table + 16 + 4, d2 + 10);
+  sflz4_size_result r =
+      sflz4_frame_index_blocks(blocks, MAX_BLOCKS, frame, frame_len);
+  CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+
+  // A mismatched encoded length is also caught.
+  sflz4_private_poke_u32le(table + 8 + 4, d1);
+  sflz4_private_poke_u32le(table + 16 + 4, d2);
+  const uint32_t e1 = sflz4_private_peek_u32le(table + 8);
+  const uint32_t e2 = sflz4_private_peek_u32le(table + 16);
+  sflz4_private_poke_u32le(table + 8, e1 + 4);
+  sflz4_private_poke_u32le(table + 16, e2 - 4);
+  r = sflz4_frame_index_blocks(blocks, MAX_BLOCKS, frame, frame_len);
+  CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+}
+
+// test_mismatched_blocks passes the reader an index that doesn't match the
+// frame. Reads must fail, not return the wrong bytes.
+static void  //
+test_mismatched_blocks() {
+  make_frame(0);
+  sflz4_size_result r =
+      sflz4_frame_index_blocks(blocks, MAX_BLOCKS, frame, frame_len);
+  CHECK(!r.status_message);
+  num_blocks = r.value;
+  sflz4_frame_block bad[MAX_BLOCKS];
+  for (size_t i = 1; i < (num_blocks - 1); i++) {
+    memcpy(bad, blocks, sizeof(blocks));
+    bad[i].decoded_offset -= 10;
+    CHECK(read_all(bad, num_blocks) ==
+          sflz4_status_message__error_invalid_data);
+  }
+
+  // Reading only from the uncompressed block 1, when the index says that it
+  // is 10 bytes shorter than it is.
+  memcpy(bad, blocks, sizeof(blocks));
+  bad[2].decoded_offset -= 10;
+  sflz4_size_result wl = sflz4_reader_workspace_len(BLOCK_LEN, 1, 1);
+  uint8_t* workspace = (uint8_t*)malloc(wl.value);
+  sflz4_reader rd;
+  CHECK(!sflz4_reader_initialize(&rd, frame, frame_len, bad, num_blocks,
+                                 workspace, wl.value, 1, 1));
+  r = sflz4_reader_read_at(&rd, buf, 100, BLOCK_LEN + 100);
+  CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+  free(workspace);
+}
+
+static void  //
+test_corrupt_input() {
+  make_frame(SFLZ4_FRAME_ENCODE_FLAGS__SEEK_TABLE |
+             SFLZ4_FRAME_ENCODE_FLAGS__BLOCK_CHECKSUMS);
+  uint8_t* original = (uint8_t*)malloc(frame_len);
+  memcpy(original, frame, frame_len);
+  uint32_t state = 82;
+  for (int k = 0; k < 30; k++) {
+    memcpy(frame, original, frame_len);
+    uint32_t x = test_rand(&state);
+    frame[(x >> 3) % frame_len] ^= (uint8_t)(1 << (x & 7));
+    sflz4_size_result r =
+        sflz4_frame_index_blocks(blocks, MAX_BLOCKS, frame, frame_len);
+    if (!r.status_message) {
+      // Uncompressed blocks aren't checksummed when read in place, so a
+      // flipped bit in one of them isn't caught. This only checks that
+      // reads don't crash.
+      read_all(blocks, r.value);
+    }
+  }
+  free(original);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_round_trip();
+  test_mismatched_seek_table();
+  test_mismatched_blocks();
+  test_corrupt_input();
+  return test_finish("reader_test");
+}
@@ -0,0 +1,248 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// records_test.c tests the "LZ4 Record Container" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/records_test.c && ./a.out
+
+#include "test.h"
+
+#define DATA_LEN 200000
+#define NUM_RECORDS_MAX (DATA_LEN + 1)
+#define BLOCK_MAX_LEN 4096
+
+uint8_t data[DATA_LEN];
+size_t offsets[NUM_RECORDS_MAX];
+size_t lengths[NUM_RECORDS_MAX];
+size_t num_records;
+
+uint8_t container[2 * DATA_LEN];
+size_t container_len;
+
+uint64_t scan_next_id;
+int scan_mismatches;
+
+static void                     //
+scan_func(                      //
+    void* context,              //
+    uint64_t record_id,         //
+    const uint8_t* record_ptr,  //
+    size_t record_len) {
+  (void)context;
+  if ((record_id != scan_next_id) || (record_id >= num_records) ||
+      (record_len != lengths[record_id]) ||
+      memcmp(record_ptr, data + offsets[record_id], record_len)) {
+    scan_mismatches++;
+  }
+  scan_next_id++;
+}
+
+static void  //
+test_round_trip() {
+  test_make_data(data, DATA_LEN, 1);
+  uint32_t state = 2;
+  num_records = 0;
+  for (size_t i = 0; i < DATA_LEN;) {
+    uint32_t r = test_rand(&state);
+    size_t n = ((r & 15) == 0) ? 0 : (r >> 8) % 300;
+    if ((r & 1023) == 1) {
+      n = BLOCK_MAX_LEN;
+    }
+    n = (n < (DATA_LEN - i)) ? n : (DATA_LEN - i);
+    offsets[num_records] = i;
+    lengths[num_records] = n;
+    num_records++;
+    i += n;
+  }
+
+  sflz4_size_result r = sflz4_record_writer_workspace_len(BLOCK_MAX_LEN);
+  CHECK(!r.status_message);
+  uint8_t* workspace = (uint8_t*)malloc(r.value);
+  sflz4_record_writer w;
+  CHECK(!sflz4_record_writer_initialize(&w, container, sizeof(container),
+                                        workspace, r.value, BLOCK_MAX_LEN));
+  CHECK(sflz4_record_writer_add(&w, data, BLOCK_MAX_LEN + 1) ==
+        sflz4_status_message__error_bad_argument);
+  for (size_t i = 0; i < num_records; i++) {
+    CHECK(!sflz4_record_writer_add(&w, data + offsets[i], lengths[i]));
+  }
+  r = sflz4_record_writer_finish(&w);
+  CHECK(!r.status_message);
+  container_len = r.value;
+  free(workspace);
+
+  r = sflz4_records_num_records(container, container_len);
+  CHECK(!r.status_message && (r.value == num_records));
+  r = sflz4_records_scratch_len(container, container_len);
+  CHECK(!r.status_message);
+  size_t scratch_len = r.value;
+  uint8_t* scratch = (uint8_t*)malloc(scratch_len);
+  uint8_t record[BLOCK_MAX_LEN];
+
+  for (size_t i = 0; i < num_records; i += 1 + (i % 7)) {
+    r = sflz4_records_get(record, sizeof(record), container, container_len, i,
+                          scratch, scratch_len);
+    CHECK(!r.status_message && (r.value == lengths[i]) &&
+          !memcmp(record, data + offsets[i], lengths[i]));
+  }
+  r = sflz4_records_get(record, sizeof(record), container, container_len,
+                        num_records, scratch, scratch_len);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+
+  scan_next_id = 0;
+  scan_mismatches = 0;
+  CHECK(!sflz4_records_scan(container, container_len, scratch, scratch_len,
+                            &scan_func, NULL));
+  CHECK((scan_next_id == num_records) && !scan_mismatches);
+  free(scratch);
+}
+
+static void  //
+test_corrupt_input() {
+  uint8_t* c = (uint8_t*)malloc(container_len);
+  uint8_t* scratch = (uint8_t*)malloc(BLOCK_MAX_LEN);
+  uint8_t record[BLOCK_MAX_LEN];
+  uint32_t state = 3;
+
+  // Truncated containers. Copying to an exactly sized allocation lets the
+  // address sanitizer catch any out of bounds read.
+  for (int k = 0; k < 300; k++) {
+    size_t n = test_rand(&state) % container_len;
+    uint8_t* t = (uint8_t*)malloc(n + 1);
+    memcpy(t, container, n);
+    sflz4_records_get(record, sizeof(record), t, n,
+                      test_rand(&state) % num_records, scratch,
+                      BLOCK_MAX_LEN);
+    sflz4_records_scan(t, n, scratch, BLOCK_MAX_LEN, &scan_func, NULL);
+    free(t);
+  }
+
+  // Flipped bits. These must fail cleanly or (for bits within the LZ4
+  // literals) succeed, but never crash.
+  for (int k = 0; k < 3000; k++) {
+    memcpy(c, container, container_len);
+    uint32_t r = test_rand(&state);
+    c[(r >> 3) % container_len] ^= (uint8_t)(1 << (r & 7));
+    sflz4_records_get(record, sizeof(record), c, container_len,
+                      test_rand(&state) % num_records, scratch,
+                      BLOCK_MAX_LEN);
+    sflz4_records_scan(c, container_len, scratch, BLOCK_MAX_LEN, &scan_func,
+                       NULL);
+  }
+  free(scratch);
+  free(c);
+}
+
+#define RECORDS_MAGIC 0x31525A53
+
+static uint8_t*  //
+put_le(          //
+    uint8_t* p,  //
+    uint64_t x,  //
+    int n) {
+  for (int i = 0; i < n; i++) {
+    *p++ = (uint8_t)(x >> (8 * i));
+  }
+  return p;
+}
+
+static uint8_t*  //
+put_varint(      //
+    uint8_t* p,  //
+    uint64_t x) {
+  for (; x >= 0x80; x >>= 7) {
+    *p++ = (uint8_t)(x | 0x80);
+  }
+  *p++ = (uint8_t)x;
+  return p;
+}
+
+// make_container writes a one block container whose index holds the given
+// record lengths (which need not match the block's decoded length).
+static size_t                  //
+make_container(                //
+    uint8_t* dst_ptr,          //
+    const uint64_t* lens_ptr,  //
+    size_t lens_len,           //
+    const uint8_t* lz4_ptr,    //
+    size_t lz4_len) {
+  uint8_t* p = dst_ptr;
+  p = put_le(p, RECORDS_MAGIC, 4);
+  p = put_le(p, BLOCK_MAX_LEN, 4);
+  p = put_varint(p, lens_len);
+  for (size_t i = 0; i < lens_len; i++) {
+    p = put_varint(p, lens_ptr[i]);
+  }
+  p = put_le(p, lz4_len, 4);
+  memcpy(p, lz4_ptr, lz4_len);
+  p += lz4_len;
+  const uint64_t dir_offset = (uint64_t)(p - dst_ptr);
+  p = put_le(p, 8, 8);
+  p = put_le(p, 0, 8);
+  p = put_le(p, dir_offset, 8);
+  p = put_le(p, lens_len, 8);
+  p = put_le(p, 1, 8);
+  p = put_le(p, RECORDS_MAGIC, 4);
+  return (size_t)(p - dst_ptr);
+}
+
+static void  //
+test_crafted_index() {
+  // An LZ4 block that decodes to 32 bytes of 'x'.
+  static const uint8_t lz4[] = {0x1F, 'x', 0x01, 0x00, 0x0C, 0x50,
+                                'x',  'x', 'x',  'x',  'x'};
+  uint8_t scratch[BLOCK_MAX_LEN];
+  uint8_t record[64];
+  uint8_t c[256];
+
+  // A valid index, as a control.
+  static const uint64_t good[3] = {10, 2, 20};
+  size_t n = make_container(c, good, 3, lz4, sizeof(lz4));
+  sflz4_size_result r = sflz4_records_get(record, sizeof(record), c, n, 2,
+                                          scratch, sizeof(scratch));
+  CHECK(!r.status_message && (r.value == 20));
+
+  // Lengths whose sum wraps around a uint64_t.
+  static const uint64_t wrap[3] = {0x8000000000000000ull,
+                                   0x7FFFFFFFFFFFFFF6ull, 20};
+  n = make_container(c, wrap, 3, lz4, sizeof(lz4));
+  for (uint64_t i = 0; i < 3; i++) {
+    r = sflz4_records_get(record, sizeof(record), c, n, i, scratch,
+                          sizeof(scratch));
+    CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+  }
+  CHECK(sflz4_records_scan(c, n, scratch, sizeof(scratch), &scan_func,
+                           NULL) == sflz4_status_message__error_invalid_data);
+
+  // Lengths that overrun block_max_len without wrapping.
+  static const uint64_t over[2] = {BLOCK_MAX_LEN, 1};
+  n = make_container(c, over, 2, lz4, sizeof(lz4));
+  r = sflz4_records_get(record, sizeof(record), c, n, 1, scratch,
+                        sizeof(scratch));
+  CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_round_trip();
+  test_corrupt_input();
+  test_crafted_index();
+  return test_finish("records_test");
+}
@@ -0,0 +1,225 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// ring_test.c tests the "LZ4 Shared Memory Rings" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined -pthread test/ring_test.c && ./a.out
+
+#include <pthread.h>
+
+#include "test.h"
+
+#define DATA_LEN 0x10000
+#define SHARED_LEN (SFLZ4_RING_HEADER_LEN + DATA_LEN)
+#define MESSAGE_MAX_LEN 2000
+#define NUM_THREADED_MESSAGES 50000
+
+uint64_t shared[SHARED_LEN / 8];
+uint8_t text[MESSAGE_MAX_LEN + NUM_THREADED_MESSAGES];
+
+// message_len returns the i'th message's length. Message i is the
+// message_len(i) bytes of text starting at text[i].
+static size_t  //
+message_len(uint32_t i) {
+  uint32_t state = i + 1;
+  return test_rand(&state) % (MESSAGE_MAX_LEN + 1);
+}
+
+static void  //
+test_initialize_and_attach() {
+  uint8_t* s = (uint8_t*)shared;
+  CHECK(sflz4_ring_shared_len(DATA_LEN).value == SHARED_LEN);
+  CHECK(sflz4_ring_shared_len(DATA_LEN + 8).status_message);
+  CHECK(sflz4_ring_shared_len(0x800).status_message);
+  CHECK(sflz4_ring_initialize(s + 4, SHARED_LEN - 8, MESSAGE_MAX_LEN));
+  CHECK(sflz4_ring_initialize(s, SHARED_LEN - 8, MESSAGE_MAX_LEN));
+  CHECK(sflz4_ring_initialize(s, SHARED_LEN, DATA_LEN));
+  CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+
+  sflz4_ring_producer p;
+  sflz4_ring_consumer c;
+  CHECK(sflz4_ring_producer_attach(&p, s, SHARED_LEN - 1));
+  CHECK(sflz4_ring_consumer_attach(&c, s + 8, SHARED_LEN - 8));
+  CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+  CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+  sflz4_size_result r = sflz4_ring_send(&p, text, MESSAGE_MAX_LEN + 1);
+  CHECK(r.status_message == sflz4_status_message__error_bad_argument);
+}
+
+// test_single_thread fills and drains the ring, then wraps around it many
+// times with sends and receives interleaved.
+static void  //
+test_single_thread() {
+  uint8_t* s = (uint8_t*)shared;
+  CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+  sflz4_ring_producer p;
+  sflz4_ring_consumer c;
+  CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+  CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+
+  uint8_t dst[MESSAGE_MAX_LEN];
+  int received = 1;
+  sflz4_size_result r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+  CHECK(!r.status_message && !received);
+
+  uint32_t num_sent = 0;
+  while (1) {
+    r = sflz4_ring_send(&p, text + num_sent, MESSAGE_MAX_LEN);
+    CHECK(!r.status_message);
+    if (!r.value) {
+      break;
+    }
+    num_sent++;
+  }
+  // The text compresses, so more messages fit than their decoded length.
+  CHECK(num_sent > (DATA_LEN / MESSAGE_MAX_LEN));
+
+  r = sflz4_ring_receive(&c, dst, MESSAGE_MAX_LEN - 1, &received);
+  CHECK((r.status_message == sflz4_status_message__error_dst_is_too_short) &&
+        !received);
+  for (uint32_t i = 0; i < num_sent; i++) {
+    r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+    CHECK(!r.status_message && received && (r.value == MESSAGE_MAX_LEN) &&
+          !memcmp(dst, text + i, MESSAGE_MAX_LEN));
+  }
+  r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+  CHECK(!r.status_message && !received);
+
+  uint32_t next_send = 0;
+  uint32_t next_receive = 0;
+  uint32_t state = 95;
+  for (int k = 0; k < 100000; k++) {
+    if (test_rand(&state) & 1) {
+      r = sflz4_ring_send(&p, text + next_send, message_len(next_send));
+      CHECK(!r.status_message);
+      next_send += r.value ? 1 : 0;
+    } else {
+      r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+      CHECK(!r.status_message && (received == (next_receive < next_send)));
+      if (received) {
+        CHECK((r.value == message_len(next_receive)) &&
+              !memcmp(dst, text + next_receive, r.value));
+        next_receive++;
+      }
+    }
+  }
+  CHECK(next_receive > 1000);
+}
+
+static void  //
+test_corruption() {
+  uint8_t* s = (uint8_t*)shared;
+  CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+  sflz4_ring_producer p;
+  sflz4_ring_consumer c;
+  CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+  CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+
+  // A record whose lengths run past the end of the data, or exceed
+  // message_max_len, is rejected.
+  uint8_t dst[MESSAGE_MAX_LEN];
+  int received = 0;
+  const uint32_t bad_lens[3][2] = {
+      {DATA_LEN, 100},
+      {100, MESSAGE_MAX_LEN + 1},
+      {0x80000000 | 100, 200},
+  };
+  for (int i = 0; i < 3; i++) {
+    CHECK(sflz4_ring_send(&p, text, 100).value);
+    uint8_t* record = s + SFLZ4_RING_HEADER_LEN;
+    memcpy(record, bad_lens[i], 8);
+    sflz4_size_result r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+    CHECK(r.status_message == sflz4_status_message__error_invalid_data);
+    CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+    CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+    CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+  }
+
+  // Other bit flips must not crash the consumer.
+  uint32_t state = 96;
+  for (int k = 0; k < 200; k++) {
+    CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+    CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+    CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+    for (uint32_t i = 0; sflz4_ring_send(&p, text + i, message_len(i)).value;
+         i++) {
+    }
+    uint32_t x = test_rand(&state);
+    s[SFLZ4_RING_HEADER_LEN + ((x >> 3) % DATA_LEN)] ^=
+        (uint8_t)(1 << (x & 7));
+    for (int i = 0; i < 1000; i++) {
+      sflz4_size_result r =
+          sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+      if (r.status_message || !received) {
+        break;
+      }
+    }
+  }
+}
+
+static void*  //
+produce(      //
+    void* arg) {
+  sflz4_ring_producer* p = (sflz4_ring_producer*)arg;
+  for (uint32_t i = 0; i < NUM_THREADED_MESSAGES;) {
+    sflz4_size_result r = sflz4_ring_send(p, text + i, message_len(i));
+    CHECK(!r.status_message);
+    i += r.value ? 1 : 0;
+  }
+  return NULL;
+}
+
+// test_two_threads passes messages from a producer thread to a consumer
+// thread, which checks that each arrives intact and in order.
+static void  //
+test_two_threads() {
+  uint8_t* s = (uint8_t*)shared;
+  CHECK(!sflz4_ring_initialize(s, SHARED_LEN, MESSAGE_MAX_LEN));
+  sflz4_ring_producer p;
+  sflz4_ring_consumer c;
+  CHECK(!sflz4_ring_producer_attach(&p, s, SHARED_LEN));
+  CHECK(!sflz4_ring_consumer_attach(&c, s, SHARED_LEN));
+
+  pthread_t producer;
+  CHECK(!pthread_create(&producer, NULL, &produce, &p));
+  uint8_t dst[MESSAGE_MAX_LEN];
+  for (uint32_t i = 0; i < NUM_THREADED_MESSAGES;) {
+    int received = 0;
+    sflz4_size_result r = sflz4_ring_receive(&c, dst, sizeof(dst), &received);
+    if (r.status_message) {
+      CHECK(!r.status_message);
+      break;
+    } else if (received) {
+      CHECK((r.value == message_len(i)) && !memcmp(dst, text + i, r.value));
+      i++;
+    }
+  }
+  pthread_join(producer, NULL);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(text, sizeof(text), 95);
+  test_initialize_and_attach();
+  test_single_thread();
+  test_corruption();
+  test_two_threads();
+  return test_finish("ring_test");
+}
@@ -0,0 +1,192 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// segments_test.c tests the "LZ4 Segments" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined -pthread test/segments_test.c && ./a.out
+
+#include <pthread.h>
+
+#include "test.h"
+
+#define SRC_MAX_LEN 300000
+#define SEGMENTS_MAX_LEN 64
+
+uint8_t src[SRC_MAX_LEN];
+uint8_t encoded[SRC_MAX_LEN + (SRC_MAX_LEN / 255) + 16];
+uint8_t decoded[SRC_MAX_LEN];
+sflz4_segment segments[SEGMENTS_MAX_LEN];
+
+// segmented_block describes the block that sflz4_block_encode_segmented last
+// wrote to encoded (and whose side index it wrote to segments).
+typedef struct {
+  size_t src_len;
+  size_t encoded_len;
+  size_t segments_len;
+} segmented_block;
+
+segmented_block block;
+
+// decode_one decodes the i'th segment of block into its place in decoded.
+static void  //
+decode_one(  //
+    size_t i) {
+  const sflz4_segment* s = &segments[i];
+  const size_t encoded_end = ((i + 1) < block.segments_len)
+                                 ? segments[i + 1].encoded_offset
+                                 : block.encoded_len;
+  const size_t decoded_end = ((i + 1) < block.segments_len)
+                                 ? segments[i + 1].decoded_offset
+                                 : block.src_len;
+  CHECK((s->encoded_offset <= encoded_end) &&
+        (s->decoded_offset <= decoded_end));
+  sflz4_size_result r = sflz4_block_decode_segment(
+      decoded + s->decoded_offset, decoded_end - s->decoded_offset,
+      encoded + s->encoded_offset, encoded_end - s->encoded_offset);
+  CHECK(!r.status_message && (r.value == (decoded_end - s->decoded_offset)));
+}
+
+static void*     //
+run_decode_one(  //
+    void* arg) {
+  decode_one((size_t)(uintptr_t)arg);
+  return NULL;
+}
+
+static void  //
+check_decoded() {
+  CHECK(!memcmp(decoded, src, block.src_len));
+  memset(decoded, 0xAA, sizeof(decoded));
+}
+
+static void          //
+round_trip(          //
+    size_t src_len,  //
+    size_t segments_len) {
+  sflz4_size_result r = sflz4_block_encode_segmented(
+      encoded, sizeof(encoded), src, src_len, segments, segments_len);
+  CHECK(!r.status_message);
+  block.src_len = src_len;
+  block.encoded_len = r.value;
+  block.segments_len = segments_len;
+  CHECK((segments[0].encoded_offset == 0) &&
+        (segments[0].decoded_offset == 0));
+  memset(decoded, 0xAA, sizeof(decoded));
+
+  // Backwards.
+  for (size_t i = segments_len; i > 0; i--) {
+    decode_one(i - 1);
+  }
+  check_decoded();
+
+  // Shuffled.
+  size_t order[SEGMENTS_MAX_LEN];
+  for (size_t i = 0; i < segments_len; i++) {
+    order[i] = i;
+  }
+  uint32_t state = (uint32_t)(src_len + segments_len);
+  for (size_t i = segments_len; i > 1; i--) {
+    size_t j = test_rand(&state) % i;
+    size_t t = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = t;
+  }
+  for (size_t i = 0; i < segments_len; i++) {
+    decode_one(order[i]);
+  }
+  check_decoded();
+
+  // Concurrently, one thread per segment.
+  pthread_t threads[SEGMENTS_MAX_LEN];
+  for (size_t i = 0; i < segments_len; i++) {
+    if (pthread_create(&threads[i], NULL, &run_decode_one,
+                       (void*)(uintptr_t)i)) {
+      decode_one(i);
+      threads[i] = pthread_self();
+    }
+  }
+  for (size_t i = 0; i < segments_len; i++) {
+    if (!pthread_equal(threads[i], pthread_self())) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  check_decoded();
+
+  // The whole block is also an ordinary LZ4 block.
+  r = sflz4_block_decode(decoded, src_len, encoded, block.encoded_len);
+  CHECK(!r.status_message && (r.value == src_len));
+  check_decoded();
+}
+
+static void  //
+test_round_trips() {
+  static const size_t src_lens[] = {1, 7, 100, 4096, 65536, SRC_MAX_LEN};
+  static const size_t segments_lens[] = {1, 2, 3, 8, 13, SEGMENTS_MAX_LEN};
+  for (size_t i = 0; i < (sizeof(src_lens) / sizeof(src_lens[0])); i++) {
+    for (size_t j = 0; j < (sizeof(segments_lens) / sizeof(segments_lens[0]));
+         j++) {
+      round_trip(src_lens[i], segments_lens[j]);
+    }
+  }
+}
+
+static void  //
+test_empty_segments() {
+  // With more segments than bytes, some segments must be empty.
+  round_trip(10, SEGMENTS_MAX_LEN);
+  size_t num_empty = 0;
+  for (size_t i = 0; (i + 1) < SEGMENTS_MAX_LEN; i++) {
+    if (segments[i].encoded_offset == segments[i + 1].encoded_offset) {
+      CHECK(segments[i].decoded_offset == segments[i + 1].decoded_offset);
+      num_empty++;
+    }
+  }
+  CHECK(num_empty > 0);
+
+  // A single 4 KiB literal run straddles every nominal boundary, so every
+  // segment but the last is empty.
+  uint32_t state = 77;
+  for (size_t i = 0; i < 4096; i++) {
+    src[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  round_trip(4096, 8);
+  for (size_t i = 0; (i + 1) < 8; i++) {
+    CHECK(segments[i].decoded_offset == 0);
+  }
+  test_make_data(src, SRC_MAX_LEN, 77);
+}
+
+static void  //
+test_bad_arguments() {
+  CHECK(sflz4_block_encode_segmented(encoded, sizeof(encoded), src, 100,
+                                     segments, 0)
+            .status_message == sflz4_status_message__error_bad_argument);
+  CHECK(sflz4_block_encode_segmented(encoded, 100, src, 100, segments, 1)
+            .status_message == sflz4_status_message__error_dst_is_too_short);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(src, SRC_MAX_LEN, 77);
+  test_round_trips();
+  test_empty_segments();
+  test_bad_arguments();
+  return test_finish("segments_test");
+}
@@ -0,0 +1,216 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// sparse_test.c tests the "LZ4 Sparse Streams" section of src/sflz4.h.
+//
+// $ gcc -fsanitize=address,undefined test/sparse_test.c && ./a.out
+
+#include "test.h"
+
+#define FILE_LEN (3 * SFLZ4_SPARSE_MAX_INCL_DATA_LEN)
+#define HOLE_LEN 0x123456789ull
+
+uint8_t file[FILE_LEN];
+uint8_t decoded[FILE_LEN + SFLZ4_SPARSE_MAX_INCL_DATA_LEN];
+uint8_t* stream;
+size_t stream_len;
+size_t expected_zeroes_len;
+
+static const size_t chunks[4] = {
+    SFLZ4_SPARSE_MAX_INCL_DATA_LEN,
+    1000,
+    SFLZ4_SPARSE_MAX_INCL_DATA_LEN,
+    SFLZ4_SPARSE_MAX_INCL_DATA_LEN - 1000,
+};
+
+// make_file fills file with compressible data, random (incompressible)
+// data and zero runs, some whole SFLZ4_SPARSE_ZERO_CHUNK_LEN chunks and some
+// not.
+static void  //
+make_file() {
+  test_make_data(file, FILE_LEN, 92);
+  uint32_t state = 92;
+  for (size_t i = 0x100000; i < 0x180000; i++) {
+    file[i] = (uint8_t)(test_rand(&state) >> 24);
+  }
+  memset(file + 0x200000, 0, 0x300000);
+  memset(file + 0x600123, 0, 3 * SFLZ4_SPARSE_ZERO_CHUNK_LEN);
+  memset(file + FILE_LEN - 0x4000, 0, 0x4000);
+
+  // Only whole zero chunks, counted from the start of each of the encoded
+  // chunks (which are not all chunk-aligned), become holes.
+  expected_zeroes_len = 0;
+  size_t offset = 0;
+  for (int i = 0; i < 4; i++) {
+    for (size_t j = 0; (j + SFLZ4_SPARSE_ZERO_CHUNK_LEN) <= chunks[i];
+         j += SFLZ4_SPARSE_ZERO_CHUNK_LEN) {
+      size_t k = 0;
+      while ((k < SFLZ4_SPARSE_ZERO_CHUNK_LEN) && !file[offset + j + k]) {
+        k++;
+      }
+      if (k == SFLZ4_SPARSE_ZERO_CHUNK_LEN) {
+        expected_zeroes_len += k;
+      }
+    }
+    offset += chunks[i];
+  }
+}
+
+// encode writes a stream for a hole, then file (in chunks), then another
+// hole.
+static void  //
+encode(uint32_t flags) {
+  const size_t cap =
+      sflz4_sparse_encode_worst_case_dst_len(SFLZ4_SPARSE_MAX_INCL_DATA_LEN)
+          .value;
+  stream = (uint8_t*)realloc(stream, (4 * cap) + 64);
+  uint8_t* p = stream;
+  sflz4_size_result r = sflz4_sparse_encode_hole(p, 64, HOLE_LEN, flags);
+  CHECK(!r.status_message &&
+        (r.value <= (SFLZ4_SPARSE_RECORD_HEADER_LEN + 4)));
+  p += r.value;
+  r = sflz4_sparse_encode_hole(p, 64, 0, flags);
+  CHECK(!r.status_message && (r.value == 0));
+
+  size_t offset = 0;
+  for (int i = 0; i < 4; i++) {
+    const size_t n = sflz4_sparse_encode_worst_case_dst_len(chunks[i]).value;
+    r = sflz4_sparse_encode_data(p, n - 1, file + offset, chunks[i], flags);
+    CHECK(r.status_message == sflz4_status_message__error_dst_is_too_short);
+    r = sflz4_sparse_encode_data(p, n, file + offset, chunks[i], flags);
+    CHECK(!r.status_message);
+    p += r.value;
+    offset += chunks[i];
+  }
+  CHECK(offset == FILE_LEN);
+  r = sflz4_sparse_encode_data(p, cap, file,
+                               SFLZ4_SPARSE_MAX_INCL_DATA_LEN + 1, flags);
+  CHECK(r.status_message == sflz4_status_message__error_src_is_too_long);
+
+  r = sflz4_sparse_encode_hole(p, 64, HOLE_LEN, flags);
+  CHECK(!r.status_message);
+  p += r.value;
+  stream_len = (size_t)(p - stream);
+  CHECK(stream_len < (FILE_LEN / 2));
+}
+
+// decode decodes src, returning NULL on success. On success, the data
+// (excluding the leading and trailing holes, which must both be HOLE_LEN
+// long) is in decoded and the sum of the inner holes' lengths is
+// *zeroes_len.
+static const char*         //
+decode(                    //
+    const uint8_t* s_ptr,  //
+    size_t s_len,          //
+    size_t* zeroes_len) {
+  uint64_t total_hole_len = 0;
+  size_t n = 0;
+  *zeroes_len = 0;
+  for (int i = 0; s_len > 0; i++) {
+    sflz4_size_result r = sflz4_sparse_record_len(s_ptr, s_len);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (r.value > s_len) {
+      return sflz4_status_message__error_invalid_data;
+    }
+    const size_t record_len = r.value;
+    uint64_t hole_len = 0;
+    r = sflz4_sparse_decode_record(decoded + n, sizeof(decoded) - n, s_ptr,
+                                   record_len, &hole_len);
+    if (r.status_message) {
+      return r.status_message;
+    } else if (hole_len) {
+      CHECK(r.value == 0);
+      if (i == 0) {
+        if (hole_len != HOLE_LEN) {
+          return "#test: wrong leading hole";
+        }
+      } else if (record_len == s_len) {
+        if (hole_len != HOLE_LEN) {
+          return "#test: wrong trailing hole";
+        }
+      } else if (hole_len > (sizeof(decoded) - n)) {
+        return "#test: hole too long";
+      } else {
+        memset(decoded + n, 0, (size_t)hole_len);
+        n += (size_t)hole_len;
+        *zeroes_len += (size_t)hole_len;
+      }
+      total_hole_len += hole_len;
+    } else {
+      n += r.value;
+    }
+    s_ptr += record_len;
+    s_len -= record_len;
+  }
+  if ((n != FILE_LEN) || memcmp(decoded, file, FILE_LEN)) {
+    return "#test: wrong data";
+  }
+  return NULL;
+}
+
+static void  //
+test_round_trip() {
+  for (uint32_t flags = 0; flags < 2; flags++) {
+    encode(flags ? SFLZ4_SPARSE_ENCODE_FLAGS__CRC32C : 0);
+    size_t zeroes_len = 0;
+    CHECK(!decode(stream, stream_len, &zeroes_len));
+    CHECK(zeroes_len == expected_zeroes_len);
+    CHECK(expected_zeroes_len > 0x300000);
+  }
+}
+
+static void  //
+test_corruption() {
+  encode(0);
+  uint8_t* c = (uint8_t*)malloc(stream_len);
+  uint32_t state = 93;
+  for (int k = 0; k < 40; k++) {
+    // Every record is checksummed, so a bit flip is either caught or is
+    // harmless (e.g. it picks an equivalent LZ4 match).
+    memcpy(c, stream, stream_len);
+    uint32_t x = test_rand(&state);
+    c[(x >> 3) % stream_len] ^= (uint8_t)(1 << (x & 7));
+    size_t zeroes_len = 0;
+    const char* status_message = decode(c, stream_len, &zeroes_len);
+    CHECK(!status_message || !strncmp(status_message, "#sflz4: ", 8));
+
+    // A truncated record is always caught.
+    status_message = decode(stream, (x >> 3) % stream_len, &zeroes_len);
+    CHECK(status_message);
+  }
+  free(c);
+
+  uint64_t hole_len = 0;
+  sflz4_size_result r = sflz4_sparse_record_len(stream, 15);
+  CHECK(r.status_message);
+  r = sflz4_sparse_decode_record(decoded, sizeof(decoded), stream, 19,
+                                 &hole_len);
+  CHECK(r.status_message);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  make_file();
+  test_round_trip();
+  test_corruption();
+  free(stream);
+  return test_finish("sparse_test");
+}
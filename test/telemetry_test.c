@@ -0,0 +1,336 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// telemetry_test.c tests the "Telemetry" section of src/sflz4.h: that every
+// layer's block and frame calls are counted, as documented, exactly once.
+//
+// $ gcc -fsanitize=address,undefined test/telemetry_test.c && ./a.out
+
+#define SFLZ4_CONFIG__TELEMETRY
+#include "test.h"
+
+#define DATA_LEN 300000
+#define BLOCK_MAX_LEN 65536
+
+uint8_t data[DATA_LEN];
+uint8_t encoded[2 * DATA_LEN];
+uint8_t decoded[DATA_LEN];
+uint8_t workspace[4 * DATA_LEN];
+
+sflz4_dictionary dictionary;
+
+sflz4_telemetry_snapshot previous;
+
+// check_calls checks how many calls of each op were counted since the
+// previous check_calls (or reset_calls).
+static void                 //
+check_calls(                //
+    const char* what,       //
+    uint64_t block_encode,  //
+    uint64_t block_decode,  //
+    uint64_t frame_encode,  //
+    uint64_t frame_decode) {
+  const uint64_t want[SFLZ4_TELEMETRY_NUM_OPS] = {block_encode, block_decode,
+                                                  frame_encode, frame_decode};
+  sflz4_telemetry_snapshot s;
+  sflz4_telemetry_read(&s);
+  for (int op = 0; op < SFLZ4_TELEMETRY_NUM_OPS; op++) {
+    const uint64_t got = s.ops[op].calls - previous.ops[op].calls;
+    if (got != want[op]) {
+      fprintf(stderr, "%s: op %d: got %llu calls, want %llu\n", what, op,
+              (unsigned long long)got, (unsigned long long)want[op]);
+      test_num_failures++;
+    }
+  }
+  previous = s;
+}
+
+static void  //
+reset_calls() {
+  sflz4_telemetry_read(&previous);
+}
+
+static void*         //
+realloc_func(        //
+    void* context,   //
+    void* ptr,       //
+    size_t old_len,  //
+    size_t new_len) {
+  (void)context;
+  (void)old_len;
+  return realloc(ptr, new_len);
+}
+
+static void  //
+test_blocks() {
+  reset_calls();
+  const size_t n = 100000;
+  sflz4_size_result r = sflz4_block_encode(encoded, sizeof(encoded), data, n);
+  CHECK(!r.status_message);
+  const size_t encoded_len = r.value;
+  CHECK(!sflz4_block_encode_high_ratio(encoded, sizeof(encoded), data, n,
+                                       workspace, sizeof(workspace))
+             .status_message);
+  CHECK(!sflz4_block_encode_parallel(encoded, sizeof(encoded), data, n,
+                                     workspace, sizeof(workspace), 4, NULL,
+                                     NULL)
+             .status_message);
+  sflz4_segment segments[4];
+  CHECK(!sflz4_block_encode_segmented(encoded, sizeof(encoded), data, n,
+                                      segments, 4)
+             .status_message);
+  check_calls("block encodes", 4, 0, 0, 0);
+
+  r = sflz4_block_encode(encoded, sizeof(encoded), data, n);
+  check_calls("block encode", 1, 0, 0, 0);
+  CHECK(sflz4_block_decode(decoded, n, encoded, encoded_len).value == n);
+  CHECK(sflz4_block_decode_prefix(decoded, 10, encoded, encoded_len).value ==
+        10);
+  uint8_t* grown_ptr = NULL;
+  size_t grown_len = 0;
+  CHECK(sflz4_block_decode_growing(&grown_ptr, &grown_len, n, encoded,
+                                   encoded_len, &realloc_func, NULL)
+            .value == n);
+  free(grown_ptr);
+  check_calls("block decodes", 0, 3, 0, 0);
+
+  // Failed calls are counted too.
+  sflz4_telemetry_snapshot s;
+  sflz4_telemetry_read(&s);
+  CHECK(sflz4_block_decode(decoded, n - 1, encoded, encoded_len)
+            .status_message == sflz4_status_message__error_dst_is_too_short);
+  CHECK(sflz4_block_decode_with_dictionary(decoded, n, encoded, encoded_len,
+                                           NULL)
+            .status_message == sflz4_status_message__error_bad_argument);
+  check_calls("failed block decodes", 0, 2, 0, 0);
+  CHECK((previous.ops[SFLZ4_TELEMETRY_OP__BLOCK_DECODE]
+             .errors[SFLZ4_TELEMETRY_ERROR__BAD_ARGUMENT] -
+         s.ops[SFLZ4_TELEMETRY_OP__BLOCK_DECODE]
+             .errors[SFLZ4_TELEMETRY_ERROR__BAD_ARGUMENT]) == 1);
+
+  r = sflz4_block_encode_with_dictionary(encoded, sizeof(encoded), data, n,
+                                         &dictionary);
+  CHECK(!r.status_message);
+  CHECK(sflz4_block_decode_with_dictionary(decoded, n, encoded, r.value,
+                                           &dictionary)
+            .value == n);
+  check_calls("dictionary", 1, 1, 0, 0);
+}
+
+static void  //
+test_frames() {
+  reset_calls();
+  // The frame has several blocks, but only counts as one frame call.
+  sflz4_size_result r =
+      sflz4_frame_encode(encoded, sizeof(encoded), data, DATA_LEN, NULL);
+  CHECK(!r.status_message);
+  CHECK(sflz4_frame_decode(decoded, DATA_LEN, encoded, r.value).value ==
+        DATA_LEN);
+  check_calls("frame", 0, 0, 1, 1);
+}
+
+static void                     //
+count_record(                   //
+    void* context,              //
+    uint64_t record_id,         //
+    const uint8_t* record_ptr,  //
+    size_t record_len) {
+  uint64_t* num_records = (uint64_t*)context;
+  CHECK((record_id == *num_records) && (record_len == 100) &&
+        !memcmp(record_ptr, data + (100 * record_id), 100));
+  (*num_records)++;
+}
+
+static void  //
+test_records() {
+  sflz4_size_result r = sflz4_record_writer_workspace_len(BLOCK_MAX_LEN);
+  CHECK(!r.status_message && (r.value <= sizeof(workspace)));
+  sflz4_record_writer w;
+  CHECK(!sflz4_record_writer_initialize(&w, encoded, sizeof(encoded),
+                                        workspace, r.value, BLOCK_MAX_LEN));
+  for (size_t i = 0; i < 1000; i++) {
+    CHECK(!sflz4_record_writer_add(&w, data + (100 * i), 100));
+  }
+  r = sflz4_record_writer_finish(&w);
+  CHECK(!r.status_message);
+  const size_t container_len = r.value;
+
+  reset_calls();
+  uint8_t record[100];
+  for (uint64_t i = 0; i < 1000; i += 100) {
+    CHECK(sflz4_records_get(record, sizeof(record), encoded, container_len, i,
+                            workspace, BLOCK_MAX_LEN)
+              .value == 100);
+  }
+  check_calls("records_get", 0, 10, 0, 0);
+
+  // Scanning decodes, and counts, each block once.
+  uint64_t num_records = 0;
+  CHECK(!sflz4_records_scan(encoded, container_len, workspace, BLOCK_MAX_LEN,
+                            &count_record, &num_records));
+  CHECK(num_records == 1000);
+  const uint64_t records_per_block = BLOCK_MAX_LEN / 100;
+  check_calls("records_scan", 0,
+              (1000 + records_per_block - 1) / records_per_block, 0, 0);
+
+  // A scan that fails before decoding anything counts nothing.
+  CHECK(sflz4_records_scan(encoded, container_len, workspace,
+                           BLOCK_MAX_LEN - 1, &count_record,
+                           &num_records) ==
+        sflz4_status_message__error_workspace_is_too_short);
+  check_calls("failed records_scan", 0, 0, 0, 0);
+}
+
+static void  //
+test_messages() {
+  for (int independent = 0; independent < 2; independent++) {
+    const uint32_t flags =
+        independent ? SFLZ4_MESSAGE_FLAGS__INDEPENDENT : 0;
+    sflz4_size_result wl = sflz4_message_encoder_workspace_len(1000, flags);
+    CHECK(!wl.status_message && (wl.value <= sizeof(workspace)));
+    sflz4_message_encoder e;
+    CHECK(!sflz4_message_encoder_initialize(&e, workspace, wl.value, 1000,
+                                            flags, &dictionary));
+
+    reset_calls();
+    size_t channel_len = 0;
+    for (size_t i = 0; i < 10; i++) {
+      sflz4_size_result r =
+          sflz4_message_encode(&e, encoded + channel_len,
+                               sizeof(encoded) - channel_len,
+                               data + (1000 * i), 1000);
+      CHECK(!r.status_message);
+      channel_len += r.value;
+    }
+    check_calls(independent ? "independent message_encode" : "message_encode",
+                10, 0, 0, 0);
+
+    const sflz4_dictionary* entries[1];
+    sflz4_dictionary_registry registry;
+    sflz4_dictionary_registry_initialize(&registry, entries, 1);
+    CHECK(!sflz4_dictionary_registry_add(&registry, &dictionary));
+    sflz4_message_decoder d;
+    CHECK(!sflz4_message_decoder_initialize(
+        &d, workspace, SFLZ4_MESSAGE_DECODER_WORKSPACE_LEN, &registry));
+    reset_calls();
+    // The first message is the hello message, which decodes no block.
+    size_t decoded_len = 0;
+    for (size_t pos = 0; pos < channel_len;) {
+      sflz4_message_header h;
+      sflz4_size_result r =
+          sflz4_message_parse_header(&h, encoded + pos, channel_len - pos);
+      CHECK(!r.status_message && r.value);
+      if (r.status_message || !r.value) {
+        break;
+      }
+      sflz4_size_result mr =
+          sflz4_message_decode(&d, decoded + decoded_len,
+                               sizeof(decoded) - decoded_len, encoded + pos,
+                               r.value);
+      CHECK(!mr.status_message);
+      pos += r.value;
+      decoded_len += mr.value;
+    }
+    CHECK((decoded_len == 10000) && !memcmp(decoded, data, 10000));
+    check_calls(independent ? "independent message_decode" : "message_decode",
+                0, 10, 0, 0);
+  }
+}
+
+size_t log_len;
+
+static const char*       //
+log_write_func(          //
+    void* context,       //
+    const uint8_t* ptr,  //
+    size_t len) {
+  (void)context;
+  if (len > (sizeof(encoded) - log_len)) {
+    return "#test: log is full";
+  }
+  memcpy(encoded + log_len, ptr, len);
+  log_len += len;
+  return NULL;
+}
+
+static const char*  //
+log_sync_func(      //
+    void* context) {
+  (void)context;
+  return NULL;
+}
+
+static void  //
+test_log() {
+  sflz4_size_result wl = sflz4_log_writer_workspace_len(0);
+  CHECK(!wl.status_message && (wl.value <= sizeof(workspace)));
+  sflz4_log_writer w;
+  log_len = 0;
+  CHECK(!sflz4_log_writer_initialize(&w, workspace, wl.value, NULL,
+                                     &log_write_func, &log_sync_func, NULL));
+  reset_calls();
+  // Each flush encodes one block.
+  for (size_t i = 0; i < 5; i++) {
+    CHECK(!sflz4_log_writer_append(&w, data + (1000 * i), 1000, 0)
+               .status_message);
+    CHECK(!sflz4_log_writer_flush(&w));
+  }
+  CHECK(!sflz4_log_writer_close(&w));
+  check_calls("log_writer", 5, 0, 0, 0);
+
+  size_t valid_len = 0;
+  int unterminated = 0;
+  CHECK(sflz4_log_recover(decoded, sizeof(decoded), encoded, log_len,
+                          &valid_len, &unterminated)
+            .value == 5000);
+  check_calls("log_recover", 0, 5, 0, 0);
+}
+
+static void  //
+test_archive() {
+  sflz4_archive_file file;
+  file.name_ptr = (const uint8_t*)"f";
+  file.name_len = 1;
+  file.data_ptr = data;
+  file.data_len = 3 * BLOCK_MAX_LEN;
+  reset_calls();
+  sflz4_size_result r = sflz4_archive_encode(
+      encoded, sizeof(encoded), &file, 1, BLOCK_MAX_LEN, &dictionary,
+      workspace, sizeof(workspace), NULL, NULL);
+  CHECK(!r.status_message);
+  check_calls("archive_encode", 3, 0, 0, 0);
+  CHECK(sflz4_archive_extract(decoded, sizeof(decoded), encoded, r.value, 0,
+                              workspace, sizeof(workspace))
+            .value == file.data_len);
+  check_calls("archive_extract", 0, 3, 0, 0);
+}
+
+int            //
+main(          //
+    int argc,  //
+    char** argv) {
+  (void)argc;
+  (void)argv;
+  test_make_data(data, DATA_LEN, 100);
+  CHECK(!sflz4_dictionary_initialize(&dictionary, 100, data + 250000, 20000));
+  test_blocks();
+  test_frames();
+  test_records();
+  test_messages();
+  test_log();
+  test_archive();
+  return test_finish("telemetry_test");
+}
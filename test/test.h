@@ -0,0 +1,101 @@
+// Copyright 2022 Nigel Tao.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----
+
+// test.h holds what the test/*_test.c (and test/*_test.cc) programs share.
+// Each of those is a standalone program that prints "PASS" and exits zero on
+// success:
+//
+// $ gcc -fsanitize=address,undefined test/records_test.c && ./a.out
+// records_test: PASS
+//
+// or, to run them all:
+//
+// $ for f in test/*_test.c; do gcc -O2 -pthread $f -o /tmp/t && /tmp/t; done
+
+#ifndef SFLZ4_TEST_H
+#define SFLZ4_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SFLZ4_IMPLEMENTATION
+#include "../src/sflz4.h"
+
+static int test_num_failures = 0;
+
+#define CHECK(cond)                                                      \
+  do {                                                                   \
+    if (!(cond)) {                                                       \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+              #cond);                                                    \
+      test_num_failures++;                                               \
+    }                                                                    \
+  } while (0)
+
+// test_rand returns pseudo-random numbers from *state, an xorshift32 state.
+// It is deterministic, so that failures are reproducible.
+static inline uint32_t  //
+test_rand(              //
+    uint32_t* state) {
+  uint32_t x = *state ? *state : 1;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+// test_make_data fills dst with compressible, text-like bytes: words drawn
+// from a small vocabulary, with the occasional random byte.
+static inline void     //
+test_make_data(        //
+    uint8_t* dst_ptr,  //
+    size_t dst_len,    //
+    uint32_t seed) {
+  static const char* words[16] = {
+      "the ",   "quick ", "brown ",  "fox ",    "jumps ", "over ",
+      "lazy ",  "dog ",   "sells ",  "sea ",    "shells ", "by ",
+      "shore ", "and ",   "is ",     "sure.\n",
+  };
+  uint32_t state = seed;
+  size_t i = 0;
+  while (i < dst_len) {
+    uint32_t r = test_rand(&state);
+    if ((r & 63) == 0) {
+      dst_ptr[i++] = (uint8_t)(r >> 8);
+      continue;
+    }
+    const char* w = words[(r >> 8) & 15];
+    for (; *w && (i < dst_len); w++) {
+      dst_ptr[i++] = (uint8_t)*w;
+    }
+  }
+}
+
+// test_finish reports the result and returns main's exit code.
+static inline int  //
+test_finish(       //
+    const char* name) {
+  if (test_num_failures) {
+    printf("%s: FAIL (%d checks failed)\n", name, test_num_failures);
+    return 1;
+  }
+  printf("%s: PASS\n", name);
+  return 0;
+}
+
+#endif  // SFLZ4_TEST_H